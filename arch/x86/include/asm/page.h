@@ -54,6 +54,32 @@ static inline void *phys_to_virt(phys_addr_t address)
 #define clear_page(page)	memset((page), 0, PAGE_SIZE)
 #define copy_page(to,from)	memcpy((to), (from), PAGE_SIZE)
 
+/*
+ * Clear a page with non-temporal stores.
+ * The page is not brought into cache, use it for pages that
+ * will not be touched by this CPU soon.
+ */
+static inline void clear_page_nocache(void *page)
+{
+	unsigned long *p = page;
+	unsigned long *end = p + PAGE_SIZE / sizeof(*p);
+
+	for (; p < end; p += 8) {
+		asm volatile("movnti %1, 0*8(%0)\n\t"
+			     "movnti %1, 1*8(%0)\n\t"
+			     "movnti %1, 2*8(%0)\n\t"
+			     "movnti %1, 3*8(%0)\n\t"
+			     "movnti %1, 4*8(%0)\n\t"
+			     "movnti %1, 5*8(%0)\n\t"
+			     "movnti %1, 6*8(%0)\n\t"
+			     "movnti %1, 7*8(%0)\n\t"
+			     : : "r" (p), "r" (0UL) : "memory");
+	}
+
+	/* Order the weakly-ordered stores above */
+	asm volatile("sfence" : : : "memory");
+}
+
 #endif /* __ASSEMBLY__ */
 
 #endif /* _ASM_X86_PAGE_H_ */
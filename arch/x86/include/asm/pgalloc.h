@@ -22,9 +22,13 @@ static inline void pmd_populate_kernel(struct mm_struct *mm,
 }
 
 /*
- * Currently stuck as a macro due to indirect forward reference to
+ * Currently stuck as macros due to indirect forward reference to
  * linux/mmzone.h's __section_mem_map_addr() definition:
  */
+#define pmd_populate(mm, pmd, pte)					\
+	pmd_set(pmd, __pmd(((pteval_t)page_to_pfn(pte) << PAGE_SHIFT) |	\
+			   _PAGE_TABLE))
+
 #define pmd_page(pmd)		\
 	pfn_to_page((pmd_val(pmd) & pmd_pfn_mask(pmd)) >> PAGE_SHIFT)
 
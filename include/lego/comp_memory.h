@@ -18,4 +18,10 @@ static inline void memory_manager_early_init(void) { }
 static inline void memory_component_init(void) { }
 #endif
 
+#ifdef CONFIG_PROFILING_BOOT_PGCACHE_LIRS
+void pgcache_lirs_profile(void);
+#else
+static inline void pgcache_lirs_profile(void) { }
+#endif
+
 #endif /* _LEGO_COMP_MEMORY_H_ */
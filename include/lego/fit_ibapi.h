@@ -82,6 +82,26 @@ struct fit_sglist {
 	int len;
 };
 
+/* Max number of pieces one send_reply message can be gathered from */
+#define FIT_MAX_NR_SGLIST	8
+
+/*
+ * Max number of send_reply requests waiting for their reply at the same
+ * time. Synchronous callers spinning on it take at most one per CPU.
+ */
+#define FIT_NR_REPLY_INDICATORS	64
+
+/*
+ * Handle of one outstanding send_reply request.
+ * Posted by ibapi_send_reply_async(), reaped by ibapi_wait_reply().
+ * The handle must stay valid until the reply is reaped.
+ */
+struct fit_reply_handle {
+	int		reply_ready;	/* set by recv_cq polling thread */
+	int		reply_index;
+	void		*caller;
+};
+
 void ibapi_free_recv_buf(void *input_buf);
 
 /* IMM related */
@@ -109,6 +129,16 @@ int ibapi_send_reply_timeout(int target_node, void *addr, int size, void *ret_ad
 int ibapi_send_reply_timeout_w_private_bits(int target_node, void *addr, int size, void *ret_addr,
 			     int max_ret_size, int *private_bits, int if_use_ret_phys_addr,
 			     unsigned long timeout_sec);
+
+int ibapi_send_reply_async(int target_node, void *addr, int size, void *ret_addr,
+			   int max_ret_size, int if_use_ret_phys_addr,
+			   struct fit_reply_handle *handle);
+int ibapi_wait_reply(struct fit_reply_handle *handle, unsigned long timeout_sec,
+		     bool may_yield);
+int ibapi_send_reply_sglist_timeout(int target_node, struct fit_sglist *sglist,
+				    int nr_sglist, void *ret_addr, int max_ret_size,
+				    int if_use_ret_phys_addr, unsigned long timeout_sec);
+
 int ibapi_multicast_send_reply_timeout(int num_nodes, int *target_node, 
 				struct fit_sglist *sglist, struct fit_sglist *output_msg,
 				int max_ret_size, int if_use_ret_phys_addr, unsigned long timeout_sec);
@@ -157,6 +187,20 @@ int ibapi_send_reply_timeout_w_private_bits(int target_node, void *addr, int siz
 			     unsigned long timeout_sec);
 { return -EIO; }
 
+static inline int ibapi_send_reply_async(int target_node, void *addr, int size, void *ret_addr,
+			   int max_ret_size, int if_use_ret_phys_addr,
+			   struct fit_reply_handle *handle)
+{ return -EIO; }
+
+static inline int ibapi_wait_reply(struct fit_reply_handle *handle, unsigned long timeout_sec,
+		     bool may_yield)
+{ return -EIO; }
+
+static inline int ibapi_send_reply_sglist_timeout(int target_node, struct fit_sglist *sglist,
+				    int nr_sglist, void *ret_addr, int max_ret_size,
+				    int if_use_ret_phys_addr, unsigned long timeout_sec)
+{ return -EIO; }
+
 int ibapi_multicast_send_reply_timeout(int num_nodes, int *target_node, 
 				struct fit_sglist *sglist, struct fit_sglist *output_msg,
 				int max_ret_size, int if_use_ret_phys_addr, unsigned long timeout_sec)
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_LZ4_H_
+#define _LEGO_LZ4_H_
+
+#include <lego/types.h>
+
+#define LZ4_HASH_BITS		12
+#define LZ4_MEM_COMPRESS	((1 << LZ4_HASH_BITS) * sizeof(u16))
+
+/* Max input is 64KB, so 16-bit positions are enough */
+#define LZ4_MAX_INPUT_SIZE	(64 * 1024)
+
+int lz4_compress(const u8 *src, int src_len, u8 *dst, int dst_cap, void *wrkmem);
+int lz4_decompress_safe(const u8 *src, int src_len, u8 *dst, int dst_cap);
+
+#endif /* _LEGO_LZ4_H_ */
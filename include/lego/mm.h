@@ -257,6 +257,15 @@ static inline void get_page(struct page *page)
 	atomic_inc(&page->_refcount);
 }
 
+/*
+ * For lockless lookups: the page may be freed under us,
+ * do not resurrect it then.
+ */
+static inline int get_page_unless_zero(struct page *page)
+{
+	return atomic_inc_not_zero(&page->_refcount);
+}
+
 /*
  * This function returns the order of a free page in the buddy system. In
  * general, page_zone(page)->lock must be held by the caller to prevent the
@@ -558,6 +567,7 @@ do {							\
 #define FAULT_FLAG_USER		0x40	/* The fault originated in userspace */
 #define FAULT_FLAG_REMOTE	0x80	/* faulting for non current tsk/mm */
 #define FAULT_FLAG_INSTRUCTION  0x100	/* The fault was during an instruction fetch */
+#define FAULT_FLAG_PREFETCH	0x200	/* Speculative pcache prefetch, not a real fault */
 
 void switch_mm_irqs_off(struct mm_struct *prev, struct mm_struct *next,
 			struct task_struct *tsk);
@@ -122,6 +122,10 @@ struct mm_struct {
 	spinlock_t vmr_lock;			/* protect vma_roots array */
 #endif /* CONFIG_DISTRIBUTED_VMA_PROCESSOR */ 
 
+#ifdef CONFIG_PCACHE_QUOTA
+	struct pcache_quota *pcache_quota;	/* set at first pcache alloc */
+#endif
+
 	int gpid;
 	struct list_head list;
 
@@ -121,6 +121,14 @@ enum node_stat_item {
 
 #ifndef __GENERATING_BOUNDS_H
 
+struct per_cpu_pageset {
+	struct per_cpu_pages pcp;
+
+	/* Zone counters are folded in once the diff is above threshold */
+	s8 stat_threshold;
+	s8 vm_stat_diff[NR_VM_ZONE_STAT_ITEMS];
+};
+
 struct zone {
 	struct pglist_data	*zone_pgdat;
 
@@ -178,6 +186,9 @@ struct zone {
 
 	const char		*name;
 
+	/* NULL until percpu allocator is up, see setup_per_cpu_pageset() */
+	struct per_cpu_pageset __percpu *pageset;
+
 	/* Write-intensive fields used from the page allocator */
 	ZONE_PADDING(_pad1_)
 
@@ -316,6 +327,15 @@ static inline bool managed_zone(struct zone *zone)
 	return zone->managed_pages;
 }
 
+#define for_each_managed_zone(nid, zone)				\
+	for_each_online_node(nid)					\
+		for (zone = NODE_DATA(nid)->node_zones;			\
+		     zone < NODE_DATA(nid)->node_zones + MAX_NR_ZONES;	\
+		     zone++)						\
+			if (!managed_zone(zone))			\
+				;					\
+			else
+
 /*
  * zone_idx() returns 0 for the ZONE_DMA zone, 1 for the ZONE_NORMAL zone, etc.
  */
@@ -39,6 +39,9 @@ enum pageflags {
 	PG_slob_free,
 
 	__NR_PAGEFLAGS,
+
+	/* SLUB: slab is owned by a cpu, SLOB and SLUB never coexist */
+	PG_slub_frozen = PG_slob_free,
 };
 
 #ifndef __GENERATING_BOUNDS_H
@@ -116,6 +119,7 @@ PAGE_FLAG(Reserved, reserved)
 PAGE_FLAG(Private, private)
 PAGE_FLAG(Slab, slab)
 PAGE_FLAG(SlobFree, slob_free)
+PAGE_FLAG(SlubFrozen, slub_frozen)
 
 /*
  * For pages that are never mapped to userspace, page->mapcount may be
@@ -46,6 +46,11 @@ void boot_time_profile(void);
 static inline void boot_time_profile(void) { }
 #endif
 
+struct cpumask;
+unsigned long profile_run_threads(void (*fn)(void *), void *arg,
+				  unsigned int nr_threads,
+				  const struct cpumask *mask, const char *name);
+
 /*
  * heatmap
  * or, /proc/profile
@@ -48,6 +48,47 @@ struct p2m_flush_msg {
 
 void handle_p2m_flush_one(struct p2m_flush_msg *msg, struct thpool_buffer *tb);
 
+/*
+ * P2M_PCACHE_FLUSH_BATCH
+ *
+ * Up to P2M_FLUSH_BATCH_MAX_LINES lines of the same process, going to the
+ * same memory node. @nr_lines cache lines follow the header back to back,
+ * in the same order as @user_va. Reply is the number of lines flushed,
+ * or a negative error if none of them could be.
+ */
+#define P2M_FLUSH_BATCH_MAX_LINES	7
+
+struct p2m_flush_batch_msg {
+	struct common_header	header;
+	u32			pid;
+	u32			nr_lines;
+	unsigned long		user_va[P2M_FLUSH_BATCH_MAX_LINES];
+	char			pcachelines[0];
+};
+
+void handle_p2m_flush_batch(struct p2m_flush_batch_msg *msg, struct thpool_buffer *tb);
+
+/*
+ * P2M_PCACHE_FLUSH_DELTA
+ *
+ * Only the modified parts of one line. The line is divided into
+ * P2M_FLUSH_DELTA_NR_CHUNKS chunks, bit i of @dirty_chunks set means
+ * chunk i is carried. Carried chunks follow the header back to back,
+ * in ascending order.
+ */
+#define P2M_FLUSH_DELTA_NR_CHUNKS	64
+#define P2M_FLUSH_DELTA_CHUNK_SIZE	(PCACHE_LINE_SIZE / P2M_FLUSH_DELTA_NR_CHUNKS)
+
+struct p2m_flush_delta_msg {
+	struct common_header	header;
+	u32			pid;
+	unsigned long		user_va;
+	u64			dirty_chunks;
+	char			chunks[0];
+};
+
+void handle_p2m_flush_delta(struct p2m_flush_delta_msg *msg, struct thpool_buffer *tb);
+
 /*
  * P2M_MISS
  */
@@ -78,6 +119,11 @@ struct p2m_pcache_miss_reply_struct {
 
 void handle_p2m_pcache_miss(struct p2m_pcache_miss_msg *msg,
 			    struct thpool_buffer *b);
+bool pcache_miss_file_backed(struct p2m_pcache_miss_msg *msg);
+
+/* Same msg, but the whole 2MB region of missing_vaddr is replied */
+void handle_p2m_pcache_miss_huge(struct p2m_pcache_miss_msg *msg,
+				 struct thpool_buffer *tb);
 
 struct p2m_replica_msg {
 	struct common_header	header;
@@ -124,6 +124,65 @@
 #define SLAB_OBJ_MIN_SIZE      (KMALLOC_MIN_SIZE < 16 ? \
                                (KMALLOC_MIN_SIZE) : 16)
 
+#ifndef CONFIG_SLOB
+struct kmem_cache;
+extern struct kmem_cache *kmalloc_caches[KMALLOC_SHIFT_HIGH + 1];
+
+/*
+ * Figure out which kmalloc slab an allocation of a certain size
+ * belongs to.
+ * 0 = zero alloc
+ * 1 =  65 .. 96 bytes
+ * 2 = 129 .. 192 bytes
+ * n = 2^(n-1)+1 .. 2^n
+ */
+static __always_inline int kmalloc_index(size_t size)
+{
+	if (!size)
+		return 0;
+
+	if (size <= KMALLOC_MIN_SIZE)
+		return KMALLOC_SHIFT_LOW;
+
+	if (KMALLOC_MIN_SIZE <= 32 && size > 64 && size <= 96)
+		return 1;
+	if (KMALLOC_MIN_SIZE <= 64 && size > 128 && size <= 192)
+		return 2;
+	if (size <=          8) return 3;
+	if (size <=         16) return 4;
+	if (size <=         32) return 5;
+	if (size <=         64) return 6;
+	if (size <=        128) return 7;
+	if (size <=        256) return 8;
+	if (size <=        512) return 9;
+	if (size <=       1024) return 10;
+	if (size <=   2 * 1024) return 11;
+	if (size <=   4 * 1024) return 12;
+	if (size <=   8 * 1024) return 13;
+
+	/* Will never be reached. Needed because the compiler may complain */
+	return -1;
+}
+
+void *kmem_cache_alloc_trace(struct kmem_cache *s, gfp_t flags, size_t size) __assume_slab_alignment __malloc;
+
+#ifdef CONFIG_NUMA
+void *kmem_cache_alloc_node_trace(struct kmem_cache *s, gfp_t flags,
+				  int node, size_t size) __assume_slab_alignment __malloc;
+#else
+static __always_inline void *
+kmem_cache_alloc_node_trace(struct kmem_cache *s, gfp_t flags,
+			    int node, size_t size)
+{
+	return kmem_cache_alloc_trace(s, flags, size);
+}
+#endif
+
+void kmem_cache_init(void);
+#else
+static inline void kmem_cache_init(void) { }
+#endif /* CONFIG_SLOB */
+
 /*
  * Common kmalloc functions provided by all allocators
  */
@@ -320,4 +379,10 @@ static inline void *kzalloc_node(size_t size, gfp_t flags, int node)
 	return kmalloc_node(size, flags | __GFP_ZERO, node);
 }
 
+#ifdef CONFIG_PROFILING_BOOT_KMALLOC
+void kmalloc_profile(void);
+#else
+static inline void kmalloc_profile(void) { }
+#endif
+
 #endif /* _LEGO_SLAB_H_ */
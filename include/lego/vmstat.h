@@ -16,6 +16,7 @@
 #define _LEGO_VMSTAT_H_
 
 #include <lego/atomic.h>
+#include <lego/percpu.h>
 #include <lego/mm.h>
 
 /*
@@ -70,17 +71,12 @@ static inline unsigned long zone_page_state(struct zone *zone,
 }
 
 /*
- * XXX:
- * This equals to linux non-SMP version
- * defenitly will add a lot overhead..
- * Anyway, add this first and come back later.
+ * Zone counters are updated in per-CPU diffs, which are folded into
+ * the atomics above once they reach the threshold. Readers may be off
+ * by up to nr_cpus * threshold, use the _snapshot version if it matters.
  */
-
-static inline void __mod_zone_page_state(struct zone *zone,
-			enum zone_stat_item item, long delta)
-{
-	zone_page_state_add(delta, zone, item);
-}
+void __mod_zone_page_state(struct zone *zone, enum zone_stat_item item, long delta);
+unsigned long global_page_state_snapshot(enum zone_stat_item item);
 
 static inline void __mod_node_page_state(struct pglist_data *pgdat,
 			enum node_stat_item item, int delta)
@@ -90,8 +86,7 @@ static inline void __mod_node_page_state(struct pglist_data *pgdat,
 
 static inline void __inc_zone_state(struct zone *zone, enum zone_stat_item item)
 {
-	atomic_long_inc(&zone->vm_stat[item]);
-	atomic_long_inc(&vm_zone_stat[item]);
+	__mod_zone_page_state(zone, item, 1);
 }
 
 static inline void __inc_node_state(struct pglist_data *pgdat, enum node_stat_item item)
@@ -102,8 +97,7 @@ static inline void __inc_node_state(struct pglist_data *pgdat, enum node_stat_it
 
 static inline void __dec_zone_state(struct zone *zone, enum zone_stat_item item)
 {
-	atomic_long_dec(&zone->vm_stat[item]);
-	atomic_long_dec(&vm_zone_stat[item]);
+	__mod_zone_page_state(zone, item, -1);
 }
 
 static inline void __dec_node_state(struct pglist_data *pgdat, enum node_stat_item item)
@@ -148,4 +142,45 @@ static inline void __dec_node_page_state(struct page *page,
 #define inc_node_state __inc_node_state
 #define dec_zone_state __dec_zone_state
 
+/*
+ * Per-CPU event counters, never folded.
+ * Summed up only when someone asks.
+ */
+enum vm_event_item {
+	PGALLOC,		/* pages allocated, any order */
+	PGFREE,			/* pages freed, any order */
+	PCP_ALLOC,		/* order-0 allocations served by per-CPU lists */
+	PCP_FREE,		/* order-0 frees that went to per-CPU lists */
+	PCP_REFILL,		/* per-CPU list refilled from buddy */
+	PCP_DRAIN,		/* per-CPU list drained above high watermark */
+	PCP_DRAIN_ALL,		/* all per-CPU lists drained on allocation failure */
+
+	NR_VM_EVENT_ITEMS
+};
+
+struct vm_event_state {
+	unsigned long event[NR_VM_EVENT_ITEMS];
+};
+
+DECLARE_PER_CPU(struct vm_event_state, vm_event_states);
+
+/* Caller has preemption or irq disabled */
+static inline void __count_vm_events(enum vm_event_item item, long delta)
+{
+	raw_cpu_add(vm_event_states.event[item], delta);
+}
+
+static inline void __count_vm_event(enum vm_event_item item)
+{
+	raw_cpu_inc(vm_event_states.event[item]);
+}
+
+static inline void count_vm_event(enum vm_event_item item)
+{
+	this_cpu_inc(vm_event_states.event[item]);
+}
+
+void all_vm_events(unsigned long *ret);
+void print_vm_events(void);
+
 #endif /* _LEGO_VMSTAT_H_ */
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_MEMORY_HUGE_MEMORY_H_
+#define _LEGO_MEMORY_HUGE_MEMORY_H_
+
+#include <memory/vm.h>
+#include <memory/vm-pgtable.h>
+
+#define HPAGE_PMD_ORDER		(PMD_SHIFT - PAGE_SHIFT)
+#define HPAGE_PMD_NR		(1 << HPAGE_PMD_ORDER)
+
+#ifdef CONFIG_MEM_HUGE_ANON
+/*
+ * A huge pmd maps 2MB of anonymous memory directly, with the kernel
+ * virtual address of the 2MB page, like ptes do for 4KB pages.
+ */
+static inline bool lego_pmd_trans_huge(pmd_t pmd)
+{
+	return pmd_large(pmd);
+}
+
+static inline unsigned long lego_huge_pmd_vaddr(pmd_t pmd)
+{
+	return pmd_val(pmd) & PMD_MASK;
+}
+
+void do_huge_anonymous_page(struct vm_area_struct *vma, unsigned long address,
+			    pmd_t *pmd);
+unsigned long lego_find_huge_page(struct lego_mm_struct *mm, unsigned long address);
+
+int lego_split_huge_pmd(struct lego_mm_struct *mm, pmd_t *pmd);
+void lego_zap_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd);
+void lego_copy_huge_pmd(struct lego_mm_struct *dst_mm, struct lego_mm_struct *src_mm,
+			pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma);
+#else
+static inline bool lego_pmd_trans_huge(pmd_t pmd) { return false; }
+static inline unsigned long lego_huge_pmd_vaddr(pmd_t pmd) { BUG(); return 0; }
+
+static inline void do_huge_anonymous_page(struct vm_area_struct *vma,
+					  unsigned long address, pmd_t *pmd) { }
+static inline unsigned long
+lego_find_huge_page(struct lego_mm_struct *mm, unsigned long address)
+{
+	return 0;
+}
+
+static inline int lego_split_huge_pmd(struct lego_mm_struct *mm, pmd_t *pmd)
+{
+	return 0;
+}
+static inline void lego_zap_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd) { }
+static inline void lego_copy_huge_pmd(struct lego_mm_struct *dst_mm,
+				      struct lego_mm_struct *src_mm,
+				      pmd_t *dst_pmd, pmd_t *src_pmd,
+				      struct vm_area_struct *vma) { }
+#endif
+
+/* Kernel virtual address of the 4KB page at @address within a huge pmd */
+static inline unsigned long
+lego_huge_pmd_subpage(pmd_t pmd, unsigned long address)
+{
+	return lego_huge_pmd_vaddr(pmd) + (address & ~PMD_MASK & PAGE_MASK);
+}
+
+#endif /* _LEGO_MEMORY_HUGE_MEMORY_H_ */
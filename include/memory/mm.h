@@ -13,6 +13,7 @@
 #include <lego/kernel.h>
 #include <lego/rbtree.h>
 #include <lego/rwsem.h>
+#include <lego/seqlock.h>
 #include <lego/auxvec.h>
 #include <lego/spinlock.h>
 #include <lego/hashtable.h>
@@ -100,6 +101,23 @@ struct vma_tree {
 	struct list_head list;
 };
 
+#ifdef CONFIG_MEM_ANON_PREFETCH
+#define ANON_PREFETCH_NR_STREAMS	4
+
+/* A sequential or strided miss stream within one anonymous VMA */
+struct anon_prefetch_stream {
+	unsigned long	vm_start;	/* VMA this stream belongs to */
+	unsigned long	last_addr;	/* last demand miss */
+	long		stride;
+	unsigned int	hits;		/* times @stride repeated */
+	unsigned int	depth;		/* pages of next window */
+	unsigned long	next_addr;	/* first page of next window */
+	unsigned long	win_lo;		/* range of last window */
+	unsigned long	win_hi;
+	unsigned long	age;
+};
+#endif
+
 struct lego_mm_struct {
 	struct vm_area_struct *mmap;
 	struct rb_root mm_rb;
@@ -139,6 +157,24 @@ struct lego_mm_struct {
 	struct rw_semaphore mmap_sem;
 	struct lego_task_struct *task;
 
+#ifdef CONFIG_MEM_SPECULATIVE_MISS
+	/* Odd while a mmap_sem writer may change VMAs or page tables */
+	seqcount_t vma_seq;
+	/* Lockless page table walks in progress */
+	atomic_t nr_spec_walkers;
+#endif
+
+#ifdef CONFIG_MEM_ANON_PREFETCH
+	spinlock_t anon_prefetch_lock;
+	unsigned long anon_prefetch_clock;
+	struct anon_prefetch_stream anon_streams[ANON_PREFETCH_NR_STREAMS];
+#endif
+
+#ifdef CONFIG_MEM_ZSWAP
+	/* Where the cold page scanner resumes, protected by mmap_sem */
+	unsigned long zswap_scan_addr;
+#endif
+
 #ifdef CONFIG_DISTRIBUTED_VMA_MEMORY
 	/*
 	 * distributed vma range limit management array. Unlike processor side, size of 
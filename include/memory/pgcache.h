@@ -17,6 +17,8 @@
 #include <memory/task.h>
 #include <memory/thread_pool.h>
 #include <lego/types.h>
+#include <lego/radixtree.h>
+#include <lego/seqlock.h>
 
 #ifdef CONFIG_DEBUG_PAGE_CACHE
 #define pgcache_debug(fmt, ...) 			\
@@ -30,25 +32,34 @@ static inline void pgcache_debug(const char *fmt, ...) {  }
 #define PGCACHE_PREFETCH_ORDER	6 /* How many pages to read to page cache while cache miss */
 
 #define CL_SIZE			(PAGE_SIZE*(1 << PGCACHE_PREFETCH_ORDER))
-#define POS_MASK		~(CL_SIZE - 1)
-#define aligned_pos(x)		x & POS_MASK
-#define chunk_offset(x)		x & (~POS_MASK)
+#define POS_MASK		(~(CL_SIZE - 1))
+#define aligned_pos(x)		((x) & POS_MASK)
+#define chunk_offset(x)		((x) & (~POS_MASK))
+
+/* Capacity of the page cache, in cachelines */
+#define MAX_LIR_CACHELINES	((1 << 14) - (1 << 9))
+#define MAX_HIR_CACHELINES	(1 << 9)
+#define MAX_CACHELINES		(MAX_LIR_CACHELINES + MAX_HIR_CACHELINES)
+
+struct lego_pgcache_file;
 
 struct lego_pgcache_struct {
 
 	loff_t			pos;		/* aligned pos */
-	char 			filepath[MAX_FILENAME_LENGTH];
+	struct lego_pgcache_file *file;		/* file this cacheline belongs to */
 	u32 			real_len;	/* real length is likely to be smaller than
 						 * cacheline size if file size is small */
 	spinlock_t 		lock;		/* lock to protect lego_pgcache_struct */
 	bool 			dirty;
 	bool 			hir;		/* this cacheline is HIR */
+	bool			ra_unused;	/* read ahead, not accessed yet */
+	bool			ra_marker;	/* access triggers next readahead */
+	bool			writeback;	/* copied out, M2S_WRITE in flight */
 
 	unsigned int 		storage_node;	/* cached result of storage node of this cacheline */
 
-	struct hlist_node 	link;
-	
 	struct list_head 	dirtylist;
+	unsigned long		dirtied_when;	/* jiffies, when it became dirty */
 	
 	struct list_head 	stack_s;	/* list of lirs_stack_s */
 	
@@ -61,17 +72,36 @@ struct lego_pgcache_struct {
 struct lego_pgcache_file {
 	char 			filepath[MAX_FILENAME_LENGTH];	
 							/* filepath */
+	seqlock_t		path_lock;		/* rename vs. filepath readers */
+	unsigned int		hash;			/* hash of filepath */
 	struct hlist_node 	hlink;
+
+	spinlock_t		tree_lock;		/* protect chunk_tree */
+	struct radix_tree_root	chunk_tree;		/* cachelines, indexed by pos/CL_SIZE */
+
 	struct list_head 	head;			/* head of a file's dirtlist */
+	struct list_head	wb_list;		/* on dirty_files if dirty */
+	atomic_t		nr_writeback;		/* cachelines under writeback */
 	size_t			f_size;			/* up-to-date file size */
 	spinlock_t 		dirtylist_lock;
 
 	unsigned int 		storage_node;		/* will be used later */
+
+#ifdef CONFIG_MEM_PGCACHE_READAHEAD
+	/*
+	 * Readahead window, in cachelines. Cacheline ra_start has
+	 * ra_marker set, reading it submits the next window.
+	 */
+	spinlock_t		ra_lock;
+	unsigned long		ra_prev;		/* last accessed cacheline */
+	unsigned long		ra_start;		/* first cacheline of window */
+	unsigned int		ra_size;		/* nr of cachelines in window */
+#endif
 };
 
 /* alloc.c */
-struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
-		unsigned int storage_node);
+struct lego_pgcache_struct *__alloc_pgcache(struct lego_pgcache_file *file,
+		loff_t pos);
 void __free_pgcache_locked(struct lego_pgcache_struct *pgc);
 void __free_pgcache_struct(struct lego_pgcache_struct *pgc);
 
@@ -80,25 +110,32 @@ int ht_insert_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
 void ht_remove_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
 void free_lego_pgcache_struct(struct lego_pgcache_struct *pgc);
 struct lego_pgcache_struct *							\
-	find_lego_pgcache_struct(char *filepath, loff_t pos);
+	find_lego_pgcache_struct(struct lego_pgcache_file *file, loff_t pos);
 int drop_pgcache(void);
 
-/* dirtylist.c */
-struct lego_pgcache_file *lego_pgcache_file_open(char *filepath,		\
-		unsigned int storage_node);
-
 int ht_insert_lego_pgcache_file(struct lego_pgcache_file *file);
 void ht_remove_lego_pgcache_file(struct lego_pgcache_file *file);
-void free_lego_pgcache_file(struct lego_pgcache_file *file);
 struct lego_pgcache_file *find_lego_pgcache_file(char *filepath);
+void pgcache_file_path(struct lego_pgcache_file *file, char *buf);
+void pgcache_file_set_path(struct lego_pgcache_file *file, char *filepath);
+
+/* dirtylist.c */
+struct lego_pgcache_file *lego_pgcache_file_open(char *filepath,		\
+		unsigned int storage_node);
+struct lego_pgcache_file *find_or_open_lego_pgcache_file(char *filepath,	\
+		unsigned int storage_node);
 
 void mark_lego_pgcache_dirty(struct lego_pgcache_struct *pgc,			\
 			struct lego_pgcache_file *file);
 void make_lego_pgcache_clean(struct lego_pgcache_struct *pgc);
+void make_lego_pgcache_clean_locked(struct lego_pgcache_struct *pgc);
+int pgcache_flush_file(struct lego_pgcache_file *file);
 int handle_p2m_fsync(char *payload, struct common_header *hdr, 			\
 		     struct thpool_buffer *tb);
 
 /* read_write.c */
+ssize_t pgcache_load(struct lego_pgcache_struct *pgc);
+struct lego_pgcache_struct *insert_cacheline(struct lego_pgcache_struct *pgc);
 ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc);
 ssize_t lego_pgcache_read(struct lego_task_struct *tsk, char *f_name,		\
 		unsigned int storage_node, char __user *buf,			\
@@ -108,12 +145,55 @@ ssize_t lego_pgcache_write(struct lego_task_struct *tsk, char *f_name,	\
 		unsigned int storage_node, char __user *buf,			\
 		size_t count, loff_t *pos);
 
+/* writeback.c */
+ssize_t pgcache_writeback_file(struct lego_pgcache_file *file,
+			       unsigned long expire, unsigned int max_runs);
+void pgcache_account_dirty(struct lego_pgcache_file *file);
+void pgcache_account_clean(void);
+
+/*
+ * A cacheline under writeback may be dirtied again. Whoever writes it
+ * back next must wait, or the older M2S_WRITE could land last.
+ * Thpool workers run with preemption disabled, do not sleep.
+ */
+static inline void wait_on_pgcache_writeback(struct lego_pgcache_struct *pgc)
+{
+	while (READ_ONCE(pgc->writeback))
+		cpu_relax();
+}
+
+#ifdef CONFIG_MEM_PGCACHE_WRITEBACK
+void pgcache_balance_dirty(struct lego_pgcache_file *file);
+void __init pgcache_writeback_init(void);
+#else
+static inline void pgcache_balance_dirty(struct lego_pgcache_file *file) { }
+static inline void pgcache_writeback_init(void) { }
+#endif
+
 /* eviction.c */
 void update_lirs_structure(struct lego_pgcache_struct *pgc);
-void pgcache_evict_one(void);
+void reset_lirs_structure(void);
+void __init pgcache_lirs_init(void);
+
+/* readahead.c */
+#ifdef CONFIG_MEM_PGCACHE_READAHEAD
+void pgcache_readahead(struct lego_pgcache_file *file,
+		       struct lego_pgcache_struct *pgc, loff_t pos);
+bool pgcache_readahead_run_one(void);
+#else
+static inline void pgcache_readahead(struct lego_pgcache_file *file,
+				     struct lego_pgcache_struct *pgc, loff_t pos) { }
+static inline bool pgcache_readahead_run_one(void) { return false; }
+#endif
 
 ssize_t get_file_size_from_storage(char *filepath, unsigned int storage_node);
 
+#ifdef CONFIG_MEM_PAGE_CACHE
+void __init pgcache_init(void);
+#else
+static inline void pgcache_init(void) { }
+#endif
+
 static inline size_t file_size_read(struct lego_pgcache_file *file)
 {
 	size_t ret;
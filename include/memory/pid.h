@@ -19,4 +19,9 @@ int __must_check ht_insert_lego_task(struct lego_task_struct *tsk);
 struct lego_task_struct *
 find_lego_task_by_pid(unsigned int node, unsigned int pid);
 
+struct lego_task_struct *
+find_get_lego_task_by_pid(unsigned int node, unsigned int pid);
+
+int get_lego_tasks(struct lego_task_struct **tasks, int nr, int *pos);
+
 #endif /* _LEGO_MEMORY_PID_H_ */
@@ -15,7 +15,10 @@
 enum memory_manager_stat_item {
 	/* Handler */
 	HANDLE_PCACHE_MISS,
+	HANDLE_PCACHE_MISS_HUGE,
 	HANDLE_PCACHE_FLUSH,
+	HANDLE_PCACHE_FLUSH_BATCH,
+	HANDLE_PCACHE_FLUSH_DELTA,
 	HANDLE_PCACHE_REPLICA,
 	HANDLE_P2M_MMAP,
 	HANDLE_P2M_MUNMAP,
@@ -28,6 +31,36 @@ enum memory_manager_stat_item {
 
 	NR_BATCHED_LOG_FLUSH,
 
+	/* Speculative pcache miss */
+	SPECULATIVE_MISS,
+	SPECULATIVE_MISS_FAIL,
+
+	/* Huge anonymous pages */
+	HUGE_ANON_FAULT,
+	HUGE_ANON_FALLBACK,
+	HUGE_ANON_SPLIT,
+
+	/* Anonymous prefetch */
+	ANON_PREFETCH_MISS,
+	ANON_PREFETCH_TRIGGER,
+	ANON_PREFETCH_DROP,
+	ANON_PREFETCH_PAGES,
+	ANON_PREFETCH_USEFUL,
+
+	/* Memory-side page cache */
+	PGCACHE_HIT,
+	PGCACHE_MISS,
+	PGCACHE_EVICT,
+	PGCACHE_EVICT_DIRTY,
+	PGCACHE_RA_TRIGGER,
+	PGCACHE_RA_DROP,
+	PGCACHE_RA_CHUNKS,
+	PGCACHE_RA_HIT,
+	PGCACHE_RA_WASTE,
+	PGCACHE_WB_WRITES,
+	PGCACHE_WB_CHUNKS,
+	PGCACHE_WB_THROTTLE,
+
 	NR_MEMORY_MANAGER_STAT_ITEMS,
 };
 
@@ -48,9 +81,15 @@ static inline void inc_mm_stat(enum memory_manager_stat_item i)
 	atomic_long_inc(&memory_manager_stats.stat[i]);
 }
 
+static inline void add_mm_stat(enum memory_manager_stat_item i, long delta)
+{
+	atomic_long_add(delta, &memory_manager_stats.stat[i]);
+}
+
 void print_memory_manager_stats(void);
 #else
 static inline void inc_mm_stat(enum memory_manager_stat_item i) { }
+static inline void add_mm_stat(enum memory_manager_stat_item i, long delta) { }
 static inline void print_memory_manager_stats(void) { }
 #endif
 
@@ -11,6 +11,7 @@
 #define _LEGO_MEMORY_TASK_H_
 
 #include <lego/kernel.h>
+#include <lego/atomic.h>
 #include <lego/spinlock.h>
 #include <lego/hashtable.h>
 #include <lego/comp_common.h>
@@ -42,6 +43,7 @@ struct lego_task_struct {
 
 	LEGO_TASK_PADDING(_pad1_)
 	spinlock_t task_lock;
+	atomic_t usage;
 
         struct hlist_node link;
 } ____cacheline_aligned;
@@ -49,6 +51,12 @@ struct lego_task_struct {
 void dump_lego_tasks(void);
 struct lego_task_struct *alloc_lego_task_struct(void);
 void free_lego_task_struct(struct lego_task_struct *tsk);
+void put_lego_task(struct lego_task_struct *tsk);
+
+static inline void get_lego_task(struct lego_task_struct *tsk)
+{
+	atomic_inc(&tsk->usage);
+}
 
 static inline void lego_task_lock(struct lego_task_struct *p)
 {
@@ -25,6 +25,24 @@
 
 #define NR_THPOOL_WORKERS	CONFIG_THPOOL_NR_WORKERS
 
+/*
+ * Service classes of requests.
+ * The first NR_THPOOL_FAST_WORKERS workers only serve the fast class.
+ * If none is reserved, all workers serve both classes.
+ */
+enum thpool_class {
+	THPOOL_CLASS_FAST,	/* pcache miss, flush, zerofill */
+	THPOOL_CLASS_SLOW,	/* all others */
+
+	NR_THPOOL_CLASSES,
+};
+
+#ifdef CONFIG_THPOOL_PRIORITY_CLASSES
+#define NR_THPOOL_FAST_WORKERS	CONFIG_THPOOL_NR_FAST_WORKERS
+#else
+#define NR_THPOOL_FAST_WORKERS	0
+#endif
+
 struct thpool_buffer;
 
 struct tw_padding {
@@ -36,6 +54,14 @@ struct tw_padding {
 #define QUEUING_STAT_STRIDE_NS	(QUEUING_STAT_STRIDE_US*1000)
 #define QUEUING_STAT_ENTRIES	(40)
 
+/* Queuing delay of one class of requests, handled by one worker */
+struct thpool_queuing_stat {
+	unsigned long		nr;
+	unsigned long		total_ns;
+	unsigned long		max_ns;
+	unsigned long		hist[QUEUING_STAT_ENTRIES];
+};
+
 /* This structure describes a worker thread */
 struct thpool_worker {
 	/*
@@ -49,6 +75,7 @@ struct thpool_worker {
 	 */
 	int			cpu;
 	int			nr_queued;
+	int			busy;		/* running a handler */
 	spinlock_t		lock;
 	struct list_head	work_head;
 	struct task_struct	*task;
@@ -56,12 +83,14 @@ struct thpool_worker {
 
 	/* for debug usage */
 	unsigned long		nr_handled;
+	unsigned long		nr_stolen;	/* requests taken from others */
 	unsigned long		total_queuing_delay_ns;
 	unsigned long		max_queuing_delay_ns;
 	unsigned long		min_queuing_delay_ns;
 
 	/* us: [0, 5), [5, 10) ... [195, 200) */
 	unsigned long		queuing_stats[QUEUING_STAT_ENTRIES];
+	struct thpool_queuing_stat class_stats[NR_THPOOL_CLASSES];
 	int			max_nr_queued;
 	unsigned long		flags;
 	struct thpool_buffer	*wip_buffer;
@@ -108,6 +137,7 @@ struct thpool_buffer {
 	void			*fit_imm;
 	int			fit_node_id;
 	int			fit_offset;
+	int			class;		/* enum thpool_class */
 
 	/*
 	 * Handler supplied tx buffer
@@ -116,6 +146,12 @@ struct thpool_buffer {
 	void			*private_tx;
 	int			tx_size;
 
+	/*
+	 * User page backing private_tx, referenced by the handler.
+	 * The reference is dropped once the reply is out.
+	 */
+	unsigned long		tx_page;
+
 	THPOOL_PADDING(_pad1);
 	char			tx[THPOOL_TX_SIZE];
 };
@@ -194,9 +230,21 @@ static inline void tb_set_private_tx(struct thpool_buffer *tb, void *private_tx)
 static inline void tb_reset_private_tx(struct thpool_buffer *tb)
 {
 	tb->private_tx = NULL;
+	tb->tx_page = 0;
 	__ClearThpoolBufferPrivateTX(tb);
 }
 
+/*
+ * Reply straight from user page @page. The caller holds a reference
+ * to it, which is handed over to the thpool worker.
+ */
+static inline void tb_set_private_tx_page(struct thpool_buffer *tb,
+					  unsigned long page)
+{
+	tb_set_private_tx(tb, (void *)page);
+	tb->tx_page = page;
+}
+
 static inline void *thpool_buffer_rx(struct thpool_buffer *tb)
 {
 	return tb->fit_rx;
@@ -286,11 +334,33 @@ static inline void add_thpool_worker_total_queuing(struct thpool_worker *tw, uns
 		tw->queuing_stats[i]++;
 }
 
+static inline void add_thpool_worker_class_queuing(struct thpool_worker *tw,
+						   struct thpool_buffer *tb,
+						   unsigned long diff_ns)
+{
+	struct thpool_queuing_stat *qs = &tw->class_stats[tb->class];
+	int i;
+
+	qs->nr++;
+	qs->total_ns += diff_ns;
+	if (diff_ns > qs->max_ns)
+		qs->max_ns = diff_ns;
+
+	i = (diff_ns / QUEUING_STAT_STRIDE_NS);
+	if (i < QUEUING_STAT_ENTRIES)
+		qs->hist[i]++;
+}
+
 static inline void inc_thpool_worker_nr_handled(struct thpool_worker *tw)
 {
 	tw->nr_handled++;
 }
 
+static inline void inc_thpool_worker_nr_stolen(struct thpool_worker *tw)
+{
+	tw->nr_stolen++;
+}
+
 #else
 static inline int thpool_worker_in_handler(struct thpool_worker *tw) { return 0; }
 static inline void set_in_handler_thpool_worker(struct thpool_worker *tw) { }
@@ -308,8 +378,12 @@ static inline unsigned long thpool_buffer_queuing_delay(struct thpool_buffer *tb
 static inline void thpool_buffer_dequeue_time(struct thpool_buffer *tb) { }
 static inline void thpool_buffer_enqueue_time(struct thpool_buffer *tb) { }
 static inline void add_thpool_worker_total_queuing(struct thpool_worker *tw, unsigned long diff_ns) { }
+static inline void add_thpool_worker_class_queuing(struct thpool_worker *tw,
+						   struct thpool_buffer *tb,
+						   unsigned long diff_ns) { }
 
 static inline void inc_thpool_worker_nr_handled(struct thpool_worker *tw) { }
+static inline void inc_thpool_worker_nr_stolen(struct thpool_worker *tw) { }
 #endif /* CONFIG_COUNTER_THPOOL */
 
 void fit_ack_reply_callback(struct thpool_buffer *b);
@@ -225,6 +225,71 @@ static inline void lego_mmdrop(struct lego_mm_struct *mm)
 		__lego_mmdrop(mm);
 }
 
+/*
+ * Every mmap_sem writer must bracket its critical section with these,
+ * so that lockless readers can tell VMAs or page tables may have changed.
+ */
+#ifdef CONFIG_MEM_SPECULATIVE_MISS
+static inline void vma_seq_write_begin(struct lego_mm_struct *mm)
+{
+	write_seqcount_begin(&mm->vma_seq);
+}
+
+static inline void vma_seq_write_end(struct lego_mm_struct *mm)
+{
+	write_seqcount_end(&mm->vma_seq);
+}
+
+void vma_seq_init(struct lego_mm_struct *mm);
+void vma_seq_exit(struct lego_mm_struct *mm);
+
+/*
+ * Lockless page table walkers bracket their walk with these. Page
+ * table pages are only freed by mmap_sem writers, which wait for the
+ * walkers already in: those coming later see an odd vma_seq and
+ * back off before touching any page table.
+ */
+static inline unsigned int speculative_walk_begin(struct lego_mm_struct *mm)
+{
+	atomic_inc(&mm->nr_spec_walkers);
+	smp_mb__after_atomic();
+	return raw_read_seqcount(&mm->vma_seq);
+}
+
+static inline void speculative_walk_end(struct lego_mm_struct *mm)
+{
+	smp_mb__before_atomic();
+	atomic_dec(&mm->nr_spec_walkers);
+}
+
+/* Called by mmap_sem writers, within vma_seq_write_begin/end */
+static inline void wait_speculative_walkers(struct lego_mm_struct *mm)
+{
+	WARN_ON_ONCE(!(raw_read_seqcount(&mm->vma_seq) & 1));
+
+	smp_mb();
+	while (atomic_read(&mm->nr_spec_walkers))
+		cpu_relax();
+}
+
+struct vm_area_struct *find_vma_cached(struct lego_mm_struct *mm,
+				       unsigned long addr);
+int find_vma_speculative(struct lego_mm_struct *mm, unsigned long addr,
+			 unsigned int seq, unsigned long *vm_start, bool *anon);
+#else
+static inline void vma_seq_write_begin(struct lego_mm_struct *mm) { }
+static inline void vma_seq_write_end(struct lego_mm_struct *mm) { }
+static inline void vma_seq_init(struct lego_mm_struct *mm) { }
+static inline void vma_seq_exit(struct lego_mm_struct *mm) { }
+static inline void wait_speculative_walkers(struct lego_mm_struct *mm) { }
+
+static inline struct vm_area_struct *
+find_vma_cached(struct lego_mm_struct *mm, unsigned long addr)
+{
+	return find_vma(mm, addr);
+}
+#endif
+
 /* Decrement the use count and release all resources for an mm */
 void __lego_mmput(struct lego_mm_struct *);
 static inline void lego_mmput(struct lego_mm_struct *mm)
@@ -233,6 +298,8 @@ static inline void lego_mmput(struct lego_mm_struct *mm)
 		__lego_mmput(mm);
 }
 
+struct lego_mm_struct *lego_get_task_mm(struct lego_task_struct *tsk);
+
 static inline unsigned long vma_pages(struct vm_area_struct *vma)
 {
 	return (vma->vm_end - vma->vm_start) >> PAGE_SHIFT;
@@ -280,6 +347,17 @@ int handle_lego_mmap_faults(struct vm_area_struct *vma, unsigned long address,
 
 int count_empty_entries(struct vm_area_struct *vma, unsigned long address,
 	       		u32 nr_pages);
+
+int lego_populate_anon_page(struct vm_area_struct *vma, unsigned long address);
+int lego_speculative_mm_fault(struct lego_mm_struct *mm, unsigned long address,
+			      unsigned int flags, unsigned long *ret_va);
+
+#ifdef CONFIG_MEM_ANON_PREFETCH
+bool anon_prefetch_run_one(void);
+#else
+static inline bool anon_prefetch_run_one(void) { return false; }
+#endif
+
 /* pgtable.c */
 extern unsigned long lego_move_page_tables(struct vm_area_struct *vma,
 		unsigned long old_addr, struct vm_area_struct *new_vma,
@@ -383,6 +461,12 @@ long get_user_pages(struct lego_task_struct *tsk, unsigned long start,
 		    unsigned long nr_pages, unsigned int gup_flags,
 		    unsigned long *pages, struct vm_area_struct **vmas);
 
+/* Drop the reference taken by get_user_pages(FOLL_GET) */
+static inline void put_user_page(unsigned long page)
+{
+	free_page(page);
+}
+
 int __lego_mm_populate(struct lego_mm_struct *mm, unsigned long start,
 		       unsigned long len, int ignore_errors);
 
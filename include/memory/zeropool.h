@@ -0,0 +1,29 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_MEMORY_ZEROPOOL_H_
+#define _LEGO_MEMORY_ZEROPOOL_H_
+
+#include <lego/mm.h>
+#include <lego/gfp.h>
+
+#ifdef CONFIG_MEM_ZERO_PAGE_POOL
+unsigned long alloc_zeroed_page(void);
+bool zeropool_refill_one(void);
+void print_zeropool_stats(void);
+#else
+static inline unsigned long alloc_zeroed_page(void)
+{
+	return __get_free_page(GFP_KERNEL | __GFP_ZERO);
+}
+static inline bool zeropool_refill_one(void) { return false; }
+static inline void print_zeropool_stats(void) { }
+#endif
+
+#endif /* _LEGO_MEMORY_ZEROPOOL_H_ */
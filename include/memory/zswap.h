@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#ifndef _LEGO_MEMORY_ZSWAP_H_
+#define _LEGO_MEMORY_ZSWAP_H_
+
+#include <lego/mm.h>
+#include <lego/bitops.h>
+#include <memory/mm.h>
+
+#ifdef CONFIG_MEM_ZSWAP
+/*
+ * A compressed page is kept in a zswap entry, and its pte is
+ * replaced by a non-present pte that points to the entry:
+ *
+ *	[55:12] entry address bits [46:3]
+ *	[9]	_PAGE_ZSWAP
+ *
+ * Present, PROTNONE and the processor-side zerofill bits are clear.
+ */
+#define _PAGE_BIT_ZSWAP		_PAGE_BIT_SOFTW1
+#define _PAGE_ZSWAP		(_AT(pteval_t, 1) << _PAGE_BIT_ZSWAP)
+
+static inline bool is_zswap_pte(pte_t pte)
+{
+	return (pte_val(pte) & (_PAGE_PRESENT | _PAGE_PROTNONE | _PAGE_ZSWAP))
+		== _PAGE_ZSWAP;
+}
+
+/*
+ * Tell the cold page scanner that @ptep is in use.
+ * Caller holds mmap_sem, the scanner holds it for write.
+ */
+static inline void zswap_mark_young(pte_t *ptep)
+{
+	if (!pte_young(*ptep))
+		set_bit(_PAGE_BIT_ACCESSED, (unsigned long *)ptep);
+}
+
+int zswap_load(pte_t *ptep, pte_t orig_pte, unsigned long vaddr);
+void zswap_free_pte(pte_t pte);
+void zswap_dup_pte(pte_t pte);
+void print_zswap_stats(void);
+void __init zswap_init(void);
+#else
+static inline bool is_zswap_pte(pte_t pte) { return false; }
+static inline void zswap_mark_young(pte_t *ptep) { }
+static inline int zswap_load(pte_t *ptep, pte_t orig_pte, unsigned long vaddr)
+{
+	BUG();
+	return -EINVAL;
+}
+static inline void zswap_free_pte(pte_t pte) { }
+static inline void zswap_dup_pte(pte_t pte) { }
+static inline void print_zswap_stats(void) { }
+static inline void zswap_init(void) { }
+#endif
+
+#endif /* _LEGO_MEMORY_ZSWAP_H_ */
@@ -556,6 +556,32 @@ void clflush_one(struct task_struct *tsk, unsigned long user_va, void *cache_add
 void __clflush_one(pid_t tgid, unsigned long user_va,
 		   unsigned int m_nid, unsigned int rep_nid, void *cache_addr);
 
+/*
+ * Batched flush. Lines are accumulated as long as they belong to the same
+ * process and go to the same memory node, and sent out in one message once
+ * the batch is full, the key changes, or pcache_flush_batch_send() is called.
+ */
+#define PCACHE_FLUSH_BATCH_MAX_LINES	7
+
+struct pcache_flush_batch {
+	pid_t		tgid;
+	unsigned int	m_nid;
+	unsigned int	nr_lines;
+	unsigned long	user_va[PCACHE_FLUSH_BATCH_MAX_LINES];
+	unsigned int	rep_nid[PCACHE_FLUSH_BATCH_MAX_LINES];
+	void		*cache_addr[PCACHE_FLUSH_BATCH_MAX_LINES];
+};
+
+static inline void pcache_flush_batch_init(struct pcache_flush_batch *batch)
+{
+	batch->nr_lines = 0;
+}
+
+void pcache_flush_batch_add(struct pcache_flush_batch *batch, pid_t tgid,
+			    unsigned long user_va, unsigned int m_nid,
+			    unsigned int rep_nid, void *cache_addr);
+void pcache_flush_batch_send(struct pcache_flush_batch *batch);
+
 /* eviction */
 int pcache_evict_line(struct pcache_set *pset, unsigned long address,
 		      enum piggyback_options piggyback);
@@ -657,7 +683,119 @@ int common_do_fill_page(struct mm_struct *mm, unsigned long address,
 			unsigned long flags, fill_func_t fill_func, void *arg,
 			enum rmap_caller caller, enum piggyback_options piggyback);
 
+#ifdef CONFIG_PCACHE_PREFETCH
+extern unsigned int sysctl_pcache_prefetch_max_depth;
+
+void pcache_prefetch(struct mm_struct *mm, unsigned long address,
+		     pmd_t *pmd, unsigned long flags);
+
+/* Called once a pte mapping @pcm is found young */
+static inline void pcache_prefetch_referenced(struct pcache_meta *pcm)
+{
+	if (unlikely(PcachePrefetch(pcm)) && TestClearPcachePrefetch(pcm))
+		inc_pcache_event(PCACHE_PREFETCH_USEFUL);
+}
+
+/* Called when @pcm is freed */
+static inline void pcache_prefetch_free(struct pcache_meta *pcm)
+{
+	if (unlikely(PcachePrefetch(pcm)) && TestClearPcachePrefetch(pcm))
+		inc_pcache_event(PCACHE_PREFETCH_WASTED);
+}
+#else
+static inline void pcache_prefetch(struct mm_struct *mm, unsigned long address,
+				   pmd_t *pmd, unsigned long flags) { }
+static inline void pcache_prefetch_referenced(struct pcache_meta *pcm) { }
+static inline void pcache_prefetch_free(struct pcache_meta *pcm) { }
+#endif
+
+#ifdef CONFIG_PCACHE_HUGE_LINE
+/*
+ * A huge line is PCACHE_HUGE_NR_LINES normal lines from the same way of
+ * consecutive sets, mapped by one pmd. Only the head line has refcount,
+ * mapcount and rmap, until the huge line is split.
+ */
+#define PCACHE_HUGE_LINE_SIZE	PMD_SIZE
+#define PCACHE_HUGE_LINE_MASK	PMD_MASK
+#define PCACHE_HUGE_NR_LINES	(PCACHE_HUGE_LINE_SIZE / PCACHE_LINE_SIZE)
+
+static inline bool pcache_pmd_huge(pmd_t pmd)
+{
+	return pmd_large(pmd);
+}
+
+bool pcache_prefetch_sequential(unsigned long address);
+void pcache_prefetch_advance(unsigned long address, unsigned long end);
+
+bool pcache_huge_fault(struct mm_struct *mm, unsigned long address,
+		       pmd_t *pmd, unsigned long flags);
+void pcache_zap_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address);
+int pcache_split_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address);
+void pcache_free_huge(struct pcache_meta *head);
+int pcache_evict_huge_line(struct pcache_meta *head);
+int pcache_evict_huge_in_set(struct pcache_set *pset);
+void __init pcache_huge_init(void);
+
+int pcache_add_rmap_huge(struct pcache_meta *head, pmd_t *pmd,
+			 unsigned long address, struct mm_struct *owner_mm,
+			 struct task_struct *owner_process);
+void pcache_remove_rmap_huge(struct pcache_meta *head);
+void pcache_split_rmap_huge(struct pcache_meta *head, pte_t *ptes);
+int pcache_wrprotect_huge(struct pcache_meta *head, bool *dirty);
+void pcache_unmap_huge(struct pcache_meta *head);
+#else
+static inline bool pcache_pmd_huge(pmd_t pmd) { return false; }
+static inline bool pcache_huge_fault(struct mm_struct *mm, unsigned long address,
+				     pmd_t *pmd, unsigned long flags)
+{
+	return false;
+}
+static inline void pcache_zap_huge_pmd(struct mm_struct *mm, pmd_t *pmd,
+				       unsigned long address) { }
+static inline int pcache_split_huge_pmd(struct mm_struct *mm, pmd_t *pmd,
+					unsigned long address)
+{
+	return 0;
+}
+static inline void pcache_free_huge(struct pcache_meta *head) { }
+static inline int pcache_evict_huge_in_set(struct pcache_set *pset)
+{
+	return -EAGAIN;
+}
+static inline void pcache_huge_init(void) { }
+#endif
+
+#ifdef CONFIG_PCACHE_DELTA_FLUSH
+/*
+ * Lines are mapped read-only at fill time, so that the
+ * first write to a clean line traps and can be snapshotted.
+ */
+static inline pte_t pcache_delta_mk_pte(pte_t entry)
+{
+	return pte_wrprotect(entry);
+}
+
+void pcache_delta_snapshot(struct pcache_meta *pcm);
+void pcache_delta_free(struct pcache_meta *pcm);
+int pcache_delta_flush(struct pcache_meta *pcm, pid_t tgid, unsigned long user_va,
+		       unsigned int m_nid, unsigned int rep_nid);
+void __init pcache_delta_early_init(void);
+#else
+static inline pte_t pcache_delta_mk_pte(pte_t entry) { return entry; }
+static inline void pcache_delta_snapshot(struct pcache_meta *pcm) { }
+static inline void pcache_delta_free(struct pcache_meta *pcm) { }
+static inline int pcache_delta_flush(struct pcache_meta *pcm, pid_t tgid,
+				     unsigned long user_va, unsigned int m_nid,
+				     unsigned int rep_nid)
+{
+	return -ENOENT;
+}
+static inline void pcache_delta_early_init(void) { }
+#endif
+
 #include <processor/pcache_victim.h>
 #include <processor/pcache_evict.h>
+#include <processor/pcache_mshr.h>
+#include <processor/pcache_quota.h>
 
 #endif /* _LEGO_PROCESSOR_PCACHE_H_ */
@@ -30,6 +30,25 @@ int __init evict_sweep_init(void);
 static inline int evict_sweep_init(void) { return 0; }
 #endif
 
+/*
+ * Background reclaim threads, keep free ways in each set
+ */
+#ifdef CONFIG_PCACHE_RECLAIM
+extern unsigned int pcache_reclaim_wmark_low;
+extern unsigned int pcache_reclaim_wmark_high;
+extern unsigned int pcache_reclaim_interval_msec;
+
+int __init pcache_reclaim_init(void);
+#else
+static inline int pcache_reclaim_init(void) { return 0; }
+#endif
+
+/* Racy read, used as a hint only */
+static inline unsigned int pset_nr_free(struct pcache_set *pset)
+{
+	return bitmap_weight(pset->free_map, PCACHE_ASSOCIATIVITY);
+}
+
 /*
  * Eviction Algorithm
  * 	Least Recently Used
@@ -102,11 +121,13 @@ static inline void init_pcache_lru(struct pcache_meta *pcm)
 }
 
 /* Callback: find a pcache line to evict */
-struct pcache_meta *evict_find_line_lru(struct pcache_set *pset);
+struct pcache_meta *evict_find_line_lru(struct pcache_set *pset,
+					struct pcache_quota *filter);
 
 void kevict_sweepd_lru(void);
 
 #else
+static inline int pset_nr_lru(struct pcache_set *pset) { return 0; }
 static inline void
 add_to_lru_list(struct pcache_meta *pcm, struct pcache_set *pset) { }
 static inline void
@@ -118,7 +139,7 @@ static inline void detach_from_lru(struct pcache_meta *pcm) { }
 static inline void init_pcache_lru(struct pcache_meta *pcm) { }
 
 static inline struct pcache_meta *
-evict_find_line_lru(struct pcache_set *pset)
+evict_find_line_lru(struct pcache_set *pset, struct pcache_quota *filter)
 {
 	BUG();
 }
@@ -152,6 +173,18 @@ static inline struct pcache_meta *
 evict_find_line_random(struct pcache_set *pset) { BUG(); }
 #endif /* EVICT_RANDOM */
 
+/*
+ * Eviction Algorithm
+ * 	CLOCK, CLOCK-Pro
+ */
+#ifdef CONFIG_PCACHE_EVICT_CLOCK
+struct pcache_meta *evict_find_line_clock(struct pcache_set *pset,
+					  struct pcache_quota *filter);
+#else
+static inline struct pcache_meta *
+evict_find_line_clock(struct pcache_set *pset, struct pcache_quota *filter) { BUG(); }
+#endif /* EVICT_CLOCK */
+
 #ifdef CONFIG_PCACHE_EVICTION_PERSET_LIST
 void pset_remove_eviction(struct pcache_set *pset,
 			  struct pcache_meta *pcm, int nr_added);
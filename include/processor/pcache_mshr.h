@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Header file for pcache Miss Status Holding Registers (MSHR).
+ *
+ * Each MSHR tracks one in-flight pcache fill from remote memory. MSHRs are
+ * linked to the pcache set the faulting address maps to. Concurrent faults
+ * on the same line find the MSHR and wait for the single outstanding fill,
+ * instead of sending their own request over the network.
+ */
+
+#ifndef _LEGO_PROCESSOR_PCACHE_MSHR_H_
+#define _LEGO_PROCESSOR_PCACHE_MSHR_H_
+
+#include <lego/mm.h>
+#include <lego/sched.h>
+
+#define PCACHE_MSHR_NR_ENTRIES \
+	((unsigned int)CONFIG_PCACHE_MSHR_NR_ENTRIES)
+
+/* Entries in use, may be capped below PCACHE_MSHR_NR_ENTRIES at boot */
+extern unsigned int nr_pcache_mshr_entries;
+
+struct pcache_mshr {
+	unsigned long		flags;
+	atomic_t		_refcount;	/* 1 for owner, 1 for each waiter */
+
+	struct mm_struct	*mm;		/* only compared, never deref'ed */
+	unsigned long		address;	/* pcache line aligned UVA */
+	int			ret;		/* fill result, valid once Done */
+
+	/* Link to pset->mshr_list */
+	struct list_head	next;
+} ____cacheline_aligned_in_smp;
+
+enum pcache_mshr_flags {
+	PCACHE_MSHR_used,
+	PCACHE_MSHR_done,		/* fill finished, waiters can go */
+	PCACHE_MSHR_cancelled,		/* range unmapped during fill */
+
+	NR_PCACHE_MSHR_FLAGS
+};
+
+#define TEST_MSHR_FLAGS(uname, lname)					\
+static inline int Mshr##uname(const struct pcache_mshr *p)		\
+{									\
+	return test_bit(PCACHE_MSHR_##lname, &p->flags);		\
+}
+
+#define SET_MSHR_FLAGS(uname, lname)					\
+static inline void SetMshr##uname(struct pcache_mshr *p)		\
+{									\
+	set_bit(PCACHE_MSHR_##lname, &p->flags);			\
+}
+
+#define CLEAR_MSHR_FLAGS(uname, lname)					\
+static inline void ClearMshr##uname(struct pcache_mshr *p)		\
+{									\
+	clear_bit(PCACHE_MSHR_##lname, &p->flags);			\
+}
+
+#define TEST_SET_MSHR_FLAGS(uname, lname)				\
+static inline int TestSetMshr##uname(struct pcache_mshr *p)		\
+{									\
+	return test_and_set_bit(PCACHE_MSHR_##lname, &p->flags);	\
+}
+
+#define TEST_CLEAR_MSHR_FLAGS(uname, lname)				\
+static inline int TestClearMshr##uname(struct pcache_mshr *p)		\
+{									\
+	return test_and_clear_bit(PCACHE_MSHR_##lname, &p->flags);	\
+}
+
+#define MSHR_FLAGS(uname, lname)					\
+	TEST_MSHR_FLAGS(uname, lname)					\
+	SET_MSHR_FLAGS(uname, lname)					\
+	CLEAR_MSHR_FLAGS(uname, lname)					\
+	TEST_SET_MSHR_FLAGS(uname, lname)				\
+	TEST_CLEAR_MSHR_FLAGS(uname, lname)
+
+MSHR_FLAGS(Used, used)
+MSHR_FLAGS(Done, done)
+MSHR_FLAGS(Cancelled, cancelled)
+
+#ifdef CONFIG_PCACHE_MSHR
+struct pcache_mshr *pcache_mshr_find_or_alloc(struct mm_struct *mm,
+					      unsigned long address, bool *merged);
+void pcache_mshr_wait(struct pcache_mshr *mshr);
+void pcache_mshr_complete(struct pcache_mshr *mshr, int ret);
+void put_pcache_mshr(struct pcache_mshr *mshr);
+void pcache_mshr_cancel_range(struct mm_struct *mm,
+			      unsigned long start, unsigned long end);
+void __init pcache_mshr_init(void);
+#else
+static inline struct pcache_mshr *
+pcache_mshr_find_or_alloc(struct mm_struct *mm, unsigned long address, bool *merged)
+{
+	return NULL;
+}
+static inline void pcache_mshr_wait(struct pcache_mshr *mshr) { }
+static inline void pcache_mshr_complete(struct pcache_mshr *mshr, int ret) { }
+static inline void put_pcache_mshr(struct pcache_mshr *mshr) { }
+static inline void pcache_mshr_cancel_range(struct mm_struct *mm,
+			      unsigned long start, unsigned long end) { }
+static inline void pcache_mshr_init(void) { }
+#endif /* CONFIG_PCACHE_MSHR */
+
+#endif /* _LEGO_PROCESSOR_PCACHE_MSHR_H_ */
@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Header file for per-process pcache quota.
+ *
+ * Every pcache line is charged to the process that allocated it. A process
+ * can be given a limit, in number of lines. Once over the limit, it recycles
+ * its own lines instead of growing, and its lines are preferred as victims
+ * when others evict. See pcache/quota.c for details.
+ */
+
+#ifndef _LEGO_PROCESSOR_PCACHE_QUOTA_H_
+#define _LEGO_PROCESSOR_PCACHE_QUOTA_H_
+
+#include <lego/mm.h>
+#include <lego/sched.h>
+
+struct seq_file;
+
+#ifdef CONFIG_PCACHE_QUOTA
+
+#define PCACHE_NR_QUOTAS	((unsigned int)CONFIG_PCACHE_QUOTA_NR_ENTRIES)
+
+/**
+ * struct pcache_quota	- Pcache usage of one process
+ * @_refcount: nr of lines charged, plus 1 while the process is alive
+ * @limit: max nr of lines, 0 means unlimited
+ * @nr_miss: nr of misses filled from remote memory
+ * @nr_evicted: nr of lines evicted from pcache
+ *
+ * Quotas live in a static table, so pcm->quota never dangles.
+ * A quota is released once its process exited and all lines are freed.
+ */
+struct pcache_quota {
+	atomic_long_t		_refcount;
+	unsigned long		limit;
+	atomic_long_t		nr_miss;
+	atomic_long_t		nr_evicted;
+	pid_t			tgid;
+	char			comm[TASK_COMM_LEN];
+} ____cacheline_aligned_in_smp;
+
+extern struct pcache_quota pcache_quotas[PCACHE_NR_QUOTAS];
+extern atomic_t nr_limited_pcache_quotas;
+
+struct pcache_quota *current_pcache_quota(void);
+void put_pcache_quota(struct pcache_quota *q, long nr);
+void pcache_quota_exit(struct mm_struct *mm);
+int pcache_quota_set_limit(pid_t tgid, unsigned long limit);
+void pcache_quota_show(struct seq_file *m);
+int pcache_evict_own_line(struct pcache_set *pset, unsigned long address,
+			  struct pcache_quota *q);
+
+static inline long pcache_quota_used(struct pcache_quota *q)
+{
+	return atomic_long_read(&q->_refcount) - 1;
+}
+
+static inline bool pcache_quota_over(struct pcache_quota *q)
+{
+	unsigned long limit = READ_ONCE(q->limit);
+
+	return limit && pcache_quota_used(q) >= (long)limit;
+}
+
+/* Charge @nr lines starting from @pcm to @q */
+static inline void pcache_quota_charge(struct pcache_meta *pcm,
+				       struct pcache_quota *q, long nr)
+{
+	pcm->quota = q;
+	atomic_long_add(nr, &q->_refcount);
+}
+
+static inline void pcache_quota_uncharge(struct pcache_meta *pcm, long nr)
+{
+	put_pcache_quota(pcm->quota, nr);
+}
+
+/* @dst takes over part of the charge of @src, e.g. huge line split */
+static inline void pcache_quota_copy(struct pcache_meta *dst,
+				     struct pcache_meta *src)
+{
+	dst->quota = src->quota;
+}
+
+static inline void pcache_quota_inc_miss(void)
+{
+	atomic_long_inc(&current_pcache_quota()->nr_miss);
+}
+
+static inline void pcache_quota_inc_evicted(struct pcache_meta *pcm)
+{
+	atomic_long_inc(&pcm->quota->nr_evicted);
+}
+
+/*
+ * Victim filter used by eviction algorithms. If no quota has a limit,
+ * there is nothing to filter, and the whole set is searched as usual.
+ */
+static inline struct pcache_quota *pcache_quota_evict_filter(void)
+{
+	if (likely(!atomic_read(&nr_limited_pcache_quotas)))
+		return NULL;
+	return current_pcache_quota();
+}
+
+/*
+ * Return true if @pcm should not be evicted by @filter on the first pass:
+ * an over-quota evictor only evicts its own lines, others prefer lines
+ * of their own or of over-quota processes.
+ */
+static inline bool pcache_quota_skip_victim(struct pcache_meta *pcm,
+					    struct pcache_quota *filter)
+{
+	struct pcache_quota *owner;
+
+	if (!filter)
+		return false;
+
+	owner = pcm->quota;
+	if (owner == filter)
+		return false;
+	if (pcache_quota_over(filter))
+		return true;
+	return !pcache_quota_over(owner);
+}
+
+#else
+static inline struct pcache_quota *current_pcache_quota(void) { return NULL; }
+static inline void pcache_quota_exit(struct mm_struct *mm) { }
+static inline bool pcache_quota_over(struct pcache_quota *q) { return false; }
+static inline void pcache_quota_charge(struct pcache_meta *pcm,
+				       struct pcache_quota *q, long nr) { }
+static inline void pcache_quota_uncharge(struct pcache_meta *pcm, long nr) { }
+static inline void pcache_quota_copy(struct pcache_meta *dst,
+				     struct pcache_meta *src) { }
+static inline void pcache_quota_inc_miss(void) { }
+static inline void pcache_quota_inc_evicted(struct pcache_meta *pcm) { }
+static inline struct pcache_quota *pcache_quota_evict_filter(void) { return NULL; }
+static inline bool pcache_quota_skip_victim(struct pcache_meta *pcm,
+					    struct pcache_quota *filter)
+{
+	return false;
+}
+static inline int pcache_evict_own_line(struct pcache_set *pset,
+					unsigned long address,
+					struct pcache_quota *q)
+{
+	return PCACHE_EVICT_FAILURE_FIND;
+}
+#endif /* CONFIG_PCACHE_QUOTA */
+
+#endif /* _LEGO_PROCESSOR_PCACHE_QUOTA_H_ */
@@ -32,6 +32,7 @@ enum pcache_event_item {
 	PCACHE_CLFLUSH_CLEAN_SKIPPED,
 	PCACHE_CLFLUSH_FAIL,
 	PCACHE_CLFLUSH_PIGGYBACK_FB,
+	PCACHE_CLFLUSH_BATCH,		/* nr of batched flush messages */
 
 	/*
 	 * Write-protection fault
@@ -56,6 +57,8 @@ enum pcache_event_item {
 	 * failure_find: algorithm part failed to find a candidate
 	 * failure_evict: mechanism part failed to evict the candidate
 	 * succeed: evicted a line
+	 * scanned: lines looked at by the algorithm part
+	 * find_ns: time spent in the algorithm part
 	 */
 	PCACHE_EVICTION_TRIGGERED,
 	PCACHE_EVICTION_EAGAIN_FREEABLE,
@@ -63,6 +66,17 @@ enum pcache_event_item {
 	PCACHE_EVICTION_FAILURE_FIND,
 	PCACHE_EVICTION_FAILURE_EVICT,
 	PCACHE_EVICTION_SUCCEED,
+	PCACHE_EVICTION_SCANNED,
+	PCACHE_EVICTION_FIND_NS,
+
+	/*
+	 * CLOCK eviction
+	 * second_chance: referenced line skipped by the hand
+	 * promote/demote: CLOCK-Pro cold->hot, hot->cold
+	 */
+	PCACHE_CLOCK_SECOND_CHANCE,
+	PCACHE_CLOCK_PROMOTE,
+	PCACHE_CLOCK_DEMOTE,
 
 	PCACHE_PSET_LIST_LOOKUP,
 	PCACHE_PSET_LIST_HIT,
@@ -110,6 +124,88 @@ enum pcache_event_item {
 	PCACHE_PEE_FREE,
 	PCACHE_PEE_FREE_KMALLOC,
 
+	/*
+	 * MSHR (in-flight fill tracking)
+	 * alloc: fills that went to remote memory with an MSHR
+	 * merge: faults that waited on other's in-flight fill
+	 * full: faults that fell back to sync fill, no free MSHR
+	 * cancelled: fills discarded due to concurrent unmap
+	 */
+	PCACHE_MSHR_ALLOC,
+	PCACHE_MSHR_MERGE,
+	PCACHE_MSHR_FULL,
+	PCACHE_MSHR_CANCELLED,
+
+	/*
+	 * Background reclaim
+	 * direct_evict: pcache_alloc fastpath failed, evict inline
+	 * reclaim_run: nr of passes over its sets by reclaim threads
+	 * reclaim_evict: lines evicted by reclaim threads
+	 * reclaim_failure: eviction failed within reclaim threads
+	 * reclaim_busy: sets left for the next pass, all lines were busy
+	 */
+	PCACHE_ALLOC_DIRECT_EVICT,
+	PCACHE_RECLAIM_RUN,
+	PCACHE_RECLAIM_EVICT,
+	PCACHE_RECLAIM_FAILURE,
+	PCACHE_RECLAIM_BUSY,
+
+	/*
+	 * Prefetch
+	 * triggered: nr of prefetch windows issued
+	 * lines: lines sent to remote memory
+	 * filled: lines mapped into pgtable
+	 * dropped: lines discarded (error, raced with fault or unmap)
+	 * useful: filled lines that were accessed later
+	 * wasted: filled lines freed before being accessed
+	 * backoff: nr of times a stream reduced its depth
+	 */
+	PCACHE_PREFETCH_TRIGGERED,
+	PCACHE_PREFETCH_LINES,
+	PCACHE_PREFETCH_FILLED,
+	PCACHE_PREFETCH_DROPPED,
+	PCACHE_PREFETCH_USEFUL,
+	PCACHE_PREFETCH_WASTED,
+	PCACHE_PREFETCH_BACKOFF,
+
+	/*
+	 * Delta flush
+	 * snapshot: twin taken at first write
+	 * snapshot_fail: no twin available, line will be flushed in full
+	 * flush: lines flushed as delta
+	 * flush_clean: written, but identical to twin, flush skipped
+	 * flush_full: too much modified, flushed in full
+	 * flush_bytes: bytes of line data sent by delta flushes
+	 */
+	PCACHE_DELTA_SNAPSHOT,
+	PCACHE_DELTA_SNAPSHOT_FAIL,
+	PCACHE_DELTA_FLUSH,
+	PCACHE_DELTA_FLUSH_CLEAN,
+	PCACHE_DELTA_FLUSH_FULL,
+	PCACHE_DELTA_FLUSH_BYTES,
+
+	/*
+	 * Huge lines
+	 * fill_fail: memory refused or pmd got populated, fall back to 4KB
+	 * alloc_fail: no way is free in all sets, fall back to 4KB
+	 * split: huge mapping turned into 512 normal lines
+	 * zap: huge line dropped by munmap() or exit()
+	 */
+	PCACHE_HUGE_FILL,
+	PCACHE_HUGE_FILL_FAIL,
+	PCACHE_HUGE_ALLOC_FAIL,
+	PCACHE_HUGE_EVICTION,
+	PCACHE_HUGE_SPLIT,
+	PCACHE_HUGE_ZAP,
+
+	/*
+	 * Quota
+	 * recycle: over-quota alloc evicted its own line
+	 * table_full: no free quota entry for a new process
+	 */
+	PCACHE_QUOTA_RECYCLE,
+	PCACHE_QUOTA_TABLE_FULL,
+
 	NR_PCACHE_EVENT_ITEMS,
 };
 
@@ -126,6 +222,11 @@ static inline void inc_pcache_event(enum pcache_event_item item)
 	atomic_long_inc(&pcache_event_stats.event[item]);
 }
 
+static inline void add_pcache_event(enum pcache_event_item item, long nr)
+{
+	atomic_long_add(nr, &pcache_event_stats.event[item]);
+}
+
 static inline void inc_pcache_event_cond(enum pcache_event_item item, bool doit)
 {
 	if (doit)
@@ -171,6 +272,11 @@ static inline void dec_pcache_used(void)
 	atomic_long_dec(&nr_used_cachelines);
 }
 
+static inline void mod_pcache_used(long nr)
+{
+	atomic_long_add(nr, &nr_used_cachelines);
+}
+
 static inline long pcache_used(void)
 {
 	return atomic_long_read(&nr_used_cachelines);
@@ -178,6 +284,7 @@ static inline long pcache_used(void)
 
 #else
 static inline void inc_pcache_event(enum pcache_event_item i) { }
+static inline void add_pcache_event(enum pcache_event_item item, long nr) { }
 static inline void inc_pcache_event_cond(enum pcache_event_item item, bool doit) { }
 static inline unsigned long pcache_event(enum pcache_event_item i) { return 0; }
 static inline void mod_pset_event(int i, struct pcache_set *pset,
@@ -188,6 +295,7 @@ static inline void dec_pset_event(struct pcache_set *pset,
 				 enum pcache_set_stat_item item) { }
 static inline void inc_pcache_used(void) { }
 static inline void dec_pcache_used(void) { }
+static inline void mod_pcache_used(long nr) { }
 static inline long pcache_used(void) { return 0; }
 #endif /* CONFIG_COUNTER_PCACHE */
 
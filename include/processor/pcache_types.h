@@ -13,11 +13,13 @@
 #include <lego/mm.h>
 #include <lego/const.h>
 #include <lego/bitops.h>
+#include <lego/bitmap.h>
 #include <lego/spinlock.h>
 
 #include <processor/pcache_config.h>
 
 struct pcache_meta;
+struct pcache_quota;
 
 #define PCACHE_META_SIZE		(sizeof(struct pcache_meta))
 
@@ -106,9 +108,12 @@ struct pset_padding {
 struct pcache_set {
 	unsigned long		flags;
 
-	/* This links all FREE pcache lines within pset */
-	struct list_head	free_head;
-	spinlock_t		free_lock;
+	/*
+	 * One bit per way, set if the way is free.
+	 * Ways are claimed with cmpxchg and released with set_bit,
+	 * so (de-)allocation never takes a set-wide lock.
+	 */
+	DECLARE_BITMAP(free_map, PCACHE_ASSOCIATIVITY);
 
 	/*
 	 * Eviction Algorithms Specific
@@ -122,6 +127,10 @@ struct pcache_set {
 	spinlock_t		lru_lock;
 #endif
 
+#ifdef CONFIG_PCACHE_EVICT_CLOCK
+	atomic_t		clock_hand;
+#endif
+
 	/*
 	 * Eviction Mechanism Specific
 	 */
@@ -142,6 +151,17 @@ struct pcache_set {
 	atomic_t		nr_eviction_entries;
 #endif
 
+#ifdef CONFIG_PCACHE_MSHR
+	/*
+	 * In-flight pcache fills from remote memory.
+	 * nr_mshr is used by pgfault to have a quick check.
+	 */
+	PSET_PADDING(_pad_mshr_)
+	spinlock_t		mshr_lock;
+	struct list_head	mshr_list;
+	atomic_t		nr_mshr;
+#endif
+
 	atomic_t		stat[NR_PSET_STAT_ITEMS];
 } ____cacheline_aligned;
 
@@ -208,9 +228,6 @@ struct pcache_meta {
 	atomic_t		mapcount;
 	atomic_t		_refcount;
 
-	/* This is linked to pset free_head */
-	struct list_head	free_list;
-
 	struct list_head	rmap;
 	struct piggyback_info	pb;
 
@@ -221,6 +238,16 @@ struct pcache_meta {
 #ifdef CONFIG_PCACHE_EVICT_LRU
 	struct list_head	lru;
 #endif
+
+#ifdef CONFIG_PCACHE_DELTA_FLUSH
+	/* Clean copy taken at first write, protected by PC_locked */
+	void			*twin;
+#endif
+
+#ifdef CONFIG_PCACHE_QUOTA
+	/* Process charged for this line, set at allocation */
+	struct pcache_quota	*quota;
+#endif
 } ____cacheline_aligned;
 
 enum rmap_caller {
@@ -230,6 +257,7 @@ enum rmap_caller {
 	RMAP_COW,
 	RMAP_FORK,
 	RMAP_MREMAP_SLOWPATH,
+	RMAP_FILL_HUGE,
 
 	NR_RMAP_CALLER,
 };
@@ -380,6 +408,16 @@ PSET_FLAGS(Sweeping, sweeping)
  * 			A following pcache_alloc from the same CPU, with
  * 			ENABLE_PIGGYBACK will get it. Check piggyback.h
  *
+ * PC_prefetch:		Pcacheline was filled by prefetcher, and no
+ * 			access has been observed yet. Cleared once the
+ * 			pte is found young (useful), or at free (wasted).
+ *
+ * PC_hot:		Pcacheline was referenced again after the clock hand
+ * 			passed it once. Only used by CLOCK-Pro eviction.
+ *
+ * PC_huge:		Pcacheline is part of a huge line. Only the head line
+ * 			has refcount and rmap, see pcache/huge.c
+ *
  * Hack: remember to update the pcacheflag_names array in debug file.
  *
  * 1) PC_valid is more like the traditional cache valid bit. It is set when
@@ -393,6 +431,9 @@ enum pcache_meta_bits {
 	PC_writeback,
 	PC_piggyback,
 	PC_piggyback_cached,
+	PC_prefetch,
+	PC_hot,
+	PC_huge,
 
 	__NR_PCLBITS,
 };
@@ -469,6 +510,9 @@ PCACHE_META_BITS(Reclaim, reclaim)
 PCACHE_META_BITS(Writeback, writeback)
 PCACHE_META_BITS(Piggyback, piggyback)
 PCACHE_META_BITS(PiggybackCached, piggyback_cached)
+PCACHE_META_BITS(Prefetch, prefetch)
+PCACHE_META_BITS(Hot, hot)
+PCACHE_META_BITS(Huge, huge)
 
 /*
  * Flags checked when a pcache is freed.
@@ -92,4 +92,10 @@ static inline void rpc_profile(void) { }
 static inline void wait_rpc_profile(void) { }
 #endif
 
+#ifdef CONFIG_PROFILING_BOOT_PCACHE_ALLOC
+void pcache_alloc_profile(void);
+#else
+static inline void pcache_alloc_profile(void) { }
+#endif
+
 #endif /* _LEGO_PROCESSOR_PROCESSOR_H_ */
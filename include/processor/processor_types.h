@@ -21,6 +21,28 @@
 
 #ifdef CONFIG_COMP_PROCESSOR
 
+#ifdef CONFIG_PCACHE_PREFETCH
+/*
+ * One detected access stream of a thread.
+ * All addresses are pcache line aligned.
+ */
+struct pcache_prefetch_stream {
+	unsigned long	last_addr;	/* last line missed or prefetched */
+	unsigned long	next_addr;	/* expected next miss if window consumed */
+	long		stride;		/* in bytes, can be negative */
+	unsigned int	hits;		/* consecutive stride matches */
+	unsigned int	depth;		/* current prefetch window, in lines */
+	unsigned long	age;
+};
+
+#define PCACHE_PREFETCH_NR_STREAMS	4
+
+struct pcache_prefetch_info {
+	struct pcache_prefetch_stream	streams[PCACHE_PREFETCH_NR_STREAMS];
+	unsigned long			clock;
+};
+#endif
+
 /*
  * If you add anything to structure, please check if these fields
  * need to be initlizaed in the init_task.c
@@ -52,6 +74,11 @@ struct processor_manager {
 #endif
 
 	struct vnode_struct *virtual_node;
+
+#ifdef CONFIG_PCACHE_PREFETCH
+	/* Per-thread stride detector, reset at fork */
+	struct pcache_prefetch_info prefetch;
+#endif
 };
 
 #define UNSET_HOME_NODE		(INT_MAX)
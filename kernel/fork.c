@@ -146,6 +146,10 @@ static struct task_struct *dup_task_struct(struct task_struct *old, int node)
 	atomic_set(&new->pm_data.process_barrier, 0);
 #endif
 
+#ifdef CONFIG_PCACHE_PREFETCH
+	memset(&new->pm_data.prefetch, 0, sizeof(new->pm_data.prefetch));
+#endif
+
 	return new;
 
 free_stack:
@@ -338,6 +342,9 @@ static struct mm_struct *mm_init(struct mm_struct *mm, struct task_struct *p)
 	mm->map_count = 0;
 	mm->pinned_vm = 0;
 	mm_init_cpumask(mm);
+#ifdef CONFIG_PCACHE_QUOTA
+	mm->pcache_quota = NULL;
+#endif
 	spin_lock_init(&mm->page_table_lock);
 	init_rwsem(&mm->mmap_sem);
 
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Multi-thread harness for boot-time profiling
+ *
+ * One kthread is bound to each of the first @nr_threads CPUs of a mask.
+ * They spin on a barrier until all of them are up, so that the measured
+ * bodies really run at the same time, and the caller yields until all
+ * of them are done.
+ */
+
+#include <lego/smp.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <lego/cpumask.h>
+#include <lego/profile.h>
+
+struct profile_threads {
+	void			(*fn)(void *);
+	void			*arg;
+	atomic_t		barrier;
+	atomic_t		exit_barrier;
+	atomic64_t		total_ns;
+};
+
+static int profile_thread_func(void *_pt)
+{
+	struct profile_threads *pt = _pt;
+	unsigned long start_ns, end_ns;
+
+	/* A simple barrier to sync between threads */
+	atomic_dec(&pt->barrier);
+	while (atomic_read(&pt->barrier))
+		cpu_relax();
+
+	start_ns = profile_clock();
+	pt->fn(pt->arg);
+	end_ns = profile_clock();
+
+	atomic64_add(end_ns - start_ns, &pt->total_ns);
+	atomic_dec(&pt->exit_barrier);
+	return 0;
+}
+
+/**
+ * profile_run_threads - run @fn on @nr_threads CPUs at once
+ * @fn: the measured body, called once per thread with @arg
+ * @arg: passed to @fn
+ * @nr_threads: number of threads, one per CPU
+ * @mask: CPUs to use, the first @nr_threads of them are taken
+ * @name: kthread name
+ *
+ * Return the run time of @fn summed over all threads in ns,
+ * or 0 if not all threads could be started.
+ */
+unsigned long profile_run_threads(void (*fn)(void *), void *arg,
+				  unsigned int nr_threads,
+				  const struct cpumask *mask, const char *name)
+{
+	struct profile_threads pt;
+	struct task_struct *tsk;
+	unsigned int i, cpu;
+
+	pt.fn = fn;
+	pt.arg = arg;
+	atomic_set(&pt.barrier, nr_threads);
+	atomic_set(&pt.exit_barrier, nr_threads);
+	atomic64_set(&pt.total_ns, 0);
+
+	i = 0;
+	for_each_cpu(cpu, mask) {
+		if (i == nr_threads)
+			break;
+
+		tsk = kthread_create(profile_thread_func, &pt, 0, name);
+		if (IS_ERR(tsk)) {
+			pr_err("Fail to create profile thread\n");
+			break;
+		}
+		kthread_bind(tsk, cpu);
+		wake_up_process(tsk);
+		i++;
+	}
+
+	/* Let those already started go, and count them out */
+	if (unlikely(i < nr_threads)) {
+		atomic_sub(nr_threads - i, &pt.barrier);
+		atomic_sub(nr_threads - i, &pt.exit_barrier);
+	}
+
+	/* Non-preemptive kernel, one of them may be bound to this CPU */
+	while (atomic_read(&pt.exit_barrier))
+		schedule();
+
+	if (unlikely(i < nr_threads))
+		return 0;
+	return (unsigned long)atomic64_read(&pt.total_ns);
+}
@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * LZ4 block format, compatible with the reference implementation.
+ *
+ * Compression is a plain greedy single-hash matcher, good enough for
+ * page-sized inputs. Each sequence is:
+ *
+ *	token | [literal length ext] | literals | offset | [match length ext]
+ *
+ * High nibble of token is literal length, low nibble is match length
+ * minus MINMATCH. 15 means more length bytes follow, each 255 means
+ * yet another. The last sequence has literals only.
+ */
+
+#include <lego/lz4.h>
+#include <lego/errno.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+
+#define MINMATCH	4
+#define LASTLITERALS	5	/* last 5 bytes are always literals */
+#define MFLIMIT		12	/* last match starts 12 bytes before end */
+#define ML_MASK		15
+#define RUN_MASK	15
+#define MAX_DISTANCE	65535
+
+static inline u32 lz4_read32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline u32 lz4_hash(u32 v)
+{
+	return (v * 2654435761U) >> (32 - LZ4_HASH_BITS);
+}
+
+static inline u8 *lz4_put_length(u8 *op, unsigned int len)
+{
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = len;
+	return op;
+}
+
+/* Worst case output size of one sequence */
+static inline int lz4_seq_bound(unsigned int lit_len, unsigned int match_len)
+{
+	return 1 + lit_len / 255 + 1 + lit_len + 2 + match_len / 255 + 1;
+}
+
+/**
+ * lz4_compress - compress @src into @dst
+ * @wrkmem: LZ4_MEM_COMPRESS bytes of scratch memory
+ *
+ * Return the compressed size, or 0 if it does not fit into @dst_cap.
+ */
+int lz4_compress(const u8 *src, int src_len, u8 *dst, int dst_cap, void *wrkmem)
+{
+	u16 *table = wrkmem;
+	const u8 *ip = src, *anchor = src, *ref, *mp, *rp;
+	const u8 *iend = src + src_len;
+	const u8 *mflimit = iend - MFLIMIT;
+	const u8 *matchlimit = iend - LASTLITERALS;
+	u8 *op = dst, *oend = dst + dst_cap, *token;
+	unsigned int lit_len, match_len, offset;
+	u32 seq, h;
+
+	if (unlikely(src_len > LZ4_MAX_INPUT_SIZE))
+		return 0;
+
+	memset(table, 0, LZ4_MEM_COMPRESS);
+	if (src_len < MFLIMIT + 1)
+		goto last_literals;
+
+	while (ip < mflimit) {
+		seq = lz4_read32(ip);
+		h = lz4_hash(seq);
+		ref = src + table[h];
+		table[h] = ip - src;
+
+		if (ref >= ip || ip - ref > MAX_DISTANCE || lz4_read32(ref) != seq) {
+			ip++;
+			continue;
+		}
+
+		/* Extend backwards into pending literals */
+		while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+
+		mp = ip + MINMATCH;
+		rp = ref + MINMATCH;
+		while (mp < matchlimit && *mp == *rp) {
+			mp++;
+			rp++;
+		}
+
+		lit_len = ip - anchor;
+		match_len = mp - ip - MINMATCH;
+		offset = ip - ref;
+		if (unlikely(lz4_seq_bound(lit_len, match_len) > oend - op))
+			return 0;
+
+		token = op++;
+		if (lit_len >= RUN_MASK) {
+			*token = RUN_MASK << 4;
+			op = lz4_put_length(op, lit_len - RUN_MASK);
+		} else
+			*token = lit_len << 4;
+		memcpy(op, anchor, lit_len);
+		op += lit_len;
+
+		*op++ = offset;
+		*op++ = offset >> 8;
+
+		if (match_len >= ML_MASK) {
+			*token |= ML_MASK;
+			op = lz4_put_length(op, match_len - ML_MASK);
+		} else
+			*token |= match_len;
+
+		ip = anchor = mp;
+	}
+
+last_literals:
+	lit_len = iend - anchor;
+	if (unlikely(1 + lit_len / 255 + 1 + lit_len > oend - op))
+		return 0;
+
+	token = op++;
+	if (lit_len >= RUN_MASK) {
+		*token = RUN_MASK << 4;
+		op = lz4_put_length(op, lit_len - RUN_MASK);
+	} else
+		*token = lit_len << 4;
+	memcpy(op, anchor, lit_len);
+	op += lit_len;
+
+	return op - dst;
+}
+
+static inline int lz4_get_length(const u8 **ipp, const u8 *iend,
+				 unsigned int *len)
+{
+	const u8 *ip = *ipp;
+	u8 s;
+
+	do {
+		if (unlikely(ip >= iend))
+			return -EINVAL;
+		s = *ip++;
+		*len += s;
+	} while (s == 255);
+
+	*ipp = ip;
+	return 0;
+}
+
+/**
+ * lz4_decompress_safe - decompress @src into @dst
+ *
+ * Never reads or writes out of bounds, even on corrupted input.
+ * Return the decompressed size, or -EINVAL.
+ */
+int lz4_decompress_safe(const u8 *src, int src_len, u8 *dst, int dst_cap)
+{
+	const u8 *ip = src, *iend = src + src_len, *match;
+	u8 *op = dst, *oend = dst + dst_cap;
+	unsigned int len, offset;
+	u8 token;
+
+	while (ip < iend) {
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == RUN_MASK && lz4_get_length(&ip, iend, &len))
+			return -EINVAL;
+		if (unlikely(len > iend - ip || len > oend - op))
+			return -EINVAL;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* Last sequence has literals only */
+		if (ip >= iend)
+			break;
+
+		if (unlikely(iend - ip < 2))
+			return -EINVAL;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (unlikely(!offset || offset > op - dst))
+			return -EINVAL;
+
+		len = token & ML_MASK;
+		if (len == ML_MASK && lz4_get_length(&ip, iend, &len))
+			return -EINVAL;
+		len += MINMATCH;
+		if (unlikely(len > oend - op))
+			return -EINVAL;
+
+		match = op - offset;
+		if (offset >= 8) {
+			/* Chunks do not overlap, copy a word at a time */
+			for (; len >= 8; len -= 8, op += 8, match += 8)
+				memcpy(op, match, 8);
+		}
+		while (len--)
+			*op++ = *match++;
+	}
+
+	return op - dst;
+}
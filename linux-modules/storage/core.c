@@ -18,6 +18,9 @@
 #include <linux/module.h>
 #include <linux/dcache.h>
 #include <linux/mutex.h>
+#include <linux/list.h>
+#include <linux/wait.h>
+#include <linux/spinlock.h>
 #include <linux/mm.h>
 
 #include "../fit/fit_config.h"
@@ -27,6 +30,15 @@
 
 #define MAX_RXBUF_SIZE	(512 * PAGE_SIZE)
 
+/*
+ * FIT acks the receive ring up to the offset of the latest message
+ * received, which is only right if messages are received in order.
+ * Thus a single receiver takes messages off the port, each straight
+ * into the buffer of an idle worker, and hands it over. Workers handle
+ * and reply to one request at a time.
+ */
+#define NR_STORAGE_WORKERS	8
+
 struct info_struct {
 	uintptr_t desc;
 	char msg[MAX_RXBUF_SIZE];
@@ -124,16 +136,16 @@ static void storage_dispatch(void *msg, uintptr_t desc)
 }
 
 #if 1
-static bool in_handler;
+static atomic_t nr_in_handler = ATOMIC_INIT(0);
 
 static inline void set_in_handler(void)
 {
-	in_handler = true;
+	atomic_inc(&nr_in_handler);
 }
 
 static inline void clear_in_handler(void)
 {
-	in_handler = false;
+	atomic_dec(&nr_in_handler);
 }
 
 static int storage_self_monitor(void *unused)
@@ -142,7 +154,8 @@ static int storage_self_monitor(void *unused)
 
 	interval_sec = 30;
 	while (1) {
-		pr_info("%s(): in_handler=%d\n", __func__, in_handler);
+		pr_info("%s(): nr_in_handler=%d\n", __func__,
+			atomic_read(&nr_in_handler));
 		print_storage_manager_stats();
 
 		set_current_state(TASK_UNINTERRUPTIBLE);
@@ -175,6 +188,116 @@ static inline int init_self_monitor(void)
 }
 #endif
 
+#ifndef STORAGE_BYPASS_PAGE_CACHE
+struct storage_worker {
+	struct list_head	next;
+	wait_queue_head_t	wait;
+	bool			pending;
+	uintptr_t		desc;
+	void			*msg;
+};
+
+static struct storage_worker storage_workers[NR_STORAGE_WORKERS];
+
+/* Workers waiting for a request, linked by next */
+static LIST_HEAD(idle_workers);
+static DEFINE_SPINLOCK(idle_workers_lock);
+static DECLARE_WAIT_QUEUE_HEAD(idle_workers_wait);
+
+static struct storage_worker *get_idle_worker(void)
+{
+	struct storage_worker *w = NULL;
+
+	spin_lock(&idle_workers_lock);
+	if (!list_empty(&idle_workers)) {
+		w = list_first_entry(&idle_workers, struct storage_worker, next);
+		list_del(&w->next);
+	}
+	spin_unlock(&idle_workers_lock);
+	return w;
+}
+
+static void put_idle_worker(struct storage_worker *w)
+{
+	spin_lock(&idle_workers_lock);
+	list_add(&w->next, &idle_workers);
+	spin_unlock(&idle_workers_lock);
+
+	wake_up(&idle_workers_wait);
+}
+
+static int storage_worker(void *_w)
+{
+	struct storage_worker *w = _w;
+
+	while (1) {
+		/* Pairs with the release in storage_receiver() */
+		wait_event(w->wait, smp_load_acquire(&w->pending));
+
+		set_in_handler();
+		storage_dispatch(w->msg, w->desc);
+		clear_in_handler();
+
+		WRITE_ONCE(w->pending, false);
+		put_idle_worker(w);
+	}
+	return 0;
+}
+
+/* The only thread receiving from the port */
+static int storage_receiver(void *unused)
+{
+	struct storage_worker *w;
+	int retlen, reply;
+
+	while (1) {
+		wait_event(idle_workers_wait, (w = get_idle_worker()));
+
+		retlen = ibapi_receive_message(0, w->msg, MAX_RXBUF_SIZE, &w->desc);
+		if (unlikely(retlen >= MAX_RXBUF_SIZE)) {
+			WARN(1, "retlen=%d MAX_RETBUF_SIZE=%lu", retlen, MAX_RXBUF_SIZE);
+			reply = -EFAULT;
+			ibapi_reply_message(&reply, sizeof(reply), w->desc);
+			put_idle_worker(w);
+			continue;
+		}
+
+		smp_store_release(&w->pending, true);
+		wake_up(&w->wait);
+	}
+	return 0;
+}
+
+static int init_storage_workers(void)
+{
+	struct storage_worker *w;
+	struct task_struct *tsk;
+	int i;
+
+	for (i = 0; i < NR_STORAGE_WORKERS; i++) {
+		w = &storage_workers[i];
+		init_waitqueue_head(&w->wait);
+		w->pending = false;
+		w->msg = kmalloc(MAX_RXBUF_SIZE, GFP_KERNEL);
+		if (!w->msg)
+			return -ENOMEM;
+
+		tsk = kthread_run(storage_worker, w, "lego-storaged/%d", i);
+		if (IS_ERR(tsk)) {
+			pr_err("ERROR: Fail to create lego-storaged/%d\n", i);
+			return PTR_ERR(tsk);
+		}
+		put_idle_worker(w);
+	}
+
+	tsk = kthread_run(storage_receiver, NULL, "lego-storaged");
+	if (IS_ERR(tsk)) {
+		pr_err("ERROR: Fail to create lego-storaged\n");
+		return PTR_ERR(tsk);
+	}
+	return 0;
+}
+#else
 static int storage_manager(void *unused)
 {
 	int retlen, reply;
@@ -202,6 +325,7 @@ static int storage_manager(void *unused)
 	}
 	return 0;
 }
+#endif /* STORAGE_BYPASS_PAGE_CACHE */
 
 /*
  * If STORAGE_BYPASS_PAGE_CACHE is enabled, we need to have the user
@@ -214,13 +338,9 @@ static int __init init_storage_server(void)
 {
 	int ret = 0;
 #ifndef STORAGE_BYPASS_PAGE_CACHE
-	struct task_struct *tsk;
-
-	tsk = kthread_run(storage_manager, NULL, "lego-storaged");
-	if (IS_ERR(tsk)) {
-		pr_err("ERROR: Fail to create lego_storaged\n");
-		return PTR_ERR(tsk);
-	}
+	ret = init_storage_workers();
+	if (ret)
+		return ret;
 #else
 	unsigned long populate;
 	ubuf = (char __user *)do_mmap_pgoff(NULL, 0, MAX_RXBUF_SIZE,
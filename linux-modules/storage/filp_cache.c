@@ -0,0 +1,219 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Open file cache
+ *
+ * M2S_READ and M2S_WRITE name the file by path, and used to pay for a
+ * full path lookup, filp_open() and filp_close() each time. Instead,
+ * opened files are kept in a small LRU cache keyed by path and flags.
+ *
+ * The cache holds one reference of each file. A user takes its own with
+ * get_file() and drops it with filp_cache_put(), thus a file evicted or
+ * invalidated meanwhile stays valid until the last user is done.
+ *
+ * Unlink, rename and truncate invalidate all cached files at or below
+ * their path once done. A lookup that missed and raced with them does
+ * not insert its file, which may be stale, see filp_cache_gen.
+ */
+
+#include <linux/fs.h>
+#include <linux/file.h>
+#include <linux/jhash.h>
+#include <linux/slab.h>
+#include <linux/list.h>
+#include <linux/spinlock.h>
+#include <linux/hashtable.h>
+
+#include "storage.h"
+#include "common.h"
+#include "stat.h"
+
+#define FILP_CACHE_HASH_BITS	8
+#define FILP_CACHE_MAX_ENTRIES	256
+
+/* Flags that change the file on open, never cached */
+#define FILP_CACHE_BYPASS_FLAGS	(O_CREAT | O_EXCL | O_TRUNC)
+
+struct filp_cache_entry {
+	struct hlist_node	hlist;
+	struct list_head	lru;
+	u32			hash;
+	int			flags;
+	struct file		*filp;
+	char			name[MAX_FILE_NAME];
+};
+
+static DEFINE_HASHTABLE(filp_cache_ht, FILP_CACHE_HASH_BITS);
+static LIST_HEAD(filp_cache_lru);
+static DEFINE_SPINLOCK(filp_cache_lock);
+static unsigned int nr_filp_cache_entries;
+
+/* Bumped by each invalidation */
+static unsigned long filp_cache_gen;
+
+static inline u32 filp_cache_hash(const char *name, int flags)
+{
+	return jhash(name, strlen(name), flags);
+}
+
+static struct filp_cache_entry *
+__filp_cache_lookup(const char *name, int flags, u32 hash)
+{
+	struct filp_cache_entry *e;
+
+	hash_for_each_possible(filp_cache_ht, e, hlist, hash) {
+		if (e->hash == hash && e->flags == flags &&
+		    !strcmp(e->name, name))
+			return e;
+	}
+	return NULL;
+}
+
+static void __filp_cache_unlink(struct filp_cache_entry *e)
+{
+	hash_del(&e->hlist);
+	list_del(&e->lru);
+	nr_filp_cache_entries--;
+}
+
+static void filp_cache_free(struct filp_cache_entry *e)
+{
+	local_file_close(e->filp);
+	kfree(e);
+}
+
+/*
+ * Return an opened file of @rq, the caller must release it with
+ * filp_cache_put(). Files opened with O_CREAT, O_EXCL or O_TRUNC are
+ * opened and released as usual.
+ */
+struct file *filp_cache_get(request *rq)
+{
+	struct filp_cache_entry *e, *new, *victim = NULL;
+	struct file *filp;
+	unsigned long gen;
+	u32 hash;
+
+	if (rq->flags & FILP_CACHE_BYPASS_FLAGS)
+		return local_file_open(rq);
+
+	hash = filp_cache_hash(rq->fileName, rq->flags);
+
+	spin_lock(&filp_cache_lock);
+	e = __filp_cache_lookup(rq->fileName, rq->flags, hash);
+	if (e) {
+		list_move(&e->lru, &filp_cache_lru);
+		filp = e->filp;
+		get_file(filp);
+		spin_unlock(&filp_cache_lock);
+
+		inc_storage_stat(FILP_CACHE_HIT);
+		return filp;
+	}
+	gen = filp_cache_gen;
+	spin_unlock(&filp_cache_lock);
+
+	inc_storage_stat(FILP_CACHE_MISS);
+
+	filp = local_file_open(rq);
+	if (IS_ERR(filp))
+		return filp;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return filp;
+
+	strlcpy(new->name, rq->fileName, MAX_FILE_NAME);
+	new->hash = hash;
+	new->flags = rq->flags;
+	new->filp = filp;
+	get_file(filp);
+
+	spin_lock(&filp_cache_lock);
+	if (unlikely(gen != filp_cache_gen)) {
+		/* Invalidated meanwhile, @filp may be stale */
+		spin_unlock(&filp_cache_lock);
+		fput(new->filp);
+		kfree(new);
+		return filp;
+	}
+
+	e = __filp_cache_lookup(rq->fileName, rq->flags, hash);
+	if (unlikely(e)) {
+		/* Someone else inserted it meanwhile */
+		spin_unlock(&filp_cache_lock);
+		fput(new->filp);
+		kfree(new);
+		return filp;
+	}
+
+	if (nr_filp_cache_entries >= FILP_CACHE_MAX_ENTRIES) {
+		victim = list_entry(filp_cache_lru.prev,
+				    struct filp_cache_entry, lru);
+		__filp_cache_unlink(victim);
+	}
+
+	hash_add(filp_cache_ht, &new->hlist, hash);
+	list_add(&new->lru, &filp_cache_lru);
+	nr_filp_cache_entries++;
+	spin_unlock(&filp_cache_lock);
+
+	if (victim) {
+		inc_storage_stat(FILP_CACHE_EVICT);
+		filp_cache_free(victim);
+	}
+	return filp;
+}
+
+void filp_cache_put(struct file *filp, request *rq)
+{
+	if (rq->flags & FILP_CACHE_BYPASS_FLAGS)
+		local_file_close(filp);
+	else
+		fput(filp);
+}
+
+/* Is @name @path itself, or anything below it? */
+static inline bool filp_cache_match(const char *name, const char *path,
+				    size_t len)
+{
+	return !strncmp(name, path, len) && (!name[len] || name[len] == '/');
+}
+
+/*
+ * Drop cached files at or below @path.
+ * Called after unlink, rename and truncate of @path.
+ */
+void filp_cache_invalidate(const char *path)
+{
+	struct filp_cache_entry *e;
+	struct hlist_node *tmp;
+	size_t len = strlen(path);
+	LIST_HEAD(list);
+	int bkt;
+
+	spin_lock(&filp_cache_lock);
+	filp_cache_gen++;
+	hash_for_each_safe(filp_cache_ht, bkt, tmp, e, hlist) {
+		if (filp_cache_match(e->name, path, len)) {
+			__filp_cache_unlink(e);
+			list_add(&e->lru, &list);
+		}
+	}
+	spin_unlock(&filp_cache_lock);
+
+	while (!list_empty(&list)) {
+		e = list_first_entry(&list, struct filp_cache_entry, lru);
+		list_del(&e->lru);
+
+		inc_storage_stat(FILP_CACHE_INVALIDATE);
+		filp_cache_free(e);
+	}
+}
@@ -71,14 +71,14 @@ ssize_t handle_read_request(void *payload, uintptr_t desc)
 	} */ /*enable in future*/
 	*retval = 0;
 
-	filp = local_file_open(&rq);
+	filp = filp_cache_get(&rq);
 	if (IS_ERR(filp)){
 		*retval = PTR_ERR(filp);
 		goto out_reply;
 	}
 
 	*retval = local_file_read(filp, (char __user *)readbuf, rq.len, &rq.offset);
-	local_file_close(filp);
+	filp_cache_put(filp, &rq);
 	//yield_access(metadata_entry, user_entry); //enable in future
 	//pr_info("Content in readbuf is [%s]\n", readbuf);
 
@@ -120,13 +120,13 @@ ssize_t handle_write_request(void *payload, uintptr_t desc)
 	}*/ //enable in future
 	retval = 0;
 
-	filp = local_file_open(&rq);
+	filp = filp_cache_get(&rq);
 	if (IS_ERR(filp)){
 		retval = PTR_ERR(filp);
 		goto out_reply;
 	}
 	retval = local_file_write(filp, (const char __user *)writebuf, rq.len, &rq.offset);
-	local_file_close(filp);
+	filp_cache_put(filp, &rq);
 	//yield_access(metadata_entry, user_entry); //enable in future
 
 out_reply:
@@ -215,6 +215,7 @@ retry:
 		lookup_flags |= LOOKUP_REVAL;
 		goto retry;
 	}
+	filp_cache_invalidate(trunc->filename);
 
 reply:
 	ibapi_reply_message(&ret, sizeof(ret), desc);
@@ -227,6 +228,7 @@ long handle_unlink_request(void *payload, uintptr_t desc)
 	long ret;
 
 	ret = do_unlink(unlink->filename);
+	filp_cache_invalidate(unlink->filename);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
 	return ret;
@@ -249,6 +251,7 @@ long handle_rmdir_request(void *payload, uintptr_t desc)
 	long ret;
 
 	ret = do_rmdir(rmdir->filename);
+	filp_cache_invalidate(rmdir->filename);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
 	return ret;
@@ -356,6 +359,8 @@ long handle_rename_request(void *payload, uintptr_t desc)
 	long ret;
 
 	ret = do_rename(__payload->oldname, __payload->newname);
+	filp_cache_invalidate(__payload->oldname);
+	filp_cache_invalidate(__payload->newname);
 
 	ibapi_reply_message(&ret, sizeof(ret), desc);
 	return ret;
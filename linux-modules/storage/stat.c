@@ -29,6 +29,11 @@ static const char *const storage_manager_stat_text[] = {
 	"handle_replica_vma",
 	"handle_replica_read",
 	"handle_replica_write",
+
+	"filp_cache_hit",
+	"filp_cache_miss",
+	"filp_cache_evict",
+	"filp_cache_invalidate",
 };
 
 void print_storage_manager_stats(void)
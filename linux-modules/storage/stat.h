@@ -16,6 +16,11 @@ enum storage_manager_stat_item {
 	HANDLE_REPLICA_READ,
 	HANDLE_REPLICA_WRITE,
 
+	FILP_CACHE_HIT,
+	FILP_CACHE_MISS,
+	FILP_CACHE_EVICT,
+	FILP_CACHE_INVALIDATE,
+
 	NR_STORAGE_MANAGER_STAT_ITEMS,
 };
 
@@ -83,6 +83,11 @@ long do_getdents(const char *pathname, struct linux_dirent *dirent,
 long do_readlink(const char *pathname, char *buf, int bufsiz);
 long do_rename(char *oldname, char *newname);
 
+/* filp_cache.c */
+struct file *filp_cache_get(request *);
+void filp_cache_put(struct file *, request *);
+void filp_cache_invalidate(const char *);
+
 /* handler.c */
 int handle_open_request(void *, uintptr_t);
 ssize_t handle_write_request(void *, uintptr_t);
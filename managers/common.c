@@ -110,6 +110,9 @@ void __init manager_init(void)
 	dump_cpumasks();
 
 	rpc_profile();
+	pcache_alloc_profile();
+	kmalloc_profile();
+	pgcache_lirs_profile();
 
 	/*
 	 * Start running user threads.
@@ -8,12 +8,14 @@
  */
 
 #include <lego/smp.h>
+#include <lego/hash.h>
 #include <lego/slab.h>
 #include <lego/delay.h>
 #include <lego/kernel.h>
 #include <lego/printk.h>
 #include <lego/jiffies.h>
 #include <lego/kthread.h>
+#include <lego/vmstat.h>
 #include <lego/profile.h>
 #include <lego/sysinfo.h>
 #include <lego/memblock.h>
@@ -28,6 +30,8 @@
 #include <memory/loader.h>
 #include <memory/distvm.h>
 #include <memory/replica.h>
+#include <memory/zswap.h>
+#include <memory/zeropool.h>
 #include <memory/thread_pool.h>
 #include <memory/pgcache.h>
 
@@ -122,6 +126,186 @@ alloc_thpool_buffer(void)
 	return tb;
 }
 
+/*
+ * Fast class requests take microseconds and never wait on storage.
+ * Keep them away from those that may. File-backed pcache misses may,
+ * they are moved to the slow class later, see thpool_redirect_slow().
+ */
+static int thpool_request_class(void *msg)
+{
+	switch (to_common_header(msg)->opcode) {
+	case P2M_TEST:
+	case P2M_TEST_NOREPLY:
+	case P2M_PCACHE_MISS:
+	case P2M_PCACHE_MISS_HUGE:
+	case P2M_PCACHE_FLUSH:
+	case P2M_PCACHE_FLUSH_BATCH:
+	case P2M_PCACHE_FLUSH_DELTA:
+	case P2M_PCACHE_ZEROFILL:
+	case P2M_PCACHE_REPLICA:
+		return THPOOL_CLASS_FAST;
+	default:
+		return THPOOL_CLASS_SLOW;
+	}
+}
+
+/* Workers [*first, *first + *nr) serve @class */
+static inline void thpool_class_workers(int class, int *first, int *nr)
+{
+	if (!NR_THPOOL_FAST_WORKERS) {
+		*first = 0;
+		*nr = NR_THPOOL_WORKERS;
+	} else if (class == THPOOL_CLASS_FAST) {
+		*first = 0;
+		*nr = NR_THPOOL_FAST_WORKERS;
+	} else {
+		*first = NR_THPOOL_FAST_WORKERS;
+		*nr = NR_THPOOL_WORKERS - NR_THPOOL_FAST_WORKERS;
+	}
+}
+
+#ifdef CONFIG_THPOOL_WORK_STEALING
+/*
+ * Return true and fill @key if request @msg belongs to a process.
+ * All pcache and mm requests of one process are keyed by (src_nid, tgid),
+ * so they go to the same worker, and its mm stays hot in that core.
+ */
+static bool thpool_route_key(void *msg, u32 *key)
+{
+	struct common_header *hdr = to_common_header(msg);
+	void *payload = to_payload(msg);
+	u32 tgid;
+
+	switch (hdr->opcode) {
+	case P2M_PCACHE_MISS:
+	case P2M_PCACHE_MISS_HUGE:
+		tgid = ((struct p2m_pcache_miss_msg *)msg)->tgid;
+		break;
+	case P2M_PCACHE_FLUSH:
+		tgid = ((struct p2m_flush_msg *)msg)->pid;
+		break;
+	case P2M_PCACHE_FLUSH_BATCH:
+		tgid = ((struct p2m_flush_batch_msg *)msg)->pid;
+		break;
+	case P2M_PCACHE_FLUSH_DELTA:
+		tgid = ((struct p2m_flush_delta_msg *)msg)->pid;
+		break;
+	case P2M_PCACHE_ZEROFILL:
+		tgid = ((struct p2m_zerofill_msg *)msg)->tgid;
+		break;
+	case P2M_MMAP:
+		tgid = ((struct p2m_mmap_struct *)payload)->pid;
+		break;
+	case P2M_MUNMAP:
+		tgid = ((struct p2m_munmap_struct *)payload)->pid;
+		break;
+	case P2M_MREMAP:
+		tgid = ((struct p2m_mremap_struct *)payload)->pid;
+		break;
+	case P2M_MPROTECT:
+		tgid = ((struct p2m_mprotect_struct *)payload)->pid;
+		break;
+	case P2M_BRK:
+		tgid = ((struct p2m_brk_struct *)payload)->pid;
+		break;
+	case P2M_MSYNC:
+		tgid = ((struct p2m_msync_struct *)payload)->pid;
+		break;
+	default:
+		return false;
+	}
+
+	*key = hash_32(((u32)hdr->src_nid << 16) ^ tgid, 32);
+	return true;
+}
+
+/*
+ * Choose a worker of the request class, based on request owner.
+ * Requests without owner go to the least queued worker.
+ */
+static inline struct thpool_worker *
+select_thpool_worker(struct thpool_buffer *r)
+{
+	struct thpool_worker *tw, *best;
+	int i, first, nr_workers, nr, min_nr;
+	unsigned int idx;
+	u32 key;
+
+	thpool_class_workers(r->class, &first, &nr_workers);
+
+	if (thpool_route_key(thpool_buffer_rx(r), &key))
+		return thpool_worker_map + first + key % nr_workers;
+
+	/* Start from a rotating worker, so ties are spread */
+	idx = TW_HEAD++;
+	best = NULL;
+	min_nr = INT_MAX;
+	for (i = 0; i < nr_workers; i++) {
+		tw = thpool_worker_map + first + (idx + i) % nr_workers;
+		nr = READ_ONCE(tw->nr_queued) + READ_ONCE(tw->busy);
+		if (nr < min_nr) {
+			min_nr = nr;
+			best = tw;
+			if (!nr)
+				break;
+		}
+	}
+	return best;
+}
+
+/*
+ * Called by idle worker @w. Take the oldest request from the busiest
+ * worker that can not get to it soon: more than one request queued,
+ * or one queued behind a running handler.
+ *
+ * Reserved fast class workers only steal from each other, so they
+ * never pick up a slow request. Others may steal from anyone.
+ */
+static struct thpool_buffer *steal_thpool_buffer(struct thpool_worker *w)
+{
+	struct thpool_worker *tw, *victim;
+	struct thpool_buffer *b;
+	int i, nr, max_nr, nr_victims;
+
+	if (thpool_worker_id(w) < NR_THPOOL_FAST_WORKERS)
+		nr_victims = NR_THPOOL_FAST_WORKERS;
+	else
+		nr_victims = NR_THPOOL_WORKERS;
+
+	victim = NULL;
+	max_nr = 1;
+	for (i = 0; i < nr_victims; i++) {
+		tw = thpool_worker_map + i;
+		if (tw == w)
+			continue;
+
+		nr = READ_ONCE(tw->nr_queued);
+		if (!nr || (nr == 1 && !READ_ONCE(tw->busy)))
+			continue;
+
+		if (nr + READ_ONCE(tw->busy) > max_nr) {
+			max_nr = nr + READ_ONCE(tw->busy);
+			victim = tw;
+		}
+	}
+
+	if (!victim)
+		return NULL;
+
+	/* Do not wait, the owner or another thief is there */
+	if (!spin_trylock(&victim->lock))
+		return NULL;
+
+	b = NULL;
+	if (!list_empty(&victim->work_head)) {
+		b = __dequeue_head_thpool_worker(victim);
+		inc_thpool_worker_nr_stolen(w);
+	}
+	spin_unlock(&victim->lock);
+
+	return b;
+}
+#else
 /*
  * Choose a worker based on request types
  */
@@ -129,14 +313,22 @@ static inline struct thpool_worker *
 select_thpool_worker(struct thpool_buffer *r)
 {
 	struct thpool_worker *tw;
-	int idx;
+	int idx, first, nr_workers;
+
+	thpool_class_workers(r->class, &first, &nr_workers);
 
-	idx = TW_HEAD % NR_THPOOL_WORKERS;
-	tw = thpool_worker_map + idx;
+	idx = TW_HEAD % nr_workers;
+	tw = thpool_worker_map + first + idx;
 	TW_HEAD++;
 	return tw;
 }
 
+static inline struct thpool_buffer *steal_thpool_buffer(struct thpool_worker *w)
+{
+	return NULL;
+}
+#endif /* CONFIG_THPOOL_WORK_STEALING */
+
 static void thpool_worker_handler(struct thpool_worker *worker,
 				  struct thpool_buffer *buffer)
 {
@@ -177,10 +369,22 @@ static void thpool_worker_handler(struct thpool_worker *worker,
 		inc_mm_stat(HANDLE_PCACHE_MISS);
 		handle_p2m_pcache_miss(msg, buffer);
 		break;
+	case P2M_PCACHE_MISS_HUGE:
+		inc_mm_stat(HANDLE_PCACHE_MISS_HUGE);
+		handle_p2m_pcache_miss_huge(msg, buffer);
+		break;
 	case P2M_PCACHE_FLUSH:
 		inc_mm_stat(HANDLE_PCACHE_FLUSH);
 		handle_p2m_flush_one(msg, buffer);
 		break;
+	case P2M_PCACHE_FLUSH_BATCH:
+		inc_mm_stat(HANDLE_PCACHE_FLUSH_BATCH);
+		handle_p2m_flush_batch(msg, buffer);
+		break;
+	case P2M_PCACHE_FLUSH_DELTA:
+		inc_mm_stat(HANDLE_PCACHE_FLUSH_DELTA);
+		handle_p2m_flush_delta(msg, buffer);
+		break;
 	case P2M_PCACHE_ZEROFILL:
 		handle_p2m_zerofill(msg, buffer);
 		break;
@@ -323,17 +527,106 @@ static void thpool_worker_handler(struct thpool_worker *worker,
 	}
 }
 
+#ifdef CONFIG_THPOOL_PRIORITY_CLASSES
+/*
+ * Whether a pcache miss may wait on storage is only known once its VMA
+ * is found, which the polling thread can not afford. Reserved fast class
+ * workers look it up, and pass file-backed misses to the slow class.
+ */
+static bool thpool_redirect_slow(struct thpool_worker *w, struct thpool_buffer *b)
+{
+	void *msg = thpool_buffer_rx(b);
+
+	if (thpool_worker_id(w) >= NR_THPOOL_FAST_WORKERS ||
+	    to_common_header(msg)->opcode != P2M_PCACHE_MISS)
+		return false;
+
+	if (!pcache_miss_file_backed(msg))
+		return false;
+
+	b->class = THPOOL_CLASS_SLOW;
+	enqueue_tail_thpool_worker(select_thpool_worker(b), b);
+	return true;
+}
+#else
+static inline bool
+thpool_redirect_slow(struct thpool_worker *w, struct thpool_buffer *b)
+{
+	return false;
+}
+#endif
+
 DEFINE_PROFILE_POINT(thpool_worker_handler)
 DEFINE_PROFILE_POINT(thpool_worker_fit_ack_reply)
 
-static int thpool_worker_func(void *_worker)
+/* Handle one dequeued request @b, either ours or stolen */
+static void thpool_worker_run(struct thpool_worker *w, struct thpool_buffer *b)
 {
-	struct thpool_worker *w = _worker;
-	struct thpool_buffer *b;
 	unsigned long queuing_delay;
 	PROFILE_POINT_TIME(thpool_worker_handler)
 	PROFILE_POINT_TIME(thpool_worker_fit_ack_reply)
 
+	if (thpool_redirect_slow(w, b))
+		return;
+
+	/*
+	 * Update queuing stats
+	 *
+	 * HACK!!! The operations below except thpool_worker_handler()
+	 * are for debugging/tracing purpose. The will be compiled
+	 * away if disable CONFIG_COUNTER_THPOOL.
+	 */
+	thpool_buffer_dequeue_time(b);
+	queuing_delay = thpool_buffer_queuing_delay(b);
+	add_thpool_worker_total_queuing(w, queuing_delay);
+	add_thpool_worker_class_queuing(w, b, queuing_delay);
+
+	set_in_handler_thpool_worker(w);
+	set_wip_buffer_thpool_worker(w, b);
+	WRITE_ONCE(w->busy, 1);
+
+	PROFILE_START(thpool_worker_handler);
+
+	/* Invoke the real handler */
+	tb_reset_tx_size(b);
+	tb_reset_private_tx(b);
+	thpool_worker_handler(w, b);
+
+	/*
+	 * Leave this BUG_ON checking to catch
+	 * buggy handlers.
+	 */
+	BUG_ON(!b->tx_size);
+	PROFILE_LEAVE(thpool_worker_handler);
+
+	/*
+	 * Callback to FIT layer to perform the
+	 * last two steps: ACK, and REPLY.
+	 */
+	PROFILE_START(thpool_worker_fit_ack_reply);
+	fit_ack_reply_callback(b);
+	PROFILE_LEAVE(thpool_worker_fit_ack_reply);
+
+	/* The reply is polled to completion, the page can go */
+	if (b->tx_page)
+		put_user_page(b->tx_page);
+
+	WRITE_ONCE(w->busy, 0);
+	clear_wip_buffer_thpool_worker(w);
+	clear_in_handler_thpool_worker(w);
+
+	/* Return buffer to free pool */
+	__ClearThpoolBufferNoreply(b);
+	__ClearThpoolBufferUsed(b);
+
+	inc_thpool_worker_nr_handled(w);
+}
+
+static int thpool_worker_func(void *_worker)
+{
+	struct thpool_worker *w = _worker;
+	struct thpool_buffer *b;
+
 	pin_current_thread();
 	pr_info("thpool: CPU%2d %s worker_id: %d UP\n",
 		smp_processor_id(), current->comm, thpool_worker_id(w));
@@ -357,59 +650,28 @@ static int thpool_worker_func(void *_worker)
 
 	preempt_disable();
 	while (1) {
-		/* Check comments on enqueue */
-		while (!nr_queued_thpool_worker(w))
-			cpu_relax();
+		/*
+		 * Check comments on enqueue.
+		 * While our own queue is empty, help others,
+		 * or prepare pages for anonymous faults and file reads.
+		 */
+		while (!nr_queued_thpool_worker(w)) {
+			b = steal_thpool_buffer(w);
+			if (b)
+				thpool_worker_run(w, b);
+			else if (!anon_prefetch_run_one() &&
+				 !pgcache_readahead_run_one() &&
+				 !zeropool_refill_one())
+				cpu_relax();
+		}
 
 		spin_lock(&w->lock);
 		while (!list_empty(&w->work_head)) {
 			b = __dequeue_head_thpool_worker(w);
 			spin_unlock(&w->lock);
 
-			/*
-			 * Update queuing stats
-			 *
-			 * HACK!!! The operations below except thpool_worker_handler()
-			 * are for debugging/tracing purpose. The will be compiled
-			 * away if disable CONFIG_COUNTER_THPOOL.
-			 */
-			thpool_buffer_dequeue_time(b);
-			queuing_delay = thpool_buffer_queuing_delay(b);
-			add_thpool_worker_total_queuing(w, queuing_delay);
-
-			set_in_handler_thpool_worker(w);
-			set_wip_buffer_thpool_worker(w, b);
-
-			PROFILE_START(thpool_worker_handler);
-
-			/* Invoke the real handler */
-			tb_reset_tx_size(b);
-			tb_reset_private_tx(b);
-			thpool_worker_handler(w, b);
-
-			/*
-			 * Leave this BUG_ON checking to catch
-			 * buggy handlers.
-			 */
-			BUG_ON(!b->tx_size);
-			PROFILE_LEAVE(thpool_worker_handler);
-
-			/*
-			 * Callback to FIT layer to perform the
-			 * last two steps: ACK, and REPLY.
-			 */
-			PROFILE_START(thpool_worker_fit_ack_reply);
-			fit_ack_reply_callback(b);
-			PROFILE_LEAVE(thpool_worker_fit_ack_reply);
-
-			clear_wip_buffer_thpool_worker(w);
-			clear_in_handler_thpool_worker(w);
-
-			/* Return buffer to free pool */
-			__ClearThpoolBufferNoreply(b);
-			__ClearThpoolBufferUsed(b);
-
-			inc_thpool_worker_nr_handled(w);
+			thpool_worker_run(w, b);
+
 			spin_lock(&w->lock);
 		}
 		spin_unlock(&w->lock);
@@ -444,6 +706,7 @@ void thpool_callback(void *fit_ctx, void *fit_imm,
 	 * to it. The worker should do ACK and REPLY.
 	 */
 	thpool_buffer_enqueue_time(b);
+	b->class = thpool_request_class(rx);
 	w = select_thpool_worker(b);
 	enqueue_tail_thpool_worker(w, b);
 	nr_thpool_reqs++;
@@ -456,20 +719,26 @@ void __init thpool_init(void)
 	struct task_struct *p;
 	struct thpool_worker *worker;
 
+	/* Leave at least one worker for the slow class */
+	BUILD_BUG_ON(NR_THPOOL_FAST_WORKERS >= NR_THPOOL_WORKERS);
+
 	TW_HEAD = 0;
 	for (i = 0; i < NR_THPOOL_WORKERS; i++) {
 		worker = &thpool_worker_map[i];
 
 		worker->nr_queued = 0;
+		worker->busy = 0;
 		worker->max_nr_queued = 0;
 		worker->flags = 0;
 		worker->nr_handled = 0;
+		worker->nr_stolen = 0;
 		worker->total_queuing_delay_ns = 0;
 		worker->max_queuing_delay_ns = 0;
 		worker->min_queuing_delay_ns = ULONG_MAX;
 		INIT_LIST_HEAD(&worker->work_head);
 		spin_lock_init(&worker->lock);
 		memset(worker->queuing_stats, 0, sizeof(worker->queuing_stats));
+		memset(worker->class_stats, 0, sizeof(worker->class_stats));
 
 		init_completion(&thpool_init_completion);
 
@@ -494,9 +763,11 @@ void __init memory_component_init(void)
 
 	/* Register exec binary handlers */
 	exec_init();
+	pgcache_init();
 	thpool_init();
 
 	init_memory_flush_thread();
+	zswap_init();
 
 #ifdef CONFIG_VMA_MEMORY_UNITTEST
 	mem_vma_unittest();
@@ -588,6 +859,51 @@ static inline void ht_check_worker(int i, struct thpool_worker *tw, struct hb_ca
 }
 
 #ifdef CONFIG_COUNTER_THPOOL
+static const char *const thpool_class_names[NR_THPOOL_CLASSES] = {
+	[THPOOL_CLASS_FAST]	= "fast",
+	[THPOOL_CLASS_SLOW]	= "slow",
+};
+
+/* Queuing delay of each class, summed over all workers */
+static void print_thpool_class_stats(void)
+{
+	struct thpool_queuing_stat sum;
+	struct thpool_queuing_stat *qs;
+	int class, i, j;
+	u64 p_i, p_re;
+	char p_re_buf[32];
+
+	for (class = 0; class < NR_THPOOL_CLASSES; class++) {
+		memset(&sum, 0, sizeof(sum));
+		for (i = 0; i < NR_THPOOL_WORKERS; i++) {
+			qs = &thpool_worker_map[i].class_stats[class];
+
+			sum.nr += qs->nr;
+			sum.total_ns += qs->total_ns;
+			if (qs->max_ns > sum.max_ns)
+				sum.max_ns = qs->max_ns;
+			for (j = 0; j < QUEUING_STAT_ENTRIES; j++)
+				sum.hist[j] += qs->hist[j];
+		}
+
+		pr_info("    class[%s]\n"
+			"        nr_handled=%lu avg_queuing_ns:%lu max_queuing_ns: %lu\n",
+			thpool_class_names[class], sum.nr,
+			sum.nr ? (sum.total_ns / sum.nr) : 0, sum.max_ns);
+
+		for (j = 0; j < QUEUING_STAT_ENTRIES; j++) {
+			if (!sum.hist[j])
+				continue;
+			p_i = div64_u64_rem(sum.hist[j] * 100UL, sum.nr, &p_re);
+			scnprintf(p_re_buf, 8, "%0Lu", p_re);
+
+			pr_info("        [%3d, %3d)    %Lu.%s%%\n",
+				j * QUEUING_STAT_STRIDE_US, (j + 1) * QUEUING_STAT_STRIDE_US,
+				p_i, p_re_buf);
+		}
+	}
+}
+
 void print_thpool_stats(void)
 {
 
@@ -604,15 +920,15 @@ void print_thpool_stats(void)
 		pr_info("Watchdog:\n"
 			"    worker[%d]\n"
 			"        max_nr_queued=%d current_nr_queued=%d in_handler=%s\n"
-			"        nr_handled=%lu nr_thpool_reqs=%lu\n"
+			"        nr_handled=%lu nr_stolen=%lu nr_thpool_reqs=%lu\n"
 			"        total_queuing_ns: %lu avg_queuing_ns:%lu max_queuing_ns: %lu min_queuing_ns: %lu\n",
 			i, max_queued_thpool_worker(tw), tw->nr_queued, thpool_worker_in_handler(tw) ? "YES" : "NO",
-			tw->nr_handled, nr_thpool_reqs,
+			tw->nr_handled, tw->nr_stolen, nr_thpool_reqs,
 			tw->total_queuing_delay_ns, tw->nr_handled ? (tw->total_queuing_delay_ns / tw->nr_handled) : 0,
 			tw->max_queuing_delay_ns, tw->min_queuing_delay_ns);
 
 		for (j = 0; j < QUEUING_STAT_ENTRIES; j++) {
-			if (!tw->queuing_stats[i])
+			if (!tw->queuing_stats[j])
 				continue;
 			p_i = div64_u64_rem(tw->queuing_stats[j] * 100UL, tw->nr_handled, &p_re);
 			scnprintf(p_re_buf, 8, "%0Lu", p_re);
@@ -624,6 +940,8 @@ void print_thpool_stats(void)
 
 		ht_check_worker(i, tw, &hb_cached_data[i]);
 	}
+
+	print_thpool_class_stats();
 }
 #else
 static void print_thpool_stats(void) { }
@@ -637,5 +955,8 @@ void watchdog_print(void)
 	pr_info("Freeram: %#lx\n", si.freeram);
 	print_thpool_stats();
 	print_memory_manager_stats();
+	print_zeropool_stats();
+	print_zswap_stats();
+	print_vm_events();
 	print_profile_points();
 }
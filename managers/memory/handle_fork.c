@@ -375,6 +375,8 @@ void handle_m2m_fork(struct m2m_fork_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(parent->mm);
+
 	down_write(&child->mm->mmap_sem);
 
 	/* task struct is prepared, start duplication */
@@ -382,6 +384,7 @@ void handle_m2m_fork(struct m2m_fork_struct *payload,
 	WARN_ON(reply->ret);
 
 	up_write(&child->mm->mmap_sem);
+	vma_seq_write_end(parent->mm);
 	up_write(&parent->mm->mmap_sem);
 
 	/* everything is fine, update datasize needs to be sent to homenode */
@@ -404,6 +407,8 @@ static int dup_lego_mmap(struct lego_mm_struct *mm,
 	if (down_write_killable(&oldmm->mmap_sem))
 		return -EINTR;
 
+	vma_seq_write_begin(oldmm);
+
 	down_write(&mm->mmap_sem);
 
 	mm->total_vm = oldmm->total_vm;
@@ -452,6 +457,7 @@ static int dup_lego_mmap(struct lego_mm_struct *mm,
 
 out:
 	up_write(&mm->mmap_sem);
+	vma_seq_write_end(oldmm);
 	up_write(&oldmm->mmap_sem);
 
 	return ret;
@@ -474,6 +480,8 @@ static int dup_lego_mmap(struct lego_mm_struct *mm,
 	if (down_write_killable(&oldmm->mmap_sem))
 		return -EINTR;
 
+	vma_seq_write_begin(oldmm);
+
 	down_write(&mm->mmap_sem);
 
 	mm->total_vm = oldmm->total_vm;
@@ -545,6 +553,7 @@ static int dup_lego_mmap(struct lego_mm_struct *mm,
 	ret = 0;
 out:
 	up_write(&mm->mmap_sem);
+	vma_seq_write_end(oldmm);
 	up_write(&oldmm->mmap_sem);
 	return ret;
 }
@@ -79,6 +79,8 @@ void handle_p2m_brk(struct p2m_brk_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	min_brk = mm->start_brk;
 	if (brk < min_brk)
 		goto out;
@@ -114,6 +116,7 @@ set_brk:
 		lego_mm_populate(mm, oldbrk, newbrk - oldbrk);
 
 out:
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	reply->ret_brk = mm->brk;
@@ -178,10 +181,13 @@ void handle_p2m_mmap(struct p2m_mmap_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(tsk->mm);
+
 	load_reply_buffer(tsk->mm, &(reply->map));
 	ret = distvm_mmap_homenode(tsk->mm, file, addr, len, prot, flags, pgoff);
 	remove_reply_buffer(tsk->mm);
 
+	vma_seq_write_end(tsk->mm);
 	up_write(&tsk->mm->mmap_sem);
 #else
 	ret = vm_mmap_pgoff(tsk, file, addr, len, prot, flags, pgoff);
@@ -234,6 +240,8 @@ void handle_p2m_munmap(struct p2m_munmap_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 #ifdef CONFIG_DISTRIBUTED_VMA_MEMORY
 	load_reply_buffer(tsk->mm, &reply->map);
 	reply->ret = distvm_munmap_homenode(mm, addr, len);
@@ -241,6 +249,7 @@ void handle_p2m_munmap(struct p2m_munmap_struct *payload,
 #else
 	reply->ret = do_munmap(mm, addr, len);
 #endif
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	replicate_vma(tsk, REPLICATE_MUNMAP, addr, len, 0, 0);
@@ -453,6 +462,8 @@ void handle_p2m_mremap(struct p2m_mremap_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(tsk->mm);
+
 	load_reply_buffer(tsk->mm, &reply->map);
 	reply->new_addr = distvm_mremap_homenode(tsk->mm, old_addr, old_len,
 						new_len, flags, new_addr);
@@ -464,6 +475,7 @@ void handle_p2m_mremap(struct p2m_mremap_struct *payload,
 	}
 	reply->status = 0;
 
+	vma_seq_write_end(tsk->mm);
 	up_write(&tsk->mm->mmap_sem);
 
 out:
@@ -592,6 +604,8 @@ void handle_p2m_mremap(struct p2m_mremap_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(tsk->mm);
+
 	if (flags & MREMAP_FIXED) {
 		mremap_to(old_addr, old_len, new_addr, new_len, tsk, reply);
 		goto out;
@@ -679,6 +693,7 @@ void handle_p2m_mremap(struct p2m_mremap_struct *payload,
 	}
 
 out:
+	vma_seq_write_end(tsk->mm);
 	up_write(&tsk->mm->mmap_sem);
 
 	mmap_debug("status: %s, new_addr: %#Lx, line: %u",
@@ -729,6 +744,8 @@ void handle_p2m_brk(struct p2m_brk_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	load_reply_buffer(mm, &reply->map);
 
 	min_brk = mm->start_brk;
@@ -767,6 +784,7 @@ set_brk:
 
 out:
 	remove_reply_buffer(mm);
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 #ifdef CONFIG_DEBUG_VMA
@@ -857,10 +875,13 @@ void handle_m2m_mmap(struct m2m_mmap_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(tsk->mm);
+
 	flags &= ~(MAP_EXECUTABLE | MAP_DENYWRITE);
 	reply->addr = do_dist_mmap(tsk->mm, file, LEGO_LOCAL_NID, new_range, addr, len,
 				  prot, flags, vm_flags, pgoff, &reply->max_gap);
 
+	vma_seq_write_end(tsk->mm);
 	up_write(&tsk->mm->mmap_sem);
 
 	debug_dump_vm_all(tsk->mm, 0);
@@ -897,7 +918,10 @@ void handle_m2m_munmap(struct m2m_munmap_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	reply->status = distvm_munmap(mm, begin, len, &reply->max_gap);
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	mmap_debug("%s, reply status: %x, max_gap: %lx\n",
@@ -937,12 +961,15 @@ void handle_m2m_findvma(struct m2m_findvma_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	reply->vma_exist = 0;
 	root = mm->vmrange_map[last_vmr_idx(end)];
 	load_vma_context(mm, root);
 	if (find_vma_intersection(mm, begin, end))
 		reply->vma_exist = 1;
 	save_vma_context(mm, root);
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	debug_dump_vm_all(tsk->mm, 0);
@@ -980,9 +1007,12 @@ void handle_m2m_mremap_grow(struct m2m_mremap_grow_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	reply->status = distvm_mremap_grow(tsk, addr, old_len, new_len);
 	reply->max_gap = mm->vmrange_map[vmr_idx(addr)]->max_gap;
 
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	debug_dump_vm_all(tsk->mm, 0);
@@ -1024,9 +1054,12 @@ void handle_m2m_mremap_move(struct m2m_mremap_move_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	reply->new_addr = do_dist_mremap_move(mm, LEGO_LOCAL_NID, old_addr, old_len,
 					new_len, new_range, &reply->old_max_gap,
 					&reply->new_max_gap);
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	debug_dump_vm_all(tsk->mm, 0);
@@ -1068,10 +1101,13 @@ void handle_m2m_mremap_move_split(struct m2m_mremap_move_split_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	reply->new_addr = do_dist_mremap_move_split(mm, old_addr, old_len,
 				new_addr, new_len, &reply->old_max_gap,
 				&reply->new_max_gap);
 
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	debug_dump_vm_all(tsk->mm, 0);
@@ -1111,9 +1147,12 @@ void handle_m2m_validate(struct m2m_validate_struct *payload,
 		return;
 	}
 
+	vma_seq_write_begin(mm);
+
 	mmap_brk_validate_local(mm, addr, len);
 	*reply = 0;
 
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 	debug_dump_vm_all(tsk->mm, 0);
 }
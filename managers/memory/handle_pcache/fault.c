@@ -21,7 +21,9 @@
 #include <lego/comp_storage.h>
 #include <memory/vm.h>
 #include <memory/pid.h>
+#include <memory/stat.h>
 #include <memory/thread_pool.h>
+#include <memory/huge_memory.h>
 #include <processor/pcache.h>
 
 #include "internal.h"
@@ -78,6 +80,64 @@ static void pcache_miss_error(u32 retval, struct lego_task_struct *p,
  */
 DEFINE_PROFILE_POINT(pcache_miss_find_vma)
 
+#ifdef CONFIG_MEM_SPECULATIVE_MISS
+/*
+ * Serve a miss on an already mapped page without mmap_sem.
+ * Any mmap_sem writer in between makes us fall back to the locked path.
+ * Return 0 on success.
+ */
+static int speculative_handle_p2m_miss(struct lego_task_struct *p,
+				       u64 vaddr, u32 flags,
+				       unsigned long *new_page)
+{
+	struct lego_mm_struct *mm = p->mm;
+	unsigned long vm_start;
+	unsigned int seq;
+	bool anon;
+	int ret;
+	PROFILE_POINT_TIME(pcache_miss_find_vma)
+
+	seq = speculative_walk_begin(mm);
+
+	PROFILE_START(pcache_miss_find_vma);
+	ret = find_vma_speculative(mm, vaddr, seq, &vm_start, &anon);
+	PROFILE_LEAVE(pcache_miss_find_vma);
+	if (!ret)
+		ret = lego_speculative_mm_fault(mm, vaddr, flags, new_page);
+	if (!ret && !get_page_unless_zero(virt_to_page(*new_page)))
+		ret = -EAGAIN;
+
+	speculative_walk_end(mm);
+	if (ret)
+		goto fail;
+	if (read_seqcount_retry(&mm->vma_seq, seq)) {
+		put_user_page(*new_page);
+		goto fail;
+	}
+
+	/*
+	 * The VMA may be gone already. The stream only records a copy
+	 * of vm_start, and the prefetch worker looks the VMA up again
+	 * under mmap_sem.
+	 */
+	if (anon)
+		anon_prefetch_train(p, vm_start, vaddr, flags);
+	inc_mm_stat(SPECULATIVE_MISS);
+	return 0;
+
+fail:
+	inc_mm_stat(SPECULATIVE_MISS_FAIL);
+	return -EAGAIN;
+}
+#else
+static inline int speculative_handle_p2m_miss(struct lego_task_struct *p,
+					      u64 vaddr, u32 flags,
+					      unsigned long *new_page)
+{
+	return -EAGAIN;
+}
+#endif
+
 static int common_handle_p2m_miss(struct lego_task_struct *p,
 				  u64 vaddr, u32 flags, unsigned long *new_page)
 {
@@ -86,14 +146,19 @@ static int common_handle_p2m_miss(struct lego_task_struct *p,
 	int ret;
 	PROFILE_POINT_TIME(pcache_miss_find_vma)
 
+	/* Zerofill always allocates, do not bother */
+	if (new_page && !speculative_handle_p2m_miss(p, vaddr, flags, new_page))
+		return 0;
+
 	down_read(&mm->mmap_sem);
 
 	PROFILE_START(pcache_miss_find_vma);
-	vma = find_vma(mm, vaddr);
+	vma = find_vma_cached(mm, vaddr);
 	PROFILE_LEAVE(pcache_miss_find_vma);
 
 	if (unlikely(!vma)) {
-		pr_info("fail to find vma\n");
+		if (!(flags & FAULT_FLAG_PREFETCH))
+			pr_info("fail to find vma\n");
 		ret = VM_FAULT_SIGSEGV;
 		goto unlock;
 	}
@@ -102,6 +167,12 @@ static int common_handle_p2m_miss(struct lego_task_struct *p,
 	if (likely(vma->vm_start <= vaddr))
 		goto good_area;
 
+	/* Speculative access must not grow the stack */
+	if (unlikely(flags & FAULT_FLAG_PREFETCH)) {
+		ret = VM_FAULT_SIGSEGV;
+		goto unlock;
+	}
+
 	/* stack? */
 	if (unlikely(!(vma->vm_flags & VM_GROWSDOWN))) {
 		pr_info("not a stack\n");
@@ -123,6 +194,10 @@ static int common_handle_p2m_miss(struct lego_task_struct *p,
 	 */
 good_area:
 	ret = handle_lego_mm_fault(vma, vaddr, flags, new_page, NULL);
+	if (likely(!ret) && new_page)
+		get_page(virt_to_page(*new_page));
+	if (likely(!ret) && vma_is_anonymous(vma))
+		anon_prefetch_train(p, vma->vm_start, vaddr, flags);
 unlock:
 	up_read(&mm->mmap_sem);
 	return ret;
@@ -157,6 +232,16 @@ static void do_handle_p2m_pcache_miss(struct lego_task_struct *p,
 		else if (ret & (VM_FAULT_SIGBUS | VM_FAULT_SIGSEGV))
 			ret = RET_ESIGSEGV;
 
+		/*
+		 * Processor prefetched beyond the VMA,
+		 * which is expected. Just report quietly.
+		 */
+		if (flags & FAULT_FLAG_PREFETCH) {
+			*(int *)thpool_buffer_tx(tb) = ret;
+			tb_set_tx_size(tb, sizeof(int));
+			return;
+		}
+
 		pcache_miss_error(ret, p, vaddr, tb);
 		return;
 	}
@@ -165,7 +250,7 @@ static void do_handle_p2m_pcache_miss(struct lego_task_struct *p,
 	 * For normal pcache miss, we do not use the tx.
 	 * We simply use the page itself (use private_tx).
 	 */
-	tb_set_private_tx(tb, (void *)new_page);
+	tb_set_private_tx_page(tb, new_page);
 	tb_set_tx_size(tb, PCACHE_LINE_SIZE);
 }
 
@@ -192,10 +277,11 @@ void handle_p2m_flush_one(struct p2m_flush_msg *msg, struct thpool_buffer *tb)
 	}
 
 	down_read(&p->mm->mmap_sem);
-	ret = get_user_pages(p, msg->user_va, 1, 0, &dst_page, NULL);
+	ret = get_user_pages(p, msg->user_va, 1, FOLL_GET, &dst_page, NULL);
 	up_read(&p->mm->mmap_sem);
 	if (likely(ret == 1)) {
 		memcpy((void *)dst_page, msg->pcacheline, PCACHE_LINE_SIZE);
+		put_user_page(dst_page);
 		reply = 0;
 	} else
 		reply = -EFAULT;
@@ -206,6 +292,99 @@ out:
 	PROFILE_LEAVE(handle_flush);
 }
 
+DEFINE_PROFILE_POINT(handle_flush_batch)
+
+/*
+ * Same as handle_p2m_flush_one(), but task lookup and mmap_sem
+ * are paid once for the whole batch.
+ */
+void handle_p2m_flush_batch(struct p2m_flush_batch_msg *msg, struct thpool_buffer *tb)
+{
+	unsigned long dst_page;
+	int reply, src_nid, ret, i;
+	struct lego_task_struct *p;
+	char *line;
+	PROFILE_POINT_TIME(handle_flush_batch)
+
+	PROFILE_START(handle_flush_batch);
+
+	if (unlikely(msg->nr_lines > P2M_FLUSH_BATCH_MAX_LINES)) {
+		reply = -EINVAL;
+		goto out;
+	}
+
+	src_nid = to_common_header(msg)->src_nid;
+	p = find_lego_task_by_pid(src_nid, msg->pid);
+	if (unlikely(!p)) {
+		reply = -ESRCH;
+		goto out;
+	}
+
+	reply = 0;
+	line = msg->pcachelines;
+
+	down_read(&p->mm->mmap_sem);
+	for (i = 0; i < msg->nr_lines; i++, line += PCACHE_LINE_SIZE) {
+		ret = get_user_pages(p, msg->user_va[i], 1, 0, &dst_page, NULL);
+		if (likely(ret == 1)) {
+			memcpy((void *)dst_page, line, PCACHE_LINE_SIZE);
+			reply++;
+		}
+	}
+	up_read(&p->mm->mmap_sem);
+
+	if (unlikely(!reply && msg->nr_lines))
+		reply = -EFAULT;
+
+out:
+	*(int *)thpool_buffer_tx(tb) = reply;
+	tb_set_tx_size(tb, sizeof(int));
+	PROFILE_LEAVE(handle_flush_batch);
+}
+
+/*
+ * Patch the modified chunks of one line in place.
+ * Everything else in the page is left as is.
+ */
+void handle_p2m_flush_delta(struct p2m_flush_delta_msg *msg, struct thpool_buffer *tb)
+{
+	unsigned long dst_page;
+	int reply, src_nid, ret, i;
+	struct lego_task_struct *p;
+	char *chunk;
+
+	src_nid = to_common_header(msg)->src_nid;
+	p = find_lego_task_by_pid(src_nid, msg->pid);
+	if (unlikely(!p)) {
+		reply = -ESRCH;
+		goto out;
+	}
+
+	down_read(&p->mm->mmap_sem);
+	ret = get_user_pages(p, msg->user_va, 1, FOLL_GET, &dst_page, NULL);
+	up_read(&p->mm->mmap_sem);
+	if (unlikely(ret != 1)) {
+		reply = -EFAULT;
+		goto out;
+	}
+
+	chunk = msg->chunks;
+	for (i = 0; i < P2M_FLUSH_DELTA_NR_CHUNKS; i++) {
+		if (!(msg->dirty_chunks & (1ULL << i)))
+			continue;
+
+		memcpy((void *)(dst_page + i * P2M_FLUSH_DELTA_CHUNK_SIZE),
+		       chunk, P2M_FLUSH_DELTA_CHUNK_SIZE);
+		chunk += P2M_FLUSH_DELTA_CHUNK_SIZE;
+	}
+	put_user_page(dst_page);
+	reply = 0;
+
+out:
+	*(int *)thpool_buffer_tx(tb) = reply;
+	tb_set_tx_size(tb, sizeof(int));
+}
+
 /*
  * Processor counterpart: __pcache_do_fill_page().
  * Check how we fill the information.
@@ -230,12 +409,14 @@ static void do_piggyback_flush(void *_msg, unsigned int src_nid,
 	}
 
 	down_read(&flush_task->mm->mmap_sem);
-	ret = get_user_pages(flush_task, flush_msg->user_va, 1, 0, &dst_page, NULL);
+	ret = get_user_pages(flush_task, flush_msg->user_va, 1, FOLL_GET,
+			     &dst_page, NULL);
 	up_read(&flush_task->mm->mmap_sem);
 
-	if (likely(ret == 1))
+	if (likely(ret == 1)) {
 		memcpy((void *)dst_page, flush_msg->pcacheline, PCACHE_LINE_SIZE);
-	else
+		put_user_page(dst_page);
+	} else
 		WARN_ON_ONCE(1);
 }
 
@@ -244,6 +425,31 @@ static int fault_in_kernel_space(unsigned long address)
 	return address >= TASK_SIZE_MAX;
 }
 
+/*
+ * Does miss @msg fall into a file-backed VMA? Filling it may have to
+ * wait on storage. Lookup only, nothing is faulted in.
+ */
+bool pcache_miss_file_backed(struct p2m_pcache_miss_msg *msg)
+{
+	struct lego_task_struct *p;
+	struct vm_area_struct *vma;
+	struct lego_mm_struct *mm;
+	u64 vaddr = msg->missing_vaddr;
+	bool ret;
+
+	p = find_lego_task_by_pid(to_common_header(msg)->src_nid, msg->tgid);
+	if (unlikely(!p || !p->mm))
+		return false;
+
+	mm = p->mm;
+	down_read(&mm->mmap_sem);
+	vma = find_vma_cached(mm, vaddr);
+	ret = vma && vma->vm_start <= vaddr && !vma_is_anonymous(vma);
+	up_read(&mm->mmap_sem);
+
+	return ret;
+}
+
 DEFINE_PROFILE_POINT(handle_miss)
 
 void handle_p2m_pcache_miss(struct p2m_pcache_miss_msg *msg,
@@ -285,6 +491,92 @@ void handle_p2m_pcache_miss(struct p2m_pcache_miss_msg *msg,
 		src_nid, msg->pid, tgid, flags, vaddr);
 }
 
+DEFINE_PROFILE_POINT(handle_miss_huge)
+
+/*
+ * Processor counterpart: pcache_do_fill_huge().
+ *
+ * Reply the whole 2MB region around missing_vaddr. Pages are gathered
+ * into the tx buffer, so the region goes out in one RDMA transfer.
+ * If the region is backed by a 2MB page, it is sent in place.
+ * The region must be covered by a single VMA, processor has no VMA
+ * and relies on us to tell. If it is not, processor falls back to
+ * normal lines, so just report quietly.
+ */
+void handle_p2m_pcache_miss_huge(struct p2m_pcache_miss_msg *msg,
+				 struct thpool_buffer *tb)
+{
+	struct vm_area_struct *vma;
+	struct lego_task_struct *p;
+	struct lego_mm_struct *mm;
+	unsigned long base, address, new_page;
+	unsigned int src_nid;
+	void *tx = thpool_buffer_tx(tb);
+	int ret;
+	PROFILE_POINT_TIME(handle_miss_huge)
+
+	src_nid = to_common_header(msg)->src_nid;
+	base = msg->missing_vaddr & PMD_MASK;
+
+	p = find_lego_task_by_pid(src_nid, msg->tgid);
+	if (unlikely(!p)) {
+		ret = RET_ESRCH;
+		goto error;
+	}
+
+	if (unlikely(fault_in_kernel_space(base))) {
+		ret = RET_EFAULT;
+		goto error;
+	}
+
+	PROFILE_START(handle_miss_huge);
+	mm = p->mm;
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, base);
+	if (unlikely(!vma || vma->vm_start > base ||
+		     vma->vm_end < base + PMD_SIZE)) {
+		ret = RET_ESIGSEGV;
+		goto unlock;
+	}
+
+	ret = handle_lego_mm_fault(vma, base, msg->flags, &new_page, NULL);
+	if (unlikely(ret & VM_FAULT_ERROR)) {
+		ret = (ret & VM_FAULT_OOM) ? RET_ENOMEM : RET_ESIGSEGV;
+		goto unlock;
+	}
+
+	new_page = lego_find_huge_page(mm, base);
+	if (new_page) {
+		up_read(&mm->mmap_sem);
+		PROFILE_LEAVE(handle_miss_huge);
+
+		tb_set_private_tx(tb, (void *)new_page);
+		tb_set_tx_size(tb, PMD_SIZE);
+		return;
+	}
+
+	for (address = base; address < base + PMD_SIZE; address += PAGE_SIZE) {
+		ret = handle_lego_mm_fault(vma, address, msg->flags, &new_page, NULL);
+		if (unlikely(ret & VM_FAULT_ERROR)) {
+			ret = (ret & VM_FAULT_OOM) ? RET_ENOMEM : RET_ESIGSEGV;
+			goto unlock;
+		}
+		memcpy(tx + (address - base), (void *)new_page, PAGE_SIZE);
+	}
+	up_read(&mm->mmap_sem);
+	PROFILE_LEAVE(handle_miss_huge);
+
+	tb_set_tx_size(tb, PMD_SIZE);
+	return;
+
+unlock:
+	up_read(&mm->mmap_sem);
+	PROFILE_LEAVE(handle_miss_huge);
+error:
+	*(int *)tx = ret;
+	tb_set_tx_size(tb, sizeof(int));
+}
+
 void handle_p2m_zerofill(struct p2m_zerofill_msg *msg,
 			 struct thpool_buffer *tb)
 {
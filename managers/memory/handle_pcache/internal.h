@@ -17,4 +17,13 @@
 void do_mmap_prefetch(struct lego_task_struct *p, u64 vaddr,
 		      u32 flags, u32 nr_pages);
 
+#ifdef CONFIG_MEM_ANON_PREFETCH
+void anon_prefetch_train(struct lego_task_struct *p, unsigned long vm_start,
+			 unsigned long address, u32 flags);
+#else
+static inline void anon_prefetch_train(struct lego_task_struct *p,
+				       unsigned long vm_start,
+				       unsigned long address, u32 flags) { }
+#endif
+
 #endif /* _MEMORY_PCACHE_INTERNAL_H_ */
@@ -7,14 +7,19 @@
  * (at your option) any later version.
  */
 
+#include <lego/smp.h>
+#include <lego/percpu.h>
 #include <lego/fit_ibapi.h>
 #include <lego/ratelimit.h>
 #include <lego/comp_memory.h>
 #include <lego/comp_storage.h>
 #include <memory/vm.h>
 #include <memory/pid.h>
+#include <memory/stat.h>
 #include <processor/pcache.h>
 
+#include "internal.h"
+
 #ifdef CONFIG_MEM_PREFETCH
 void do_mmap_prefetch(struct lego_task_struct *p, u64 vaddr,
 		      u32 flags, u32 nr_pages)
@@ -56,3 +61,243 @@ void do_mmap_prefetch(struct lego_task_struct *p, u64 vaddr,
 		      u32 flags, u32 nr_pages)
 { }
 #endif /* CONFIG_MEM_PREFETCH */
+
+#ifdef CONFIG_MEM_ANON_PREFETCH
+/*
+ * Anonymous prefetch
+ *
+ * Each mm keeps a few miss streams, each within one anonymous VMA.
+ * Demand misses train them: once the same stride repeats, a window of
+ * pages ahead of the stream is queued. The window is doubled each time
+ * the stream catches up with it, and halved if the pattern breaks.
+ *
+ * Windows are not populated by the handler, which would delay the reply.
+ * They are queued per-CPU, and populated by the worker once it is idle.
+ * The coming misses then find the pages mapped, and skip allocation,
+ * zeroing and page table setup.
+ *
+ * Accuracy is anon_prefetch_useful / anon_prefetch_pages, and coverage is
+ * anon_prefetch_useful / anon_prefetch_miss. Useful is counted when a miss
+ * lands within the last window of its stream, thus it is approximate.
+ */
+
+#define ANON_PREFETCH_MAX_DEPTH		CONFIG_MEM_ANON_PREFETCH_MAX_PAGES
+#define ANON_PREFETCH_INIT_DEPTH	2
+#define ANON_PREFETCH_TRAIN_HITS	2
+#define ANON_PREFETCH_MAX_STRIDE	(64 * PAGE_SIZE)
+#define ANON_PREFETCH_NR_PENDING	8
+
+struct anon_prefetch_req {
+	unsigned int		node;
+	unsigned int		pid;
+	unsigned long		vm_start;
+	unsigned long		address;
+	long			stride;
+	unsigned int		nr_pages;
+};
+
+struct anon_prefetch_queue {
+	unsigned int		head;
+	unsigned int		tail;
+	struct anon_prefetch_req reqs[ANON_PREFETCH_NR_PENDING];
+};
+
+static DEFINE_PER_CPU(struct anon_prefetch_queue, anon_prefetch_queues);
+
+static struct anon_prefetch_stream *
+anon_prefetch_find_stream(struct lego_mm_struct *mm, unsigned long vm_start,
+			  unsigned long address)
+{
+	struct anon_prefetch_stream *s, *lru;
+	long delta;
+	int i;
+
+	for (i = 0; i < ANON_PREFETCH_NR_STREAMS; i++) {
+		s = &mm->anon_streams[i];
+		if (s->vm_start != vm_start || !s->last_addr)
+			continue;
+
+		if (address >= s->win_lo && address < s->win_hi)
+			return s;
+
+		delta = address - s->last_addr;
+		if (abs(delta) <= ANON_PREFETCH_MAX_STRIDE)
+			return s;
+	}
+
+	/* Replace the least recently used one */
+	lru = &mm->anon_streams[0];
+	for (i = 1; i < ANON_PREFETCH_NR_STREAMS; i++) {
+		s = &mm->anon_streams[i];
+		if (s->age < lru->age)
+			lru = s;
+	}
+
+	memset(lru, 0, sizeof(*lru));
+	lru->vm_start = vm_start;
+	lru->last_addr = address;
+	lru->age = ++mm->anon_prefetch_clock;
+	return NULL;
+}
+
+/*
+ * Feed one miss into the streams of @mm.
+ * Return true and fill @req if a window should be populated.
+ */
+static bool __anon_prefetch_train(struct lego_mm_struct *mm,
+				  unsigned long vm_start,
+				  unsigned long address, u32 flags,
+				  struct anon_prefetch_req *req)
+{
+	struct anon_prefetch_stream *s;
+	unsigned long first, last;
+	long delta, remaining;
+	bool ret = false;
+
+	spin_lock(&mm->anon_prefetch_lock);
+	s = anon_prefetch_find_stream(mm, vm_start, address);
+	if (!s)
+		goto out;
+	s->age = ++mm->anon_prefetch_clock;
+
+	if (address >= s->win_lo && address < s->win_hi)
+		inc_mm_stat(ANON_PREFETCH_USEFUL);
+
+	/* Speculative misses from processor do not train */
+	if (flags & FAULT_FLAG_PREFETCH)
+		goto out;
+
+	delta = address - s->last_addr;
+	s->last_addr = address;
+	if (!delta)
+		goto out;
+
+	if (delta != s->stride) {
+		/* Pattern broke, the last window was probably wasted */
+		s->depth /= 2;
+		s->stride = delta;
+		s->hits = 1;
+		s->next_addr = 0;
+		goto out;
+	}
+
+	if (++s->hits < ANON_PREFETCH_TRAIN_HITS)
+		goto out;
+
+	if (!s->depth)
+		s->depth = ANON_PREFETCH_INIT_DEPTH;
+
+	/* First window, or demand caught up with the last one */
+	remaining = s->next_addr ? (long)(s->next_addr - address) / s->stride : 0;
+	if (remaining <= 0)
+		s->next_addr = address + s->stride;
+	else if (remaining > s->depth / 2)
+		goto out;
+
+	req->vm_start = vm_start;
+	req->address = s->next_addr;
+	req->stride = s->stride;
+	req->nr_pages = s->depth;
+
+	first = s->next_addr;
+	last = first + (s->depth - 1) * s->stride;
+	s->win_lo = min(first, last);
+	s->win_hi = max(first, last) + PAGE_SIZE;
+	s->next_addr = first + s->depth * s->stride;
+	s->depth = min(s->depth * 2, (unsigned int)ANON_PREFETCH_MAX_DEPTH);
+	ret = true;
+out:
+	spin_unlock(&mm->anon_prefetch_lock);
+	return ret;
+}
+
+/*
+ * Called after a successful miss on @address, in the anonymous VMA
+ * starting at @vm_start. mmap_sem may not be held, the VMA is not used.
+ */
+void anon_prefetch_train(struct lego_task_struct *p, unsigned long vm_start,
+			 unsigned long address, u32 flags)
+{
+	struct anon_prefetch_queue *q;
+	struct anon_prefetch_req req;
+
+	inc_mm_stat(ANON_PREFETCH_MISS);
+	if (!__anon_prefetch_train(p->mm, vm_start, address & PAGE_MASK, flags, &req))
+		return;
+
+	req.node = p->node;
+	req.pid = p->pid;
+	inc_mm_stat(ANON_PREFETCH_TRIGGER);
+
+	q = &get_cpu_var(anon_prefetch_queues);
+	if (q->tail - q->head < ANON_PREFETCH_NR_PENDING)
+		q->reqs[q->tail++ % ANON_PREFETCH_NR_PENDING] = req;
+	else
+		inc_mm_stat(ANON_PREFETCH_DROP);
+	put_cpu_var(anon_prefetch_queues);
+}
+
+/*
+ * Called by idle thpool workers.
+ * Populate one queued window. Return false if there is nothing to do.
+ */
+bool anon_prefetch_run_one(void)
+{
+	struct anon_prefetch_queue *q;
+	struct anon_prefetch_req req;
+	struct lego_task_struct *p;
+	struct vm_area_struct *vma;
+	struct lego_mm_struct *mm;
+	unsigned long address;
+	unsigned int i;
+	int ret;
+
+	q = &get_cpu_var(anon_prefetch_queues);
+	if (q->head == q->tail) {
+		put_cpu_var(anon_prefetch_queues);
+		return false;
+	}
+	req = q->reqs[q->head++ % ANON_PREFETCH_NR_PENDING];
+	put_cpu_var(anon_prefetch_queues);
+
+	/*
+	 * The process may have exited or unmapped meanwhile.
+	 * Pin its mm, which may go away before the task does.
+	 */
+	p = find_get_lego_task_by_pid(req.node, req.pid);
+	if (unlikely(!p))
+		goto drop;
+	mm = lego_get_task_mm(p);
+	put_lego_task(p);
+	if (unlikely(!mm))
+		goto drop;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, req.address);
+	if (unlikely(!vma || vma->vm_start != req.vm_start ||
+		     !vma_is_anonymous(vma))) {
+		inc_mm_stat(ANON_PREFETCH_DROP);
+		goto unlock;
+	}
+
+	for (i = 0; i < req.nr_pages; i++) {
+		address = req.address + i * req.stride;
+		if (address < vma->vm_start || address >= vma->vm_end)
+			break;
+
+		ret = lego_populate_anon_page(vma, address);
+		if (ret < 0)
+			break;
+		if (ret)
+			inc_mm_stat(ANON_PREFETCH_PAGES);
+	}
+unlock:
+	up_read(&mm->mmap_sem);
+	lego_mmput(mm);
+	return true;
+
+drop:
+	inc_mm_stat(ANON_PREFETCH_DROP);
+	return true;
+}
+#endif /* CONFIG_MEM_ANON_PREFETCH */
@@ -498,6 +498,7 @@ int setup_arg_pages(struct lego_task_struct *tsk, struct lego_binprm *bprm,
 
 	if (down_write_killable(&mm->mmap_sem))
 		return -EINTR;
+	vma_seq_write_begin(mm);
 
 	vm_flags = VM_STACK_FLAGS;
 
@@ -539,6 +540,7 @@ int setup_arg_pages(struct lego_task_struct *tsk, struct lego_binprm *bprm,
 		ret = -EFAULT;
 
 out_unlock:
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 	return ret;
 }
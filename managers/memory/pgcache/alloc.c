@@ -10,23 +10,25 @@
 #include <lego/slab.h>
 #include <memory/pgcache.h>
 
-struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
-		unsigned int storage_node)
+struct lego_pgcache_struct *__alloc_pgcache(struct lego_pgcache_file *file,
+		loff_t pos)
 {
 	struct lego_pgcache_struct *pgc;
 
 	pgc = kmalloc(sizeof(struct lego_pgcache_struct), GFP_KERNEL);
-	if (unlikely(!pgc)) {
-		return ERR_PTR(-ENOMEM);
-	}
+	if (unlikely(!pgc))
+		return NULL;
 
-	strcpy(pgc->filepath, filepath);
+	pgc->file = file;
 	pgc->pos = aligned_pos(pos);
-	pgc->storage_node = storage_node;
+	pgc->storage_node = file->storage_node;
 
 	/* mark new allocated pgcache as empty */
 	pgc->real_len = 0;
 	pgc->dirty = false;
+	pgc->ra_unused = false;
+	pgc->ra_marker = false;
+	pgc->writeback = false;
 
 	INIT_LIST_HEAD(&pgc->dirtylist);
 	INIT_LIST_HEAD(&pgc->stack_s);
@@ -39,7 +41,7 @@ struct lego_pgcache_struct *__alloc_pgcache(char *filepath, loff_t pos,
 			PGCACHE_PREFETCH_ORDER);
 
 	pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",		\
-			pgc, pgc->pos, pgc->cached_pages, pgc->filepath);
+			pgc, pgc->pos, pgc->cached_pages, file->filepath);
 
 	return pgc;
 }
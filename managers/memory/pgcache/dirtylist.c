@@ -10,27 +10,11 @@
 #include <lego/list.h>
 #include <lego/spinlock.h>
 #include <lego/timer.h>
+#include <lego/jiffies.h>
 #include <memory/pgcache.h>
-#include <lego/hashtable.h>
+#include <lego/radixtree.h>
 #include <lego/fit_ibapi.h>
 
-/* lock to protect pgcache dirtylist struct */
-
-static DEFINE_SPINLOCK(hash_dirtylists_lock);
-static DEFINE_HASHTABLE(hash_dirtylists, PGCACHE_HASH_BITS);
-
-static unsigned int get_key(char *str)
-{
-	unsigned int seed = 131;
-	unsigned int hash = 0;
-
-	while (*str) {
-		hash = hash*seed + (*str++);
-	}
-
-	return hash & 0x7fffffff;
-}
-
 struct lego_pgcache_file *lego_pgcache_file_open(char *filepath,
 		unsigned int storage_node)
 {
@@ -43,6 +27,7 @@ struct lego_pgcache_file *lego_pgcache_file_open(char *filepath,
 	}
 
 	strcpy(file->filepath, filepath);
+	seqlock_init(&file->path_lock);
 	file->storage_node = storage_node;
 
 	tmp_file_size = get_file_size_from_storage(filepath, storage_node);
@@ -50,91 +35,41 @@ struct lego_pgcache_file *lego_pgcache_file_open(char *filepath,
 		file->f_size = tmp_file_size;
 
 	INIT_LIST_HEAD(&file->head);
+	INIT_LIST_HEAD(&file->wb_list);
+	atomic_set(&file->nr_writeback, 0);
 	spin_lock_init(&file->dirtylist_lock);
+	spin_lock_init(&file->tree_lock);
+	INIT_RADIX_TREE(&file->chunk_tree, GFP_KERNEL);
+#ifdef CONFIG_MEM_PGCACHE_READAHEAD
+	spin_lock_init(&file->ra_lock);
+#endif
 
 	return file;
 }
 
-int ht_insert_lego_pgcache_file(struct lego_pgcache_file *file)
-{
-	struct lego_pgcache_file *p;
-	unsigned int key;
-
-	BUG_ON(!file || strlen(file->filepath) == 0);
-
-	pgcache_debug("filepath: %s", file->filepath);
-
-	key = get_key(file->filepath);
-
-	spin_lock(&hash_dirtylists_lock);
-	hash_for_each_possible(hash_dirtylists, p, hlink, key) {
-		if (unlikely(strcmp(p->filepath, file->filepath) == 0)) {
-			spin_unlock(&hash_dirtylists_lock);
-			return -EEXIST;
-		}
-	}
-	hash_add(hash_dirtylists, &file->hlink, key);
-	spin_unlock(&hash_dirtylists_lock);
-
-	return 0;
-}
-
-void ht_remove_lego_pgcache_file(struct lego_pgcache_file *file)
-{
-	BUG_ON(!file || strlen(file->filepath) == 0);
-	spin_lock(&hash_dirtylists_lock);
-	hash_del(&file->hlink);
-	spin_unlock(&hash_dirtylists_lock);
-}
-
-// should not be called
-void free_lego_pgcache_file(struct lego_pgcache_file *file)
-{
-	struct lego_pgcache_file *p;
-	unsigned int key;
-
-	BUG_ON(!file || strlen(file->filepath) == 0);
-
-	key = get_key(file->filepath);
-
-	spin_lock(&hash_dirtylists_lock);
-	hash_for_each_possible(hash_dirtylists, p, hlink, key) {
-		if (likely(strcmp(p->filepath, file->filepath) == 0)) {
-
-			hash_del(&p->hlink);
-			kfree(p);
-			spin_unlock(&hash_dirtylists_lock);
-			return;
-		}
-	}
-	spin_unlock(&hash_dirtylists_lock);
-	WARN(1, "Fail to find file->(filepath:%s)\n", file->filepath);
-	return;
-}
-
-struct lego_pgcache_file *find_lego_pgcache_file(char *filepath)
+/*
+ * Return the hashed file struct of @filepath, create one if it was never
+ * accessed before. If someone else creates it meanwhile, use theirs.
+ */
+struct lego_pgcache_file *find_or_open_lego_pgcache_file(char *filepath,
+		unsigned int storage_node)
 {
 	struct lego_pgcache_file *file;
-	unsigned int key;
-
-	if (unlikely(strlen(filepath) == 0))
-		return NULL;
 
-	key = get_key(filepath);
-
-	spin_lock(&hash_dirtylists_lock);
-	hash_for_each_possible(hash_dirtylists, file, hlink, key) {
-		if (likely(strcmp(file->filepath, filepath) == 0)) {
-			spin_unlock(&hash_dirtylists_lock);
+retry:
+	file = find_lego_pgcache_file(filepath);
+	if (likely(file))
+		return file;
 
-			pgcache_debug("file: %p", file);
+	file = lego_pgcache_file_open(filepath, storage_node);
+	if (unlikely(IS_ERR(file)))
+		return file;
 
-			return file;
-		}
+	if (unlikely(ht_insert_lego_pgcache_file(file))) {
+		kfree(file);
+		goto retry;
 	}
-	spin_unlock(&hash_dirtylists_lock);
-
-	return NULL;
+	return file;
 }
 
 void mark_lego_pgcache_dirty(struct lego_pgcache_struct *pgc,
@@ -152,34 +87,34 @@ void mark_lego_pgcache_dirty(struct lego_pgcache_struct *pgc,
 	spin_lock(&file->dirtylist_lock);
 	/* mark as dirty cacheline*/
 	pgc->dirty = true;
-	/* add to dirty list */
+	pgc->dirtied_when = jiffies;
+	/* add to dirty list, oldest at tail */
 	list_add(&pgc->dirtylist, &file->head);
 	pgcache_debug("pgc: %p, head: %p, pgc->next: %p",		\
 			pgc, &file->head, pgc->dirtylist.next);
 
 	spin_unlock(&file->dirtylist_lock);
 
+	pgcache_account_dirty(file);
 	spin_unlock(&pgc->lock);
 	return;
 }
 
 /*
  * make one lego pgcache line clean, flush on dirty
- * should be call on eviction
+ * should be call on eviction, with pgc->lock held,
+ * and the cacheline not under writeback
  */
-void make_lego_pgcache_clean(struct lego_pgcache_struct *pgc)
+void make_lego_pgcache_clean_locked(struct lego_pgcache_struct *pgc)
 {
 	struct lego_pgcache_file *file;
 
-	spin_lock(&pgc->lock);
-	if (!pgc->dirty) {
-		spin_unlock(&pgc->lock);
+	if (!pgc->dirty)
 		return;
-	}
 
-	file = find_lego_pgcache_file(pgc->filepath);
-	BUG_ON(!file);
+	WARN_ON_ONCE(pgc->writeback);
 
+	file = pgc->file;
 	spin_lock(&file->dirtylist_lock);
 
 	/* check again */
@@ -191,34 +126,45 @@ void make_lego_pgcache_clean(struct lego_pgcache_struct *pgc)
 	list_del_init(&pgc->dirtylist);
 	spin_unlock(&file->dirtylist_lock);
 
+	pgcache_account_clean();
 	flush_one_cacheline_locked(pgc);
+}
 
+void make_lego_pgcache_clean(struct lego_pgcache_struct *pgc)
+{
+	spin_lock(&pgc->lock);
+	while (unlikely(pgc->writeback)) {
+		spin_unlock(&pgc->lock);
+		wait_on_pgcache_writeback(pgc);
+		spin_lock(&pgc->lock);
+	}
+	make_lego_pgcache_clean_locked(pgc);
 	spin_unlock(&pgc->lock);
-	return;
 }
 
-int pgcache_flush_file(struct lego_pgcache_file *file)
+static void wait_on_file_writeback(struct lego_pgcache_file *file)
 {
-	struct lego_pgcache_struct *pos;
-
-	spin_lock(&file->dirtylist_lock);
-	while(!list_empty(&file->head)) {
-		pos = list_entry(file->head.next,
-				struct lego_pgcache_struct, dirtylist);
-		pos->dirty = false;
-		list_del_init(&pos->dirtylist);
-		spin_unlock(&file->dirtylist_lock);
-
-		pgcache_debug("pgc: %p, head: %p, pgc->next: %p, sid: %u",		\
-			pos, &file->head, pos->dirtylist.next, pos->storage_node);
-
-		flush_one_cacheline_locked(pos);
-
-		spin_lock(&file->dirtylist_lock);
-	}
-	spin_unlock(&file->dirtylist_lock);
+	while (atomic_read(&file->nr_writeback))
+		cpu_relax();
+}
 
-	return 0;
+int pgcache_flush_file(struct lego_pgcache_file *file)
+{
+	ssize_t ret;
+
+	/*
+	 * Write back all dirty cachelines, coalesced. Those under writeback
+	 * by someone else are skipped, once it is done the second pass
+	 * picks up the ones dirtied again meanwhile.
+	 */
+	ret = pgcache_writeback_file(file, 0, 0);
+	wait_on_file_writeback(file);
+	if (ret < 0)
+		return ret;
+
+	ret = pgcache_writeback_file(file, 0, 0);
+	wait_on_file_writeback(file);
+	return ret < 0 ? ret : 0;
 }
 
 struct p2m_fsync_reply {
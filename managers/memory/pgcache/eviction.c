@@ -7,13 +7,37 @@
  * (at your option) any later version.
  */
 
+/*
+ * LIRS replacement
+ *
+ * The LIRS stacks are global and protected by pgcache_lirs_lock. To keep
+ * thpool workers from serializing on it at every access, accesses are
+ * first recorded in a per-cpu buffer, and applied to the stacks in order
+ * once LIRS_BATCH_SIZE of them are buffered (or LIRS_BATCH_LOW if the
+ * lock happens to be free). The policy itself is unchanged, a reference
+ * is only applied a little later.
+ *
+ * Victims are only picked under the lock. Flushing a dirty victim to
+ * storage and freeing its pages happen after the lock is released.
+ */
+
 #include <lego/list.h>
+#include <lego/percpu.h>
 #include <lego/spinlock.h>
 #include <memory/pgcache.h>
+#include <memory/stat.h>
+
+#define LIRS_BATCH_SIZE			32
+#define LIRS_BATCH_LOW			(LIRS_BATCH_SIZE / 2)
+
+struct lirs_access_buffer {
+	spinlock_t			lock;
+	unsigned int			nr;
+	struct lego_pgcache_struct	*pgcs[LIRS_BATCH_SIZE];
+};
+
+static DEFINE_PER_CPU(struct lirs_access_buffer, lirs_access_buffers);
 
-#define MAX_LIR_CACHELINES		((1 << 14) - (1 << 9))
-#define MAX_HIR_CACHELINES		(1 << 9)
-#define MAX_CACHELINES			(MAX_LIR_CACHELINES + MAX_HIR_CACHELINES)
 static atomic_t lir_credit = ATOMIC_INIT(0);
 static atomic_t hir_credit = ATOMIC_INIT(0);
 
@@ -83,33 +107,61 @@ retry:
 	goto retry;
 }
 
-/* TODO: Mark lock sequence, adjust lock range */
-void pgcache_evict_one(void)
+/*
+ * Pick the bottom of stack Q. The victim still marked as HIR in
+ * Stack S before accessed or cut. Its pages are freed later by
+ * evict_cacheline() outside pgcache_lirs_lock.
+ */
+static struct lego_pgcache_struct *pick_victim_locked(void)
 {
 	struct lego_pgcache_struct *victim;
 
 	victim = head_entry(victim, &lirs_stack_q, stack_q);
 
 	pgcache_debug("victim: %p, filepath: %s, pos: %Lx",		\
-		victim, victim->filepath, victim->pos);
+		victim, victim->file->filepath, victim->pos);
 
-	/* flush the dirty cacheline */
-	make_lego_pgcache_clean(victim);
-
-	/* free the cached pages
-	 * remove from pgcache HIRS stack Q
-	 * the victim still marked as HIR in
-	 * Stack S before accessed or cut
-	 */
-	__free_pgcache_locked(victim);
 	remove_from_stack_q_locked(victim);
+	return victim;
 }
 
-void update_lirs_structure(struct lego_pgcache_struct *pgc)
+/*
+ * Flush the victim if dirty, then free the cached pages. Both are done
+ * under pgc->lock, so a writer can not sneak in between. A victim under
+ * writeback is waited for, its M2S_WRITE must not overtake ours.
+ */
+static void evict_cacheline(struct lego_pgcache_struct *victim)
 {
-	struct lego_pgcache_struct *cur_bottom_s;
+	spin_lock(&victim->lock);
+	while (unlikely(victim->writeback)) {
+		spin_unlock(&victim->lock);
+		wait_on_pgcache_writeback(victim);
+		spin_lock(&victim->lock);
+	}
+	if (victim->dirty) {
+		make_lego_pgcache_clean_locked(victim);
+		inc_mm_stat(PGCACHE_EVICT_DIRTY);
+	}
+	if (victim->cached_pages)
+		__free_pgcache_locked(victim);
+	if (victim->ra_unused) {
+		victim->ra_unused = false;
+		inc_mm_stat(PGCACHE_RA_WASTE);
+	}
+	victim->ra_marker = false;
+	spin_unlock(&victim->lock);
 
-	spin_lock(&pgcache_lirs_lock);
+	inc_mm_stat(PGCACHE_EVICT);
+}
+
+/*
+ * Apply one access to the LIRS stacks.
+ * Return the cacheline to evict, if any.
+ */
+static struct lego_pgcache_struct *
+__update_lirs_structure_locked(struct lego_pgcache_struct *pgc)
+{
+	struct lego_pgcache_struct *cur_bottom_s;
 
 	/* page blocks that are not in stack S now
 	 */
@@ -121,7 +173,7 @@ void update_lirs_structure(struct lego_pgcache_struct *pgc)
 			atomic_inc(&lir_credit);
 			set_pgcache_lir(pgc);
 			move_to_stack_s_top_locked(pgc);
-			goto unlock;
+			return NULL;
 		}
 
 		/* LIR queue reach the limit
@@ -170,14 +222,92 @@ void update_lirs_structure(struct lego_pgcache_struct *pgc)
 	 */
 	move_to_stack_s_top_locked(pgc);
 	cut_stack_s_bottom();
-	goto unlock;
+	return NULL;
 
 eviction:
 	if (atomic_read(&hir_credit) > MAX_HIR_CACHELINES) {
-		pgcache_evict_one();
 		atomic_dec(&hir_credit);
+		return pick_victim_locked();
+	}
+	return NULL;
+}
+
+void update_lirs_structure(struct lego_pgcache_struct *pgc)
+{
+	struct lego_pgcache_struct *victims[LIRS_BATCH_SIZE];
+	struct lirs_access_buffer *buf;
+	unsigned int i, nr_victims = 0;
+
+	buf = get_cpu_ptr(&lirs_access_buffers);
+	spin_lock(&buf->lock);
+	buf->pgcs[buf->nr++] = pgc;
+
+	if (buf->nr < LIRS_BATCH_LOW)
+		goto out;
+
+	if (!spin_trylock(&pgcache_lirs_lock)) {
+		if (buf->nr < LIRS_BATCH_SIZE)
+			goto out;
+		spin_lock(&pgcache_lirs_lock);
+	}
+
+	for (i = 0; i < buf->nr; i++) {
+		struct lego_pgcache_struct *victim;
+
+		victim = __update_lirs_structure_locked(buf->pgcs[i]);
+		if (victim)
+			victims[nr_victims++] = victim;
+	}
+	buf->nr = 0;
+	spin_unlock(&pgcache_lirs_lock);
+
+out:
+	spin_unlock(&buf->lock);
+	put_cpu_ptr(&lirs_access_buffers);
+
+	for (i = 0; i < nr_victims; i++)
+		evict_cacheline(victims[i]);
+}
+
+/*
+ * Forget all buffered accesses and empty both stacks.
+ * Caller is about to free all cachelines.
+ */
+void reset_lirs_structure(void)
+{
+	struct lego_pgcache_struct *pgc;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct lirs_access_buffer *buf = per_cpu_ptr(&lirs_access_buffers, cpu);
+
+		spin_lock(&buf->lock);
+		buf->nr = 0;
+		spin_unlock(&buf->lock);
+	}
+
+	spin_lock(&pgcache_lirs_lock);
+	while (!list_empty(&lirs_stack_s)) {
+		pgc = head_entry(pgc, &lirs_stack_s, stack_s);
+		list_del_init(&pgc->stack_s);
 	}
-unlock:
+	while (!list_empty(&lirs_stack_q)) {
+		pgc = head_entry(pgc, &lirs_stack_q, stack_q);
+		list_del_init(&pgc->stack_q);
+	}
+	atomic_set(&lir_credit, 0);
+	atomic_set(&hir_credit, 0);
 	spin_unlock(&pgcache_lirs_lock);
-	return;
+}
+
+void __init pgcache_lirs_init(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct lirs_access_buffer *buf = per_cpu_ptr(&lirs_access_buffers, cpu);
+
+		spin_lock_init(&buf->lock);
+		buf->nr = 0;
+	}
 }
@@ -46,47 +46,58 @@ out:
 	return ret;
 }
 
+/*
+ * Cachelines point to their file, and are indexed per file,
+ * so only the file itself needs to be rehashed.
+ *
+ * If @newname is cached, the rename replaced that file at storage.
+ * It is unhashed, so its cachelines are never found again, and left
+ * to eviction. They were written back before the rename.
+ */
 static void __do_page_cache_rename(char *oldname, char *newname)
 {
-	size_t len = 0;
-	loff_t curr = 0;
 	struct lego_pgcache_file *pgfile = find_lego_pgcache_file(oldname);
-	loff_t stride = 1 << PGCACHE_PREFETCH_ORDER;
+	struct lego_pgcache_file *target;
 
 	/* file has not been touched yet */
 	if (unlikely(!pgfile))
 		return;
 
-	len = file_size_read(pgfile);
-	while (curr < len) {
-		struct lego_pgcache_struct *pgc =
-				find_lego_pgcache_struct(oldname, curr);
-
-		if (pgc) {
-			ht_remove_lego_pgcache_struct(pgc);
-			memset(pgc->filepath, 0, MAX_FILENAME_LENGTH);
-			strncpy(pgc->filepath, newname, MAX_FILENAME_LENGTH);
-			ht_insert_lego_pgcache_struct(pgc);
-		}
-		curr += stride;
-	}
-
 	/*
 	 * rename pgfile
 	 */
 	ht_remove_lego_pgcache_file(pgfile);
-	memset(pgfile->filepath, 0, MAX_FILENAME_LENGTH);
-	strncpy(pgfile->filepath, newname, MAX_FILENAME_LENGTH);
-	ht_insert_lego_pgcache_file(pgfile);
+	pgcache_file_set_path(pgfile, newname);
+
+	/* Someone may open @newname again meanwhile */
+	while (unlikely(ht_insert_lego_pgcache_file(pgfile) == -EEXIST)) {
+		target = find_lego_pgcache_file(newname);
+		if (target)
+			ht_remove_lego_pgcache_file(target);
+	}
 }
 
 int handle_p2m_rename(struct p2m_rename_struct *payload, struct common_header *hdr,
 		      struct thpool_buffer *tb)
 {
+	struct lego_pgcache_file *file;
 	long *retval;
 
 	retval = thpool_buffer_tx(tb);
 	tb_set_tx_size(tb, sizeof(*retval));
+
+	/*
+	 * Storage must have everything before it renames. Dirty data of
+	 * @oldname would not be found under that name afterwards, and that
+	 * of @newname would land in the renamed file.
+	 */
+	file = find_lego_pgcache_file(payload->oldname);
+	if (file)
+		pgcache_flush_file(file);
+	file = find_lego_pgcache_file(payload->newname);
+	if (file)
+		pgcache_flush_file(file);
+
 	*retval = do_m2s_rename(payload->oldname,
 			payload->newname, payload->storage_node);
 	/*
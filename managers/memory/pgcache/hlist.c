@@ -7,16 +7,55 @@
  * (at your option) any later version.
  */
 
-#include <lego/hashtable.h>
+/*
+ * Page cache index
+ *
+ * Two levels. The top level maps a full pathname to its lego_pgcache_file,
+ * the second level is a per-file radix tree of cachelines, indexed by
+ * pos / CL_SIZE. A request hashes its pathname once, and all following
+ * cacheline lookups only take the per-file tree_lock.
+ *
+ * The file table has a lock per bucket and doubles itself once it holds
+ * more than PGCACHE_FILE_LOAD files per bucket. Resizing bumps
+ * file_table_lock's sequence, lookups that raced with it simply retry.
+ * Lego has no RCU grace periods, and a lookup may still spin on a bucket
+ * lock of the old table, so old tables are retired rather than freed.
+ * Their total size is bounded by the size of the current table.
+ *
+ * File structs are never freed once hashed, so lookups hand out plain
+ * pointers without reference counting.
+ */
+
+#include <lego/hash.h>
+#include <lego/slab.h>
+#include <lego/percpu.h>
+#include <lego/seqlock.h>
 #include <lego/spinlock.h>
+#include <lego/radixtree.h>
 #include <lego/comp_memory.h>
 #include <memory/pgcache.h>
 
-/* lock to protect pgcache hashtable struct */
-static DEFINE_SPINLOCK(pgcache_hash_lock);
-static DEFINE_HASHTABLE(pgcache_hash, PGCACHE_HASH_BITS);
-static unsigned int lookups = 0;
-static unsigned int walks = 0;
+#define PGCACHE_FILE_MIN_BITS	6
+#define PGCACHE_FILE_MAX_BITS	20
+#define PGCACHE_FILE_LOAD	2
+
+struct pgcache_file_bucket {
+	spinlock_t		lock;
+	struct hlist_head	head;
+};
+
+struct pgcache_file_table {
+	unsigned int			bits;
+	struct pgcache_file_bucket	*buckets;
+	struct pgcache_file_table	*retired;	/* previous tables */
+};
+
+static struct pgcache_file_table *file_table;
+static DEFINE_SEQLOCK(file_table_lock);
+static atomic_t nr_pgcache_files = ATOMIC_INIT(0);
+
+static DEFINE_PER_CPU(unsigned long, nr_file_lookups);
+static DEFINE_PER_CPU(unsigned long, nr_file_walks);
 
 static unsigned int BKDRHash(char *str)
 {
@@ -30,134 +69,389 @@ static unsigned int BKDRHash(char *str)
 	return hash & 0x7fffffff;
 }
 
-/*
- * TODO: replace with correct key function
- * DONE
- */
-static unsigned int get_key(char *filename, loff_t _aligned_pos)
+static inline unsigned long chunk_index(loff_t pos)
 {
-	unsigned int key = 0;
+	return pos >> (PAGE_SHIFT + PGCACHE_PREFETCH_ORDER);
+}
+
+static struct pgcache_file_table *alloc_file_table(unsigned int bits)
+{
+	struct pgcache_file_table *t;
+	unsigned int i;
 
-	key = BKDRHash(filename);
-	key += (_aligned_pos) >> (PAGE_SHIFT + PGCACHE_PREFETCH_ORDER);
+	t = kmalloc(sizeof(*t), GFP_KERNEL);
+	if (!t)
+		return NULL;
 
-	return key;
+	t->buckets = kmalloc(sizeof(*t->buckets) << bits, GFP_KERNEL);
+	if (!t->buckets) {
+		kfree(t);
+		return NULL;
+	}
+
+	for (i = 0; i < (1U << bits); i++) {
+		spin_lock_init(&t->buckets[i].lock);
+		INIT_HLIST_HEAD(&t->buckets[i].head);
+	}
+	t->bits = bits;
+	t->retired = NULL;
+	return t;
 }
 
 /*
- * when this func is invoked, the caller is responsible to do sanity
- * check if pgc is already exist, we avoid reductant check here
- * for performance reasons
+ * Lock the bucket @hash falls into in the current table.
+ * Retry if the table was resized meanwhile.
  */
-int ht_insert_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+static struct pgcache_file_bucket *lock_file_bucket(unsigned int hash)
 {
-	unsigned int key;
+	struct pgcache_file_table *t;
+	struct pgcache_file_bucket *b;
+	unsigned int seq;
 
-	BUG_ON(!pgc || strlen(pgc->filepath) == 0);
+	do {
+		seq = read_seqbegin(&file_table_lock);
+		t = READ_ONCE(file_table);
+		b = &t->buckets[hash_32(hash, t->bits)];
+		spin_lock(&b->lock);
+		if (!read_seqretry(&file_table_lock, seq))
+			break;
+		spin_unlock(&b->lock);
+	} while (1);
 
-	pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",		\
-			pgc, pgc->pos, pgc->cached_pages, pgc->filepath);
+	return b;
+}
 
-	key = get_key(pgc->filepath, pgc->pos);
+static void grow_file_table(void)
+{
+	struct pgcache_file_table *old, *new;
+	struct lego_pgcache_file *file;
+	struct hlist_node *tmp;
+	unsigned int i;
 
-	spin_lock(&pgcache_hash_lock);
-	hash_add(pgcache_hash, &pgc->link, key);
-	spin_unlock(&pgcache_hash_lock);
+	old = READ_ONCE(file_table);
+	if (old->bits >= PGCACHE_FILE_MAX_BITS)
+		return;
 
-	return 0;
-}
+	new = alloc_file_table(old->bits + 1);
+	if (!new)
+		return;
 
-void ht_remove_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
-{
-	BUG_ON(!pgc || strlen(pgc->filepath) == 0);
-	spin_lock(&pgcache_hash_lock);
-	hash_del(&pgc->link);
-	spin_unlock(&pgcache_hash_lock);
+	write_seqlock(&file_table_lock);
+
+	/* Someone else did it */
+	if (file_table != old) {
+		write_sequnlock(&file_table_lock);
+		kfree(new->buckets);
+		kfree(new);
+		return;
+	}
+
+	/*
+	 * Lookups can not lock any bucket successfully from now on.
+	 * Wait for those already inside one by taking its lock.
+	 */
+	for (i = 0; i < (1U << old->bits); i++) {
+		struct pgcache_file_bucket *b = &old->buckets[i];
+
+		spin_lock(&b->lock);
+		hlist_for_each_entry_safe(file, tmp, &b->head, hlink) {
+			hlist_del(&file->hlink);
+			hlist_add_head(&file->hlink,
+				&new->buckets[hash_32(file->hash, new->bits)].head);
+		}
+		spin_unlock(&b->lock);
+	}
+
+	new->retired = old;
+	WRITE_ONCE(file_table, new);
+	write_sequnlock(&file_table_lock);
+
+	pr_debug("%s(): %u buckets, %d files\n", __func__,
+		1U << new->bits, atomic_read(&nr_pgcache_files));
 }
 
-void free_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+int ht_insert_lego_pgcache_file(struct lego_pgcache_file *file)
 {
-	struct lego_pgcache_struct *p;
-	unsigned int key;
+	struct pgcache_file_bucket *b;
+	struct lego_pgcache_file *p;
+	int nr;
 
-	BUG_ON(!pgc || strlen(pgc->filepath) == 0);
+	BUG_ON(!file || strlen(file->filepath) == 0);
 
-	key = get_key(pgc->filepath, pgc->pos);
+	pgcache_debug("filepath: %s", file->filepath);
 
-	spin_lock(&pgcache_hash_lock);
-	hash_for_each_possible(pgcache_hash, p, link, key) {
-		if (likely(p->pos == pgc->pos &&
-			strcmp(p->filepath, pgc->filepath) == 0)) {
-			hash_del(&p->link);
-			spin_unlock(&pgcache_hash_lock);
-			/* TODO:
-			 * finish implementing __free_pgcache
-			 */
-			__free_pgcache_struct(p);
-			return;
+	file->hash = BKDRHash(file->filepath);
+
+	b = lock_file_bucket(file->hash);
+	hlist_for_each_entry(p, &b->head, hlink) {
+		if (unlikely(p->hash == file->hash &&
+			     strcmp(p->filepath, file->filepath) == 0)) {
+			spin_unlock(&b->lock);
+			return -EEXIST;
 		}
 	}
-	spin_unlock(&pgcache_hash_lock);
-	WARN(1, "Fail to find pgc->(filepath:%s,pos:%Ld)\n", pgc->filepath, pgc->pos);
-	return;
+	hlist_add_head(&file->hlink, &b->head);
+	spin_unlock(&b->lock);
+
+	nr = atomic_inc_return(&nr_pgcache_files);
+	if (unlikely(nr > (PGCACHE_FILE_LOAD << READ_ONCE(file_table)->bits)))
+		grow_file_table();
+
+	return 0;
 }
 
-struct lego_pgcache_struct *
-	find_lego_pgcache_struct(char *filepath, loff_t pos)
+void ht_remove_lego_pgcache_file(struct lego_pgcache_file *file)
 {
-	loff_t _aligned_pos;
-	struct lego_pgcache_struct *pgc;
-	unsigned int key;
+	struct pgcache_file_bucket *b;
+
+	BUG_ON(!file || strlen(file->filepath) == 0);
+
+	b = lock_file_bucket(file->hash);
+	hlist_del_init(&file->hlink);
+	spin_unlock(&b->lock);
+
+	atomic_dec(&nr_pgcache_files);
+}
+
+struct lego_pgcache_file *find_lego_pgcache_file(char *filepath)
+{
+	struct pgcache_file_bucket *b;
+	struct lego_pgcache_file *file;
+	unsigned int hash;
 
 	if (unlikely(strlen(filepath) == 0))
 		return NULL;
 
-	_aligned_pos = aligned_pos(pos);
-	key = get_key(filepath, _aligned_pos);
+	hash = BKDRHash(filepath);
 
-	spin_lock(&pgcache_hash_lock);
-	lookups++;
-	hash_for_each_possible(pgcache_hash, pgc, link, key) {
-		walks++;
-		if (likely(pgc->pos == _aligned_pos &&
-			strcmp(pgc->filepath, filepath) == 0)) {
-			spin_unlock(&pgcache_hash_lock);
+	this_cpu_inc(nr_file_lookups);
+	b = lock_file_bucket(hash);
+	hlist_for_each_entry(file, &b->head, hlink) {
+		this_cpu_inc(nr_file_walks);
+		if (likely(file->hash == hash &&
+			   strcmp(file->filepath, filepath) == 0)) {
+			spin_unlock(&b->lock);
 
-			pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",		\
-				pgc, pgc->pos, pgc->cached_pages, pgc->filepath);
+			pgcache_debug("file: %p", file);
 
-			return pgc;
+			return file;
 		}
 	}
-	spin_unlock(&pgcache_hash_lock);
+	spin_unlock(&b->lock);
 
 	return NULL;
 }
 
-int drop_pgcache(void)
+/*
+ * Copy the pathname of @file to @buf, MAX_FILENAME_LENGTH bytes.
+ * Messages to storage take it from here, rename may change it anytime.
+ */
+void pgcache_file_path(struct lego_pgcache_file *file, char *buf)
+{
+	unsigned int seq;
+
+	do {
+		seq = read_seqbegin(&file->path_lock);
+		memcpy(buf, file->filepath, MAX_FILENAME_LENGTH);
+	} while (read_seqretry(&file->path_lock, seq));
+}
+
+/* Rename @file, which must not be hashed */
+void pgcache_file_set_path(struct lego_pgcache_file *file, char *filepath)
+{
+	write_seqlock(&file->path_lock);
+	memset(file->filepath, 0, MAX_FILENAME_LENGTH);
+	strncpy(file->filepath, filepath, MAX_FILENAME_LENGTH - 1);
+	write_sequnlock(&file->path_lock);
+}
+
+/*
+ * when this func is invoked, the caller is responsible to do sanity
+ * check if pgc is already exist. If someone else inserted the same
+ * cacheline meanwhile, -EEXIST is returned and pgc is not inserted.
+ */
+int ht_insert_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+{
+	struct lego_pgcache_file *file = pgc->file;
+	int ret;
+
+	pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",		\
+			pgc, pgc->pos, pgc->cached_pages, file->filepath);
+
+	spin_lock(&file->tree_lock);
+	ret = radix_tree_insert(&file->chunk_tree, chunk_index(pgc->pos), pgc);
+	spin_unlock(&file->tree_lock);
+
+	return ret;
+}
+
+void ht_remove_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+{
+	struct lego_pgcache_file *file = pgc->file;
+
+	spin_lock(&file->tree_lock);
+	radix_tree_delete_item(&file->chunk_tree, chunk_index(pgc->pos), pgc);
+	spin_unlock(&file->tree_lock);
+}
+
+void free_lego_pgcache_struct(struct lego_pgcache_struct *pgc)
+{
+	struct lego_pgcache_file *file = pgc->file;
+	void *p;
+
+	spin_lock(&file->tree_lock);
+	p = radix_tree_delete_item(&file->chunk_tree, chunk_index(pgc->pos), pgc);
+	spin_unlock(&file->tree_lock);
+
+	if (unlikely(!p)) {
+		WARN(1, "Fail to find pgc->(filepath:%s,pos:%Ld)\n",
+			file->filepath, pgc->pos);
+		return;
+	}
+	__free_pgcache_struct(pgc);
+}
+
+struct lego_pgcache_struct *
+	find_lego_pgcache_struct(struct lego_pgcache_file *file, loff_t pos)
 {
-	int bkt;
 	struct lego_pgcache_struct *pgc;
-	struct hlist_node *tmp;
 
-	spin_lock(&pgcache_hash_lock);
-	pr_info("lookups = %u, walks = %u\n", lookups, walks);
-	hash_for_each_safe(pgcache_hash, bkt, tmp, pgc, link) {
-		hash_del(&pgc->link);
+	spin_lock(&file->tree_lock);
+	pgc = radix_tree_lookup(&file->chunk_tree, chunk_index(pos));
+	spin_unlock(&file->tree_lock);
+
+	if (pgc)
+		pgcache_debug("pgc:%p, pos:%Ld, pages:%p, filepath: %s",	\
+			pgc, pgc->pos, pgc->cached_pages, file->filepath);
+
+	return pgc;
+}
+
+/* Remove and free all cachelines of @file, which was flushed before */
+static void drop_pgcache_file(struct lego_pgcache_file *file)
+{
+	struct lego_pgcache_struct *pgc;
+	struct radix_tree_iter iter;
+	void **slot;
+
+	spin_lock(&file->tree_lock);
+	do {
+		pgc = NULL;
+		radix_tree_for_each_slot(slot, &file->chunk_tree, &iter, 0) {
+			pgc = *slot;
+			break;
+		}
+		if (!pgc)
+			break;
+
+		radix_tree_delete(&file->chunk_tree, iter.index);
+
+		/* Dirtied after the flush above */
+		if (unlikely(pgc->dirty)) {
+			spin_lock(&file->dirtylist_lock);
+			list_del_init(&pgc->dirtylist);
+			spin_unlock(&file->dirtylist_lock);
+			pgcache_account_clean();
+		}
 
 		/*
 		 * free lines one by one
 		 */
 		__free_pgcache_struct(pgc);
+	} while (1);
+	spin_unlock(&file->tree_lock);
+}
+
+/*
+ * Return an array of all hashed files, and their number in @nr.
+ * Files are never freed, pointers stay valid without the bucket locks.
+ */
+static struct lego_pgcache_file **snapshot_pgcache_files(unsigned int *nr)
+{
+	struct pgcache_file_table *t;
+	struct lego_pgcache_file **files, *file;
+	unsigned int i, n, max;
+
+retry:
+	max = atomic_read(&nr_pgcache_files) + 16;
+	files = kmalloc(sizeof(*files) * max, GFP_KERNEL);
+	if (!files)
+		return NULL;
+
+	n = 0;
+	read_seqlock_excl(&file_table_lock);
+	t = file_table;
+	for (i = 0; i < (1U << t->bits); i++) {
+		spin_lock(&t->buckets[i].lock);
+		hlist_for_each_entry(file, &t->buckets[i].head, hlink) {
+			if (unlikely(n == max)) {
+				/* Files were added meanwhile */
+				spin_unlock(&t->buckets[i].lock);
+				read_sequnlock_excl(&file_table_lock);
+				kfree(files);
+				goto retry;
+			}
+			files[n++] = file;
+		}
+		spin_unlock(&t->buckets[i].lock);
 	}
-	lookups = 0;
-	walks = 0;
-	spin_unlock(&pgcache_hash_lock);
-
-	if (likely(hash_empty(pgcache_hash))) {
-		pr_info("Successfully drop lego pgcache.\n");
-	} else {
-		pr_warn("Lego pgcache is not dropped entirely");
+	read_sequnlock_excl(&file_table_lock);
+
+	*nr = n;
+	return files;
+}
+
+int drop_pgcache(void)
+{
+	struct pgcache_file_table *t;
+	struct lego_pgcache_file *file, **files;
+	unsigned long lookups = 0, walks = 0;
+	unsigned int i, nr_files;
+	int cpu;
+
+	/*
+	 * Write back everything first, without holding any lock
+	 * across the M2S_WRITEs. Only then unhook and free.
+	 */
+	files = snapshot_pgcache_files(&nr_files);
+	if (!files)
+		return -ENOMEM;
+	for (i = 0; i < nr_files; i++)
+		pgcache_flush_file(files[i]);
+	kfree(files);
+
+	for_each_possible_cpu(cpu) {
+		lookups += per_cpu(nr_file_lookups, cpu);
+		walks += per_cpu(nr_file_walks, cpu);
+		per_cpu(nr_file_lookups, cpu) = 0;
+		per_cpu(nr_file_walks, cpu) = 0;
 	}
+
+	/* Cachelines are about to be freed */
+	reset_lirs_structure();
+
+	read_seqlock_excl(&file_table_lock);
+	t = file_table;
+	pr_info("lookups = %lu, walks = %lu, files = %d, buckets = %u\n",
+		lookups, walks, atomic_read(&nr_pgcache_files), 1U << t->bits);
+	for (i = 0; i < (1U << t->bits); i++) {
+		spin_lock(&t->buckets[i].lock);
+		hlist_for_each_entry(file, &t->buckets[i].head, hlink)
+			drop_pgcache_file(file);
+		spin_unlock(&t->buckets[i].lock);
+	}
+	read_sequnlock_excl(&file_table_lock);
+
+	pr_info("Successfully drop lego pgcache.\n");
 	return 0;
 }
+
+void __init pgcache_init(void)
+{
+	file_table = alloc_file_table(PGCACHE_FILE_MIN_BITS);
+	if (!file_table)
+		panic("Fail to allocate pgcache file table");
+
+	pgcache_lirs_init();
+	pgcache_writeback_init();
+}
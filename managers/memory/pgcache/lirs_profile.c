@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Boot-time LIRS bookkeeping throughput profiling
+ *
+ * Dummy cachelines without pages are fed to update_lirs_structure() by
+ * 1, 2, 4.. threads. The working set is twice the cache size, and 80%
+ * of accesses go to a hot 10% of it, so that all LIRS paths (LIR hit,
+ * HIR promotion, eviction) are taken. Only active CPUs are used.
+ */
+
+#include <lego/smp.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/cpumask.h>
+#include <lego/profile.h>
+#include <lego/comp_memory.h>
+#include <memory/pgcache.h>
+
+#define NR_ACCESSES		(200000)
+#define NR_PGCS			(2 * MAX_CACHELINES)
+#define NR_HOT_PGCS		(NR_PGCS / 10)
+
+static struct lego_pgcache_struct *pgcs;
+
+static inline unsigned int xorshift32(unsigned int *state)
+{
+	unsigned int x = *state;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*state = x;
+	return x;
+}
+
+static void __profile_lirs(void *unused)
+{
+	unsigned int seed = 2463534242U + smp_processor_id();
+	unsigned int r, idx;
+	int i;
+
+	for (i = 0; i < NR_ACCESSES; i++) {
+		r = xorshift32(&seed);
+		if (r % 10 < 8)
+			idx = (r >> 4) % NR_HOT_PGCS;
+		else
+			idx = (r >> 4) % NR_PGCS;
+		update_lirs_structure(&pgcs[idx]);
+	}
+}
+
+static void profile_lirs_threads(unsigned int nr_threads)
+{
+	unsigned long thread_ns;
+
+	thread_ns = profile_run_threads(__profile_lirs, NULL, nr_threads,
+					cpu_active_mask, "lirs_profile");
+
+	/* Start every run from empty stacks */
+	reset_lirs_structure();
+
+	if (!thread_ns)
+		return;
+
+	/* Average run time of one thread */
+	thread_ns /= nr_threads;
+	if (!thread_ns)
+		thread_ns = 1;
+
+	pr_info("    nr_threads: %2u. Avg update: %4lu ns. Throughput: %lu Kops/s\n",
+		nr_threads, thread_ns / NR_ACCESSES,
+		NR_ACCESSES * nr_threads * 1000000UL / thread_ns);
+}
+
+void pgcache_lirs_profile(void)
+{
+	unsigned int nr_threads, max_threads;
+	int i;
+
+	pgcs = kzalloc(sizeof(*pgcs) * NR_PGCS, GFP_KERNEL);
+	if (!pgcs) {
+		pr_err("%s(): fail to allocate cachelines\n", __func__);
+		return;
+	}
+
+	for (i = 0; i < NR_PGCS; i++) {
+		pgcs[i].pos = (loff_t)i * CL_SIZE;
+		spin_lock_init(&pgcs[i].lock);
+		INIT_LIST_HEAD(&pgcs[i].dirtylist);
+		INIT_LIST_HEAD(&pgcs[i].stack_s);
+		INIT_LIST_HEAD(&pgcs[i].stack_q);
+	}
+
+	/* Whatever real cachelines were tracked are forgotten */
+	reset_lirs_structure();
+
+	max_threads = cpumask_weight(cpu_active_mask);
+
+	pr_info("Pgcache LIRS Profile. [nr_access/thread: %d, cachelines: %d/%d]\n",
+		NR_ACCESSES, NR_PGCS, MAX_CACHELINES);
+	for (nr_threads = 1; nr_threads <= max_threads; nr_threads *= 2)
+		profile_lirs_threads(nr_threads);
+
+	kfree(pgcs);
+	pgcs = NULL;
+}
@@ -17,10 +17,11 @@
 #include <lego/comp_storage.h>
 #include <memory/vm.h>
 #include <memory/file_ops.h>
+#include <memory/stat.h>
 
 #include <memory/pgcache.h>
 
-ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
+ssize_t pgcache_load(struct lego_pgcache_struct *pgc)
 {
 	u32 len_msg, len_ret, *opcode;
 	void *msg, *retbuf, *content;
@@ -43,7 +44,7 @@ ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
 	}
 
 	pgcache_debug("pages:%p, offset:%Lx, count:%u, f_name: %s",					\
-				pgc->cached_pages, pgc->pos, count, f_name);
+				pgc->cached_pages, pgc->pos, count, pgc->file->filepath);
 
 	opcode = msg;
 	*opcode = M2S_READ;
@@ -53,7 +54,7 @@ ssize_t pgcache_load(char *f_name, struct lego_pgcache_struct *pgc)
 	payload->flags = O_RDONLY;
 	payload->len = count;
 	payload->offset = pgc->pos;
-	strcpy(payload->filename, f_name);
+	pgcache_file_path(pgc->file, payload->filename);
 
 	ibapi_send_reply_imm(pgc->storage_node, msg, len_msg, retbuf, len_ret, false);
 	/* The first 8 bytes are the nr of bytes been read */
@@ -96,7 +97,7 @@ ssize_t flush_one_cacheline_locked(struct lego_pgcache_struct *pgc)
 	payload->flags = O_WRONLY;
 	payload->len = pgc->real_len;
 	payload->offset = pgc->pos;
-	strcpy(payload->filename, pgc->filepath);
+	pgcache_file_path(pgc->file, payload->filename);
 
 	content = msg + sizeof(*opcode) + sizeof(*payload);
 
@@ -128,6 +129,73 @@ static unsigned int __nr_cachelines(loff_t pos, size_t count)
 	return nr_cachelines;
 }
 
+/*
+ * Hash a freshly allocated and loaded @pgc.
+ * If someone else hashed the same cacheline meanwhile, use theirs.
+ */
+struct lego_pgcache_struct *insert_cacheline(struct lego_pgcache_struct *pgc)
+{
+	struct lego_pgcache_struct *old;
+	int ret;
+
+	do {
+		ret = ht_insert_lego_pgcache_struct(pgc);
+		if (likely(!ret))
+			return pgc;
+		if (ret != -EEXIST)
+			break;
+
+		old = find_lego_pgcache_struct(pgc->file, pgc->pos);
+		if (likely(old)) {
+			__free_pgcache_struct(pgc);
+			return old;
+		}
+	} while (1);
+
+	__free_pgcache_struct(pgc);
+	return NULL;
+}
+
+/*
+ * Give pages back to non-resident HIR cacheline @pgc, loading them from
+ * storage if @load. Pages are allocated and loaded without the lock, and
+ * only installed if nobody else (e.g. readahead) did so meanwhile.
+ * Return the bytes loaded, or the error of pgcache_load().
+ */
+static ssize_t refill_cacheline(struct lego_pgcache_struct *pgc, bool load)
+{
+	struct lego_pgcache_struct *new;
+	ssize_t retval = 0;
+
+	new = __alloc_pgcache(pgc->file, pgc->pos);
+	if (unlikely(!new))
+		return -ENOMEM;
+	if (unlikely(!new->cached_pages)) {
+		__free_pgcache_struct(new);
+		return -ENOMEM;
+	}
+
+	if (load) {
+		retval = pgcache_load(new);
+		if (unlikely(retval < 0)) {
+			__free_pgcache_struct(new);
+			return retval;
+		}
+	}
+
+	spin_lock(&pgc->lock);
+	if (!pgc->cached_pages) {
+		pgc->cached_pages = new->cached_pages;
+		pgc->real_len = new->real_len;
+		new->cached_pages = NULL;
+	} else
+		retval = pgc->real_len;
+	spin_unlock(&pgc->lock);
+
+	__free_pgcache_struct(new);
+	return retval;
+}
+
 /* prepare one cacheline
  * return pgc
  */
@@ -135,29 +203,32 @@ static struct lego_pgcache_struct *
 prepare_cacheline(struct lego_pgcache_file *file, loff_t pos, ssize_t *retval)
 {
 	struct lego_pgcache_struct *pgc;
-	char *f_name = file->filepath;
 
-	pgc = find_lego_pgcache_struct(f_name, pos);
+	pgc = find_lego_pgcache_struct(file, pos);
 	if (!pgc) {
-		pgc = __alloc_pgcache(f_name, pos, file->storage_node);
+		pgc = __alloc_pgcache(file, pos);
 		if (unlikely(!pgc))
 			return NULL;
 
 		pgcache_debug("alloc cachedline: %p", pgc->cached_pages);
 
-		*retval = pgcache_load(f_name, pgc);
-		ht_insert_lego_pgcache_struct(pgc);
-		return pgc;
+		inc_mm_stat(PGCACHE_MISS);
+		pgcache_readahead(file, NULL, pos);
+		*retval = pgcache_load(pgc);
+		return insert_cacheline(pgc);
 	}
 
 	/* no-residental HIR pages */
-	if (!pgc->cached_pages) {
-		pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,	\
-			PGCACHE_PREFETCH_ORDER);
-		*retval = pgcache_load(f_name, pgc);
+	if (!READ_ONCE(pgc->cached_pages)) {
+		inc_mm_stat(PGCACHE_MISS);
+		pgcache_readahead(file, NULL, pos);
+		*retval = refill_cacheline(pgc, true);
+	} else {
+		inc_mm_stat(PGCACHE_HIT);
+		pgcache_readahead(file, pgc, pos);
 	}
 
-	pgcache_debug("f_name: %s, cacheline:%p", f_name, pgc->cached_pages);
+	pgcache_debug("f_name: %s, cacheline:%p", file->filepath, pgc->cached_pages);
 
 	return pgc;
 }
@@ -170,30 +241,27 @@ static struct lego_pgcache_struct *
 prepare_cacheline_fast(struct lego_pgcache_file *file, loff_t pos, ssize_t *retval)
 {
 	struct lego_pgcache_struct *pgc;
-	char *f_name = file->filepath;
 
 	printk_once("%s()\n", __func__);
-	pgc = find_lego_pgcache_struct(f_name, pos);
+	pgc = find_lego_pgcache_struct(file, pos);
 	if (!pgc) {
-		pgc = __alloc_pgcache(f_name, pos, file->storage_node);
+		pgc = __alloc_pgcache(file, pos);
 		if (unlikely(!pgc))
 			return NULL;
 
 		pgcache_debug("alloc cachedline fast: %p", pgc->cached_pages);
 
 		*retval = CL_SIZE;
-		ht_insert_lego_pgcache_struct(pgc);
-		return pgc;
+		return insert_cacheline(pgc);
 	}
 
 	/* no-residental HIR pages */
-	if (!pgc->cached_pages) {
-		pgc->cached_pages = (void *)__get_free_pages(GFP_KERNEL | __GFP_ZERO,	\
-			PGCACHE_PREFETCH_ORDER);
+	if (!READ_ONCE(pgc->cached_pages)) {
+		refill_cacheline(pgc, false);
 		*retval = CL_SIZE;
 	}
 
-	pgcache_debug("f_name: %s, cacheline:%p", f_name, pgc->cached_pages);
+	pgcache_debug("f_name: %s, cacheline:%p", file->filepath, pgc->cached_pages);
 
 	return pgc;
 }
@@ -202,27 +270,13 @@ prepare_cacheline_fast(struct lego_pgcache_file *file, loff_t pos, ssize_t *retv
 static int prepare_two_cachelines(struct lego_pgcache_file *file, loff_t pos, ssize_t *retval,
 		struct lego_pgcache_struct **pgc1, struct lego_pgcache_struct **pgc2)
 {
-	char *f_name = file->filepath;
-
-	*pgc1 = find_lego_pgcache_struct(f_name, pos);
-	if (!(*pgc1)) {
-		*pgc1 = __alloc_pgcache(f_name, pos, file->storage_node);
-		if (unlikely(!(*pgc1)))
-			return -ENOMEM;
-
-		*retval = pgcache_load(f_name, *pgc1);
-		ht_insert_lego_pgcache_struct(*pgc1);
-	}
-
-	*pgc2 = find_lego_pgcache_struct(f_name, pos);
-	if (!(*pgc2)) {
-		*pgc2 = __alloc_pgcache(f_name, pos, file->storage_node);
-		if (unlikely(!(*pgc2)))
-			return -ENOMEM;
+	*pgc1 = prepare_cacheline(file, pos, retval);
+	if (unlikely(!(*pgc1)))
+		return -ENOMEM;
 
-		*retval = pgcache_load(f_name, *pgc2);
-		ht_insert_lego_pgcache_struct(*pgc2);
-	}
+	*pgc2 = prepare_cacheline(file, aligned_pos(pos) + CL_SIZE, retval);
+	if (unlikely(!(*pgc2)))
+		return -ENOMEM;
 
 	return 0;
 }
@@ -234,19 +288,22 @@ ssize_t __read_from_one_cacheline(struct lego_task_struct *tsk,
 	loff_t ckoff;
 	ssize_t retval;
 	size_t len = count;
-	char *f_name = file->filepath;
+	char f_name[MAX_FILENAME_LENGTH];
 
 	pgc = prepare_cacheline(file, *pos, &retval);
+
+	/* NOMEM for caching */
+	if (unlikely(!pgc)) {
+		pgcache_file_path(file, f_name);
+		return __storage_read(tsk, f_name, buf, count, pos);
+	}
+
 	ckoff = chunk_offset(*pos);
 
 	/* read count cannot be satified */
 	if (unlikely(ckoff + count > pgc->real_len))
 		len = pgc->real_len - ckoff;
 
-	/* NOMEM for caching */
-	if (unlikely(!pgc))
-		return __storage_read(tsk, f_name, buf, count, pos);
-
 
 	pgcache_debug("pgcache vaddr: %p, content: [%s]", pgc->cached_pages + ckoff,
 			(char *) pgc->cached_pages + ckoff);
@@ -277,7 +334,7 @@ ssize_t __read_from_two_cachelines(struct lego_task_struct *tsk,
 	int ret;
 	loff_t ckoff_1;
 	size_t len_1, len_2, cl_size;
-	char *f_name = file->filepath;
+	char f_name[MAX_FILENAME_LENGTH];
 
 	ret = prepare_two_cachelines(file, *pos, &retval, &pgc1, &pgc2);
 
@@ -285,7 +342,8 @@ ssize_t __read_from_two_cachelines(struct lego_task_struct *tsk,
 			pgc1, pgc2, pgc1->cached_pages, pgc2->cached_pages);
 
 	/* NOMEM for allocating cachelines */
-	if(unlikely(!ret)) {
+	if (unlikely(ret)) {
+		pgcache_file_path(file, f_name);
 		return __storage_read(tsk, f_name, buf, count, pos);
 	}
 
@@ -345,15 +403,10 @@ ssize_t lego_pgcache_read(struct lego_task_struct *tsk, char *f_name,
 
 	BUG_ON(nr_cachelines > 2);
 
-	file = find_lego_pgcache_file(f_name);
-	if (!file) {
-		file = lego_pgcache_file_open(f_name, storage_node);
-		/* NO memory for allocating file struct and page cache */
-		if (unlikely(IS_ERR(file))) {
-			return -ENOMEM;
-		}
-		ht_insert_lego_pgcache_file(file);
-	}
+	file = find_or_open_lego_pgcache_file(f_name, storage_node);
+	/* NO memory for allocating file struct and page cache */
+	if (unlikely(IS_ERR(file)))
+		return -ENOMEM;
 
 	if (likely(nr_cachelines == 1)) {
 		return __read_from_one_cacheline(tsk, file, buf, count, pos);
@@ -371,7 +424,7 @@ ssize_t __write_to_one_cacheline(struct lego_task_struct *tsk,
 	struct lego_pgcache_struct *pgc;
 	loff_t ckoff;
 	ssize_t retval;
-	char *f_name = file->filepath;
+	char f_name[MAX_FILENAME_LENGTH];
 
 	if (likely((*pos) % CL_SIZE == 0 && count == CL_SIZE))
 		pgc = prepare_cacheline_fast(file, *pos, &retval);
@@ -380,8 +433,10 @@ ssize_t __write_to_one_cacheline(struct lego_task_struct *tsk,
 	ckoff = chunk_offset(*pos);
 
 	/* NOMEM for caching */
-	if (unlikely(!pgc))
+	if (unlikely(!pgc)) {
+		pgcache_file_path(file, f_name);
 		return __storage_write(tsk, f_name, buf, count, pos);
+	}
 
 	spin_lock(&pgc->lock);
 	memcpy(pgc->cached_pages + ckoff, buf, count);
@@ -406,6 +461,7 @@ ssize_t __write_to_one_cacheline(struct lego_task_struct *tsk,
 	}
 	spin_unlock(&file->dirtylist_lock);
 
+	pgcache_balance_dirty(file);
 	return count;
 }
 
@@ -417,7 +473,7 @@ ssize_t __write_to_two_cachelines(struct lego_task_struct *tsk,
 	int ret;
 	loff_t ckoff_1;
 	size_t len_1, len_2, cl_size;
-	char *f_name = file->filepath;
+	char f_name[MAX_FILENAME_LENGTH];
 
 	ret = prepare_two_cachelines(file, *pos, &retval, &pgc1, &pgc2);
 
@@ -425,7 +481,8 @@ ssize_t __write_to_two_cachelines(struct lego_task_struct *tsk,
 			pgc1, pgc2, pgc1->cached_pages, pgc2->cached_pages);
 
 	/* NOMEM for allocating cachelines */
-	if(unlikely(!ret)) {
+	if (unlikely(ret)) {
+		pgcache_file_path(file, f_name);
 		return __storage_write(tsk, f_name, buf, count, pos);
 	}
 
@@ -459,7 +516,7 @@ ssize_t __write_to_two_cachelines(struct lego_task_struct *tsk,
 
 	/* extending pgc2 length to len_2 */
 	if (pgc2->real_len < len_2) {
-		pgc1->real_len = len_2;
+		pgc2->real_len = len_2;
 	}
 	spin_unlock(&pgc2->lock);
 
@@ -473,6 +530,7 @@ ssize_t __write_to_two_cachelines(struct lego_task_struct *tsk,
 	}
 	spin_unlock(&file->dirtylist_lock);
 
+	pgcache_balance_dirty(file);
 	return count;
 }
 
@@ -497,15 +555,10 @@ ssize_t lego_pgcache_write(struct lego_task_struct *tsk, char *f_name,
 
 	BUG_ON(nr_cachelines > 2);
 
-	file = find_lego_pgcache_file(f_name);
-	if (!file) {
-		file = lego_pgcache_file_open(f_name, storage_node);
-		/* NO memory for allocating file struct and page cache */
-		if (unlikely(IS_ERR(file))) {
-			return -ENOMEM;
-		}
-		ht_insert_lego_pgcache_file(file);
-	}
+	file = find_or_open_lego_pgcache_file(f_name, storage_node);
+	/* NO memory for allocating file struct and page cache */
+	if (unlikely(IS_ERR(file)))
+		return -ENOMEM;
 
 	if (likely(nr_cachelines == 1)) {
 		return __write_to_one_cacheline(tsk, file, buf, count, pos);
@@ -0,0 +1,241 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Page cache readahead
+ *
+ * Each cached file tracks the last cacheline accessed. A miss on the
+ * same or the next cacheline starts a window right after it. The first
+ * cacheline of a window carries ra_marker, once the reader gets there
+ * the next window is submitted, twice as large, up to PGCACHE_RA_MAX.
+ * Thus storage reads stay one window ahead of a sequential reader.
+ *
+ * Windows are not loaded by the handler, which would delay the reply.
+ * They are queued per-CPU, and loaded by the worker once it is idle,
+ * one cacheline at a time, so that new requests do not wait for a
+ * whole window.
+ *
+ * Cachelines read ahead have ra_unused set until they are first accessed
+ * (pgcache_ra_hit), or evicted (pgcache_ra_waste).
+ */
+
+#include <lego/smp.h>
+#include <lego/percpu.h>
+#include <lego/spinlock.h>
+#include <memory/pgcache.h>
+#include <memory/stat.h>
+
+#define PGCACHE_RA_MAX			CONFIG_MEM_PGCACHE_READAHEAD_MAX
+#define PGCACHE_RA_INIT			2
+#define PGCACHE_RA_NR_PENDING		8
+
+struct pgcache_ra_req {
+	struct lego_pgcache_file	*file;
+	unsigned long			start;
+	unsigned int			nr;
+	unsigned int			done;	/* cachelines loaded so far */
+};
+
+struct pgcache_ra_queue {
+	unsigned int			head;
+	unsigned int			tail;
+	struct pgcache_ra_req		reqs[PGCACHE_RA_NR_PENDING];
+};
+
+static DEFINE_PER_CPU(struct pgcache_ra_queue, pgcache_ra_queues);
+
+static inline unsigned long cacheline_index(loff_t pos)
+{
+	return pos >> (PAGE_SHIFT + PGCACHE_PREFETCH_ORDER);
+}
+
+/*
+ * Feed one access into the window of @file.
+ * Return true and fill @req if a window should be loaded.
+ */
+static bool __pgcache_readahead(struct lego_pgcache_file *file,
+				unsigned long index, bool miss, bool marker,
+				struct pgcache_ra_req *req)
+{
+	unsigned long nr_cachelines;
+	bool ret = false;
+
+	spin_lock(&file->ra_lock);
+	if (miss) {
+		if (index != file->ra_prev && index != file->ra_prev + 1) {
+			/* Random access */
+			file->ra_size = 0;
+			goto out;
+		}
+
+		/* First window, or the reader overtook the last one */
+		file->ra_start = index + 1;
+		file->ra_size = file->ra_size ?
+			min_t(unsigned int, file->ra_size * 2, PGCACHE_RA_MAX) :
+			PGCACHE_RA_INIT;
+	} else {
+		/* Stale marker, the window moved on */
+		if (!marker || index != file->ra_start)
+			goto out;
+
+		file->ra_start += file->ra_size;
+		file->ra_size = min_t(unsigned int, file->ra_size * 2, PGCACHE_RA_MAX);
+	}
+
+	nr_cachelines = DIV_ROUND_UP(file_size_read(file), CL_SIZE);
+	if (file->ra_start >= nr_cachelines)
+		goto out;
+
+	req->file = file;
+	req->start = file->ra_start;
+	req->nr = min_t(unsigned long, file->ra_size,
+			nr_cachelines - file->ra_start);
+	req->done = 0;
+	ret = true;
+out:
+	file->ra_prev = index;
+	spin_unlock(&file->ra_lock);
+	return ret;
+}
+
+/*
+ * Called on each cacheline access of @file at @pos, before loading it on
+ * a miss. @pgc is the cached cacheline, or NULL on a miss.
+ */
+void pgcache_readahead(struct lego_pgcache_file *file,
+		       struct lego_pgcache_struct *pgc, loff_t pos)
+{
+	struct pgcache_ra_queue *q;
+	struct pgcache_ra_req req;
+	bool marker = false;
+
+	if (pgc && (READ_ONCE(pgc->ra_unused) || READ_ONCE(pgc->ra_marker))) {
+		spin_lock(&pgc->lock);
+		if (pgc->ra_unused) {
+			pgc->ra_unused = false;
+			inc_mm_stat(PGCACHE_RA_HIT);
+		}
+		marker = pgc->ra_marker;
+		pgc->ra_marker = false;
+		spin_unlock(&pgc->lock);
+	}
+
+	if (!__pgcache_readahead(file, cacheline_index(pos), !pgc, marker, &req))
+		return;
+
+	inc_mm_stat(PGCACHE_RA_TRIGGER);
+
+	q = &get_cpu_var(pgcache_ra_queues);
+	if (q->tail - q->head < PGCACHE_RA_NR_PENDING)
+		q->reqs[q->tail++ % PGCACHE_RA_NR_PENDING] = req;
+	else
+		inc_mm_stat(PGCACHE_RA_DROP);
+	put_cpu_var(pgcache_ra_queues);
+}
+
+/* Load one cacheline ahead, return false if it failed */
+static bool pgcache_readahead_one(struct lego_pgcache_file *file,
+				  loff_t pos, bool marker)
+{
+	struct lego_pgcache_struct *pgc, *new;
+	bool used;
+
+	pgc = find_lego_pgcache_struct(file, pos);
+	if (pgc && pgc->cached_pages) {
+		/* Already cached, keep the marker for the next window */
+		if (marker) {
+			spin_lock(&pgc->lock);
+			pgc->ra_marker = true;
+			spin_unlock(&pgc->lock);
+		}
+		return true;
+	}
+
+	new = __alloc_pgcache(file, pos);
+	if (unlikely(!new))
+		return false;
+	if (unlikely(!new->cached_pages)) {
+		__free_pgcache_struct(new);
+		return false;
+	}
+
+	if (unlikely(pgcache_load(new) < 0)) {
+		__free_pgcache_struct(new);
+		return false;
+	}
+	new->ra_unused = true;
+	new->ra_marker = marker;
+
+	if (pgc) {
+		/* Non-resident HIR cacheline, hand our pages over */
+		spin_lock(&pgc->lock);
+		if (!pgc->cached_pages) {
+			pgc->cached_pages = new->cached_pages;
+			pgc->real_len = new->real_len;
+			pgc->ra_unused = true;
+			pgc->ra_marker = marker;
+			new->cached_pages = NULL;
+		}
+		spin_unlock(&pgc->lock);
+
+		/* Loaded by someone else meanwhile if we still own the pages */
+		used = !new->cached_pages;
+		__free_pgcache_struct(new);
+	} else {
+		pgc = insert_cacheline(new);
+		if (unlikely(!pgc))
+			return false;
+		used = pgc == new;
+	}
+
+	if (used) {
+		inc_mm_stat(PGCACHE_RA_CHUNKS);
+		update_lirs_structure(pgc);
+	}
+	return true;
+}
+
+/*
+ * Called by idle thpool workers.
+ * Load the next cacheline of the oldest queued window.
+ * Return false if there is nothing to do.
+ */
+bool pgcache_readahead_run_one(void)
+{
+	struct pgcache_ra_queue *q;
+	struct pgcache_ra_req *req;
+	struct lego_pgcache_file *file;
+	unsigned long index;
+	bool marker, last;
+
+	q = &get_cpu_var(pgcache_ra_queues);
+	if (q->head == q->tail) {
+		put_cpu_var(pgcache_ra_queues);
+		return false;
+	}
+	req = &q->reqs[q->head % PGCACHE_RA_NR_PENDING];
+	file = req->file;
+	index = req->start + req->done;
+	marker = req->done == 0;
+	last = ++req->done == req->nr;
+	if (last)
+		q->head++;
+	put_cpu_var(pgcache_ra_queues);
+
+	/*
+	 * Drop the rest of the window on failure. We are the only one
+	 * to consume this queue, the window is still at its head.
+	 */
+	if (!pgcache_readahead_one(file, (loff_t)index * CL_SIZE, marker) && !last) {
+		q = &get_cpu_var(pgcache_ra_queues);
+		q->head++;
+		put_cpu_var(pgcache_ra_queues);
+	}
+	return true;
+}
@@ -0,0 +1,335 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Page cache write-back
+ *
+ * Dirty cachelines of a file are written back in runs: starting from a
+ * dirty cacheline, following cachelines of the same file are appended
+ * as long as they are dirty too and the previous one is full. Each run
+ * is one M2S_WRITE, of at most PGCACHE_WB_MAX_CHUNKS cachelines.
+ *
+ * Cachelines are marked clean when copied out, and stay under writeback
+ * until storage replied. Meanwhile they may be dirtied again, but not
+ * written back by anyone else: writeback skips them, fsync and eviction
+ * wait for them. Thus writes of one cacheline reach storage in order.
+ *
+ * With MEM_PGCACHE_WRITEBACK, kpgcache_wbd periodically writes back
+ * cachelines dirty for longer than the expire interval. Once the dirty
+ * cachelines exceed the background threshold, it writes back everything
+ * until they drop below. Writers above the hard threshold write back a
+ * run of their own file before replying. Thus eviction seldom finds a
+ * dirty victim, and does not have to wait for storage.
+ */
+
+#include <lego/slab.h>
+#include <lego/sched.h>
+#include <lego/jiffies.h>
+#include <lego/kthread.h>
+#include <lego/spinlock.h>
+#include <lego/fit_ibapi.h>
+#include <memory/pgcache.h>
+#include <memory/stat.h>
+
+/* Storage receive buffer is 2MB, including the header */
+#define PGCACHE_WB_MAX_CHUNKS	4
+#define PGCACHE_WB_BATCH	32
+
+#define PGCACHE_WB_MSG_SIZE(nr_chunks)						\
+	(sizeof(u32) + sizeof(struct m2s_read_write_payload) +			\
+	 (nr_chunks) * CL_SIZE)
+
+static atomic_t nr_dirty_cachelines = ATOMIC_INIT(0);
+
+/* Files with dirty cachelines, linked by wb_list */
+static LIST_HEAD(dirty_files);
+static DEFINE_SPINLOCK(dirty_files_lock);
+
+static int pgc_pos_cmp(const void *a, const void *b)
+{
+	const struct lego_pgcache_struct *pa = *(struct lego_pgcache_struct **)a;
+	const struct lego_pgcache_struct *pb = *(struct lego_pgcache_struct **)b;
+
+	if (pa->pos < pb->pos)
+		return -1;
+	return pa->pos > pb->pos;
+}
+
+/*
+ * Copy @pgc to @content, mark it clean and under writeback, if it is
+ * still dirty and not under writeback already.
+ * Return the number of bytes copied.
+ */
+static u32 wb_grab_cacheline(struct lego_pgcache_struct *pgc, void *content)
+{
+	struct lego_pgcache_file *file = pgc->file;
+	u32 len = 0;
+
+	spin_lock(&pgc->lock);
+	if (!pgc->dirty || pgc->writeback)
+		goto out;
+
+	spin_lock(&file->dirtylist_lock);
+	pgc->dirty = false;
+	list_del_init(&pgc->dirtylist);
+	spin_unlock(&file->dirtylist_lock);
+	pgcache_account_clean();
+
+	pgc->writeback = true;
+	atomic_inc(&file->nr_writeback);
+
+	len = pgc->real_len;
+	memcpy(content, pgc->cached_pages, len);
+out:
+	spin_unlock(&pgc->lock);
+	return len;
+}
+
+static void wb_end_cacheline(struct lego_pgcache_struct *pgc)
+{
+	spin_lock(&pgc->lock);
+	pgc->writeback = false;
+	spin_unlock(&pgc->lock);
+
+	atomic_dec(&pgc->file->nr_writeback);
+}
+
+/*
+ * Write back the run starting at @pgc with one M2S_WRITE, of at most
+ * @max_chunks cachelines. Cachelines of the run stay under writeback
+ * until storage replied.
+ * Return bytes written, 0 if @pgc was cleaned or is under writeback.
+ */
+static ssize_t wb_write_run(struct lego_pgcache_struct *pgc, void *msg,
+			    unsigned int max_chunks)
+{
+	struct lego_pgcache_struct *run[PGCACHE_WB_MAX_CHUNKS];
+	struct lego_pgcache_file *file = pgc->file;
+	struct m2s_read_write_payload *payload;
+	unsigned int i, nr = 0, storage_node;
+	void *content;
+	ssize_t retval;
+	u32 *opcode, len, total = 0;
+	loff_t offset;
+
+	opcode = msg;
+	payload = msg + sizeof(*opcode);
+	content = msg + sizeof(*opcode) + sizeof(*payload);
+
+	offset = pgc->pos;
+	storage_node = pgc->storage_node;
+	while (1) {
+		len = wb_grab_cacheline(pgc, content + total);
+		if (!len)
+			break;
+
+		run[nr++] = pgc;
+		total += len;
+		if (nr == max_chunks || len < CL_SIZE)
+			break;
+
+		pgc = find_lego_pgcache_struct(file, pgc->pos + CL_SIZE);
+		if (!pgc || !READ_ONCE(pgc->dirty))
+			break;
+	}
+
+	if (!nr)
+		return 0;
+
+	*opcode = M2S_WRITE;
+	payload->uid = 0;
+	payload->flags = O_WRONLY;
+	payload->len = total;
+	payload->offset = offset;
+	pgcache_file_path(file, payload->filename);
+
+	ibapi_send_reply_imm(storage_node, msg,
+			     sizeof(*opcode) + sizeof(*payload) + total,
+			     &retval, sizeof(retval), false);
+
+	for (i = 0; i < nr; i++)
+		wb_end_cacheline(run[i]);
+
+	inc_mm_stat(PGCACHE_WB_WRITES);
+	add_mm_stat(PGCACHE_WB_CHUNKS, nr);
+	return retval;
+}
+
+/*
+ * Write back dirty cachelines of @file, oldest first.
+ * Those under writeback already are skipped, not waited for.
+ * @expire: only those dirty for at least @expire jiffies, 0 for all
+ * @max_runs: stop after this many M2S_WRITEs, 0 for no limit
+ */
+ssize_t pgcache_writeback_file(struct lego_pgcache_file *file,
+			       unsigned long expire, unsigned int max_runs)
+{
+	struct lego_pgcache_struct *batch[PGCACHE_WB_BATCH], *pgc;
+	unsigned int nr, i, nr_runs = 0, batch_runs;
+	unsigned int max_chunks = PGCACHE_WB_MAX_CHUNKS;
+	ssize_t ret, written = 0;
+	void *msg;
+
+	if (list_empty(&file->head))
+		return 0;
+
+	/*
+	 * A full run needs a high-order buffer. If memory is fragmented,
+	 * write back one cacheline per M2S_WRITE, as eviction does.
+	 */
+	msg = kmalloc(PGCACHE_WB_MSG_SIZE(max_chunks), GFP_KERNEL | __GFP_NOWARN);
+	if (unlikely(!msg)) {
+		max_chunks = 1;
+		msg = kmalloc(PGCACHE_WB_MSG_SIZE(max_chunks),
+			      GFP_KERNEL | __GFP_NOWARN);
+		if (!msg)
+			return -ENOMEM;
+	}
+
+	do {
+		/*
+		 * Cachelines are never freed while the page cache is in use,
+		 * pointers stay valid after the lock is dropped.
+		 */
+		nr = 0;
+		spin_lock(&file->dirtylist_lock);
+		list_for_each_entry_reverse(pgc, &file->head, dirtylist) {
+			if (expire && time_before(jiffies, pgc->dirtied_when + expire))
+				break;
+			batch[nr++] = pgc;
+			if (nr == PGCACHE_WB_BATCH)
+				break;
+		}
+		spin_unlock(&file->dirtylist_lock);
+
+		/* Sort by offset, so that runs start at their lowest cacheline */
+		sort(batch, nr, sizeof(*batch), pgc_pos_cmp, NULL);
+
+		batch_runs = 0;
+		for (i = 0; i < nr; i++) {
+			if (!READ_ONCE(batch[i]->dirty))
+				continue;
+
+			ret = wb_write_run(batch[i], msg, max_chunks);
+			if (ret < 0) {
+				written = ret;
+				goto out;
+			}
+			if (!ret)
+				continue;
+			written += ret;
+			batch_runs++;
+
+			if (max_runs && ++nr_runs >= max_runs)
+				goto out;
+		}
+
+		/* The whole batch is under writeback, it would come back again */
+	} while (nr == PGCACHE_WB_BATCH && batch_runs);
+
+out:
+	kfree(msg);
+	return written;
+}
+
+void pgcache_account_dirty(struct lego_pgcache_file *file)
+{
+	atomic_inc(&nr_dirty_cachelines);
+
+	spin_lock(&dirty_files_lock);
+	if (list_empty(&file->wb_list))
+		list_add_tail(&file->wb_list, &dirty_files);
+	spin_unlock(&dirty_files_lock);
+}
+
+void pgcache_account_clean(void)
+{
+	atomic_dec(&nr_dirty_cachelines);
+}
+
+#ifdef CONFIG_MEM_PGCACHE_WRITEBACK
+#define PGCACHE_WB_INTERVAL_MS	1000
+#define PGCACHE_DIRTY_EXPIRE	msecs_to_jiffies(CONFIG_MEM_PGCACHE_DIRTY_EXPIRE_MS)
+#define PGCACHE_DIRTY_LIMIT	(MAX_CACHELINES / 100 * CONFIG_MEM_PGCACHE_DIRTY_RATIO)
+#define PGCACHE_DIRTY_BG_LIMIT	(PGCACHE_DIRTY_LIMIT / 2)
+
+static struct task_struct *pgcache_wb_task;
+
+static inline bool over_bground_thresh(void)
+{
+	return atomic_read(&nr_dirty_cachelines) > PGCACHE_DIRTY_BG_LIMIT;
+}
+
+/* One pass over all files with dirty cachelines */
+static void pgcache_writeback_all(void)
+{
+	struct lego_pgcache_file *file;
+	LIST_HEAD(list);
+
+	spin_lock(&dirty_files_lock);
+	list_splice_init(&dirty_files, &list);
+	spin_unlock(&dirty_files_lock);
+
+	/*
+	 * Writers only check whether wb_list is empty, thus files stay
+	 * on our private list until we are done with them.
+	 */
+	while (!list_empty(&list)) {
+		file = list_first_entry(&list, struct lego_pgcache_file, wb_list);
+
+		pgcache_writeback_file(file,
+			over_bground_thresh() ? 0 : PGCACHE_DIRTY_EXPIRE, 0);
+
+		spin_lock(&dirty_files_lock);
+		list_del_init(&file->wb_list);
+		if (!list_empty(&file->head))
+			list_add_tail(&file->wb_list, &dirty_files);
+		spin_unlock(&dirty_files_lock);
+	}
+}
+
+static int kpgcache_wbd(void *unused)
+{
+	set_cpus_allowed_ptr(current, cpu_active_mask);
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_timeout(msecs_to_jiffies(PGCACHE_WB_INTERVAL_MS));
+
+		pgcache_writeback_all();
+	}
+	BUG();
+	return 0;
+}
+
+/*
+ * Called after a write to @file.
+ * Kick the flusher above the background threshold, and write back
+ * one run of @file ourselves above the hard one.
+ */
+void pgcache_balance_dirty(struct lego_pgcache_file *file)
+{
+	if (!over_bground_thresh())
+		return;
+
+	wake_up_process(pgcache_wb_task);
+
+	if (atomic_read(&nr_dirty_cachelines) > PGCACHE_DIRTY_LIMIT) {
+		inc_mm_stat(PGCACHE_WB_THROTTLE);
+		pgcache_writeback_file(file, 0, 1);
+	}
+}
+
+void __init pgcache_writeback_init(void)
+{
+	pgcache_wb_task = kthread_run(kpgcache_wbd, NULL, "kpgcache_wbd");
+	if (IS_ERR(pgcache_wb_task))
+		panic("Fail to create kpgcache_wbd");
+}
+#endif /* CONFIG_MEM_PGCACHE_WRITEBACK */
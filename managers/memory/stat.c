@@ -16,7 +16,10 @@ struct memory_manager_stat memory_manager_stats;
 static const char *const memory_manager_stat_text[] = {
 	/* Handler group */
 	"handle_pcache_miss",
+	"handle_pcache_miss_huge",
 	"handle_pcache_flush",
+	"handle_pcache_flush_batch",
+	"handle_pcache_flush_delta",
 	"handle_pcache_replica",
 	"handle_p2m_mmap",
 	"handle_p2m_munmap",
@@ -29,7 +32,37 @@ static const char *const memory_manager_stat_text[] = {
 	"handle_write",
 
 	/* replication */
-	"nr_batched_log_flush"
+	"nr_batched_log_flush",
+
+	/* speculative pcache miss */
+	"speculative_miss",
+	"speculative_miss_fail",
+
+	/* huge anonymous pages */
+	"huge_anon_fault",
+	"huge_anon_fallback",
+	"huge_anon_split",
+
+	/* anonymous prefetch */
+	"anon_prefetch_miss",
+	"anon_prefetch_trigger",
+	"anon_prefetch_drop",
+	"anon_prefetch_pages",
+	"anon_prefetch_useful",
+
+	/* memory-side page cache */
+	"pgcache_hit",
+	"pgcache_miss",
+	"pgcache_evict",
+	"pgcache_evict_dirty",
+	"pgcache_ra_trigger",
+	"pgcache_ra_drop",
+	"pgcache_ra_chunks",
+	"pgcache_ra_hit",
+	"pgcache_ra_waste",
+	"pgcache_wb_writes",
+	"pgcache_wb_chunks",
+	"pgcache_wb_throttle",
 };
 
 #ifdef CONFIG_COUNTER_MEMORY_HANDLER
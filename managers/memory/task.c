@@ -7,8 +7,10 @@
  * (at your option) any later version.
  */
 
-#include <lego/kernel.h>
+#include <lego/hash.h>
 #include <lego/slab.h>
+#include <lego/percpu.h>
+#include <lego/kernel.h>
 #include <lego/hashtable.h>
 #include <lego/spinlock.h>
 #include <lego/comp_memory.h>
@@ -17,37 +19,82 @@
 #include <memory/pid.h>
 #include <memory/task.h>
 
+/*
+ * (node, pid) -> lego_task_struct
+ *
+ * Every miss, flush and zerofill handler looks up its task, so this
+ * must not be a global serialization point. Each bucket has its own lock,
+ * and each CPU remembers its last hit. Thpool workers are pinned, and
+ * consecutive requests tend to come from the same process, so most
+ * lookups do not touch any shared lock at all.
+ *
+ * The hashtable holds one reference of each task, and each per-CPU cache
+ * holds another one of its cached task. free_lego_task() unhashes the
+ * task and bumps lego_task_gen, which makes all caches stale. A stale
+ * cache drops its reference at its next lookup.
+ */
+
 #define PID_ARRAY_HASH_BITS	10
+#define PID_ARRAY_SIZE		(1 << PID_ARRAY_HASH_BITS)
+
+struct pid_hash_bucket {
+	spinlock_t		lock;
+	struct hlist_head	head;
+} ____cacheline_aligned;
+
+static struct pid_hash_bucket node_pid_hash[PID_ARRAY_SIZE] = {
+	[0 ... PID_ARRAY_SIZE - 1] = {
+		.lock = __SPIN_LOCK_UNLOCKED(node_pid_hash.lock),
+		.head = HLIST_HEAD_INIT,
+	}
+};
+
+struct lego_task_cache {
+	unsigned int		node;
+	unsigned int		pid;
+	int			gen;
+	struct lego_task_struct	*tsk;
+};
 
-static DEFINE_HASHTABLE(node_pid_hash, PID_ARRAY_HASH_BITS);
-static DEFINE_SPINLOCK(hashtable_lock);
+static DEFINE_PER_CPU(struct lego_task_cache, lego_task_caches);
+static atomic_t lego_task_gen = ATOMIC_INIT(0);
 
-static int getKey(unsigned int node, unsigned int pid)
+static inline struct pid_hash_bucket *
+pid_hash_bucket(unsigned int node, unsigned int pid)
 {
-        return node*10000+pid*10;
+	return &node_pid_hash[hash_32(node * 10000 + pid, PID_ARRAY_HASH_BITS)];
+}
+
+void put_lego_task(struct lego_task_struct *tsk)
+{
+	if (atomic_dec_and_test(&tsk->usage)) {
+		BUG_ON(hash_hashed(&tsk->link));
+		kfree(tsk);
+	}
 }
 
 int __must_check ht_insert_lego_task(struct lego_task_struct *tsk)
 {
 	struct lego_task_struct *p;
-	unsigned int key;
+	struct pid_hash_bucket *b;
 	unsigned int node, pid;
 
 	BUG_ON(!tsk || !tsk->pid);
 
 	pid = tsk->pid;
 	node = tsk->node;
-	key = getKey(node, pid);
+	b = pid_hash_bucket(node, pid);
 
-	spin_lock(&hashtable_lock);
-	hash_for_each_possible(node_pid_hash, p, link, key) {
-		if (unlikely(p->pid == pid && p->node ==node)) {
-			spin_unlock(&hashtable_lock);
+	spin_lock(&b->lock);
+	hlist_for_each_entry(p, &b->head, link) {
+		if (unlikely(p->pid == pid && p->node == node)) {
+			spin_unlock(&b->lock);
 			return -EEXIST;
 		}
 	}
-	hash_add(node_pid_hash, &tsk->link, key);
-	spin_unlock(&hashtable_lock);
+	/* The reference from alloc_lego_task_struct() goes to hashtable */
+	hlist_add_head(&tsk->link, &b->head);
+	spin_unlock(&b->lock);
 
 	return 0;
 }
@@ -59,6 +106,7 @@ struct lego_task_struct *alloc_lego_task_struct(void)
 	tsk = kzalloc(sizeof(*tsk), GFP_KERNEL);
 	if (tsk) {
 		spin_lock_init(&tsk->task_lock);
+		atomic_set(&tsk->usage, 1);
 	}
 	return tsk;
 }
@@ -73,64 +121,164 @@ void free_lego_task_struct(struct lego_task_struct *tsk)
 	kfree(tsk);
 }
 
+/*
+ * Unhash @tsk and drop the hashtable reference.
+ * @tsk is freed once all lookups and caches are done with it.
+ */
 void free_lego_task(struct lego_task_struct *tsk)
 {
-	unsigned int node, pid, key;
-	struct lego_task_struct *p;
+	struct pid_hash_bucket *b;
 
 	BUG_ON(!tsk);
 	BUG_ON(!hash_hashed(&tsk->link));
 
-	node = tsk->node;
-	pid = tsk->pid;
-	key = getKey(node, pid);
-
-	spin_lock(&hashtable_lock);
-	hash_for_each_possible(node_pid_hash, p, link, key) {
-		if (likely(p->node == node && p->pid == pid)) {
-			hash_del(&p->link);
-			spin_unlock(&hashtable_lock);
-			kfree(tsk);
-			return;
+	b = pid_hash_bucket(tsk->node, tsk->pid);
+	spin_lock(&b->lock);
+	hlist_del_init(&tsk->link);
+	spin_unlock(&b->lock);
+
+	atomic_inc(&lego_task_gen);
+	put_lego_task(tsk);
+}
+
+static struct lego_task_struct *
+__find_get_lego_task(unsigned int node, unsigned int pid)
+{
+	struct lego_task_struct *tsk;
+	struct pid_hash_bucket *b;
+
+	b = pid_hash_bucket(node, pid);
+	spin_lock(&b->lock);
+	hlist_for_each_entry(tsk, &b->head, link) {
+		if (likely(tsk->pid == pid && tsk->node == node)) {
+			get_lego_task(tsk);
+			spin_unlock(&b->lock);
+			return tsk;
 		}
 	}
-	spin_unlock(&hashtable_lock);
-	WARN(1, "fail to find tsk->(node:%u,pid:%u)\n", node, pid);
+	spin_unlock(&b->lock);
+
+	return NULL;
 }
 
-struct lego_task_struct *
-find_lego_task_by_pid(unsigned int node, unsigned int pid)
+/*
+ * Look up the cache of this CPU first, refill it on miss.
+ * If @get is true, return with a reference held.
+ */
+static struct lego_task_struct *
+__find_lego_task_by_pid(unsigned int node, unsigned int pid, bool get)
 {
-	struct lego_task_struct *tsk;
-	unsigned int key;
+	struct lego_task_cache *c;
+	struct lego_task_struct *tsk, *stale = NULL;
+	int gen;
 
 	if (unlikely(!pid))
 		return NULL;
 
-	key = getKey(node, pid);
-	spin_lock(&hashtable_lock);
-	hash_for_each_possible(node_pid_hash, tsk, link, key) {
-		if (likely(tsk->pid == pid && tsk->node == node)) {
-			spin_unlock(&hashtable_lock);
+	c = &get_cpu_var(lego_task_caches);
+	gen = atomic_read(&lego_task_gen);
+	if (likely(c->tsk && c->gen == gen)) {
+		if (likely(c->node == node && c->pid == pid)) {
+			tsk = c->tsk;
+			if (get)
+				get_lego_task(tsk);
+			put_cpu_var(lego_task_caches);
 			return tsk;
 		}
-        }
-        spin_unlock(&hashtable_lock);
+	}
 
-	return NULL;
+	tsk = __find_get_lego_task(node, pid);
+	if (likely(tsk)) {
+		stale = c->tsk;
+		get_lego_task(tsk);
+		c->tsk = tsk;
+		c->node = node;
+		c->pid = pid;
+		c->gen = gen;
+	}
+	put_cpu_var(lego_task_caches);
+
+	if (stale)
+		put_lego_task(stale);
+	if (tsk && !get)
+		put_lego_task(tsk);
+	return tsk;
+}
+
+/*
+ * Return the task of (@node, @pid), without taking a reference.
+ * The task stays valid until free_lego_task().
+ */
+struct lego_task_struct *
+find_lego_task_by_pid(unsigned int node, unsigned int pid)
+{
+	return __find_lego_task_by_pid(node, pid, false);
+}
+
+/*
+ * Return the task of (@node, @pid) with a reference held,
+ * the caller must put_lego_task() once done.
+ *
+ * The reference keeps the task struct, not its mm: the task may still
+ * exit and drop its mm meanwhile. Use lego_get_task_mm() to pin it.
+ */
+struct lego_task_struct *
+find_get_lego_task_by_pid(unsigned int node, unsigned int pid)
+{
+	return __find_lego_task_by_pid(node, pid, true);
+}
+
+/*
+ * Take a reference on up to @nr tasks, walking buckets from *@pos on.
+ * Only whole buckets are taken, unless the first one alone has more
+ * than @nr tasks. *@pos is moved past the buckets taken.
+ *
+ * Return the number of tasks put into @tasks, 0 once all buckets are done.
+ */
+int get_lego_tasks(struct lego_task_struct **tasks, int nr, int *pos)
+{
+	struct lego_task_struct *p;
+	struct pid_hash_bucket *b;
+	int n = 0, cnt;
+
+	for (; *pos < PID_ARRAY_SIZE; (*pos)++) {
+		b = &node_pid_hash[*pos];
+
+		spin_lock(&b->lock);
+		cnt = 0;
+		hlist_for_each_entry(p, &b->head, link)
+			cnt++;
+		if (n && n + cnt > nr) {
+			spin_unlock(&b->lock);
+			break;
+		}
+
+		hlist_for_each_entry(p, &b->head, link) {
+			if (n == nr)
+				break;
+			get_lego_task(p);
+			tasks[n++] = p;
+		}
+		spin_unlock(&b->lock);
+	}
+	return n;
 }
 
 void dump_lego_tasks(void)
 {
 	struct lego_task_struct *p;
+	struct pid_hash_bucket *b;
 	int i;
 
-	spin_lock(&hashtable_lock);
 	pr_info("----- Start Dump Tasks\n");
-	hash_for_each(node_pid_hash, i, p, link) {
-		pr_info("  node:%u comm: %s pid: %u vnode_id: %u parent_pid:%u home_node: %u\n",
-			p->node, p->comm, p->pid, p->vnode_id, p->parent_pid, p->home_node);
+	for (i = 0; i < PID_ARRAY_SIZE; i++) {
+		b = &node_pid_hash[i];
+		spin_lock(&b->lock);
+		hlist_for_each_entry(p, &b->head, link) {
+			pr_info("  node:%u comm: %s pid: %u vnode_id: %u parent_pid:%u home_node: %u\n",
+				p->node, p->comm, p->pid, p->vnode_id, p->parent_pid, p->home_node);
+		}
+		spin_unlock(&b->lock);
 	}
 	pr_info("----- Finish Dump Tasks\n");
-	spin_unlock(&hashtable_lock);
 }
@@ -16,6 +16,9 @@
 #include <lego/comp_storage.h>
 
 #include <memory/vm.h>
+#include <memory/zswap.h>
+#include <memory/zeropool.h>
+#include <memory/huge_memory.h>
 #include <memory/file_ops.h>
 #include <memory/vm-pgtable.h>
 
@@ -93,7 +96,7 @@ static int do_anonymous_page(struct vm_area_struct *vma, unsigned long address,
 	unsigned long vaddr;
 	struct lego_mm_struct *mm = vma->vm_mm;
 
-	vaddr = __get_free_page(GFP_KERNEL | __GFP_ZERO);
+	vaddr = alloc_zeroed_page();
 	if (!vaddr)
 		return VM_FAULT_OOM;
 
@@ -111,8 +114,11 @@ static int do_anonymous_page(struct vm_area_struct *vma, unsigned long address,
 		entry = pte_mkwrite(pte_mkdirty(entry));
 
 	page_table = lego_pte_offset_lock(mm, pmd, address, &ptl);
-	if (!pte_none(*page_table))
+	if (!pte_none(*page_table)) {
+		/* Someone else mapped it meanwhile */
+		free_page(vaddr);
 		goto unlock;
+	}
 
 	pte_set(page_table, entry);
 unlock:
@@ -122,9 +128,45 @@ unlock:
 	return 0;
 }
 
+/*
+ * Bring back a page from the compressed tier.
+ * Decompression is done under the pte lock, which keeps the entry alive.
+ */
+static int do_zswap_page(struct vm_area_struct *vma, unsigned long address,
+			 unsigned int flags, pte_t *page_table, pmd_t *pmd,
+			 pte_t orig_pte, unsigned long *mapping_flags)
+{
+	spinlock_t *ptl;
+	unsigned long vaddr;
+	struct lego_mm_struct *mm = vma->vm_mm;
+	int ret = 0;
+
+	vaddr = __get_free_page(GFP_KERNEL);
+	if (!vaddr)
+		return VM_FAULT_OOM;
+
+	page_table = lego_pte_offset_lock(mm, pmd, address, &ptl);
+	if (unlikely(!pte_same(*page_table, orig_pte))) {
+		/* Someone else brought it back meanwhile */
+		free_page(vaddr);
+		goto unlock;
+	}
+
+	if (unlikely(zswap_load(page_table, orig_pte, vaddr))) {
+		free_page(vaddr);
+		ret = VM_FAULT_SIGBUS;
+	}
+unlock:
+	lego_pte_unlock(page_table, ptl);
+	if (mapping_flags)
+		*mapping_flags = PCACHE_MAPPING_ANON;
+	return ret;
+}
+
 DEFINE_PROFILE_POINT(anon_fault)
 DEFINE_PROFILE_POINT(file_fault)
 DEFINE_PROFILE_POINT(wp_fault)
+DEFINE_PROFILE_POINT(zswap_fault)
 
 static int handle_pte_fault(struct vm_area_struct *vma, unsigned long address,
 			    unsigned int flags, pte_t *pte, pmd_t *pmd,
@@ -137,6 +179,7 @@ static int handle_pte_fault(struct vm_area_struct *vma, unsigned long address,
 	PROFILE_POINT_TIME(anon_fault)
 	PROFILE_POINT_TIME(file_fault)
 	PROFILE_POINT_TIME(wp_fault)
+	PROFILE_POINT_TIME(zswap_fault)
 
 	entry = *pte;
 	if (likely(!pte_present(entry))) {
@@ -156,9 +199,18 @@ static int handle_pte_fault(struct vm_area_struct *vma, unsigned long address,
 			}
 		}
 
+		if (is_zswap_pte(entry)) {
+			PROFILE_START(zswap_fault);
+			ret = do_zswap_page(vma, address, flags,
+					    pte, pmd, entry, mapping_flags);
+			PROFILE_LEAVE(zswap_fault);
+			return ret;
+		}
+
 		/*
-		 * Lego does not fill extra info into PTE at Memory side.
-		 * We only fill Zerofill bit at Processor side.
+		 * Lego does not fill extra info into PTE at Memory side,
+		 * other than compressed pages. We only fill Zerofill bit
+		 * at Processor side.
 		 */
 		dump_pte(pte, NULL);
 		BUG();
@@ -245,13 +297,23 @@ int handle_lego_mm_fault(struct vm_area_struct *vma, unsigned long address,
 	pmd = lego_pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
+
+	do_huge_anonymous_page(vma, address, pmd);
+	if (lego_pmd_trans_huge(READ_ONCE(*pmd)))
+		goto huge;
+
 	pte = lego_pte_alloc(mm, pmd, address);
 	if (!pte)
 		return VM_FAULT_OOM;
 
+	/* Someone mapped a huge page before the pte table went in */
+	if (unlikely(lego_pmd_trans_huge(READ_ONCE(*pmd))))
+		goto huge;
+
 	ret = handle_pte_fault(vma, address, flags, pte, pmd, mapping_flags);
 	if (unlikely(ret))
 		return ret;
+	zswap_mark_young(pte);
 
 	/*
 	 * Return the kernel virtual address of the new
@@ -260,6 +322,109 @@ int handle_lego_mm_fault(struct vm_area_struct *vma, unsigned long address,
 	if (ret_va)
 		*ret_va = pte_val(*pte) & PTE_VFN_MASK;
 	return 0;
+
+huge:
+	/*
+	 * Write to a write-protected huge pmd is left
+	 * alone, same as do_wp_page() does for ptes.
+	 */
+	if (ret_va)
+		*ret_va = lego_huge_pmd_subpage(READ_ONCE(*pmd), address);
+	if (mapping_flags)
+		*mapping_flags = PCACHE_MAPPING_ANON;
+	return 0;
+}
+
+#ifdef CONFIG_MEM_SPECULATIVE_MISS
+/*
+ * Lockless version of handle_lego_mm_fault(), for pages already mapped.
+ * Nothing is allocated or changed. Caller holds no lock, and must validate
+ * the result with mm->vma_seq. Caller must be within speculative_walk_begin()
+ * and speculative_walk_end(), so page table pages are not freed under us.
+ *
+ * Return 0 and the kernel virtual address of the page in @ret_va,
+ * or -EAGAIN if the locked path is needed.
+ */
+int lego_speculative_mm_fault(struct lego_mm_struct *mm, unsigned long address,
+			      unsigned int flags, unsigned long *ret_va)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd, pmdval;
+	pte_t entry;
+
+	pgd = lego_pgd_offset(mm, address);
+	if (pgd_none(READ_ONCE(*pgd)))
+		return -EAGAIN;
+	pud = lego_pud_offset(pgd, address);
+	if (pud_none(READ_ONCE(*pud)))
+		return -EAGAIN;
+	pmd = lego_pmd_offset(pud, address);
+	pmdval = READ_ONCE(*pmd);
+	if (pmd_none(pmdval))
+		return -EAGAIN;
+
+	if (lego_pmd_trans_huge(pmdval)) {
+		if ((flags & FAULT_FLAG_WRITE) && !(pmd_flags(pmdval) & _PAGE_RW))
+			return -EAGAIN;
+		*ret_va = lego_huge_pmd_subpage(pmdval, address);
+		return 0;
+	}
+
+	entry = READ_ONCE(*lego_pte_offset(pmd, address));
+	if (!pte_present(entry))
+		return -EAGAIN;
+
+	/* COW is left to the locked path */
+	if ((flags & FAULT_FLAG_WRITE) && !pte_write(entry))
+		return -EAGAIN;
+
+	/* Only the locked path may tell the cold page scanner */
+	if (IS_ENABLED(CONFIG_MEM_ZSWAP) && !pte_young(entry))
+		return -EAGAIN;
+
+	*ret_va = pte_val(entry) & PTE_VFN_MASK;
+	return 0;
+}
+#endif
+
+/*
+ * Map a zeroed page at @address of anonymous @vma, if nothing is there.
+ * Used by speculative population, caller holds mmap_sem.
+ *
+ * Return 1 if a new page is mapped, 0 if it was mapped already,
+ * or -ENOMEM.
+ */
+int lego_populate_anon_page(struct vm_area_struct *vma, unsigned long address)
+{
+	struct lego_mm_struct *mm = vma->vm_mm;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+	pte_t *pte;
+
+	pgd = lego_pgd_offset(mm, address);
+	pud = lego_pud_alloc(mm, pgd, address);
+	if (!pud)
+		return -ENOMEM;
+	pmd = lego_pmd_alloc(mm, pud, address);
+	if (!pmd)
+		return -ENOMEM;
+
+	do_huge_anonymous_page(vma, address, pmd);
+	if (lego_pmd_trans_huge(READ_ONCE(*pmd)))
+		return 0;
+
+	pte = lego_pte_alloc(mm, pmd, address);
+	if (!pte)
+		return -ENOMEM;
+
+	if (unlikely(lego_pmd_trans_huge(READ_ONCE(*pmd))) || !pte_none(*pte))
+		return 0;
+
+	if (do_anonymous_page(vma, address, 0, pte, pmd, NULL))
+		return -ENOMEM;
+	return 1;
 }
 
 /*
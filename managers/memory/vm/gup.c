@@ -11,6 +11,8 @@
 #include <lego/rwsem.h>
 #include <lego/kernel.h>
 #include <memory/vm.h>
+#include <memory/zswap.h>
+#include <memory/huge_memory.h>
 
 int faultin_page(struct vm_area_struct *vma, unsigned long start,
 		 unsigned long flags, unsigned long *kvaddr)
@@ -56,9 +58,13 @@ unsigned long find_page(struct vm_area_struct *vma, unsigned long address)
 	if (pmd_none(*pmd))
 		return 0;
 
+	if (lego_pmd_trans_huge(*pmd))
+		return lego_huge_pmd_subpage(*pmd, address);
+
 	pte = lego_pte_offset(pmd, address);
-	if (pte_none(*pte))
+	if (!pte_present(*pte))
 		return 0;
+	zswap_mark_young(pte);
 
 	/* extract vfn from pte */
 	page = pte_val(*pte) & PTE_VFN_MASK;
@@ -100,8 +106,11 @@ retry:
 				return i ? i : ret;
 		}
 
-		if (pages)
+		if (pages) {
+			if (gup_flags & FOLL_GET)
+				get_page(virt_to_page(page));
 			pages[i] = page;
+		}
 		if (vmas)
 			vmas[i] = vma;
 
@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * 2MB backing for large anonymous VMAs
+ *
+ * The first fault on an empty pmd of a large anonymous VMA allocates a
+ * zeroed 2MB page and maps it with a single huge pmd. There is no pte
+ * table, and later walks stop at the pmd.
+ *
+ * The 2MB page is split into 512 independently refcounted 4KB pages
+ * right after allocation. Fork can then share it like 512 ptes, and any
+ * walker that does not know about huge pmds can split it back into a
+ * pte table in place, without touching the data.
+ *
+ * Huge pmds are created on fault only. They are split on partial zap and
+ * mremap, and never collapsed back.
+ */
+
+#include <lego/mm.h>
+#include <lego/gfp.h>
+#include <lego/kernel.h>
+#include <lego/comp_memory.h>
+
+#include <memory/vm.h>
+#include <memory/stat.h>
+#include <memory/vm-pgtable.h>
+#include <memory/huge_memory.h>
+
+#define HUGE_ANON_MIN_VMA_SIZE	(CONFIG_MEM_HUGE_ANON_MIN_VMA_MB << 20)
+
+static bool transhuge_vma_suitable(struct vm_area_struct *vma,
+				   unsigned long address)
+{
+	unsigned long haddr = address & PMD_MASK;
+
+	if (!vma_is_anonymous(vma) || (vma->vm_flags & VM_NOHUGEPAGE))
+		return false;
+	if (vma->vm_end - vma->vm_start < HUGE_ANON_MIN_VMA_SIZE)
+		return false;
+	return haddr >= vma->vm_start && haddr + PMD_SIZE <= vma->vm_end;
+}
+
+/* Same as split_page(): make each 4KB page freeable on its own */
+static void split_huge_page_refcount(struct page *page)
+{
+	int i;
+
+	for (i = 1; i < HPAGE_PMD_NR; i++)
+		set_page_refcounted(page + i);
+}
+
+/*
+ * Try to map a zeroed 2MB page at the empty @pmd.
+ * On failure, the pmd is left empty and caller falls back to ptes.
+ * Caller holds mmap_sem.
+ */
+void do_huge_anonymous_page(struct vm_area_struct *vma, unsigned long address,
+			    pmd_t *pmd)
+{
+	struct lego_mm_struct *mm = vma->vm_mm;
+	struct page *page;
+	unsigned long vaddr;
+	spinlock_t *ptl;
+	pmd_t entry;
+
+	if (!pmd_none(*pmd) || !transhuge_vma_suitable(vma, address))
+		return;
+
+	page = alloc_pages(GFP_KERNEL | __GFP_ZERO | __GFP_NOWARN, HPAGE_PMD_ORDER);
+	if (unlikely(!page)) {
+		inc_mm_stat(HUGE_ANON_FALLBACK);
+		return;
+	}
+	vaddr = (unsigned long)page_address(page);
+
+	entry = __pmd(vaddr | pgprot_val(vma->vm_page_prot));
+	entry = pmd_mkhuge(entry);
+	if (vma->vm_flags & VM_WRITE)
+		entry = pmd_mkwrite(pmd_mkdirty(entry));
+
+	ptl = lego_pmd_lock(mm, pmd);
+	if (unlikely(!pmd_none(*pmd))) {
+		/* Someone else mapped it meanwhile, still one 2MB page */
+		spin_unlock(ptl);
+		free_pages(vaddr, HPAGE_PMD_ORDER);
+		return;
+	}
+	pmd_set(pmd, entry);
+
+	/* Before anyone can split or zap it */
+	split_huge_page_refcount(page);
+	spin_unlock(ptl);
+
+	inc_mm_stat(HUGE_ANON_FAULT);
+}
+
+/*
+ * Return the kernel virtual address of the 2MB page mapping @address,
+ * or 0 if @address is not mapped by a huge pmd.
+ */
+unsigned long lego_find_huge_page(struct lego_mm_struct *mm, unsigned long address)
+{
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t pmd;
+
+	pgd = lego_pgd_offset(mm, address);
+	if (pgd_none(*pgd))
+		return 0;
+	pud = lego_pud_offset(pgd, address);
+	if (pud_none(*pud))
+		return 0;
+
+	pmd = READ_ONCE(*lego_pmd_offset(pud, address));
+	if (!lego_pmd_trans_huge(pmd))
+		return 0;
+	return lego_huge_pmd_vaddr(pmd);
+}
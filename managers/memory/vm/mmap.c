@@ -1238,11 +1238,14 @@ int vm_munmap(struct lego_task_struct *p, unsigned long start, size_t len)
 	if (down_write_killable(&mm->mmap_sem))
 		return -EINTR;
 
+	vma_seq_write_begin(mm);
+
 #ifdef CONFIG_DISTRIBUTED_VMA_MEMORY
 	ret = distvm_munmap_homenode(mm, start, len);
 #else
 	ret = do_munmap(mm, start, len);
 #endif
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	return ret;
@@ -1858,12 +1861,15 @@ unsigned long vm_mmap_pgoff(struct lego_task_struct *p, struct lego_file *file,
 	if (down_write_killable(&p->mm->mmap_sem))
 		return -EINTR;
 
+	vma_seq_write_begin(p->mm);
+
 #ifdef CONFIG_DISTRIBUTED_VMA_MEMORY
 	ret = distvm_mmap_homenode(p->mm, file, addr, len, prot, flag, pgoff);
 #else
 	ret = do_mmap_pgoff(p, file, addr, len, prot, flag, pgoff);
 #endif
 
+	vma_seq_write_end(p->mm);
 	up_write(&p->mm->mmap_sem);
 	return ret;
 }
@@ -1967,11 +1973,14 @@ int vm_brk(struct lego_task_struct *tsk,
 	if (down_write_killable(&mm->mmap_sem))
 		return -EINTR;
 
+	vma_seq_write_begin(mm);
+
 #ifdef CONFIG_DISTRIBUTED_VMA_MEMORY
 	ret = distvm_brk_homenode(tsk->mm, start, len);
 #else
 	ret = do_brk(tsk, start, len);
 #endif
+	vma_seq_write_end(mm);
 	up_write(&mm->mmap_sem);
 
 	/* Prepopulate brk pages */
@@ -2009,6 +2018,16 @@ lego_mm_init(struct lego_mm_struct *mm, struct lego_task_struct *p)
 	atomic_set(&mm->mm_count, 1);
 	init_rwsem(&mm->mmap_sem);
 	spin_lock_init(&mm->lego_page_table_lock);
+	vma_seq_init(mm);
+#ifdef CONFIG_MEM_ANON_PREFETCH
+	/* Do not inherit parent streams on fork */
+	spin_lock_init(&mm->anon_prefetch_lock);
+	mm->anon_prefetch_clock = 0;
+	memset(mm->anon_streams, 0, sizeof(mm->anon_streams));
+#endif
+#ifdef CONFIG_MEM_ZSWAP
+	mm->zswap_scan_addr = 0;
+#endif
 #ifdef CONFIG_DISTRIBUTED_VMA_MEMORY
 	if (is_homenode(p))
 		distvm_init_homenode(mm, false);
@@ -2052,10 +2071,30 @@ void __lego_mmdrop(struct lego_mm_struct *mm)
 void __lego_mmput(struct lego_mm_struct *mm)
 {
 	BUG_ON(atomic_read(&mm->mm_users));
+
+	/* Never ended: speculative readers of this mm must always fail */
+	vma_seq_write_begin(mm);
+	vma_seq_exit(mm);
 	exit_lego_mmap(mm);
 	lego_mmdrop(mm);
 }
 
+/*
+ * Return the mm of @tsk with mm_users raised, or NULL if it has none or
+ * the mm is being torn down. The caller drops it with lego_mmput().
+ */
+struct lego_mm_struct *lego_get_task_mm(struct lego_task_struct *tsk)
+{
+	struct lego_mm_struct *mm;
+
+	lego_task_lock(tsk);
+	mm = tsk->mm;
+	if (mm && !atomic_inc_not_zero(&mm->mm_users))
+		mm = NULL;
+	lego_task_unlock(tsk);
+	return mm;
+}
+
 void vm_stat_account(struct lego_mm_struct *mm, vm_flags_t flags, long npages)
 {
 	mm->total_vm += npages;
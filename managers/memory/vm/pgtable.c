@@ -11,7 +11,10 @@
 #include <lego/comp_memory.h>
 
 #include <memory/vm.h>
+#include <memory/stat.h>
+#include <memory/zswap.h>
 #include <memory/vm-pgtable.h>
+#include <memory/huge_memory.h>
 
 #define PGALLOC_GFP	(GFP_KERNEL | __GFP_ZERO)
 
@@ -201,6 +204,8 @@ static inline void free_pmd_range(struct lego_mm_struct *mm, pud_t *pud,
 		next = pmd_addr_end(addr, end);
 		if (pmd_none(*pmd))
 			continue;
+		/* Huge pmds must have been zapped by now */
+		BUG_ON(lego_pmd_trans_huge(*pmd));
 		free_pte_range(mm, pmd, addr);
 	} while (pmd++, addr = next, addr != end);
 
@@ -308,6 +313,9 @@ void lego_free_pgd_range(struct lego_mm_struct *mm,
 	if (addr > end - 1)
 		return;
 
+	/* Lockless walkers may be reading the pages we are about to free */
+	wait_speculative_walkers(mm);
+
 	pgd = lego_pgd_offset(mm, addr);
 	do {
 		next = pgd_addr_end(addr, end);
@@ -332,6 +340,96 @@ void lego_free_pgtables(struct vm_area_struct *vma,
 	}
 }
 
+#ifdef CONFIG_MEM_HUGE_ANON
+/*
+ * Replace the huge @pmd with a pte table mapping the same 4KB pages,
+ * with the same protection. Data is not touched.
+ * Return 0 on success, or if someone else has split it meanwhile.
+ */
+int lego_split_huge_pmd(struct lego_mm_struct *mm, pmd_t *pmd)
+{
+	unsigned long vaddr, prot;
+	spinlock_t *ptl;
+	pte_t *new;
+	int i;
+
+	new = lego_pte_alloc_one();
+	if (!new)
+		return -ENOMEM;
+
+	ptl = lego_pmd_lock(mm, pmd);
+	if (unlikely(!lego_pmd_trans_huge(*pmd))) {
+		spin_unlock(ptl);
+		lego_pte_free(new);
+		return 0;
+	}
+
+	vaddr = lego_huge_pmd_vaddr(*pmd);
+	prot = pmd_flags(*pmd) & ~_PAGE_PSE;
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		pte_set(new + i, __pte((vaddr + i * PAGE_SIZE) | prot));
+
+	/* Make ptes visible before the table */
+	smp_wmb();
+	lego_pmd_populate(pmd, new);
+	spin_unlock(ptl);
+
+	inc_mm_stat(HUGE_ANON_SPLIT);
+	return 0;
+}
+
+void lego_zap_huge_pmd(struct vm_area_struct *vma, pmd_t *pmd)
+{
+	unsigned long vaddr;
+	spinlock_t *ptl;
+	int i;
+
+	ptl = lego_pmd_lock(vma->vm_mm, pmd);
+	vaddr = lego_huge_pmd_vaddr(*pmd);
+	pmd_clear(pmd);
+	spin_unlock(ptl);
+
+	/* Fork may have shared some of them, drop one by one */
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		free_page(vaddr + i * PAGE_SIZE);
+}
+
+/* Huge version of lego_copy_one_pte(), @dst_pmd must be empty */
+void lego_copy_huge_pmd(struct lego_mm_struct *dst_mm, struct lego_mm_struct *src_mm,
+			pmd_t *dst_pmd, pmd_t *src_pmd, struct vm_area_struct *vma)
+{
+	unsigned long vm_flags = vma->vm_flags;
+	spinlock_t *src_ptl, *dst_ptl;
+	unsigned long vaddr;
+	pmd_t pmd;
+	int i;
+
+	dst_ptl = lego_pmd_lock(dst_mm, dst_pmd);
+	src_ptl = lego_pmd_lockptr(src_mm, src_pmd);
+	if (src_ptl != dst_ptl)
+		spin_lock(src_ptl);
+
+	pmd = *src_pmd;
+	if (is_cow_mapping(vm_flags)) {
+		pmd_set(src_pmd, pmd_wrprotect(pmd));
+		pmd = pmd_wrprotect(pmd);
+	}
+	if (vm_flags & VM_SHARED)
+		pmd = pmd_mkclean(pmd);
+	pmd = pmd_mkold(pmd);
+
+	vaddr = lego_huge_pmd_vaddr(pmd);
+	for (i = 0; i < HPAGE_PMD_NR; i++)
+		get_page(virt_to_page(vaddr + i * PAGE_SIZE));
+
+	pmd_set(dst_pmd, pmd);
+
+	if (src_ptl != dst_ptl)
+		spin_unlock(src_ptl);
+	spin_unlock(dst_ptl);
+}
+#endif /* CONFIG_MEM_HUGE_ANON */
+
 static inline int
 lego_copy_one_pte(struct lego_mm_struct *dst_mm, struct lego_mm_struct *src_mm,
 		pte_t *dst_pte, pte_t *src_pte, struct vm_area_struct *vma,
@@ -344,10 +442,13 @@ lego_copy_one_pte(struct lego_mm_struct *dst_mm, struct lego_mm_struct *src_mm,
 
 	/*
 	 * PTE contains position in swap or file?
-	 * Lego does not have any swap now, so skip.
+	 * Lego only has the compressed tier, share its entry.
 	 */
-	if (unlikely(!pte_present(pte)))
+	if (unlikely(!pte_present(pte))) {
+		if (is_zswap_pte(pte))
+			zswap_dup_pte(pte);
 		goto pte_set;
+	}
 
 	/*
 	 * If it's a COW mapping, write protect it both
@@ -436,6 +537,10 @@ static inline int lego_copy_pmd_range(struct lego_mm_struct *dst_mm,
 		next = pmd_addr_end(addr, end);
 		if (pmd_none(*src_pmd))
 			continue;
+		if (lego_pmd_trans_huge(*src_pmd)) {
+			lego_copy_huge_pmd(dst_mm, src_mm, dst_pmd, src_pmd, vma);
+			continue;
+		}
 		if (lego_copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
 						vma, addr, next))
 			return -ENOMEM;
@@ -532,6 +637,8 @@ zap_pte_range(struct vm_area_struct *vma, pmd_t *pmd,
 			free_page(page);
 			continue;
 		}
+		if (is_zswap_pte(ptent))
+			zswap_free_pte(ptent);
 		pte_clear(pte);
 	} while (pte++, addr += PAGE_SIZE, addr != end);
 
@@ -552,6 +659,15 @@ zap_pmd_range(struct vm_area_struct *vma, pud_t *pud,
 		next = pmd_addr_end(addr, end);
 		if (pmd_none(*pmd))
 			continue;
+		if (lego_pmd_trans_huge(*pmd)) {
+			if (next - addr == PMD_SIZE) {
+				lego_zap_huge_pmd(vma, pmd);
+				continue;
+			}
+			/* Partial zap, fall back to ptes */
+			if (WARN_ON_ONCE(lego_split_huge_pmd(vma->vm_mm, pmd)))
+				continue;
+		}
 		next = zap_pte_range(vma, pmd, addr, next);
 	} while (pmd++, addr = next, addr != end);
 
@@ -689,6 +805,11 @@ unsigned long lego_move_page_tables(struct vm_area_struct *vma,
 		if (!old_pmd)
 			continue;
 
+		/* Source and destination may not be 2MB aligned alike */
+		if (lego_pmd_trans_huge(*old_pmd) &&
+		    lego_split_huge_pmd(vma->vm_mm, old_pmd))
+			break;
+
 		new_pmd = alloc_new_pmd(vma->vm_mm, vma, new_addr);
 		if (!new_pmd)
 			break;
@@ -35,6 +35,15 @@ static inline void uaccess_debug(const char *fmt, ...) { }
  */
 #define UACCESS_WARNING_LIMIT	3
 
+/* @nr may be a negative errno from get_user_pages() */
+static void put_user_pages(unsigned long *pages, long nr)
+{
+	long i;
+
+	for (i = 0; i < nr; i++)
+		put_user_page(pages[i]);
+}
+
 static __always_inline void
 __lego_copy_to_user(void *to, const void *from, size_t len)
 {
@@ -83,13 +92,14 @@ unsigned long _lego_copy_to_user(struct lego_task_struct *tsk,
 		unsigned long page;
 
 		down_read(&tsk->mm->mmap_sem);
-		ret = get_user_pages(tsk, first_page, 1, 0, &page, NULL);
+		ret = get_user_pages(tsk, first_page, 1, FOLL_GET, &page, NULL);
 		up_read(&tsk->mm->mmap_sem);
 		if (unlikely(ret != 1))
 			return 0;
 
 		__lego_copy_to_user((void *)(page + offset_in_page(to)),
 				    from, n);
+		put_user_page(page);
 		return n;
 	} else {
 	/* otherwise, it does not seem fast.. */
@@ -104,9 +114,10 @@ unsigned long _lego_copy_to_user(struct lego_task_struct *tsk,
 			return 0;
 
 		down_read(&tsk->mm->mmap_sem);
-		ret = get_user_pages(tsk, first_page, nr_pages, 0, pages, NULL);
+		ret = get_user_pages(tsk, first_page, nr_pages, FOLL_GET, pages, NULL);
 		up_read(&tsk->mm->mmap_sem);
 		if (unlikely(ret != nr_pages)) {
+			put_user_pages(pages, ret);
 			kfree(pages);
 			return 0;
 		}
@@ -129,6 +140,7 @@ unsigned long _lego_copy_to_user(struct lego_task_struct *tsk,
 			start += bytes_to_copy;
 		}
 
+		put_user_pages(pages, nr_pages);
 		kfree(pages);
 		return copied;
 	}
@@ -182,12 +194,13 @@ unsigned long _lego_copy_from_user(struct lego_task_struct *tsk,
 		unsigned long page;
 
 		down_read(&tsk->mm->mmap_sem);
-		ret = get_user_pages(tsk, first_page, 1, 0, &page, NULL);
+		ret = get_user_pages(tsk, first_page, 1, FOLL_GET, &page, NULL);
 		up_read(&tsk->mm->mmap_sem);
 		if (unlikely(ret != 1))
 			return 0;
 
 		__lego_copy_from_user(to, (void *)(page + offset_in_page(from)), n);
+		put_user_page(page);
 		return n;
 	} else {
 		unsigned long *pages;
@@ -201,9 +214,10 @@ unsigned long _lego_copy_from_user(struct lego_task_struct *tsk,
 			return 0;
 
 		down_read(&tsk->mm->mmap_sem);
-		ret = get_user_pages(tsk, first_page, nr_pages, 0, pages, NULL);
+		ret = get_user_pages(tsk, first_page, nr_pages, FOLL_GET, pages, NULL);
 		up_read(&tsk->mm->mmap_sem);
 		if (unlikely(ret != nr_pages)) {
+			put_user_pages(pages, ret);
 			kfree(pages);
 			return 0;
 		}
@@ -226,6 +240,7 @@ unsigned long _lego_copy_from_user(struct lego_task_struct *tsk,
 			start += bytes_to_copy;
 		}
 
+		put_user_pages(pages, nr_pages);
 		kfree(pages);
 		return copied;
 	}
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Per-CPU VMA lookup cache
+ *
+ * Each CPU remembers the last few VMAs it found, tagged with the mm and
+ * the mm's vma_seq at the time. vma_seq is bumped by every mmap_sem
+ * writer, so an entry whose tag still matches describes a VMA that has
+ * not been changed or freed since.
+ *
+ * With mmap_sem held for read, vma_seq is stable and even, so a hit
+ * can be used as is. Without mmap_sem, the caller must read vma_seq
+ * first, and check it again with read_seqcount_retry() once done.
+ *
+ * Entries keep copies of vm_start, vm_end and whether the VMA is
+ * anonymous, so a lookup does not touch the VMA itself: without
+ * mmap_sem, it may be freed at any time. expand_stack() may lower
+ * vm_start under the read lock, which only makes the copy stale in
+ * the safe direction.
+ *
+ * Entries are never flushed, and a freed mm may be reallocated at the
+ * same address. vma_seq of a new mm thus does not start from zero, but
+ * above the last value of every mm freed before, see vma_seq_init().
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/spinlock.h>
+#include <memory/vm.h>
+
+#define VMACACHE_BITS	2
+#define VMACACHE_SIZE	(1U << VMACACHE_BITS)
+#define VMACACHE_MASK	(VMACACHE_SIZE - 1)
+#define VMACACHE_HASH(addr)	(((addr) >> PAGE_SHIFT) & VMACACHE_MASK)
+
+struct vmacache_entry {
+	struct lego_mm_struct	*mm;
+	unsigned int		seq;
+	unsigned long		vm_start;
+	unsigned long		vm_end;
+	bool			anon;
+	struct vm_area_struct	*vma;
+};
+
+struct vmacache {
+	struct vmacache_entry	entries[VMACACHE_SIZE];
+};
+
+static DEFINE_PER_CPU(struct vmacache, vmacaches);
+
+/* Even, above the vma_seq of every freed mm */
+static unsigned int vma_seq_next;
+static DEFINE_SPINLOCK(vma_seq_lock);
+
+void vma_seq_init(struct lego_mm_struct *mm)
+{
+	seqcount_init(&mm->vma_seq);
+	atomic_set(&mm->nr_spec_walkers, 0);
+
+	spin_lock(&vma_seq_lock);
+	mm->vma_seq.sequence = vma_seq_next;
+	spin_unlock(&vma_seq_lock);
+}
+
+/* Called when @mm is torn down, no writer may follow */
+void vma_seq_exit(struct lego_mm_struct *mm)
+{
+	unsigned int seq = raw_read_seqcount(&mm->vma_seq);
+
+	spin_lock(&vma_seq_lock);
+	if ((int)(seq - vma_seq_next) >= 0)
+		vma_seq_next = (seq | 1) + 1;
+	spin_unlock(&vma_seq_lock);
+}
+
+/* Copy the entry covering @addr to @hit, return false if none */
+static bool vmacache_find(struct lego_mm_struct *mm, unsigned long addr,
+			  unsigned int seq, struct vmacache_entry *hit)
+{
+	struct vmacache_entry *e;
+	struct vmacache *c;
+	bool found = false;
+	int i;
+
+	c = &get_cpu_var(vmacaches);
+	for (i = 0; i < VMACACHE_SIZE; i++) {
+		e = &c->entries[i];
+		if (e->mm == mm && e->seq == seq &&
+		    e->vm_start <= addr && addr < e->vm_end) {
+			*hit = *e;
+			found = true;
+			break;
+		}
+	}
+	put_cpu_var(vmacaches);
+	return found;
+}
+
+static void vmacache_update(struct lego_mm_struct *mm, unsigned long addr,
+			    struct vm_area_struct *vma, unsigned int seq)
+{
+	struct vmacache_entry *e;
+
+	e = &get_cpu_var(vmacaches).entries[VMACACHE_HASH(addr)];
+	e->mm = mm;
+	e->seq = seq;
+	e->vm_start = vma->vm_start;
+	e->vm_end = vma->vm_end;
+	e->anon = vma_is_anonymous(vma);
+	e->vma = vma;
+	put_cpu_var(vmacaches);
+}
+
+/*
+ * Same as find_vma(), but look up the cache of this CPU first.
+ * Caller must hold mmap_sem.
+ */
+struct vm_area_struct *find_vma_cached(struct lego_mm_struct *mm,
+				       unsigned long addr)
+{
+	struct vmacache_entry hit;
+	struct vm_area_struct *vma;
+	unsigned int seq;
+
+	seq = raw_read_seqcount(&mm->vma_seq);
+	if (likely(vmacache_find(mm, addr, seq, &hit)))
+		return hit.vma;
+
+	vma = find_vma(mm, addr);
+
+	/* Do not cache the stack gap, or a writer's view */
+	if (vma && vma->vm_start <= addr && !(seq & 1))
+		vmacache_update(mm, addr, vma, seq);
+	return vma;
+}
+
+/*
+ * Look up the VMA covering @addr without mmap_sem.
+ * @seq must be read from mm->vma_seq before calling, and the result
+ * is only valid if read_seqcount_retry() succeeds afterwards. The VMA
+ * may be freed meanwhile, so only copies of its start and whether it
+ * is anonymous are returned.
+ *
+ * Return 0 on success, -EAGAIN if not cached, caller should fall back
+ * to the locked path.
+ */
+int find_vma_speculative(struct lego_mm_struct *mm, unsigned long addr,
+			 unsigned int seq, unsigned long *vm_start, bool *anon)
+{
+	struct vmacache_entry hit;
+
+	if (unlikely(seq & 1))
+		return -EAGAIN;
+	if (!vmacache_find(mm, addr, seq, &hit))
+		return -EAGAIN;
+
+	*vm_start = hit.vm_start;
+	*anon = hit.anon;
+	return 0;
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Pre-zeroed page pool
+ *
+ * Every first touch of an anonymous page ends up in do_anonymous_page(),
+ * which used to clear a page inline before the pcache reply went out.
+ * Instead, thpool workers clear pages while they have nothing else to do,
+ * one page at a time, and stash them per-CPU. Pages are cleared with
+ * non-temporal stores, so idle-time zeroing does not evict the working
+ * set of the next request from cache.
+ *
+ * Workers are pinned, so the stash is only touched by one thread.
+ * If the stash runs dry, the page is cleared inline as before.
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/gfp.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/printk.h>
+#include <memory/zeropool.h>
+
+#define ZEROPOOL_STASH_SIZE	CONFIG_MEM_ZERO_PAGE_POOL_SIZE
+
+struct zero_page_stash {
+	int			nr;
+	unsigned long		pages[ZEROPOOL_STASH_SIZE];
+
+	unsigned long		nr_hit;
+	unsigned long		nr_miss;
+	unsigned long		nr_refill;
+	unsigned long		refill_ns;
+};
+
+static DEFINE_PER_CPU(struct zero_page_stash, zero_page_stashes);
+
+/*
+ * Return the kernel virtual address of a zeroed page,
+ * or 0 if out of memory.
+ */
+unsigned long alloc_zeroed_page(void)
+{
+	struct zero_page_stash *s;
+	unsigned long vaddr;
+
+	s = &get_cpu_var(zero_page_stashes);
+	if (likely(s->nr)) {
+		vaddr = s->pages[--s->nr];
+		s->nr_hit++;
+		put_cpu_var(zero_page_stashes);
+		return vaddr;
+	}
+	s->nr_miss++;
+	put_cpu_var(zero_page_stashes);
+
+	return __get_free_page(GFP_KERNEL | __GFP_ZERO);
+}
+
+/*
+ * Called by idle thpool workers.
+ * Clear one more page into this CPU's stash.
+ * Return false if there is nothing to do.
+ */
+bool zeropool_refill_one(void)
+{
+	struct zero_page_stash *s;
+	unsigned long vaddr, start;
+	bool ret = false;
+
+	s = &get_cpu_var(zero_page_stashes);
+	if (s->nr >= ZEROPOOL_STASH_SIZE)
+		goto out;
+
+	/* Do not complain, we will simply clear inline later */
+	vaddr = __get_free_page(GFP_KERNEL | __GFP_NOWARN);
+	if (unlikely(!vaddr))
+		goto out;
+
+	start = sched_clock();
+	clear_page_nocache((void *)vaddr);
+	s->refill_ns += sched_clock() - start;
+
+	s->pages[s->nr++] = vaddr;
+	s->nr_refill++;
+	ret = true;
+out:
+	put_cpu_var(zero_page_stashes);
+	return ret;
+}
+
+void print_zeropool_stats(void)
+{
+	struct zero_page_stash *s;
+	unsigned long nr_hit = 0, nr_miss = 0, nr_refill = 0, refill_ns = 0;
+	unsigned long nr_stashed = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(&zero_page_stashes, cpu);
+
+		nr_hit += s->nr_hit;
+		nr_miss += s->nr_miss;
+		nr_refill += s->nr_refill;
+		refill_ns += s->refill_ns;
+		nr_stashed += s->nr;
+	}
+
+	pr_info("zeropool: nr_stashed=%lu nr_hit=%lu nr_miss=%lu hit_rate=%lu%%\n",
+		nr_stashed, nr_hit, nr_miss,
+		(nr_hit + nr_miss) ? (nr_hit * 100 / (nr_hit + nr_miss)) : 0);
+	pr_info("zeropool: nr_refill=%lu refill_ns=%lu avg_ns=%lu MB/s=%lu\n",
+		nr_refill, refill_ns,
+		nr_refill ? (refill_ns / nr_refill) : 0,
+		refill_ns ? (nr_refill * PAGE_SIZE * 1000 / refill_ns) : 0);
+}
@@ -0,0 +1,383 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Compressed cold page tier
+ *
+ * Memory component has nowhere to swap to. Once free memory drops below
+ * the watermark, kzswapd walks anonymous VMAs of all tasks, clock style:
+ * a young pte is made old, an old one has its page compressed with LZ4
+ * and freed. The pte then points to the compressed copy, which is kept
+ * in kmalloc memory. Pages that do not compress to at least half are
+ * left alone.
+ *
+ * Nothing at memory side touches user pages by hardware, so the accessed
+ * bit is set by software: every miss, flush and get_user_pages() marks
+ * the pte young, see zswap_mark_young().
+ *
+ * A miss or flush on a compressed page goes down the normal fault path,
+ * where do_zswap_page() decompresses it into a new page before the reply
+ * goes out. Entries are immutable once stored. They are refcounted, only
+ * because fork shares them between parent and child.
+ *
+ * The scanner holds mmap_sem for write, and bumps vma_seq, so speculative
+ * misses and get_user_pages() callers never see a page going away under
+ * them. Whoever keeps using a page after dropping mmap_sem holds a page
+ * reference: flushes and uaccess take it with FOLL_GET, a miss keeps it
+ * until the reply is out. The scanner skips any page with more than one
+ * reference. Passes are at least ZSWAP_PASS_GAP_MS apart, so that a page
+ * made old has a real chance to be touched again before it is compressed.
+ */
+
+#include <lego/mm.h>
+#include <lego/lz4.h>
+#include <lego/slab.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/printk.h>
+#include <lego/vmstat.h>
+#include <lego/jiffies.h>
+#include <lego/kthread.h>
+#include <memory/vm.h>
+#include <memory/pid.h>
+#include <memory/task.h>
+#include <memory/zswap.h>
+#include <memory/huge_memory.h>
+#include <memory/vm-pgtable.h>
+
+#define ZSWAP_WATERMARK_PAGES	\
+	((unsigned long)CONFIG_MEM_ZSWAP_FREE_WATERMARK_MB << (20 - PAGE_SHIFT))
+#define ZSWAP_SCAN_INTERVAL_MS	CONFIG_MEM_ZSWAP_SCAN_INTERVAL_MS
+
+/* Max ptes looked at per mmap_sem hold */
+#define ZSWAP_SCAN_BATCH	512
+#define ZSWAP_TASK_BATCH	16
+#define ZSWAP_MAX_PASSES	16
+#define ZSWAP_PASS_GAP_MS	10
+
+struct zswap_entry {
+	atomic_t		refcount;
+	unsigned short		pte_flags;
+	unsigned short		length;
+	u8			data[0];
+};
+
+/* Keep at least 2:1, counting the kmalloc header */
+#define ZSWAP_MAX_LENGTH	\
+	(PAGE_SIZE / 2 - sizeof(struct zswap_entry) - ARCH_KMALLOC_MINALIGN)
+
+/*
+ * Entries are kmalloc'ed, so they live in the direct mapping
+ * and are at least 8 bytes aligned.
+ */
+static inline pte_t zswap_entry_to_pte(struct zswap_entry *e)
+{
+	unsigned long addr = (unsigned long)e & __VIRTUAL_MASK;
+
+	return __pte((addr >> 3) << PAGE_SHIFT | _PAGE_ZSWAP);
+}
+
+static inline struct zswap_entry *zswap_pte_to_entry(pte_t pte)
+{
+	unsigned long addr = (pte_val(pte) >> PAGE_SHIFT) << 3;
+
+	return (struct zswap_entry *)(addr | ~__VIRTUAL_MASK);
+}
+
+static atomic_long_t zswap_stored_pages = ATOMIC_LONG_INIT(0);
+static atomic_long_t zswap_pool_bytes = ATOMIC_LONG_INIT(0);
+
+/* Only touched by kzswapd */
+static unsigned long nr_zswap_scanned;
+static unsigned long nr_zswap_compress;
+static unsigned long nr_zswap_store;
+static unsigned long nr_zswap_reject;
+static unsigned long nr_zswap_alloc_fail;
+static unsigned long zswap_store_ns;
+static u8 zswap_dst[ZSWAP_MAX_LENGTH];
+static u8 zswap_wrkmem[LZ4_MEM_COMPRESS];
+
+struct zswap_load_stat {
+	unsigned long		nr_load;
+	unsigned long		load_ns;
+};
+
+static DEFINE_PER_CPU(struct zswap_load_stat, zswap_load_stats);
+
+static void zswap_entry_put(struct zswap_entry *e)
+{
+	if (atomic_dec_and_test(&e->refcount)) {
+		atomic_long_dec(&zswap_stored_pages);
+		atomic_long_sub(e->length, &zswap_pool_bytes);
+		kfree(e);
+	}
+}
+
+void zswap_free_pte(pte_t pte)
+{
+	zswap_entry_put(zswap_pte_to_entry(pte));
+}
+
+void zswap_dup_pte(pte_t pte)
+{
+	atomic_inc(&zswap_pte_to_entry(pte)->refcount);
+}
+
+/*
+ * Decompress the page behind @orig_pte into @vaddr, and map it at @ptep.
+ * Caller holds the pte lock, and has checked @ptep still has @orig_pte.
+ */
+int zswap_load(pte_t *ptep, pte_t orig_pte, unsigned long vaddr)
+{
+	struct zswap_entry *e = zswap_pte_to_entry(orig_pte);
+	struct zswap_load_stat *s;
+	unsigned long start;
+	pte_t entry;
+	int len;
+
+	start = sched_clock();
+	len = lz4_decompress_safe(e->data, e->length, (u8 *)vaddr, PAGE_SIZE);
+	if (WARN_ON_ONCE(len != PAGE_SIZE))
+		return -EIO;
+
+	s = &get_cpu_var(zswap_load_stats);
+	s->nr_load++;
+	s->load_ns += sched_clock() - start;
+	put_cpu_var(zswap_load_stats);
+
+	entry = lego_vfn_pte(((signed long)vaddr >> PAGE_SHIFT),
+			     __pgprot(e->pte_flags));
+	pte_set(ptep, pte_mkyoung(entry));
+	zswap_entry_put(e);
+	return 0;
+}
+
+/*
+ * Compress the page mapped by @pte, and replace it with a zswap pte.
+ * Called by kzswapd with mmap_sem held for write, and the pte lock.
+ */
+static void zswap_store(pte_t *ptep, pte_t pte)
+{
+	unsigned long vaddr = lego_pte_to_virt(pte);
+	struct zswap_entry *e;
+	unsigned long start;
+	int len;
+
+	/* Shared with a forked child, or pinned by a handler */
+	if (page_ref_count(virt_to_page(vaddr)) > 1)
+		return;
+
+	start = sched_clock();
+	len = lz4_compress((u8 *)vaddr, PAGE_SIZE, zswap_dst,
+			   ZSWAP_MAX_LENGTH, zswap_wrkmem);
+	zswap_store_ns += sched_clock() - start;
+	nr_zswap_compress++;
+	if (!len) {
+		nr_zswap_reject++;
+		return;
+	}
+
+	/* We are here because memory is short, do not panic */
+	e = kmalloc(sizeof(*e) + len, GFP_KERNEL | __GFP_NOWARN);
+	if (unlikely(!e)) {
+		nr_zswap_alloc_fail++;
+		return;
+	}
+
+	atomic_set(&e->refcount, 1);
+	e->pte_flags = pte_val(pte) & ~PAGE_MASK;
+	e->length = len;
+	memcpy(e->data, zswap_dst, len);
+
+	pte_set(ptep, zswap_entry_to_pte(e));
+	free_page(vaddr);
+
+	nr_zswap_store++;
+	atomic_long_inc(&zswap_stored_pages);
+	atomic_long_add(len, &zswap_pool_bytes);
+}
+
+static unsigned long
+zswap_scan_pte_range(struct lego_mm_struct *mm, pmd_t *pmd,
+		     unsigned long addr, unsigned long end, int *budget)
+{
+	spinlock_t *ptl;
+	pte_t *pte;
+
+	pte = lego_pte_offset_lock(mm, pmd, addr, &ptl);
+	do {
+		pte_t ptent = *pte;
+
+		if (!pte_present(ptent))
+			continue;
+
+		nr_zswap_scanned++;
+		if (pte_young(ptent))
+			pte_set(pte, pte_mkold(ptent));
+		else
+			zswap_store(pte, ptent);
+	} while (pte++, addr += PAGE_SIZE, addr != end && --(*budget) > 0);
+	spin_unlock(ptl);
+
+	return addr;
+}
+
+/*
+ * Scan @vma from @addr on, until @budget runs out.
+ * Return the address to resume from.
+ */
+static unsigned long
+zswap_scan_vma(struct vm_area_struct *vma, unsigned long addr, int *budget)
+{
+	struct lego_mm_struct *mm = vma->vm_mm;
+	unsigned long next;
+	pgd_t *pgd;
+	pud_t *pud;
+	pmd_t *pmd;
+
+	while (addr < vma->vm_end && *budget > 0) {
+		next = pmd_addr_end(addr, vma->vm_end);
+
+		pgd = lego_pgd_offset(mm, addr);
+		if (pgd_none(*pgd))
+			goto skip;
+		pud = lego_pud_offset(pgd, addr);
+		if (pud_none(*pud))
+			goto skip;
+		pmd = lego_pmd_offset(pud, addr);
+		if (pmd_none(*pmd) || lego_pmd_trans_huge(*pmd))
+			goto skip;
+
+		addr = zswap_scan_pte_range(mm, pmd, addr, next, budget);
+		continue;
+skip:
+		(*budget)--;
+		addr = next;
+	}
+	return addr;
+}
+
+static void zswap_scan_mm(struct lego_mm_struct *mm)
+{
+	struct vm_area_struct *vma;
+	unsigned long addr;
+	int budget = ZSWAP_SCAN_BATCH;
+
+	/* Never stall misses of a busy task */
+	if (!down_write_trylock(&mm->mmap_sem))
+		return;
+	vma_seq_write_begin(mm);
+
+	addr = mm->zswap_scan_addr;
+	vma = find_vma(mm, addr);
+	while (vma && budget > 0) {
+		if (!vma_is_anonymous(vma)) {
+			vma = vma->vm_next;
+			continue;
+		}
+
+		addr = max(addr, vma->vm_start);
+		addr = zswap_scan_vma(vma, addr, &budget);
+		if (addr >= vma->vm_end)
+			vma = vma->vm_next;
+	}
+	mm->zswap_scan_addr = vma ? addr : 0;
+
+	vma_seq_write_end(mm);
+	up_write(&mm->mmap_sem);
+}
+
+static inline bool zswap_below_watermark(void)
+{
+	return global_page_state(NR_FREE_PAGES) < ZSWAP_WATERMARK_PAGES;
+}
+
+/* One batch of each task */
+static void zswap_scan(void)
+{
+	struct lego_task_struct *tasks[ZSWAP_TASK_BATCH];
+	struct lego_mm_struct *mm;
+	int pos = 0, nr, i;
+
+	while ((nr = get_lego_tasks(tasks, ZSWAP_TASK_BATCH, &pos))) {
+		for (i = 0; i < nr; i++) {
+			mm = lego_get_task_mm(tasks[i]);
+			if (mm) {
+				zswap_scan_mm(mm);
+				lego_mmput(mm);
+			}
+			put_lego_task(tasks[i]);
+		}
+	}
+}
+
+static int kzswapd(void *unused)
+{
+	int pass;
+
+	set_cpus_allowed_ptr(current, cpu_active_mask);
+
+	while (1) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		schedule_timeout(msecs_to_jiffies(ZSWAP_SCAN_INTERVAL_MS));
+
+		for (pass = 0; pass < ZSWAP_MAX_PASSES; pass++) {
+			if (!zswap_below_watermark())
+				break;
+
+			/* Give pages made old by the last pass time to be used */
+			if (pass) {
+				set_current_state(TASK_INTERRUPTIBLE);
+				schedule_timeout(msecs_to_jiffies(ZSWAP_PASS_GAP_MS));
+			}
+			zswap_scan();
+		}
+	}
+	BUG();
+	return 0;
+}
+
+void __init zswap_init(void)
+{
+	struct task_struct *p;
+
+	BUILD_BUG_ON(ARCH_KMALLOC_MINALIGN < 8);
+
+	p = kthread_run(kzswapd, NULL, "kzswapd");
+	if (IS_ERR(p))
+		panic("Fail to create kzswapd");
+}
+
+void print_zswap_stats(void)
+{
+	struct zswap_load_stat *s;
+	unsigned long nr_load = 0, load_ns = 0;
+	unsigned long stored, bytes;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(&zswap_load_stats, cpu);
+
+		nr_load += s->nr_load;
+		load_ns += s->load_ns;
+	}
+
+	stored = atomic_long_read(&zswap_stored_pages);
+	bytes = atomic_long_read(&zswap_pool_bytes);
+
+	pr_info("zswap: stored_pages=%lu pool_bytes=%lu saved_bytes=%lu ratio=%lu%%\n",
+		stored, bytes, stored * PAGE_SIZE - bytes,
+		stored ? (bytes * 100 / (stored * PAGE_SIZE)) : 0);
+	pr_info("zswap: nr_scanned=%lu nr_store=%lu nr_reject=%lu nr_alloc_fail=%lu avg_compress_ns=%lu\n",
+		nr_zswap_scanned, nr_zswap_store, nr_zswap_reject, nr_zswap_alloc_fail,
+		nr_zswap_compress ? (zswap_store_ns / nr_zswap_compress) : 0);
+	pr_info("zswap: nr_load=%lu avg_decompress_ns=%lu\n",
+		nr_load, nr_load ? (load_ns / nr_load) : 0);
+}
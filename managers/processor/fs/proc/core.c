@@ -24,6 +24,7 @@ extern struct file_operations proc_processes_ops;
 extern struct file_operations proc_sys_vm_overcommit_kbytes_ops;
 extern struct file_operations proc_sys_vm_overcommit_memory_ops;
 extern struct file_operations proc_sys_vm_overcommit_ratio_ops;
+extern struct file_operations proc_pcache_quota_ops;
 
 struct proc_file_struct {
 	char f_name[FILENAME_LEN_DEFAULT];
@@ -36,6 +37,13 @@ static struct proc_file_struct proc_files[] = {
 		.f_name = "/proc/processes",
 		.f_op = &proc_processes_ops,
 	},
+#ifdef CONFIG_PCACHE_QUOTA
+	{
+		/* Lego Specific */
+		.f_name = "/proc/pcache_quota",
+		.f_op = &proc_pcache_quota_ops,
+	},
+#endif
 	{
 		.f_name	= "/proc/stat",
 		.f_op = &proc_stat_ops,
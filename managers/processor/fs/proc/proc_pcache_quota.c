@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+#include <lego/files.h>
+#include <lego/kernel.h>
+#include <lego/uaccess.h>
+#include <lego/seq_file.h>
+#include <processor/pcache.h>
+
+static int pcache_quota_proc_show(struct seq_file *m, void *v)
+{
+	pcache_quota_show(m);
+	return 0;
+}
+
+static int pcache_quota_proc_open(struct file *file)
+{
+	return single_open(file, pcache_quota_proc_show, NULL);
+}
+
+/*
+ * Write "tgid nr_lines" to set the limit of a process.
+ * nr_lines 0 removes the limit.
+ */
+static ssize_t pcache_quota_proc_write(struct file *f, const char __user *buf,
+				       size_t count, loff_t *off)
+{
+	char kbuf[64];
+	unsigned long limit;
+	int tgid, ret;
+
+	if (count >= sizeof(kbuf))
+		return -EINVAL;
+	if (copy_from_user(kbuf, buf, count))
+		return -EFAULT;
+	kbuf[count] = '\0';
+
+	if (sscanf(kbuf, "%d %lu", &tgid, &limit) != 2)
+		return -EINVAL;
+
+	ret = pcache_quota_set_limit(tgid, limit);
+	if (ret)
+		return ret;
+	return count;
+}
+
+struct file_operations proc_pcache_quota_ops = {
+	.open		= pcache_quota_proc_open,
+	.read		= seq_read,
+	.write		= pcache_quota_proc_write,
+	.release	= single_release,
+};
@@ -96,32 +96,53 @@ static inline void pcache_free_check(struct pcache_meta *pcm)
 	pcache_free_check_bad(pcm);
 }
 
-static inline void
-__enqueue_free_list_head(struct pcache_meta *pcm, struct pcache_set *pset)
+/*
+ * Claim one free way of @pset, lock-free.
+ * Return NULL if all ways are in use.
+ */
+static inline struct pcache_meta *pset_claim_free_way(struct pcache_set *pset)
 {
-	list_add(&pcm->free_list, &pset->free_head);
+	unsigned long *word, old, prev;
+	unsigned int i, bit;
+
+	for (i = 0; i < BITS_TO_LONGS(PCACHE_ASSOCIATIVITY); i++) {
+		word = &pset->free_map[i];
+		old = READ_ONCE(*word);
+		while (old) {
+			bit = __ffs(old);
+			prev = cmpxchg(word, old, old & ~(1UL << bit));
+			if (likely(prev == old)) {
+				bit += i * BITS_PER_LONG;
+				return pcache_set_to_first_pcache_meta(pset) +
+				       bit * nr_cachesets;
+			}
+			old = prev;
+		}
+	}
+	return NULL;
 }
 
-static inline struct pcache_meta *
-__dequeue_free_list_head(struct pcache_set *pset)
+/* Release @pcm back to its set, lock-free */
+static inline void pset_release_way(struct pcache_meta *pcm, struct pcache_set *pset)
 {
-        struct pcache_meta *pcm;
-
-        pcm = list_first_entry(&pset->free_head, struct pcache_meta, free_list);
-        list_del(&pcm->free_list);
-        return pcm;
+	/* All updates to @pcm must be visible before it can be claimed */
+	smp_mb__before_atomic();
+	set_bit(pcache_meta_to_way(pcm), pset->free_map);
 }
 
 /*
  * This is the ultimate free function.
  * At the time of calling, @pcm has been removed from LRU list.
- * Upon finish, @pcm will be enqueued into free list.
+ * Upon finish, @pcm will be marked free in its set.
  */
 void __put_pcache_nolru(struct pcache_meta *pcm)
 {
 	struct pcache_set *pset;
 
+	pcache_prefetch_free(pcm);
+	pcache_delta_free(pcm);
 	pcache_free_check(pcm);
+	pcache_quota_uncharge(pcm, 1);
 	dec_pcache_used();
 
 	/*
@@ -132,9 +153,7 @@ void __put_pcache_nolru(struct pcache_meta *pcm)
 		return;
 
 	pset = pcache_meta_to_pcache_set(pcm);
-	spin_lock(&pset->free_lock);
-	__enqueue_free_list_head(pcm, pset);
-	spin_unlock(&pset->free_lock);
+	pset_release_way(pcm, pset);
 }
 
 /*
@@ -143,6 +162,11 @@ void __put_pcache_nolru(struct pcache_meta *pcm)
  */
 void __put_pcache(struct pcache_meta *pcm)
 {
+	if (unlikely(PcacheHuge(pcm))) {
+		pcache_free_huge(pcm);
+		return;
+	}
+
 	detach_from_lru(pcm);
 	__put_pcache_nolru(pcm);
 }
@@ -178,13 +202,9 @@ pcache_alloc_fastpath(struct pcache_set *pset)
 		goto prep;
 	}
 
-	spin_lock(&pset->free_lock);
-	if (list_empty(&pset->free_head)) {
-		spin_unlock(&pset->free_lock);
+	pcm = pset_claim_free_way(pset);
+	if (!pcm)
 		return NULL;
-	}
-	pcm = __dequeue_free_list_head(pset);
-	spin_unlock(&pset->free_lock);
 
 	pcache_reset_flags(pcm);
 prep:
@@ -221,6 +241,7 @@ struct pcache_meta *pcache_alloc(unsigned long address,
 {
 	struct pcache_set *pset;
 	struct pcache_meta *pcm;
+	struct pcache_quota *quota;
 	enum evict_status ret;
 	unsigned long alloc_start, timeout;
 	PROFILE_POINT_TIME(pcache_alloc)
@@ -234,8 +255,18 @@ struct pcache_meta *pcache_alloc(unsigned long address,
 
 	pset = user_vaddr_to_pcache_set(address);
 	inc_pset_event(pset, PSET_ALLOC);
+	quota = current_pcache_quota();
 
 retry:
+	/*
+	 * Over quota: recycle one of our own lines in this set first,
+	 * instead of growing into a free way. If we have none here,
+	 * fall through and allocate as usual.
+	 */
+	if (unlikely(pcache_quota_over(quota)) &&
+	    pcache_evict_own_line(pset, address, quota) == PCACHE_EVICT_SUCCEED)
+		inc_pcache_event(PCACHE_QUOTA_RECYCLE);
+
 	/* Fastpath try to allocate one directly */
 	PROFILE_START(pcache_alloc_fastpath);
 	pcm = pcache_alloc_fastpath(pset);
@@ -243,10 +274,12 @@ retry:
 	if (likely(pcm)) {
 		if (piggyback == DISABLE_PIGGYBACK && PcachePiggyback(pcm))
 			BUG();
+		pcache_quota_charge(pcm, quota, 1);
 		PROFILE_LEAVE(pcache_alloc);
 		return pcm;
 	}
 
+	inc_pcache_event(PCACHE_ALLOC_DIRECT_EVICT);
 	PROFILE_START(pcache_alloc_evict);
 	ret = pcache_evict_line(pset, address, piggyback);
 	PROFILE_LEAVE(pcache_alloc_evict);
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Boot-time pcache alloc/free contention profiling
+ *
+ * All threads hammer the same set, which is the worst case for
+ * way allocation. Each thread holds one line at a time, so the
+ * set never fills up and eviction never kicks in.
+ */
+
+#include <lego/smp.h>
+#include <lego/kernel.h>
+#include <lego/cpumask.h>
+#include <lego/profile.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+#define NR_TESTS		(100000)
+#define PROFILE_ADDRESS		(0x400000UL)
+
+static void __profile_alloc(void *unused)
+{
+	struct pcache_meta *pcm;
+	int i;
+
+	for (i = 0; i < NR_TESTS; i++) {
+		pcm = pcache_alloc(PROFILE_ADDRESS, DISABLE_PIGGYBACK);
+		if (unlikely(!pcm)) {
+			pr_err("CPU%2d fail to alloc pcache\n", smp_processor_id());
+			break;
+		}
+		put_pcache(pcm);
+	}
+}
+
+static void profile_alloc_threads(unsigned int nr_threads)
+{
+	unsigned long total_ns;
+
+	total_ns = profile_run_threads(__profile_alloc, NULL, nr_threads,
+				       cpu_online_mask, "pcache_alloc_profile");
+	if (!total_ns)
+		return;
+
+	pr_info("    nr_threads: %2u. Avg alloc+free: %lu ns.\n", nr_threads,
+		total_ns / nr_threads / NR_TESTS);
+}
+
+void pcache_alloc_profile(void)
+{
+	unsigned int nr_threads, max_threads;
+
+	max_threads = min_t(unsigned int, num_online_cpus(), PCACHE_ASSOCIATIVITY);
+
+	pr_info("Pcache Alloc Profile. [pset: %lu. nr_run/thread: %d]\n",
+		pcache_set_to_set_index(user_vaddr_to_pcache_set(PROFILE_ADDRESS)),
+		NR_TESTS);
+	for (nr_threads = 1; nr_threads <= max_threads; nr_threads *= 2)
+		profile_alloc_threads(nr_threads);
+}
@@ -32,6 +32,7 @@ static inline void clflush_debug(const char *fmt, ...) { }
 #endif
 
 static struct p2m_flush_msg *clflush_msg_array;
+static struct p2m_flush_batch_msg *clflush_batch_msg_array;
 
 DEFINE_PROFILE_POINT(pcache_flush_net)
 
@@ -43,15 +44,15 @@ DEFINE_PROFILE_POINT(pcache_flush_net)
  *
  * Replication is done the at the end, if configured.
  *
- * TODO:
- * Instead of having a per-cpu message array and doing a memcpy,
- * we should use IB sg list to send both metadate and in-place cache data out.
+ * The per-cpu message only carries metadata. The cache line itself is sent
+ * in-place with IB sg list, remote still gets a complete p2m_flush_msg.
  */
 void __clflush_one(pid_t tgid, unsigned long user_va,
 		   unsigned int m_nid, unsigned int rep_nid, void *cache_addr)
 {
 	int reply, cpu;
 	struct p2m_flush_msg *msg;
+	struct fit_sglist sglist[2];
 	PROFILE_POINT_TIME(pcache_flush_net)
 
 	/*
@@ -66,16 +67,20 @@ void __clflush_one(pid_t tgid, unsigned long user_va,
 	fill_common_header(msg, P2M_PCACHE_FLUSH);
 	msg->pid = tgid;
 	msg->user_va = user_va & PCACHE_LINE_MASK;
-	memcpy(msg->pcacheline, cache_addr, PCACHE_LINE_SIZE);
 	barrier();
 
+	sglist[0].addr = msg;
+	sglist[0].len = offsetof(struct p2m_flush_msg, pcacheline);
+	sglist[1].addr = cache_addr;
+	sglist[1].len = PCACHE_LINE_SIZE;
+
 	clflush_debug("I m_nid:%d tgid:%u user_va:%#lx cache_kva:%p",
 		m_nid, msg->pid, msg->user_va, cache_addr);
 
 	/* Network */
 	PROFILE_START(pcache_flush_net);
-	ibapi_send_reply_timeout(m_nid, msg, sizeof(*msg),
-				 &reply, sizeof(reply), false, DEF_NET_TIMEOUT);
+	ibapi_send_reply_sglist_timeout(m_nid, sglist, ARRAY_SIZE(sglist),
+					&reply, sizeof(reply), false, DEF_NET_TIMEOUT);
 	PROFILE_LEAVE(pcache_flush_net);
 	clflush_debug("O tgid:%u user_va:%#lx cache_kva:%p reply:%d %s",
 		msg->pid, msg->user_va, cache_addr, reply, perror(reply));
@@ -93,6 +98,113 @@ void __clflush_one(pid_t tgid, unsigned long user_va,
 	put_cpu();
 }
 
+DEFINE_PROFILE_POINT(pcache_flush_batch_net)
+
+static void __pcache_flush_batch_send(struct pcache_flush_batch *batch)
+{
+	int reply, cpu, i, nr_sglist;
+	unsigned int nr_lines = batch->nr_lines;
+	struct p2m_flush_batch_msg *msg;
+	struct fit_sglist sglist[FIT_MAX_NR_SGLIST];
+	PROFILE_POINT_TIME(pcache_flush_batch_net)
+
+	/* Same per-cpu trick as __clflush_one() */
+	cpu = get_cpu();
+	msg = &clflush_batch_msg_array[cpu];
+
+	fill_common_header(msg, P2M_PCACHE_FLUSH_BATCH);
+	msg->pid = batch->tgid;
+	msg->nr_lines = nr_lines;
+	for (i = 0; i < nr_lines; i++)
+		msg->user_va[i] = batch->user_va[i] & PCACHE_LINE_MASK;
+	barrier();
+
+	/* Header, then all lines in-place */
+	sglist[0].addr = msg;
+	sglist[0].len = sizeof(*msg);
+	for (i = 0; i < nr_lines; i++) {
+		sglist[i + 1].addr = batch->cache_addr[i];
+		sglist[i + 1].len = PCACHE_LINE_SIZE;
+	}
+	nr_sglist = nr_lines + 1;
+
+	clflush_debug("I m_nid:%d tgid:%u nr_lines:%u",
+		batch->m_nid, msg->pid, nr_lines);
+
+	PROFILE_START(pcache_flush_batch_net);
+	ibapi_send_reply_sglist_timeout(batch->m_nid, sglist, nr_sglist,
+					&reply, sizeof(reply), false, DEF_NET_TIMEOUT);
+	PROFILE_LEAVE(pcache_flush_batch_net);
+	clflush_debug("O tgid:%u nr_lines:%u reply:%d",
+		msg->pid, nr_lines, reply);
+
+	/* reply is the nr of lines flushed */
+	inc_pcache_event(PCACHE_CLFLUSH_BATCH);
+	add_pcache_event(PCACHE_CLFLUSH, nr_lines);
+	if (unlikely(reply < 0))
+		add_pcache_event(PCACHE_CLFLUSH_FAIL, nr_lines);
+	else if (unlikely(reply < nr_lines))
+		add_pcache_event(PCACHE_CLFLUSH_FAIL, nr_lines - reply);
+
+	for (i = 0; i < nr_lines; i++)
+		replicate(batch->tgid, batch->user_va[i], batch->m_nid,
+			  batch->rep_nid[i], batch->cache_addr[i]);
+
+	put_cpu();
+}
+
+/**
+ * pcache_flush_batch_send
+ * @batch: the batch to send
+ *
+ * Flush all lines accumulated in @batch, wait until remote has written
+ * them back. @batch is empty on return and can be reused.
+ * A single line goes out as a normal P2M_PCACHE_FLUSH.
+ */
+void pcache_flush_batch_send(struct pcache_flush_batch *batch)
+{
+	if (!batch->nr_lines)
+		return;
+
+	if (batch->nr_lines == 1)
+		__clflush_one(batch->tgid, batch->user_va[0], batch->m_nid,
+			      batch->rep_nid[0], batch->cache_addr[0]);
+	else
+		__pcache_flush_batch_send(batch);
+
+	batch->nr_lines = 0;
+}
+
+/**
+ * pcache_flush_batch_add
+ * @batch: the batch to add to
+ * @cache_addr: kernel virtual address of the line, must stay intact
+ *              until the batch is sent
+ *
+ * Same rules as __clflush_one(): all information must not be pointers.
+ * If the line can not join @batch, whatever in @batch is sent first.
+ */
+void pcache_flush_batch_add(struct pcache_flush_batch *batch, pid_t tgid,
+			    unsigned long user_va, unsigned int m_nid,
+			    unsigned int rep_nid, void *cache_addr)
+{
+	unsigned int nr;
+
+	if (batch->nr_lines &&
+	    (batch->tgid != tgid || batch->m_nid != m_nid))
+		pcache_flush_batch_send(batch);
+
+	nr = batch->nr_lines++;
+	batch->tgid = tgid;
+	batch->m_nid = m_nid;
+	batch->user_va[nr] = user_va;
+	batch->rep_nid[nr] = rep_nid;
+	batch->cache_addr[nr] = cache_addr;
+
+	if (batch->nr_lines == PCACHE_FLUSH_BATCH_MAX_LINES)
+		pcache_flush_batch_send(batch);
+}
+
 /*
  * @tsk: the task this cache line belongs to
  * @user_va: the user virtual address associated with this line
@@ -112,15 +224,32 @@ void clflush_one(struct task_struct *tsk, unsigned long user_va, void *cache_add
 	__clflush_one(tsk->tgid, user_va, m_nid, rep_nid, cache_addr);
 }
 
+struct pcache_flush_control {
+	int				nr_flushed;
+	struct pcache_flush_batch	batch;
+};
+
 static int __pcache_flush_one(struct pcache_meta *pcm,
 			      struct pcache_rmap *rmap, void *arg)
 {
-	int *nr_flushed = arg;
+	struct pcache_flush_control *fc = arg;
+	struct task_struct *tsk = rmap->owner_process;
+	unsigned long user_va = rmap->address;
+	unsigned int m_nid, rep_nid;
+
+	m_nid = get_memory_node(tsk, user_va);
+	rep_nid = get_replica_node_by_addr(tsk, user_va);
 
-	clflush_one(rmap->owner_process, rmap->address,
-		    pcache_meta_to_kva(pcm));
+	/*
+	 * Twin only tells what changed since the fill of this
+	 * address space, shared lines always go out in full.
+	 */
+	if (!list_is_singular(&pcm->rmap) ||
+	    pcache_delta_flush(pcm, tsk->tgid, user_va, m_nid, rep_nid))
+		pcache_flush_batch_add(&fc->batch, tsk->tgid, user_va,
+				       m_nid, rep_nid, pcache_meta_to_kva(pcm));
 
-	(*nr_flushed)++;
+	fc->nr_flushed++;
 	return PCACHE_RMAP_AGAIN;
 }
 
@@ -135,9 +264,9 @@ static int __pcache_flush_one(struct pcache_meta *pcm,
  */
 int pcache_flush_one(struct pcache_meta *pcm)
 {
-	int nr_flushed = 0;
+	struct pcache_flush_control fc;
 	struct rmap_walk_control rwc = {
-		.arg = &nr_flushed,
+		.arg = &fc,
 		.rmap_one = __pcache_flush_one,
 	};
 
@@ -153,8 +282,16 @@ int pcache_flush_one(struct pcache_meta *pcm)
 	 */
 	PCACHE_BUG_ON_PCM(!PcacheReclaim(pcm), pcm);
 
+	fc.nr_flushed = 0;
+	pcache_flush_batch_init(&fc.batch);
+
+	/*
+	 * All rmaps of the same process that go to the
+	 * same memory node are flushed in one message.
+	 */
 	SetPcacheWriteback(pcm);
 	rmap_walk(pcm, &rwc);
+	pcache_flush_batch_send(&fc.batch);
 	ClearPcacheWriteback(pcm);
 
 	return 0;
@@ -166,6 +303,14 @@ void __init init_pcache_clflush_buffer(void)
 	if (!clflush_msg_array)
 		panic("Unable to allocate clflush message array");
 
-	pr_info("%s(): clflush array at %p, nr_entries: %d\n",
-		__func__, clflush_msg_array, nr_cpus);
+	clflush_batch_msg_array = kmalloc(sizeof(*clflush_batch_msg_array) * nr_cpus, GFP_KERNEL);
+	if (!clflush_batch_msg_array)
+		panic("Unable to allocate clflush batch message array");
+
+	/* Header plus one sg entry per line */
+	BUILD_BUG_ON(PCACHE_FLUSH_BATCH_MAX_LINES > P2M_FLUSH_BATCH_MAX_LINES);
+	BUILD_BUG_ON(PCACHE_FLUSH_BATCH_MAX_LINES + 1 > FIT_MAX_NR_SGLIST);
+
+	pr_info("%s(): clflush array at %p, batch array at %p, nr_entries: %d\n",
+		__func__, clflush_msg_array, clflush_batch_msg_array, nr_cpus);
 }
@@ -0,0 +1,248 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Sub-line dirty tracking and delta flush
+ *
+ * A single byte store makes the whole line dirty, and the whole line
+ * crosses the network at eviction. With this enabled, lines are filled
+ * read-only. The first write to a clean line takes a write-protect fault,
+ * where we copy the line into a twin before upgrading the pte. At flush
+ * time the line is compared against its twin chunk by chunk, and only
+ * modified chunks are sent. The memory side patches them in place.
+ *
+ * Twins come from a fixed pool. If the pool is empty, or the line is
+ * mostly modified, we simply fall back to full line flush.
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/memblock.h>
+#include <lego/spinlock.h>
+#include <lego/fit_ibapi.h>
+#include <processor/pcache.h>
+#include <processor/distvm.h>
+#include <processor/processor.h>
+#include <processor/replication.h>
+
+#define NR_TWINS		CONFIG_PCACHE_DELTA_NR_TWINS
+#define DELTA_NR_CHUNKS		P2M_FLUSH_DELTA_NR_CHUNKS
+#define DELTA_CHUNK_SIZE	P2M_FLUSH_DELTA_CHUNK_SIZE
+
+/* Header takes one sg entry, each run of chunks takes one */
+#define DELTA_MAX_RUNS		(FIT_MAX_NR_SGLIST - 1)
+
+/* Beyond this, sending the whole line is just as good */
+#define DELTA_FULL_CHUNKS	(DELTA_NR_CHUNKS * 3 / 4)
+
+static void *twin_data_map;
+static void **twin_free_stack;
+static int nr_free_twins;
+static DEFINE_SPINLOCK(twin_lock);
+
+static DEFINE_PER_CPU(struct p2m_flush_delta_msg, delta_msg_array);
+
+static void *alloc_twin(void)
+{
+	void *twin = NULL;
+
+	spin_lock(&twin_lock);
+	if (likely(nr_free_twins))
+		twin = twin_free_stack[--nr_free_twins];
+	spin_unlock(&twin_lock);
+	return twin;
+}
+
+static void free_twin(void *twin)
+{
+	spin_lock(&twin_lock);
+	twin_free_stack[nr_free_twins++] = twin;
+	spin_unlock(&twin_lock);
+}
+
+/*
+ * Called at the first write to a clean line, before the pte
+ * is upgraded. @pcm must be locked.
+ */
+void pcache_delta_snapshot(struct pcache_meta *pcm)
+{
+	void *twin;
+
+	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
+
+	if (pcm->twin)
+		return;
+
+	twin = alloc_twin();
+	if (unlikely(!twin)) {
+		inc_pcache_event(PCACHE_DELTA_SNAPSHOT_FAIL);
+		return;
+	}
+
+	memcpy(twin, pcache_meta_to_kva(pcm), PCACHE_LINE_SIZE);
+	pcm->twin = twin;
+	inc_pcache_event(PCACHE_DELTA_SNAPSHOT);
+}
+
+/* Called when @pcm is freed */
+void pcache_delta_free(struct pcache_meta *pcm)
+{
+	if (pcm->twin) {
+		free_twin(pcm->twin);
+		pcm->twin = NULL;
+	}
+}
+
+static u64 delta_diff(void *line, void *twin)
+{
+	u64 dirty = 0;
+	int i;
+
+	for (i = 0; i < DELTA_NR_CHUNKS; i++) {
+		if (memcmp(line + i * DELTA_CHUNK_SIZE,
+			   twin + i * DELTA_CHUNK_SIZE, DELTA_CHUNK_SIZE))
+			dirty |= 1ULL << i;
+	}
+	return dirty;
+}
+
+/*
+ * Each run of dirty chunks is sent with one sg entry.
+ * If there are too many runs, fill the smallest holes until
+ * they fit. The clean chunks sent this way are harmless.
+ */
+static u64 delta_coalesce(u64 dirty)
+{
+	int start[DELTA_NR_CHUNKS / 2 + 1], end[DELTA_NR_CHUNKS / 2 + 1];
+	int nr_runs, i, hole, min_hole;
+
+	for (;;) {
+		nr_runs = 0;
+		for (i = 0; i < DELTA_NR_CHUNKS; i++) {
+			if (!(dirty & (1ULL << i)))
+				continue;
+			if (!nr_runs || end[nr_runs - 1] != i) {
+				start[nr_runs] = i;
+				nr_runs++;
+			}
+			end[nr_runs - 1] = i + 1;
+		}
+
+		if (nr_runs <= DELTA_MAX_RUNS)
+			return dirty;
+
+		min_hole = 0;
+		for (i = 1; i < nr_runs - 1; i++) {
+			hole = start[i + 1] - end[i];
+			if (hole < start[min_hole + 1] - end[min_hole])
+				min_hole = i;
+		}
+
+		for (i = end[min_hole]; i < start[min_hole + 1]; i++)
+			dirty |= 1ULL << i;
+	}
+}
+
+/**
+ * pcache_delta_flush
+ * @pcm: the pcache line being flushed, locked
+ *
+ * Flush only modified chunks of @pcm back to memory.
+ * Return 0 if done, or a negative value if @pcm must be flushed in full.
+ */
+int pcache_delta_flush(struct pcache_meta *pcm, pid_t tgid, unsigned long user_va,
+		       unsigned int m_nid, unsigned int rep_nid)
+{
+	struct p2m_flush_delta_msg *msg;
+	struct fit_sglist sglist[FIT_MAX_NR_SGLIST];
+	void *line = pcache_meta_to_kva(pcm);
+	int i, nr_sglist, nr_chunks, reply;
+	u64 dirty;
+
+	PCACHE_BUG_ON_PCM(!PcacheLocked(pcm), pcm);
+
+	if (!pcm->twin)
+		return -ENOENT;
+
+	dirty = delta_diff(line, pcm->twin);
+	if (!dirty) {
+		inc_pcache_event(PCACHE_DELTA_FLUSH_CLEAN);
+		return 0;
+	}
+
+	dirty = delta_coalesce(dirty);
+	nr_chunks = hweight64(dirty);
+	if (nr_chunks >= DELTA_FULL_CHUNKS) {
+		inc_pcache_event(PCACHE_DELTA_FLUSH_FULL);
+		return -E2BIG;
+	}
+
+	msg = &get_cpu_var(delta_msg_array);
+	fill_common_header(msg, P2M_PCACHE_FLUSH_DELTA);
+	msg->pid = tgid;
+	msg->user_va = user_va & PCACHE_LINE_MASK;
+	msg->dirty_chunks = dirty;
+
+	sglist[0].addr = msg;
+	sglist[0].len = sizeof(*msg);
+	nr_sglist = 1;
+	for (i = 0; i < DELTA_NR_CHUNKS; i++) {
+		if (!(dirty & (1ULL << i)))
+			continue;
+
+		/* Extend the current run, or start a new one */
+		if (nr_sglist > 1 &&
+		    sglist[nr_sglist - 1].addr + sglist[nr_sglist - 1].len ==
+		    line + i * DELTA_CHUNK_SIZE) {
+			sglist[nr_sglist - 1].len += DELTA_CHUNK_SIZE;
+			continue;
+		}
+		sglist[nr_sglist].addr = line + i * DELTA_CHUNK_SIZE;
+		sglist[nr_sglist].len = DELTA_CHUNK_SIZE;
+		nr_sglist++;
+	}
+
+	ibapi_send_reply_sglist_timeout(m_nid, sglist, nr_sglist,
+					&reply, sizeof(reply), false, DEF_NET_TIMEOUT);
+	put_cpu_var(delta_msg_array);
+
+	inc_pcache_event(PCACHE_CLFLUSH);
+	inc_pcache_event_cond(PCACHE_CLFLUSH_FAIL, !!reply);
+	inc_pcache_event(PCACHE_DELTA_FLUSH);
+	add_pcache_event(PCACHE_DELTA_FLUSH_BYTES, nr_chunks * DELTA_CHUNK_SIZE);
+
+	/* Replica log keeps whole lines */
+	replicate(tgid, user_va, m_nid, rep_nid, line);
+	return 0;
+}
+
+void __init pcache_delta_early_init(void)
+{
+	u64 size;
+	int i;
+
+	BUILD_BUG_ON(PCACHE_LINE_SIZE % DELTA_NR_CHUNKS);
+	BUILD_BUG_ON(DELTA_NR_CHUNKS > 64);
+
+	size = (u64)NR_TWINS * PCACHE_LINE_SIZE;
+	twin_data_map = memblock_virt_alloc(size, PAGE_SIZE);
+	if (!twin_data_map)
+		panic("Unable to allocate pcache twin lines!");
+
+	size = NR_TWINS * sizeof(*twin_free_stack);
+	twin_free_stack = memblock_virt_alloc(size, PAGE_SIZE);
+	if (!twin_free_stack)
+		panic("Unable to allocate pcache twin stack!");
+
+	for (i = 0; i < NR_TWINS; i++)
+		twin_free_stack[i] = twin_data_map + (u64)i * PCACHE_LINE_SIZE;
+	nr_free_twins = NR_TWINS;
+}
@@ -12,6 +12,7 @@
 #include <lego/slab.h>
 #include <lego/log2.h>
 #include <lego/hash.h>
+#include <lego/sched.h>
 #include <lego/kernel.h>
 #include <lego/pgfault.h>
 #include <lego/syscalls.h>
@@ -19,24 +20,30 @@
 #include <lego/jiffies.h>
 #include <lego/profile.h>
 #include <processor/pcache.h>
+#include <processor/distvm.h>
 #include <processor/processor.h>
+#include <processor/replication.h>
 
 /**
  * evict_find_line
  * @pset: the pcache set in question
+ * @filter: quota filter, NULL to consider all lines
  *
  * This function will find a line to evict within a set.
  * The returned pcache line MUST be locked.
+ * RANDOM and FIFO do not support quota filter.
  */
 static inline struct pcache_meta *
-evict_find_line(struct pcache_set *pset)
+evict_find_line(struct pcache_set *pset, struct pcache_quota *filter)
 {
 #ifdef CONFIG_PCACHE_EVICT_RANDOM
 	return evict_find_line_random(pset);
 #elif defined(CONFIG_PCACHE_EVICT_FIFO)
 	return evict_find_line_fifo(pset);
 #elif defined(CONFIG_PCACHE_EVICT_LRU)
-	return evict_find_line_lru(pset);
+	return evict_find_line_lru(pset, filter);
+#elif defined(CONFIG_PCACHE_EVICT_CLOCK)
+	return evict_find_line_clock(pset, filter);
 #endif
 }
 
@@ -116,9 +123,11 @@ DEFINE_PROFILE_POINT(pcache_alloc_evict_do_find)
 DEFINE_PROFILE_POINT(pcache_alloc_evict_do_evict)
 
 /**
- * pcache_evict_line
+ * __pcache_evict_line
  * @pset: the pcache set to find a line to evict
  * @address: the user virtual address who initalized this eviction
+ * @filter: quota filter for the first search, NULL to consider all lines
+ * @fallback: search again without @filter if nothing found
  *
  * 1)
  * This function will try to evict one cache line from @pset.
@@ -137,12 +146,14 @@ DEFINE_PROFILE_POINT(pcache_alloc_evict_do_evict)
  *
  * Return 0 on success, otherwise on failures.
  */
-int pcache_evict_line(struct pcache_set *pset, unsigned long address,
-		      enum piggyback_options piggyback)
+static int __pcache_evict_line(struct pcache_set *pset, unsigned long address,
+			       enum piggyback_options piggyback,
+			       struct pcache_quota *filter, bool fallback)
 {
 	struct pcache_meta *pcm;
 	int nr_mapped;
 	int ret;
+	unsigned long long find_start = 0;
 	PROFILE_POINT_TIME(pcache_alloc_evict_do_find)
 	PROFILE_POINT_TIME(pcache_alloc_evict_do_evict)
 
@@ -156,12 +167,28 @@ int pcache_evict_line(struct pcache_set *pset, unsigned long address,
 	 * held within evict_find_line(), it is fine to clear it.
 	 */
 	PROFILE_START(pcache_alloc_evict_do_find);
+	if (IS_ENABLED(CONFIG_COUNTER_PCACHE))
+		find_start = sched_clock();
 	__SetPsetEvicting(pset);
-	pcm = evict_find_line(pset);
+	pcm = evict_find_line(pset, filter);
+	if (unlikely(filter && fallback && IS_ERR(pcm)))
+		pcm = evict_find_line(pset, NULL);
 	__ClearPsetEvicting(pset);
+	if (IS_ENABLED(CONFIG_COUNTER_PCACHE))
+		add_pcache_event(PCACHE_EVICTION_FIND_NS, sched_clock() - find_start);
 	PROFILE_LEAVE(pcache_alloc_evict_do_find);
 
 	if (IS_ERR_OR_NULL(pcm)) {
+		/*
+		 * Policies skip huge lines, which could otherwise hold
+		 * their ways forever. Lines of others are fair game only
+		 * if the caller is not restricted to its own.
+		 */
+		if ((!filter || fallback) && !pcache_evict_huge_in_set(pset)) {
+			inc_pcache_event(PCACHE_EVICTION_SUCCEED);
+			return PCACHE_EVICT_SUCCEED;
+		}
+
 		if (likely(PTR_ERR(pcm) == -EAGAIN)) {
 			inc_pcache_event(PCACHE_EVICTION_EAGAIN_FREEABLE);
 			return PCACHE_EVICT_EAGAIN_FREEABLE;
@@ -241,9 +268,100 @@ int pcache_evict_line(struct pcache_set *pset, unsigned long address,
 	 */
 	__ClearPcacheReclaim(pcm);
 	__ClearPcacheLocked(pcm);
+	pcache_quota_inc_evicted(pcm);
 	__put_pcache_nolru(pcm);
 
 	inc_pset_event(pset, PSET_EVICTION);
 	inc_pcache_event(PCACHE_EVICTION_SUCCEED);
 	return PCACHE_EVICT_SUCCEED;
 }
+
+int pcache_evict_line(struct pcache_set *pset, unsigned long address,
+		      enum piggyback_options piggyback)
+{
+	return __pcache_evict_line(pset, address, piggyback,
+				   pcache_quota_evict_filter(), true);
+}
+
+#ifdef CONFIG_PCACHE_QUOTA
+/*
+ * Evict one line of @q from @pset, never touch lines of others.
+ * Used by over-quota allocations to recycle their own lines.
+ */
+int pcache_evict_own_line(struct pcache_set *pset, unsigned long address,
+			  struct pcache_quota *q)
+{
+	return __pcache_evict_line(pset, address, DISABLE_PIGGYBACK, q, false);
+}
+#endif
+
+#ifdef CONFIG_PCACHE_HUGE_LINE
+/**
+ * pcache_evict_huge_line
+ * @head: head line of a huge line
+ *
+ * Evict a whole huge line: write-protect, flush back all lines if the
+ * pmd is dirty, then unmap. Called by huge fill to free a way.
+ *
+ * Return 0 on success, -EAGAIN if it is busy or was accessed recently.
+ */
+int pcache_evict_huge_line(struct pcache_meta *head)
+{
+	struct pcache_flush_batch batch;
+	struct pcache_rmap *rmap;
+	struct task_struct *owner;
+	unsigned int m_nid, rep_nid;
+	unsigned long base;
+	bool dirty = false;
+	int i, ret = -EAGAIN;
+
+	if (!get_pcache_unless_zero(head))
+		return ret;
+
+	if (!PcacheHuge(head) || !PcacheValid(head))
+		goto put;
+
+	if (!trylock_pcache(head))
+		goto put;
+
+	/*
+	 * Recheck with lock held, it may be split or zapped.
+	 * 1 for the rmap, 1 for us. Otherwise, it is used by others.
+	 */
+	if (!PcacheHuge(head) || !PcacheValid(head) ||
+	    pcache_ref_count(head) > 2)
+		goto unlock;
+
+	ret = pcache_wrprotect_huge(head, &dirty);
+	if (ret)
+		goto unlock;
+
+	if (dirty) {
+		rmap = list_first_entry(&head->rmap, struct pcache_rmap, next);
+		owner = rmap->owner_process;
+		base = rmap->address;
+		m_nid = get_memory_node(owner, base);
+		rep_nid = get_replica_node_by_addr(owner, base);
+
+		pcache_flush_batch_init(&batch);
+		for (i = 0; i < PCACHE_HUGE_NR_LINES; i++)
+			pcache_flush_batch_add(&batch, owner->tgid,
+					       base + i * PCACHE_LINE_SIZE,
+					       m_nid, rep_nid,
+					       pcache_meta_to_kva(head + i));
+		pcache_flush_batch_send(&batch);
+	}
+
+	pcache_unmap_huge(head);
+
+	/* The rmap's ref */
+	put_pcache(head);
+	inc_pcache_event(PCACHE_HUGE_EVICTION);
+
+unlock:
+	unlock_pcache(head);
+put:
+	put_pcache(head);
+	return ret;
+}
+#endif
@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * CLOCK eviction
+ *
+ * Ways of a set form the clock. The hand is an atomic counter in pset,
+ * concurrent evictors each take the next way and never wait on a set-wide
+ * lock. A line whose pte accessed bit is set gets a second chance: the
+ * bit is cleared and the hand moves on. Since the accessed bits are
+ * checked at eviction time, no sweep thread is needed.
+ *
+ * With CLOCK_PRO, lines are either cold or hot. New lines start cold.
+ * A cold line found referenced is promoted, an unreferenced hot line is
+ * demoted, and only unreferenced cold lines are evicted. Lines touched
+ * only once (e.g. a scan) stay cold and go first.
+ * This is a simplified CLOCK-Pro: no non-resident test period is kept.
+ */
+
+#include <lego/mm.h>
+#include <lego/kernel.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+#ifdef CONFIG_PCACHE_EVICT_CLOCK_PRO
+/* Cold lines may need two passes to be found unreferenced */
+#define CLOCK_MAX_SCAN		(3 * PCACHE_ASSOCIATIVITY)
+#else
+#define CLOCK_MAX_SCAN		(2 * PCACHE_ASSOCIATIVITY)
+#endif
+
+static inline struct pcache_meta *
+clock_advance_hand(struct pcache_set *pset)
+{
+	unsigned int way;
+
+	way = (unsigned int)atomic_inc_return(&pset->clock_hand);
+	way %= PCACHE_ASSOCIATIVITY;
+
+	return pcache_set_to_first_pcache_meta(pset) + way * nr_cachesets;
+}
+
+/*
+ * @pcm is locked and unreferenced right now.
+ * Return true if it should be evicted.
+ */
+#ifdef CONFIG_PCACHE_EVICT_CLOCK_PRO
+static inline bool clock_want_evict(struct pcache_meta *pcm, int referenced)
+{
+	if (referenced) {
+		if (!PcacheHot(pcm)) {
+			SetPcacheHot(pcm);
+			inc_pcache_event(PCACHE_CLOCK_PROMOTE);
+		} else
+			inc_pcache_event(PCACHE_CLOCK_SECOND_CHANCE);
+		return false;
+	}
+
+	if (PcacheHot(pcm)) {
+		ClearPcacheHot(pcm);
+		inc_pcache_event(PCACHE_CLOCK_DEMOTE);
+		return false;
+	}
+	return true;
+}
+#else
+static inline bool clock_want_evict(struct pcache_meta *pcm, int referenced)
+{
+	if (referenced) {
+		inc_pcache_event(PCACHE_CLOCK_SECOND_CHANCE);
+		return false;
+	}
+	return true;
+}
+#endif
+
+/*
+ * The returned pcache is Locked, Reclaim, ref inc'ed 1 by us.
+ * Same rules as evict_find_line_lru().
+ */
+struct pcache_meta *evict_find_line_clock(struct pcache_set *pset,
+					  struct pcache_quota *filter)
+{
+	struct pcache_meta *pcm;
+	int nr_scan, referenced, contention;
+
+	for (nr_scan = 0; nr_scan < CLOCK_MAX_SCAN; nr_scan++) {
+		pcm = clock_advance_hand(pset);
+		inc_pcache_event(PCACHE_EVICTION_SCANNED);
+
+		/* Free way, nothing to evict here */
+		if (!get_pcache_unless_zero(pcm))
+			continue;
+
+		/*
+		 * This means pcache is within common_do_fill_page(),
+		 * before pte and rmap are both setup.
+		 * Do not race with normal pgfault code
+		 */
+		if (unlikely(!PcacheValid(pcm)))
+			goto put_pcache;
+
+		/* Huge lines are evicted as a whole, see huge.c */
+		if (unlikely(PcacheHuge(pcm)))
+			goto put_pcache;
+
+		if (pcache_quota_skip_victim(pcm, filter))
+			goto put_pcache;
+
+		if (!trylock_pcache(pcm))
+			goto put_pcache;
+
+		if (PcacheWriteback(pcm) || PcacheReclaim(pcm))
+			goto unlock_pcache;
+
+		/*
+		 * 1 for original allocation
+		 * 1 for get_pcache_unless_zero above
+		 * Otherwise, it is used by others.
+		 */
+		if (unlikely(pcache_ref_count(pcm) > 2))
+			goto unlock_pcache;
+
+		/*
+		 * Test and clear accessed bit of all ptes.
+		 * Do not wait for pte locks, we may hold one.
+		 */
+		pcache_referenced_trylock(pcm, &referenced, &contention);
+		if (contention)
+			goto unlock_pcache;
+
+		if (!clock_want_evict(pcm, referenced))
+			goto unlock_pcache;
+
+		SetPcacheReclaim(pcm);
+		return pcm;
+
+unlock_pcache:
+		unlock_pcache(pcm);
+put_pcache:
+		put_pcache(pcm);
+	}
+
+	return ERR_PTR(-EAGAIN);
+}
@@ -77,8 +77,10 @@ static inline int lru_get_pcache(struct pcache_meta *pcm)
 /*
  * This function is similar to some part of shrink_page_list(). 
  * The returned pcache is Locked, Reclaim, ref inc'ed 1 by us.
+ * Lines rejected by quota @filter are skipped, see pcache_quota.h
  */
-struct pcache_meta *evict_find_line_lru(struct pcache_set *pset)
+struct pcache_meta *evict_find_line_lru(struct pcache_set *pset,
+					struct pcache_quota *filter)
 {
 	struct pcache_meta *pcm;
 	bool found = false;
@@ -93,6 +95,7 @@ struct pcache_meta *evict_find_line_lru(struct pcache_set *pset)
 	spin_lock(&pset->lru_lock);
 	list_for_each_entry_reverse(pcm, &pset->lru_list, lru) {
 		PCACHE_BUG_ON_PCM(PcacheReclaim(pcm), pcm);
+		inc_pcache_event(PCACHE_EVICTION_SCANNED);
 
 		/*
 		 * Someone else freed at the same time
@@ -110,6 +113,9 @@ struct pcache_meta *evict_find_line_lru(struct pcache_set *pset)
 		if (unlikely(!PcacheValid(pcm)))
 			goto put_pcache;
 
+		if (pcache_quota_skip_victim(pcm, filter))
+			goto put_pcache;
+
 		if (!trylock_pcache(pcm))
 			goto put_pcache;
 
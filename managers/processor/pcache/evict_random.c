@@ -28,6 +28,8 @@ struct pcache_meta *evict_find_line_random(struct pcache_set *pset)
 	int way;
 
 	pcache_for_each_way_set(pcm, pset, way) {
+		inc_pcache_event(PCACHE_EVICTION_SCANNED);
+
 		/*
 		 * Still under alloc setup, or
 		 * freed by someone else before this checking
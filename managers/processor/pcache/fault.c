@@ -120,6 +120,7 @@ int common_do_fill_page(struct mm_struct *mm, unsigned long address,
 
 	/* TODO: Need right permission bits */
 	entry = pcache_mk_pte(pcm, PAGE_SHARED_EXEC);
+	entry = pcache_delta_mk_pte(entry);
 
 	/*
 	 * Concurrent faults are serialized by this lock
@@ -181,13 +182,38 @@ DEFINE_PROFILE_POINT(__pcache_fill_remote_piggyback_net)
 
 static DEFINE_PER_CPU(struct p2m_pcache_miss_flush_combine_msg, pb_msg_array);
 
+/*
+ * Send the miss request and wait for the line to come back.
+ * If @may_yield, nothing is held, and the CPU can run others meanwhile.
+ */
+static inline int pcache_fill_send_reply(int dst_nid, void *msg, int size,
+					 void *va_cache, bool may_yield)
+{
+	struct fit_reply_handle handle;
+	int ret;
+
+	if (!may_yield)
+		return ibapi_send_reply_timeout(dst_nid, msg, size, va_cache,
+						PCACHE_LINE_SIZE, false,
+						DEF_NET_TIMEOUT);
+
+	ret = ibapi_send_reply_async(dst_nid, msg, size, va_cache,
+				     PCACHE_LINE_SIZE, false, &handle);
+	if (unlikely(ret))
+		return ret;
+	return ibapi_wait_reply(&handle, DEF_NET_TIMEOUT, true);
+}
+
 /*
  * Callback for common fill code
  * Fill the pcache line from remote memory.
+ *
+ * @arg is non-NULL if we are called from the MSHR path,
+ * which holds no lock and is able to yield while waiting.
  */
 static int
 __pcache_do_fill_page(unsigned long address, unsigned long flags,
-		      struct pcache_meta *pcm, void *unused)
+		      struct pcache_meta *pcm, void *arg)
 {
 	int ret, len, dst_nid;
 	struct pcache_set *pset;
@@ -208,6 +234,7 @@ __pcache_do_fill_page(unsigned long address, unsigned long flags,
 	if (PcachePiggyback(pcm)) {
 		struct p2m_pcache_miss_flush_combine_msg *pb_msg;
 		struct piggyback_info *pb = &pcm->pb;
+		struct fit_sglist sglist[2];
 
 		/*
 		 * Okay. Flush and miss belong to different nodes.
@@ -243,13 +270,23 @@ __pcache_do_fill_page(unsigned long address, unsigned long flags,
 		/* The piggyback flush part */
 		pb_msg->flush.pid = pb->tgid;
 		pb_msg->flush.user_va = pb->user_addr;
-		memcpy(pb_msg->flush.pcacheline, va_cache, PCACHE_LINE_SIZE);
 		smp_wmb();
 
+		/*
+		 * The dirty line is sent in-place. It is also where
+		 * the reply lands, which is fine: the reply can only
+		 * come after HCA has read out the whole request.
+		 */
+		sglist[0].addr = pb_msg;
+		sglist[0].len = offsetof(struct p2m_pcache_miss_flush_combine_msg,
+					 flush.pcacheline);
+		sglist[1].addr = va_cache;
+		sglist[1].len = PCACHE_LINE_SIZE;
+
 		PROFILE_START(__pcache_fill_remote_piggyback_net);
-		len = ibapi_send_reply_timeout(dst_nid, pb_msg, sizeof(*pb_msg),
-					       va_cache, PCACHE_LINE_SIZE, false,
-					       DEF_NET_TIMEOUT);
+		len = ibapi_send_reply_sglist_timeout(dst_nid, sglist, ARRAY_SIZE(sglist),
+						      va_cache, PCACHE_LINE_SIZE, false,
+						      DEF_NET_TIMEOUT);
 		PROFILE_LEAVE(__pcache_fill_remote_piggyback_net);
 
 		/*
@@ -273,9 +310,8 @@ fallback:
 		msg.missing_vaddr = address;
 
 		PROFILE_START(__pcache_fill_remote_net);
-		len = ibapi_send_reply_timeout(dst_nid, &msg, sizeof(msg),
-					       va_cache, PCACHE_LINE_SIZE, false,
-					       DEF_NET_TIMEOUT);
+		len = pcache_fill_send_reply(dst_nid, &msg, sizeof(msg),
+					     va_cache, !!arg);
 		PROFILE_LEAVE(__pcache_fill_remote_net);
 	}
 
@@ -304,8 +340,77 @@ fallback:
 out:
 	inc_pset_event(pset, PSET_FILL_MEMORY);
 	inc_pcache_event(PCACHE_FAULT_FILL_FROM_MEMORY);
+	pcache_quota_inc_miss();
+	return ret;
+}
+
+#ifdef CONFIG_PCACHE_MSHR
+/*
+ * The MSHR version of common_do_fill_page().
+ *
+ * We are the owner of @mshr. The network round trip is done without
+ * pte lock held, so concurrent faults on nearby lines are not blocked.
+ * Once the line is back, recheck the pte under lock: it may have been
+ * changed or unmapped (@mshr cancelled) in the meantime.
+ */
+static int
+pcache_do_fill_page_mshr(struct mm_struct *mm, unsigned long address,
+			 pte_t *page_table, pte_t orig_pte, pmd_t *pmd,
+			 unsigned long flags, struct pcache_mshr *mshr)
+{
+	struct pcache_meta *pcm;
+	spinlock_t *ptl;
+	pte_t entry;
+	int ret;
+
+	pcm = pcache_alloc(address, ENABLE_PIGGYBACK);
+	if (unlikely(!pcm)) {
+		ret = VM_FAULT_OOM;
+		goto complete;
+	}
+
+	/* TODO: Need right permission bits */
+	entry = pcache_mk_pte(pcm, PAGE_SHARED_EXEC);
+	entry = pcache_delta_mk_pte(entry);
+
+	/*
+	 * pcm is not PcacheValid yet, thus invisible to eviction.
+	 * Only yield if the fault came from userspace.
+	 */
+	ret = __pcache_do_fill_page(address, flags, pcm,
+				    (flags & FAULT_FLAG_USER) ? mshr : NULL);
+	if (unlikely(ret)) {
+		put_pcache(pcm);
+		ret = VM_FAULT_SIGSEGV;
+		goto complete;
+	}
+
+	page_table = pte_offset_lock(mm, pmd, address, &ptl);
+	if (unlikely(!pte_same(*page_table, orig_pte) || MshrCancelled(mshr))) {
+		/* Piggybacked flush (if any) has been done by fill */
+		put_pcache(pcm);
+		ret = 0;
+		goto unlock;
+	}
+
+	pte_set(page_table, entry);
+
+	/* which will also mark PcacheValid */
+	ret = pcache_add_rmap(pcm, page_table, address,
+			      mm, current->group_leader, RMAP_FILL_PAGE_REMOTE);
+	if (unlikely(ret)) {
+		pte_clear(page_table);
+		put_pcache(pcm);
+		ret = VM_FAULT_OOM;
+	}
+
+unlock:
+	spin_unlock(ptl);
+complete:
+	pcache_mshr_complete(mshr, ret);
 	return ret;
 }
+#endif
 
 /*
  * This function handles normal cache line misses.
@@ -315,6 +420,26 @@ static inline int
 pcache_do_fill_page(struct mm_struct *mm, unsigned long address,
 		    pte_t *page_table, pte_t orig_pte, pmd_t *pmd, unsigned long flags)
 {
+#ifdef CONFIG_PCACHE_MSHR
+	struct pcache_mshr *mshr;
+	bool merged;
+
+	mshr = pcache_mshr_find_or_alloc(mm, address, &merged);
+	if (likely(mshr)) {
+		if (!merged)
+			return pcache_do_fill_page_mshr(mm, address, page_table,
+							orig_pte, pmd, flags, mshr);
+
+		/*
+		 * Someone else is filling this line. Wait for it and
+		 * return to user, the access will be retried.
+		 */
+		pcache_mshr_wait(mshr);
+		put_pcache_mshr(mshr);
+		return 0;
+	}
+	/* MSHRs are all in use, fallback to the blocking fill */
+#endif
 	return common_do_fill_page(mm, address, page_table, orig_pte, pmd, flags,
 			__pcache_do_fill_page, NULL, RMAP_FILL_PAGE_REMOTE,
 			ENABLE_PIGGYBACK);
@@ -468,6 +593,14 @@ static int pcache_do_wp_page(struct mm_struct *mm, unsigned long address,
 	if (pcache_mapcount(old_pcm) == 1) {
 		pte_t entry;
 
+		/*
+		 * First write to a clean line, keep a copy to diff against.
+		 * A dirty line may have been write-protected by fork(),
+		 * its content is already different from memory.
+		 */
+		if (!pte_dirty(orig_pte))
+			pcache_delta_snapshot(old_pcm);
+
 		entry = pte_mkyoung(orig_pte);
 		entry = pte_mkdirty(entry);
 		entry = pte_mkwrite(entry);
@@ -539,6 +672,7 @@ static int pcache_handle_pte_fault(struct mm_struct *mm, unsigned long address,
 {
 	pte_t entry;
 	spinlock_t *ptl;
+	int ret;
 
 	entry = *pte;
 	if (likely(!pte_present(entry))) {
@@ -569,7 +703,12 @@ static int pcache_handle_pte_fault(struct mm_struct *mm, unsigned long address,
 			 *
 			 * All of them fall-back and merge into this:
 			 */
-			return pcache_do_fill_page(mm, address, pte, entry, pmd, flags);
+			ret = pcache_do_fill_page(mm, address, pte, entry, pmd, flags);
+
+			/* Train the prefetcher with remote misses only */
+			if (likely(!ret))
+				pcache_prefetch(mm, address, pmd, flags);
+			return ret;
 		}
 		return pcache_do_zerofill_page(mm, address, pte, entry, pmd, flags);
 	}
@@ -639,10 +778,19 @@ int pcache_handle_fault(struct mm_struct *mm,
 	pmd = pmd_alloc(mm, pud, address);
 	if (!pmd)
 		return VM_FAULT_OOM;
+
+	/* Streams are mapped by huge lines, if configured */
+	if (pcache_huge_fault(mm, address, pmd, flags))
+		return 0;
+
 	pte = pte_alloc(mm, pmd, address);
 	if (!pte)
 		return VM_FAULT_OOM;
 
+	/* Raced with a huge line fill, just retry */
+	if (unlikely(pcache_pmd_huge(*pmd)))
+		return 0;
+
 	inc_pcache_event(PCACHE_FAULT);
 	inc_pcache_event_cond(PCACHE_FAULT_CODE, !!(flags & FAULT_FLAG_INSTRUCTION));
 
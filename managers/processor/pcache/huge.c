@@ -0,0 +1,460 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Huge pcache lines
+ *
+ * A 2MB aligned user region maps to PCACHE_HUGE_NR_LINES consecutive sets,
+ * and the same way of these sets is physically contiguous. So if one way
+ * is free in all of them, they form a 2MB line which can be mapped by one
+ * pmd: one fault, one network request, one TLB entry.
+ *
+ * Processor has no VMA. We go huge only when the prefetcher says the
+ * thread is streaming forward, and memory checks the whole region is
+ * covered by one VMA. Otherwise we fall back to normal lines.
+ *
+ * Only the head line has refcount, mapcount and rmap. Tail lines have
+ * refcount 0, eviction algorithms skip them as free ways, and skip the
+ * head since it is PcacheHuge. Huge lines are evicted as a whole, by
+ * another huge fill that needs their way, or by a normal fill which
+ * finds no other victim in its set.
+ *
+ * fork(), mremap() and partial munmap() need 4KB granularity: the huge
+ * line is split into normal lines mapped by a pte page.
+ */
+
+#include <lego/mm.h>
+#include <lego/kernel.h>
+#include <lego/pgfault.h>
+#include <lego/fit_ibapi.h>
+#include <processor/pcache.h>
+#include <processor/distvm.h>
+#include <processor/processor.h>
+
+#include <asm/pgalloc.h>
+#include <asm/tlbflush.h>
+
+#define PCACHE_HUGE_NR_WAYS	CONFIG_PCACHE_HUGE_NR_WAYS
+#define HUGE_FIRST_WAY		(PCACHE_ASSOCIATIVITY - PCACHE_HUGE_NR_WAYS)
+
+static bool pcache_huge_enabled __read_mostly;
+
+static inline struct pcache_set *huge_first_pset(unsigned long base)
+{
+	return user_vaddr_to_pcache_set(base);
+}
+
+/* Claim @way in all sets of the huge line, or none of them */
+static bool huge_claim_way(struct pcache_set *pset, unsigned int way)
+{
+	int i;
+
+	for (i = 0; i < PCACHE_HUGE_NR_LINES; i++) {
+		if (!test_and_clear_bit(way, pset[i].free_map))
+			goto rollback;
+	}
+	return true;
+
+rollback:
+	while (--i >= 0)
+		set_bit(way, pset[i].free_map);
+	return false;
+}
+
+static struct pcache_meta *huge_way_to_head(struct pcache_set *pset,
+					    unsigned int way)
+{
+	return pcache_set_to_first_pcache_meta(pset) + way * nr_cachesets;
+}
+
+static void prep_new_huge_line(struct pcache_meta *head)
+{
+	struct pcache_meta *pcm;
+	int i;
+
+	for (i = 0; i < PCACHE_HUGE_NR_LINES; i++) {
+		pcm = head + i;
+
+		smp_store_mb(pcm->bits, 0);
+		__SetPcacheHuge(pcm);
+		INIT_LIST_HEAD(&pcm->rmap);
+		init_pcache_lru(pcm);
+		pcache_mapcount_reset(pcm);
+	}
+
+	/* Tails stay at 0 */
+	init_pcache_ref_count(head);
+	mod_pcache_used(PCACHE_HUGE_NR_LINES);
+	pcache_quota_charge(head, current_pcache_quota(), PCACHE_HUGE_NR_LINES);
+}
+
+/*
+ * Allocate a huge line for the 2MB region @base.
+ * On success, the head has refcount 1, and mapcount 0.
+ */
+static struct pcache_meta *pcache_alloc_huge(unsigned long base)
+{
+	struct pcache_set *pset = huge_first_pset(base);
+	struct pcache_meta *head;
+	int way;
+
+	for (way = PCACHE_ASSOCIATIVITY - 1; way >= HUGE_FIRST_WAY; way--) {
+		if (huge_claim_way(pset, way))
+			goto found;
+	}
+
+	/*
+	 * No way is free in all sets. Ways used by other huge lines
+	 * can be freed as a whole, ways used by normal lines can not.
+	 */
+	for (way = PCACHE_ASSOCIATIVITY - 1; way >= HUGE_FIRST_WAY; way--) {
+		head = huge_way_to_head(pset, way);
+		if (!PcacheHuge(head))
+			continue;
+
+		if (pcache_evict_huge_line(head))
+			continue;
+
+		if (huge_claim_way(pset, way))
+			goto found;
+	}
+	return NULL;
+
+found:
+	head = huge_way_to_head(pset, way);
+	prep_new_huge_line(head);
+	return head;
+}
+
+/*
+ * Called when a normal fill finds no victim in @pset.
+ * Evict one of the huge lines that hold a way of @pset.
+ * Return 0 on success, -EAGAIN if there is none or all are busy.
+ */
+int pcache_evict_huge_in_set(struct pcache_set *pset)
+{
+	struct pcache_meta *pcm;
+	unsigned long offset;
+	int way;
+
+	if (!pcache_huge_enabled)
+		return -EAGAIN;
+
+	/* The head sits in the first set of the 2MB region */
+	offset = pcache_set_to_set_index(pset) % PCACHE_HUGE_NR_LINES;
+
+	for (way = PCACHE_ASSOCIATIVITY - 1; way >= HUGE_FIRST_WAY; way--) {
+		pcm = huge_way_to_head(pset, way);
+		if (!PcacheHuge(pcm))
+			continue;
+
+		if (!pcache_evict_huge_line(pcm - offset))
+			return 0;
+	}
+	return -EAGAIN;
+}
+
+/*
+ * Called when the refcount of @head drops to 0.
+ * Return all lines back to their sets.
+ */
+void pcache_free_huge(struct pcache_meta *head)
+{
+	struct pcache_set *pset;
+	struct pcache_meta *pcm;
+	unsigned int way;
+	int i;
+
+	PCACHE_BUG_ON_PCM(pcache_mapped(head) || PcacheValid(head), head);
+
+	way = pcache_meta_to_way(head);
+	pset = pcache_meta_to_pcache_set(head);
+
+	for (i = 0; i < PCACHE_HUGE_NR_LINES; i++) {
+		pcm = head + i;
+		pcm->bits = 0;
+	}
+
+	/* All updates must be visible before they can be claimed */
+	smp_mb__before_atomic();
+	for (i = 0; i < PCACHE_HUGE_NR_LINES; i++)
+		set_bit(way, pset[i].free_map);
+
+	pcache_quota_uncharge(head, PCACHE_HUGE_NR_LINES);
+	mod_pcache_used(-PCACHE_HUGE_NR_LINES);
+}
+
+/*
+ * Fetch the 2MB region @base from memory as one huge line.
+ * Return true if the pmd has been populated, by us or others.
+ */
+static bool pcache_do_fill_huge(struct mm_struct *mm, unsigned long base,
+				pmd_t *pmd, unsigned long flags)
+{
+	struct p2m_pcache_miss_msg msg;
+	struct pcache_mshr *mshr;
+	struct pcache_meta *head;
+	spinlock_t *ptl;
+	bool merged, filled = false;
+	int len, dst_nid;
+
+	/*
+	 * pmd is none, so no normal line of this region is mapped,
+	 * or under eviction: they would have a pte page. Only fills
+	 * in flight need to be checked.
+	 */
+	mshr = pcache_mshr_find_or_alloc(mm, base, &merged);
+	if (!mshr)
+		return false;
+	if (merged) {
+		put_pcache_mshr(mshr);
+		return false;
+	}
+
+	head = pcache_alloc_huge(base);
+	if (!head) {
+		inc_pcache_event(PCACHE_HUGE_ALLOC_FAIL);
+		goto complete;
+	}
+
+	dst_nid = get_memory_node(current, base);
+	fill_common_header(&msg, P2M_PCACHE_MISS_HUGE);
+	msg.has_flush_msg = 0;
+	msg.pid = current->pid;
+	msg.tgid = current->tgid;
+	msg.flags = flags;
+	msg.missing_vaddr = base;
+
+	len = ibapi_send_reply_timeout(dst_nid, &msg, sizeof(msg),
+				       pcache_meta_to_kva(head),
+				       PCACHE_HUGE_LINE_SIZE, false,
+				       DEF_NET_TIMEOUT);
+	if (unlikely(len != PCACHE_HUGE_LINE_SIZE)) {
+		/* Not covered by one VMA, or network error */
+		inc_pcache_event(PCACHE_HUGE_FILL_FAIL);
+		goto put;
+	}
+
+	/*
+	 * Populated by others, or unmapped in the middle.
+	 * Either way, let the fault retry.
+	 */
+	filled = true;
+	ptl = pmd_lock(mm, pmd);
+	if (unlikely(!pmd_none(*pmd) || MshrCancelled(mshr))) {
+		spin_unlock(ptl);
+		goto put;
+	}
+
+	/* TODO: Need right permission bits */
+	pmd_set(pmd, pmd_mkhuge(pfn_pmd(pcache_meta_to_pfn(head), PAGE_SHARED_EXEC)));
+	if (unlikely(pcache_add_rmap_huge(head, pmd, base, mm,
+					  current->group_leader))) {
+		pmd_clear(pmd);
+		spin_unlock(ptl);
+		filled = false;
+		goto put;
+	}
+	spin_unlock(ptl);
+
+	inc_pcache_event(PCACHE_HUGE_FILL);
+	goto complete;
+
+put:
+	put_pcache(head);
+complete:
+	pcache_mshr_complete(mshr, 0);
+	return filled;
+}
+
+/**
+ * pcache_huge_fault
+ * @mm: address space in question
+ * @address: the missing user virtual address
+ * @pmd: pmd covering @address
+ * @flags: flags of the pgfault
+ *
+ * Called before pte page is allocated. Return true if the fault has been
+ * handled with a huge line, otherwise caller falls back to normal lines.
+ */
+bool pcache_huge_fault(struct mm_struct *mm, unsigned long address,
+		       pmd_t *pmd, unsigned long flags)
+{
+	unsigned long base = address & PCACHE_HUGE_LINE_MASK;
+	pmd_t pmdval = READ_ONCE(*pmd);
+
+	/*
+	 * Spurious fault, or write to a huge line which is
+	 * write-protected under eviction. Just retry.
+	 */
+	if (pcache_pmd_huge(pmdval))
+		return true;
+
+	if (!pmd_none(pmdval) || !pcache_huge_enabled)
+		return false;
+
+	/* 512 lines at once would blow the quota */
+	if (pcache_quota_over(current_pcache_quota()))
+		return false;
+
+	if (!pcache_prefetch_sequential(address))
+		return false;
+
+	if (!pcache_do_fill_huge(mm, base, pmd, flags))
+		return false;
+
+	pcache_prefetch_advance(address, base + PCACHE_HUGE_LINE_SIZE);
+	return true;
+}
+
+/*
+ * Lock @head and the pmd in order, and make sure the pmd still maps @head.
+ * Return with both locked on success, with nothing locked on failure.
+ */
+static struct pcache_meta *
+huge_pmd_lock(struct mm_struct *mm, pmd_t *pmd, spinlock_t **ptlp)
+{
+	struct pcache_meta *head;
+	spinlock_t *ptl;
+	pmd_t orig;
+
+	ptl = pmd_lock(mm, pmd);
+	orig = *pmd;
+	if (!pcache_pmd_huge(orig)) {
+		spin_unlock(ptl);
+		return NULL;
+	}
+
+	/* In case it got evicted while we wait */
+	head = pfn_to_pcache_meta(pmd_pfn(orig));
+	get_pcache(head);
+	spin_unlock(ptl);
+
+	lock_pcache(head);
+	spin_lock(ptl);
+
+	if (unlikely(!pcache_pmd_huge(*pmd) || pmd_pfn(*pmd) != pmd_pfn(orig))) {
+		spin_unlock(ptl);
+		unlock_pcache(head);
+		put_pcache(head);
+		return NULL;
+	}
+
+	/* Still mapped, the rmap holds a ref */
+	put_pcache(head);
+	*ptlp = ptl;
+	return head;
+}
+
+/*
+ * Drop the huge line mapped by @pmd, no flush.
+ * Called by munmap() and exit(), which cover the whole 2MB.
+ */
+void pcache_zap_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	struct pcache_meta *head;
+	spinlock_t *ptl;
+
+	head = huge_pmd_lock(mm, pmd, &ptl);
+	if (!head)
+		return;
+
+	pmd_clear(pmd);
+	flush_tlb_mm_range(mm, address & PCACHE_HUGE_LINE_MASK,
+			   (address & PCACHE_HUGE_LINE_MASK) + PCACHE_HUGE_LINE_SIZE);
+	spin_unlock(ptl);
+
+	pcache_remove_rmap_huge(head);
+	unlock_pcache(head);
+
+	/* The rmap's ref, this may free the huge line */
+	put_pcache(head);
+	inc_pcache_event(PCACHE_HUGE_ZAP);
+}
+
+/**
+ * pcache_split_huge_pmd
+ * @mm: address space in question
+ * @pmd: pmd that may map a huge line
+ * @address: any address covered by @pmd
+ *
+ * If @pmd maps a huge line, remap it with a pte page, each line
+ * becomes a normal line. Dirty and write bits are carried over.
+ * Return 0 on success, or if @pmd is not huge.
+ */
+int pcache_split_huge_pmd(struct mm_struct *mm, pmd_t *pmd, unsigned long address)
+{
+	unsigned long base = address & PCACHE_HUGE_LINE_MASK;
+	struct pcache_meta *head, *pcm;
+	struct page *new;
+	spinlock_t *ptl;
+	pte_t *ptes, entry;
+	pmd_t orig;
+	int i;
+
+	if (!pcache_pmd_huge(READ_ONCE(*pmd)))
+		return 0;
+
+	new = pte_alloc_one(mm, address);
+	if (unlikely(!new))
+		return -ENOMEM;
+
+	head = huge_pmd_lock(mm, pmd, &ptl);
+	if (!head) {
+		pte_free(mm, new);
+		return 0;
+	}
+
+	orig = __pmd(xchg(&pmd->pmd, 0));
+	flush_tlb_mm_range(mm, base, base + PCACHE_HUGE_LINE_SIZE);
+
+	ptes = (pte_t *)page_address(new);
+	for (i = 0; i < PCACHE_HUGE_NR_LINES; i++) {
+		entry = pcache_mk_pte(head + i, PAGE_SHARED_EXEC);
+		if (pmd_dirty(orig))
+			entry = pte_mkdirty(entry);
+		if (!(pmd_flags(orig) & _PAGE_RW))
+			entry = pte_wrprotect(entry);
+		pte_set(ptes + i, entry);
+	}
+
+	pcache_split_rmap_huge(head, ptes);
+
+	/* See comments in __pte_alloc */
+	smp_wmb();
+	pmd_populate(mm, pmd, new);
+	spin_unlock(ptl);
+
+	for (i = 0; i < PCACHE_HUGE_NR_LINES; i++) {
+		pcm = head + i;
+		ClearPcacheHuge(pcm);
+		pcache_quota_copy(pcm, head);
+		add_to_lru_list(pcm, pcache_meta_to_pcache_set(pcm));
+	}
+	unlock_pcache(head);
+
+	inc_pcache_event(PCACHE_HUGE_SPLIT);
+	return 0;
+}
+
+void __init pcache_huge_init(void)
+{
+	BUILD_BUG_ON(PCACHE_LINE_SIZE != PAGE_SIZE);
+	BUILD_BUG_ON(PCACHE_HUGE_NR_WAYS >= PCACHE_ASSOCIATIVITY);
+
+	if (nr_cachesets < PCACHE_HUGE_NR_LINES ||
+	    !IS_ALIGNED(phys_start_cacheline, PCACHE_HUGE_LINE_SIZE)) {
+		pr_info("Pcache: huge line disabled, sets: %llu start: %#llx\n",
+			nr_cachesets, phys_start_cacheline);
+		return;
+	}
+
+	pcache_huge_enabled = true;
+	pr_info("Pcache: huge line enabled, %d ways\n", PCACHE_HUGE_NR_WAYS);
+}
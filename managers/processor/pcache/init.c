@@ -144,6 +144,7 @@ void __init pcache_early_init(void)
 	alloc_pcache_rmap_map();
 	alloc_pcache_perset_map();
 	victim_cache_early_init();
+	pcache_delta_early_init();
 }
 
 static void __init init_pcache_set_free_list(void)
@@ -153,9 +154,8 @@ static void __init init_pcache_set_free_list(void)
 	int setidx, way;
 
 	pcache_for_each_set(pset, setidx) {
-		pcache_for_each_way_set(pcm, pset, way) {
-			list_add_tail(&pcm->free_list, &pset->free_head);
-		}
+		pcache_for_each_way_set(pcm, pset, way)
+			set_bit(way, pset->free_map);
 	}
 }
 
@@ -166,9 +166,8 @@ static void __init init_pcache_set_map(void)
 	int setidx, j;
 
 	pcache_for_each_set(pset, setidx) {
-		/* Head of free pcache line */
-		INIT_LIST_HEAD(&pset->free_head);
-		spin_lock_init(&pset->free_lock);
+		/* Free ways are filled in by init_pcache_set_free_list() */
+		bitmap_zero(pset->free_map, PCACHE_ASSOCIATIVITY);
 
 		/* Eviction Algorithm Specific */
 #ifdef CONFIG_PCACHE_EVICT_LRU
@@ -176,6 +175,9 @@ static void __init init_pcache_set_map(void)
 		spin_lock_init(&pset->lru_lock);
 		atomic_set(&pset->nr_lru, 0);
 #endif
+#ifdef CONFIG_PCACHE_EVICT_CLOCK
+		atomic_set(&pset->clock_hand, 0);
+#endif
 
 		/* Eviction Mechanism Specific */
 #ifdef CONFIG_PCACHE_EVICTION_VICTIM
@@ -186,6 +188,12 @@ static void __init init_pcache_set_map(void)
 		atomic_set(&pset->nr_eviction_entries, 0);
 #endif
 
+#ifdef CONFIG_PCACHE_MSHR
+		INIT_LIST_HEAD(&pset->mshr_list);
+		spin_lock_init(&pset->mshr_lock);
+		atomic_set(&pset->nr_mshr, 0);
+#endif
+
 		for (j = 0; j < NR_PSET_STAT_ITEMS; j++)
 			atomic_set(&pset->stat[j], 0);
 	}
@@ -199,7 +207,6 @@ static void __init init_pcache_meta_map(void)
 
 	pcache_for_each_way(pcm, nr) {
 		pcm->bits = 0;
-		INIT_LIST_HEAD(&pcm->free_list);
 		INIT_LIST_HEAD(&pcm->rmap);
 		pcache_mapcount_reset(pcm);
 		pcache_ref_count_set(pcm, 0);
@@ -246,8 +253,10 @@ void __init pcache_post_init(void)
 	init_pcache_meta_map();
 	init_pcache_set_map();
 	init_pcache_set_free_list();
+	pcache_huge_init();
 
 	init_pcache_clflush_buffer();
+	pcache_mshr_init();
 
 	/* Create victim_flush thread if configured */
 	victim_cache_post_init();
@@ -257,6 +266,11 @@ void __init pcache_post_init(void)
 	if (ret)
 		panic("Pcache: fail to create evict sweep threads!");
 
+	/* Create background reclaim threads if configured */
+	ret = pcache_reclaim_init();
+	if (ret)
+		panic("Pcache: fail to create reclaim threads!");
+
 	pcache_print_info();
 }
 
@@ -312,6 +326,14 @@ void __init pcache_print_info(void)
 #ifdef CONFIG_PCACHE_EVICTION_VICTIM
 	pr_info("    NR victim $ entries:     %u\n", VICTIM_NR_ENTRIES);
 #endif
+#ifdef CONFIG_PCACHE_MSHR
+	pr_info("    NR MSHR entries:         %u\n", nr_pcache_mshr_entries);
+#endif
+#ifdef CONFIG_PCACHE_RECLAIM
+	pr_info("    NR reclaim threads:      %u\n", CONFIG_PCACHE_RECLAIM_NR_THREADS);
+	pr_info("    Reclaim watermarks:      low %u high %u\n",
+		pcache_reclaim_wmark_low, pcache_reclaim_wmark_high);
+#endif
 }
 
 /**
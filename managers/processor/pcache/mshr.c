@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Miss Status Holding Registers for pcache fill.
+ *
+ * Without MSHR, a pcache miss holds the pte lock across the whole network
+ * round trip. Concurrent faults on any line covered by the same pte page
+ * are serialized behind it, and each of them will allocate a pcache line
+ * just to find out someone else already filled it.
+ *
+ * With MSHR, the fill owner registers the line in its pcache set, drops
+ * all locks, and waits for the reply with the CPU open to other threads.
+ * Faults on the same line merge into the existing MSHR and wait for it.
+ * Faults on other lines go to network in parallel.
+ *
+ * Lock ordering:
+ *	pset->mshr_lock
+ * It nests in nothing, and nothing nests in it.
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/slab.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/fit_ibapi.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+static struct pcache_mshr *pcache_mshr_map;
+
+/*
+ * Each owner waits for its fill with a FIT reply indicator, while
+ * every CPU may hold one more for a synchronous RPC. Entries beyond
+ * what the indicators can cover are left unused, see pcache_mshr_init().
+ */
+unsigned int nr_pcache_mshr_entries __read_mostly;
+
+static inline int mshr_ref_count(struct pcache_mshr *mshr)
+{
+	return atomic_read(&mshr->_refcount);
+}
+
+static inline void get_pcache_mshr(struct pcache_mshr *mshr)
+{
+	BUG_ON(mshr_ref_count(mshr) <= 0);
+	atomic_inc(&mshr->_refcount);
+}
+
+static struct pcache_mshr *alloc_pcache_mshr(void)
+{
+	struct pcache_mshr *mshr;
+	int i;
+
+	for (i = 0; i < nr_pcache_mshr_entries; i++) {
+		mshr = &pcache_mshr_map[i];
+		if (likely(!TestSetMshrUsed(mshr)))
+			return mshr;
+	}
+	return NULL;
+}
+
+static inline void free_pcache_mshr(struct pcache_mshr *mshr)
+{
+	mshr->mm = NULL;
+	ClearMshrDone(mshr);
+	ClearMshrCancelled(mshr);
+	smp_mb__before_atomic();
+	ClearMshrUsed(mshr);
+}
+
+void put_pcache_mshr(struct pcache_mshr *mshr)
+{
+	if (atomic_dec_and_test(&mshr->_refcount))
+		free_pcache_mshr(mshr);
+}
+
+static struct pcache_mshr *
+__pset_find_mshr(struct pcache_set *pset, struct mm_struct *mm,
+		 unsigned long address)
+{
+	struct pcache_mshr *pos;
+
+	list_for_each_entry(pos, &pset->mshr_list, next) {
+		if (pos->address == address && pos->mm == mm)
+			return pos;
+	}
+	return NULL;
+}
+
+/**
+ * pcache_mshr_find_or_alloc
+ * @mm: address space in question
+ * @address: the missing user virtual address
+ * @merged: set to true if returned MSHR belongs to other
+ *
+ * If a fill for the line is already in flight, return its MSHR with one
+ * extra reference, caller should pcache_mshr_wait() on it. Otherwise,
+ * allocate a new MSHR and link it to pset, caller becomes the owner and
+ * must call pcache_mshr_complete() once the fill has finished.
+ *
+ * Return NULL if all MSHRs are in use.
+ */
+struct pcache_mshr *pcache_mshr_find_or_alloc(struct mm_struct *mm,
+					      unsigned long address, bool *merged)
+{
+	struct pcache_set *pset;
+	struct pcache_mshr *mshr;
+
+	address &= PCACHE_LINE_MASK;
+	pset = user_vaddr_to_pcache_set(address);
+
+	spin_lock(&pset->mshr_lock);
+	if (atomic_read(&pset->nr_mshr)) {
+		mshr = __pset_find_mshr(pset, mm, address);
+		if (mshr) {
+			get_pcache_mshr(mshr);
+			spin_unlock(&pset->mshr_lock);
+
+			*merged = true;
+			inc_pcache_event(PCACHE_MSHR_MERGE);
+			return mshr;
+		}
+	}
+
+	mshr = alloc_pcache_mshr();
+	if (unlikely(!mshr)) {
+		spin_unlock(&pset->mshr_lock);
+		inc_pcache_event(PCACHE_MSHR_FULL);
+		return NULL;
+	}
+
+	mshr->mm = mm;
+	mshr->address = address;
+	mshr->ret = 0;
+	atomic_set(&mshr->_refcount, 1);
+	list_add(&mshr->next, &pset->mshr_list);
+	atomic_inc(&pset->nr_mshr);
+	spin_unlock(&pset->mshr_lock);
+
+	*merged = false;
+	inc_pcache_event(PCACHE_MSHR_ALLOC);
+	return mshr;
+}
+
+/*
+ * Wait until the owner of @mshr finished its fill.
+ * We do not care whether it succeed or not: caller will return
+ * to user and retry the access, which either hits the newly
+ * established pte, or faults again and does its own fill.
+ */
+void pcache_mshr_wait(struct pcache_mshr *mshr)
+{
+	while (!MshrDone(mshr)) {
+		cpu_relax();
+		cond_resched();
+	}
+}
+
+/*
+ * Called by MSHR owner, after pte has been setup (or not).
+ * Unlink @mshr from pset and release all waiters.
+ */
+void pcache_mshr_complete(struct pcache_mshr *mshr, int ret)
+{
+	struct pcache_set *pset;
+
+	pset = user_vaddr_to_pcache_set(mshr->address);
+
+	spin_lock(&pset->mshr_lock);
+	list_del(&mshr->next);
+	atomic_dec(&pset->nr_mshr);
+	spin_unlock(&pset->mshr_lock);
+
+	mshr->ret = ret;
+	smp_wmb();
+	SetMshrDone(mshr);
+
+	put_pcache_mshr(mshr);
+}
+
+/**
+ * pcache_mshr_cancel_range
+ * @mm: address space in question
+ * @start: start of the range
+ * @end: end of the range
+ *
+ * Called before [@start, @end) of @mm is unmapped. Any fill in flight within
+ * this range has no pte lock held, thus it would establish a mapping after
+ * we have zapped this range. Mark them cancelled, fill owners will check
+ * this under pte lock and drop the line.
+ */
+void pcache_mshr_cancel_range(struct mm_struct *mm,
+			      unsigned long start, unsigned long end)
+{
+	struct pcache_mshr *mshr;
+	struct pcache_set *pset;
+	unsigned long address;
+	int i;
+
+#ifdef CONFIG_PCACHE_HUGE_LINE
+	/*
+	 * Huge line fills are registered at the start of their 2MB.
+	 * Normal fills below @start get cancelled too, they just refault.
+	 */
+	start &= PCACHE_HUGE_LINE_MASK;
+#endif
+
+	for (i = 0; i < nr_pcache_mshr_entries; i++) {
+		mshr = &pcache_mshr_map[i];
+		if (!MshrUsed(mshr) || READ_ONCE(mshr->mm) != mm)
+			continue;
+
+		address = READ_ONCE(mshr->address);
+		if (address < (start & PCACHE_LINE_MASK) || address >= end)
+			continue;
+
+		/* Recheck, it may have been reused */
+		pset = user_vaddr_to_pcache_set(address);
+		spin_lock(&pset->mshr_lock);
+		if (__pset_find_mshr(pset, mm, address) == mshr) {
+			SetMshrCancelled(mshr);
+			inc_pcache_event(PCACHE_MSHR_CANCELLED);
+		}
+		spin_unlock(&pset->mshr_lock);
+	}
+}
+
+void __init pcache_mshr_init(void)
+{
+	size_t size;
+
+	size = sizeof(*pcache_mshr_map) * PCACHE_MSHR_NR_ENTRIES;
+	pcache_mshr_map = kzalloc(size, GFP_KERNEL);
+	if (!pcache_mshr_map)
+		panic("Unable to allocate pcache MSHR array");
+
+	nr_pcache_mshr_entries = PCACHE_MSHR_NR_ENTRIES;
+	if (nr_cpus < FIT_NR_REPLY_INDICATORS)
+		nr_pcache_mshr_entries = min(nr_pcache_mshr_entries,
+					     FIT_NR_REPLY_INDICATORS - nr_cpus);
+
+	pr_info("%s(): MSHR array at %p, nr_entries: %u (%u configured)\n",
+		__func__, pcache_mshr_map, nr_pcache_mshr_entries,
+		PCACHE_MSHR_NR_ENTRIES);
+}
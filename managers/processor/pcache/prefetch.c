@@ -9,6 +9,20 @@
 
 /*
  * Prefetch facilities
+ *
+ * Each thread has a few streams. Every remote pcache miss trains them:
+ * once the same stride repeats, we prefetch a window of lines ahead of the
+ * miss. Misses within a window are sent out in parallel, so the whole
+ * window costs about one network round trip.
+ *
+ * Adaptive depth: if the next miss lands right after the window, the
+ * window was consumed, and we double the depth. If the pattern breaks,
+ * we half it. Processor has no VMA, so streams are formed by distance:
+ * a miss belongs to the stream whose last line is close enough.
+ *
+ * Prefetched lines are mapped with pte accessed bit cleared and marked
+ * PcachePrefetch. If the pte is later found young, the line was useful.
+ * If it is freed before that, it was wasted.
  */
 
 #include <lego/mm.h>
@@ -20,6 +34,344 @@
 #include <lego/pgfault.h>
 #include <lego/syscalls.h>
 #include <lego/jiffies.h>
+#include <lego/fit_ibapi.h>
 #include <processor/pcache.h>
+#include <processor/distvm.h>
 #include <processor/processor.h>
 
+#define PREFETCH_MAX_DEPTH	CONFIG_PCACHE_PREFETCH_MAX_DEPTH
+#define PREFETCH_INIT_DEPTH	2
+#define PREFETCH_TRAIN_HITS	2	/* stride must repeat before we trust it */
+#define PREFETCH_MAX_STRIDE	(64 * PCACHE_LINE_SIZE)
+
+unsigned int sysctl_pcache_prefetch_max_depth __read_mostly = PREFETCH_MAX_DEPTH;
+
+struct prefetch_req {
+	unsigned long			address;
+	struct pcache_meta		*pcm;
+	struct pcache_mshr		*mshr;
+	struct fit_reply_handle		handle;
+	struct p2m_pcache_miss_msg	msg;
+};
+
+static struct pcache_prefetch_stream *
+prefetch_find_stream(struct pcache_prefetch_info *info, unsigned long address)
+{
+	struct pcache_prefetch_stream *s;
+	long delta;
+	int i;
+
+	/* The miss right after a consumed window */
+	for (i = 0; i < PCACHE_PREFETCH_NR_STREAMS; i++) {
+		s = &info->streams[i];
+		if (s->depth && s->next_addr == address)
+			return s;
+	}
+
+	for (i = 0; i < PCACHE_PREFETCH_NR_STREAMS; i++) {
+		s = &info->streams[i];
+		if (!s->last_addr)
+			continue;
+
+		delta = address - s->last_addr;
+		if (delta && abs(delta) <= PREFETCH_MAX_STRIDE)
+			return s;
+	}
+	return NULL;
+}
+
+/* Replace the least recently used stream */
+static void prefetch_new_stream(struct pcache_prefetch_info *info,
+				unsigned long address)
+{
+	struct pcache_prefetch_stream *s, *lru;
+	int i;
+
+	lru = &info->streams[0];
+	for (i = 1; i < PCACHE_PREFETCH_NR_STREAMS; i++) {
+		s = &info->streams[i];
+		if (s->age < lru->age)
+			lru = s;
+	}
+
+	memset(lru, 0, sizeof(*lru));
+	lru->last_addr = address;
+	lru->age = ++info->clock;
+}
+
+/*
+ * Feed one miss into stream @s.
+ * Return the number of lines to prefetch.
+ */
+static unsigned int prefetch_train(struct pcache_prefetch_stream *s,
+				   unsigned long address)
+{
+	long delta;
+
+	if (s->depth && s->next_addr == address) {
+		/* The whole window was consumed, open up */
+		s->depth = min(s->depth * 2, sysctl_pcache_prefetch_max_depth);
+		s->hits++;
+		return s->depth;
+	}
+
+	delta = address - s->last_addr;
+	if (delta == s->stride) {
+		s->hits++;
+		if (s->hits < PREFETCH_TRAIN_HITS)
+			return 0;
+		if (!s->depth)
+			s->depth = min_t(unsigned int, PREFETCH_INIT_DEPTH,
+					 sysctl_pcache_prefetch_max_depth);
+		return s->depth;
+	}
+
+	/*
+	 * Pattern broke. If we were prefetching, part of
+	 * the last window was probably useless: back off.
+	 */
+	if (s->depth) {
+		s->depth /= 2;
+		inc_pcache_event(PCACHE_PREFETCH_BACKOFF);
+	}
+	s->stride = delta;
+	s->hits = 1;
+	return 0;
+}
+
+/*
+ * All prefetched lines must share the pte page of @address,
+ * so we do not need to allocate pgtables here.
+ */
+static unsigned int prefetch_clip(unsigned long address, long stride,
+				  unsigned int nr)
+{
+	unsigned long next;
+	unsigned int i;
+
+	for (i = 1; i <= nr; i++) {
+		next = address + i * stride;
+		if ((next & PMD_MASK) != (address & PMD_MASK))
+			break;
+	}
+	return i - 1;
+}
+
+/*
+ * Lines that are being evicted must not be fetched from memory,
+ * their latest content may not have been flushed back yet.
+ */
+static inline bool prefetch_line_busy(unsigned long address)
+{
+#ifdef CONFIG_PCACHE_EVICTION_PERSET_LIST
+	return pset_find_eviction(address, current);
+#elif defined(CONFIG_PCACHE_EVICTION_VICTIM)
+	return victim_may_hit(address);
+#else
+	return false;
+#endif
+}
+
+static int prefetch_send_one(struct prefetch_req *req, unsigned long flags)
+{
+	struct p2m_pcache_miss_msg *msg = &req->msg;
+	int dst_nid;
+
+	dst_nid = get_memory_node(current, req->address);
+
+	fill_common_header(msg, P2M_PCACHE_MISS);
+	msg->has_flush_msg = 0;
+	msg->pid = current->pid;
+	msg->tgid = current->tgid;
+	msg->flags = (flags & FAULT_FLAG_USER) | FAULT_FLAG_PREFETCH;
+	msg->missing_vaddr = req->address;
+
+	return ibapi_send_reply_async(dst_nid, msg, sizeof(*msg),
+				      pcache_meta_to_kva(req->pcm),
+				      PCACHE_LINE_SIZE, false, &req->handle);
+}
+
+static void prefetch_install_one(struct mm_struct *mm, pmd_t *pmd,
+				 struct prefetch_req *req, int len)
+{
+	struct pcache_meta *pcm = req->pcm;
+	spinlock_t *ptl;
+	pte_t *pte, entry;
+
+	if (unlikely(len != PCACHE_LINE_SIZE))
+		goto drop;
+
+	pte = pte_offset_lock(mm, pmd, req->address, &ptl);
+	if (unlikely(!pte_none(*pte) || MshrCancelled(req->mshr))) {
+		spin_unlock(ptl);
+		goto drop;
+	}
+
+	/* Leave it old, so we can tell if it is ever used */
+	entry = pcache_mk_pte(pcm, PAGE_SHARED_EXEC);
+	entry = pte_mkold(entry);
+	entry = pcache_delta_mk_pte(entry);
+
+	SetPcachePrefetch(pcm);
+	pte_set(pte, entry);
+	if (unlikely(pcache_add_rmap(pcm, pte, req->address, mm,
+				     current->group_leader, RMAP_FILL_PAGE_REMOTE))) {
+		pte_clear(pte);
+		ClearPcachePrefetch(pcm);
+		spin_unlock(ptl);
+		goto drop;
+	}
+	spin_unlock(ptl);
+
+	pcache_mshr_complete(req->mshr, 0);
+	inc_pcache_event(PCACHE_PREFETCH_FILLED);
+	return;
+
+drop:
+	put_pcache(pcm);
+	pcache_mshr_complete(req->mshr, 0);
+	inc_pcache_event(PCACHE_PREFETCH_DROPPED);
+}
+
+static void prefetch_issue(struct mm_struct *mm, pmd_t *pmd,
+			   unsigned long address, long stride,
+			   unsigned int nr, unsigned long flags)
+{
+	struct prefetch_req reqs[PREFETCH_MAX_DEPTH];
+	struct prefetch_req *req;
+	unsigned int i, nr_reqs = 0;
+	bool merged;
+	int len;
+
+	for (i = 1; i <= nr; i++) {
+		req = &reqs[nr_reqs];
+		req->address = address + i * stride;
+
+		if (!pte_none(*pte_offset(pmd, req->address)) ||
+		    prefetch_line_busy(req->address))
+			continue;
+
+		/*
+		 * Register in MSHR, so demand faults on this line
+		 * will wait for us instead of fetching it again.
+		 */
+		req->mshr = pcache_mshr_find_or_alloc(mm, req->address, &merged);
+		if (!req->mshr)
+			break;
+		if (merged) {
+			put_pcache_mshr(req->mshr);
+			continue;
+		}
+
+		req->pcm = pcache_alloc(req->address, DISABLE_PIGGYBACK);
+		if (unlikely(!req->pcm)) {
+			pcache_mshr_complete(req->mshr, VM_FAULT_OOM);
+			break;
+		}
+
+		if (unlikely(prefetch_send_one(req, flags))) {
+			put_pcache(req->pcm);
+			pcache_mshr_complete(req->mshr, 0);
+			break;
+		}
+
+		nr_reqs++;
+		inc_pcache_event(PCACHE_PREFETCH_LINES);
+	}
+
+	for (i = 0; i < nr_reqs; i++) {
+		req = &reqs[i];
+		len = ibapi_wait_reply(&req->handle, DEF_NET_TIMEOUT,
+				       !!(flags & FAULT_FLAG_USER));
+		prefetch_install_one(mm, pmd, req, len);
+	}
+}
+
+/**
+ * pcache_prefetch
+ * @mm: address space in question
+ * @address: the missing user virtual address, just filled
+ * @pmd: pmd covering @address, its pte page is allocated
+ * @flags: flags of the pgfault
+ *
+ * Called after a remote pcache miss has been handled.
+ * Train the stride detector and prefetch if needed.
+ */
+void pcache_prefetch(struct mm_struct *mm, unsigned long address,
+		     pmd_t *pmd, unsigned long flags)
+{
+	struct pcache_prefetch_info *info = &current->pm_data.prefetch;
+	struct pcache_prefetch_stream *s;
+	unsigned int nr;
+
+	address &= PCACHE_LINE_MASK;
+
+	s = prefetch_find_stream(info, address);
+	if (!s) {
+		prefetch_new_stream(info, address);
+		return;
+	}
+
+	nr = prefetch_train(s, address);
+	s->last_addr = address;
+	s->next_addr = 0;
+	s->age = ++info->clock;
+
+	nr = prefetch_clip(address, s->stride, nr);
+	if (!nr)
+		return;
+
+	/* Window consumed if next miss lands right after it */
+	s->last_addr = address + nr * s->stride;
+	s->next_addr = s->last_addr + s->stride;
+
+	inc_pcache_event(PCACHE_PREFETCH_TRIGGERED);
+	prefetch_issue(mm, pmd, address, s->stride, nr, flags);
+}
+
+#ifdef CONFIG_PCACHE_HUGE_LINE
+static struct pcache_prefetch_stream *
+prefetch_find_sequential(struct pcache_prefetch_info *info, unsigned long address)
+{
+	struct pcache_prefetch_stream *s;
+	int i;
+
+	for (i = 0; i < PCACHE_PREFETCH_NR_STREAMS; i++) {
+		s = &info->streams[i];
+		if (s->depth && s->depth >= sysctl_pcache_prefetch_max_depth &&
+		    s->stride == PCACHE_LINE_SIZE && s->next_addr == address)
+			return s;
+	}
+	return NULL;
+}
+
+/*
+ * Return true if the miss at @address continues a forward stream
+ * which has already opened up to the max depth. Such a stream is
+ * worth a huge line.
+ */
+bool pcache_prefetch_sequential(unsigned long address)
+{
+	struct pcache_prefetch_info *info = &current->pm_data.prefetch;
+
+	return !!prefetch_find_sequential(info, address & PCACHE_LINE_MASK);
+}
+
+/*
+ * [@address, @end) has been filled as a huge line.
+ * Move the stream, so the miss right after it stays sequential.
+ */
+void pcache_prefetch_advance(unsigned long address, unsigned long end)
+{
+	struct pcache_prefetch_info *info = &current->pm_data.prefetch;
+	struct pcache_prefetch_stream *s;
+
+	s = prefetch_find_sequential(info, address & PCACHE_LINE_MASK);
+	if (!s)
+		return;
+
+	s->last_addr = end - PCACHE_LINE_SIZE;
+	s->next_addr = end;
+	s->age = ++info->clock;
+}
+#endif
@@ -0,0 +1,187 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Per-process pcache quota
+ *
+ * A quota entry is attached to a mm at its first pcache_alloc(), and every
+ * line allocated is charged to it. A process may be given a limit in lines.
+ * The limit is a global line budget, enforced in two places:
+ *
+ *  - pcache_alloc(): an over-quota process first evicts one of its own
+ *    lines within the target set, instead of taking a free way.
+ *  - eviction: while any limit is set, victims are first searched among
+ *    lines of over-quota processes (or the evictor's own lines). Only if
+ *    none is found, the whole set is searched as usual.
+ *
+ * So the limit is soft: a process that has no line in a full set will
+ * still evict others there. But a streaming process will mostly recycle
+ * its own lines, and leave the working set of others alone.
+ *
+ * Entries are never freed, only reused. One entry is released once its
+ * process has exited and all lines charged to it are freed.
+ */
+
+#include <lego/mm.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/string.h>
+#include <lego/seq_file.h>
+#include <lego/spinlock.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+/*
+ * Entry 0 is shared by kernel threads and processes that
+ * found the table full. It is never released, and has no limit.
+ */
+struct pcache_quota pcache_quotas[PCACHE_NR_QUOTAS] = {
+	[0] = {
+		._refcount	= ATOMIC_LONG_INIT(1),
+		.comm		= "shared",
+	},
+};
+#define default_pcache_quota	(&pcache_quotas[0])
+
+/* Nr of entries with limit set, eviction filter is off if 0 */
+atomic_t nr_limited_pcache_quotas = ATOMIC_INIT(0);
+
+/* Protect claim and release of entries, and limit updates */
+static DEFINE_SPINLOCK(pcache_quota_lock);
+
+static struct pcache_quota *alloc_pcache_quota(struct task_struct *p)
+{
+	struct pcache_quota *q;
+	int i;
+
+	spin_lock(&pcache_quota_lock);
+	for (i = 1; i < PCACHE_NR_QUOTAS; i++) {
+		q = &pcache_quotas[i];
+		if (q->tgid)
+			continue;
+
+		q->tgid = p->tgid;
+		q->limit = 0;
+		memcpy(q->comm, p->comm, TASK_COMM_LEN);
+		atomic_long_set(&q->nr_miss, 0);
+		atomic_long_set(&q->nr_evicted, 0);
+		atomic_long_set(&q->_refcount, 1);
+		spin_unlock(&pcache_quota_lock);
+		return q;
+	}
+	spin_unlock(&pcache_quota_lock);
+
+	inc_pcache_event(PCACHE_QUOTA_TABLE_FULL);
+	return default_pcache_quota;
+}
+
+static void free_pcache_quota(struct pcache_quota *q)
+{
+	spin_lock(&pcache_quota_lock);
+	if (q->limit)
+		atomic_dec(&nr_limited_pcache_quotas);
+	q->limit = 0;
+	q->tgid = 0;
+	spin_unlock(&pcache_quota_lock);
+}
+
+void put_pcache_quota(struct pcache_quota *q, long nr)
+{
+	if (atomic_long_sub_and_test(nr, &q->_refcount))
+		free_pcache_quota(q);
+}
+
+/*
+ * Return the quota of current process.
+ * The entry is attached to mm at the first call.
+ */
+struct pcache_quota *current_pcache_quota(void)
+{
+	struct mm_struct *mm = current->mm;
+	struct pcache_quota *q, *old;
+
+	if (unlikely(!mm))
+		return default_pcache_quota;
+
+	q = READ_ONCE(mm->pcache_quota);
+	if (likely(q))
+		return q;
+
+	q = alloc_pcache_quota(current);
+	old = cmpxchg(&mm->pcache_quota, NULL, q);
+	if (unlikely(old)) {
+		/* Another thread was faster */
+		if (q != default_pcache_quota)
+			put_pcache_quota(q, 1);
+		q = old;
+	}
+	return q;
+}
+
+/*
+ * Called when the process exit, after all its lines are unmapped.
+ * Lines still referenced by others drop their charges once freed.
+ */
+void pcache_quota_exit(struct mm_struct *mm)
+{
+	struct pcache_quota *q;
+
+	q = xchg(&mm->pcache_quota, NULL);
+	if (q && q != default_pcache_quota)
+		put_pcache_quota(q, 1);
+}
+
+/* Set the limit of process @tgid in nr of lines, 0 to remove */
+int pcache_quota_set_limit(pid_t tgid, unsigned long limit)
+{
+	struct pcache_quota *q;
+	int i, ret = -ESRCH;
+
+	if (!tgid)
+		return -EINVAL;
+
+	spin_lock(&pcache_quota_lock);
+	for (i = 1; i < PCACHE_NR_QUOTAS; i++) {
+		q = &pcache_quotas[i];
+		if (q->tgid != tgid)
+			continue;
+
+		if (!q->limit && limit)
+			atomic_inc(&nr_limited_pcache_quotas);
+		else if (q->limit && !limit)
+			atomic_dec(&nr_limited_pcache_quotas);
+		WRITE_ONCE(q->limit, limit);
+		ret = 0;
+		break;
+	}
+	spin_unlock(&pcache_quota_lock);
+
+	return ret;
+}
+
+void pcache_quota_show(struct seq_file *m)
+{
+	struct pcache_quota *q;
+	int i;
+
+	seq_printf(m, "%8s %16s %12s %12s %16s %16s\n",
+		"tgid", "comm", "limit", "used", "nr_miss", "nr_evicted");
+
+	for (i = 0; i < PCACHE_NR_QUOTAS; i++) {
+		q = &pcache_quotas[i];
+		if (i && !q->tgid)
+			continue;
+
+		seq_printf(m, "%8d %16s %12lu %12ld %16ld %16ld\n",
+			q->tgid, q->comm, q->limit,
+			max(pcache_quota_used(q), 0L),
+			atomic_long_read(&q->nr_miss),
+			atomic_long_read(&q->nr_evicted));
+	}
+}
@@ -0,0 +1,137 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Background pcache reclaim, the kswapd of pcache.
+ *
+ * Once pcache is warm, pcache_alloc() finds no free way and has to evict
+ * a line inline: a remote flush and TLB shootdown on the critical path of
+ * every miss. The reclaim threads try to keep a few free ways in each set,
+ * so that the fastpath allocation succeeds most of the time.
+ *
+ * Each thread owns a contiguous group of sets. When a set has less than
+ * low watermark free ways, the thread evicts lines until it reaches high
+ * watermark. Eviction itself is the normal pcache_evict_line(), thus
+ * it works with all eviction algorithms and mechanisms.
+ */
+
+#include <lego/mm.h>
+#include <lego/smp.h>
+#include <lego/delay.h>
+#include <lego/sched.h>
+#include <lego/kernel.h>
+#include <lego/kthread.h>
+#include <processor/pcache.h>
+#include <processor/processor.h>
+
+/*
+ * Free ways per set.
+ * Reclaim starts below low, and stops at high.
+ */
+unsigned int pcache_reclaim_wmark_low __read_mostly = CONFIG_PCACHE_RECLAIM_WMARK_LOW;
+unsigned int pcache_reclaim_wmark_high __read_mostly = CONFIG_PCACHE_RECLAIM_WMARK_HIGH;
+
+/* How long to back off if a whole pass found nothing to do */
+unsigned int pcache_reclaim_interval_msec __read_mostly = CONFIG_PCACHE_RECLAIM_INTERVAL_MSEC;
+
+#define NR_RECLAIM_THREADS	CONFIG_PCACHE_RECLAIM_NR_THREADS
+
+/* Give up on a set after this many busy lines, come back next pass */
+#define RECLAIM_MAX_EAGAIN	8
+
+static struct task_struct *reclaim_threads[NR_RECLAIM_THREADS];
+
+/*
+ * Reclaim one set up to high watermark.
+ * Return number of lines evicted.
+ */
+static int reclaim_pset(struct pcache_set *pset)
+{
+	int nr_evicted = 0, nr_eagain = 0;
+	enum evict_status ret;
+
+	while (pset_nr_free(pset) < pcache_reclaim_wmark_high) {
+		/*
+		 * Don't race with the inline eviction:
+		 * whoever is evicting there will free a way anyway.
+		 */
+		if (PsetEvicting(pset))
+			break;
+
+		ret = pcache_evict_line(pset, 0, DISABLE_PIGGYBACK);
+		if (ret == PCACHE_EVICT_SUCCEED) {
+			nr_evicted++;
+			inc_pcache_event(PCACHE_RECLAIM_EVICT);
+		} else if (ret == PCACHE_EVICT_FAILURE_FIND ||
+			   ret == PCACHE_EVICT_FAILURE_EVICT) {
+			inc_pcache_event(PCACHE_RECLAIM_FAILURE);
+			break;
+		} else if (++nr_eagain >= RECLAIM_MAX_EAGAIN) {
+			inc_pcache_event(PCACHE_RECLAIM_BUSY);
+			break;
+		}
+	}
+	return nr_evicted;
+}
+
+static int kpcache_reclaimd(void *_id)
+{
+	int id = (int)(long)_id;
+	unsigned long start, end, setidx;
+	struct pcache_set *pset;
+	int nr_evicted;
+
+	if (pin_current_thread())
+		panic("Fail to pin pcache reclaimd");
+
+	start = nr_cachesets * id / NR_RECLAIM_THREADS;
+	end = nr_cachesets * (id + 1) / NR_RECLAIM_THREADS;
+
+	pr_info("%s(): CPU%d reclaims set [%lu - %lu)\n",
+		__func__, smp_processor_id(), start, end);
+
+	while (1) {
+		nr_evicted = 0;
+		for (setidx = start; setidx < end; setidx++) {
+			pset = pcache_set_map + setidx;
+			if (pset_nr_free(pset) >= pcache_reclaim_wmark_low)
+				continue;
+			nr_evicted += reclaim_pset(pset);
+			cond_resched();
+		}
+		inc_pcache_event(PCACHE_RECLAIM_RUN);
+
+		/*
+		 * Keep going if there was work to do,
+		 * otherwise be nice to others.
+		 */
+		if (!nr_evicted)
+			mdelay(pcache_reclaim_interval_msec);
+	}
+	return 0;
+}
+
+int __init pcache_reclaim_init(void)
+{
+	int i;
+
+	/* Watermarks make no sense if a set can never reach them */
+	if (pcache_reclaim_wmark_high >= PCACHE_ASSOCIATIVITY)
+		pcache_reclaim_wmark_high = PCACHE_ASSOCIATIVITY - 1;
+	if (pcache_reclaim_wmark_low > pcache_reclaim_wmark_high)
+		pcache_reclaim_wmark_low = pcache_reclaim_wmark_high;
+
+	for (i = 0; i < NR_RECLAIM_THREADS; i++) {
+		reclaim_threads[i] = kthread_run(kpcache_reclaimd, (void *)(long)i,
+						 "kpcache_reclaimd%d", i);
+		if (IS_ERR(reclaim_threads[i]))
+			return PTR_ERR(reclaim_threads[i]);
+	}
+	return 0;
+}
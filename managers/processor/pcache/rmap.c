@@ -917,6 +917,9 @@ int pcache_zap_pte(struct mm_struct *mm, unsigned long address,
 		put_pcache(pcm);
 	}
 
+	if (pte_present(ptent) && pte_young(ptent))
+		pcache_prefetch_referenced(pcm);
+
 	rmap_walk(pcm, &rwc);
 	unlock_pcache(pcm);
 
@@ -969,6 +972,8 @@ static int pcache_try_to_unmap_one(struct pcache_meta *pcm,
 		 */
 		if (pte_dirty(pteval))
 			*dirty = true;
+		if (pte_young(pteval))
+			pcache_prefetch_referenced(pcm);
 
 		/*
 		 * Flush any stale TLB entries.
@@ -1011,6 +1016,8 @@ static int pcache_try_to_unmap_reserve_one(struct pcache_meta *pcm,
 		 */
 		if (pte_dirty(pteval))
 			*dirty = true;
+		if (pte_young(pteval))
+			pcache_prefetch_referenced(pcm);
 
 		/*
 		 * Flush any stale TLB entries.
@@ -1244,8 +1251,10 @@ static int pcache_referenced_one(struct pcache_meta *pcm,
 	if (unlikely(!pte))
 		return PCACHE_RMAP_AGAIN;
 
-	if (ptep_clear_flush_young(pte))
+	if (ptep_clear_flush_young(pte)) {
 		prc->referenced++;
+		pcache_prefetch_referenced(pcm);
+	}
 	spin_unlock(ptl);
 
 	/*
@@ -1312,8 +1321,10 @@ static int pcache_referenced_trylock_one(struct pcache_meta *pcm,
 	if (unlikely(!pte))
 		return PCACHE_RMAP_AGAIN;
 
-	if (ptep_clear_flush_young(pte))
+	if (ptep_clear_flush_young(pte)) {
 		prc->referenced = 1;
+		pcache_prefetch_referenced(pcm);
+	}
 	spin_unlock(ptl);
 
 	/*
@@ -1362,6 +1373,151 @@ out:
 	*pte_contention = prc.pte_contention;
 }
 
+#ifdef CONFIG_PCACHE_HUGE_LINE
+/*
+ * A huge line has one single rmap, at its head line, whose page_table
+ * points to the pmd. The pmd is protected by pmd lock instead of pte lock.
+ * fork() splits huge lines, so they are never shared.
+ */
+static inline struct pcache_rmap *huge_rmap(struct pcache_meta *head)
+{
+	PCACHE_BUG_ON_PCM(!PcacheHuge(head), head);
+	PCACHE_BUG_ON_PCM(pcache_mapcount(head) != 1, head);
+
+	return list_first_entry(&head->rmap, struct pcache_rmap, next);
+}
+
+/*
+ * @pmd is locked when called.
+ * @head must NOT be locked on entry.
+ */
+int pcache_add_rmap_huge(struct pcache_meta *head, pmd_t *pmd,
+			 unsigned long address, struct mm_struct *owner_mm,
+			 struct task_struct *owner_process)
+{
+	struct pcache_rmap *rmap;
+	int ret = 0;
+
+	PCACHE_BUG_ON_PCM(!PcacheHuge(head), head);
+	BUG_ON(!thread_group_leader(owner_process));
+
+	lock_pcache(head);
+
+	rmap = alloc_pcache_rmap(head);
+	if (unlikely(!rmap)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	rmap->page_table = (pte_t *)pmd;
+	rmap->address = address & PCACHE_HUGE_LINE_MASK;
+	rmap->owner_mm = owner_mm;
+	rmap->owner_process = owner_process;
+	rmap->caller = RMAP_FILL_HUGE;
+
+	list_add(&rmap->next, &head->rmap);
+	atomic_inc(&head->mapcount);
+	SetPcacheValid(head);
+out:
+	unlock_pcache(head);
+	return ret;
+}
+
+/*
+ * @head is locked, and the pmd is locked and cleared by caller.
+ * Same as pcache_remove_rmap, caller will put_pcache.
+ */
+void pcache_remove_rmap_huge(struct pcache_meta *head)
+{
+	__pcache_remove_rmap(head, huge_rmap(head));
+}
+
+/*
+ * @head is locked, and the pmd is locked and cleared by caller.
+ * @ptes is the new pte page which maps the lines one by one.
+ *
+ * Each line gets its own rmap, mapcount and refcount, as if they were
+ * filled one by one. Tail lines are not visible to anyone else yet:
+ * their refcount is 0, so we do not need to lock them.
+ */
+void pcache_split_rmap_huge(struct pcache_meta *head, pte_t *ptes)
+{
+	struct pcache_rmap *head_rmap, *rmap;
+	struct pcache_meta *pcm;
+	int i;
+
+	head_rmap = huge_rmap(head);
+
+	for (i = 1; i < PCACHE_HUGE_NR_LINES; i++) {
+		pcm = head + i;
+
+		/* The pre-allocated one is always free for tail lines */
+		rmap = alloc_pcache_rmap(pcm);
+		PCACHE_BUG_ON_PCM(!rmap || RmapKmalloced(rmap), pcm);
+
+		rmap->page_table = ptes + i;
+		rmap->address = head_rmap->address + i * PCACHE_LINE_SIZE;
+		rmap->owner_mm = head_rmap->owner_mm;
+		rmap->owner_process = head_rmap->owner_process;
+		rmap->caller = RMAP_FILL_HUGE;
+
+		list_add(&rmap->next, &pcm->rmap);
+		atomic_inc(&pcm->mapcount);
+		SetPcacheValid(pcm);
+		init_pcache_ref_count(pcm);
+	}
+
+	head_rmap->page_table = ptes;
+}
+
+/*
+ * Write-protect the pmd of @head, so its content is stable
+ * while being flushed back. @head is locked when called.
+ *
+ * If the pmd was accessed since last time, clear the accessed bit
+ * and return -EAGAIN: the line gets a second chance.
+ */
+int pcache_wrprotect_huge(struct pcache_meta *head, bool *dirty)
+{
+	struct pcache_rmap *rmap = huge_rmap(head);
+	pmd_t *pmd = (pmd_t *)rmap->page_table;
+	spinlock_t *ptl;
+	int ret = 0;
+
+	ptl = pmd_lock(rmap->owner_mm, pmd);
+	if (test_and_clear_bit(_PAGE_BIT_ACCESSED, (unsigned long *)pmd))
+		ret = -EAGAIN;
+	else
+		clear_bit(_PAGE_BIT_RW, (unsigned long *)pmd);
+
+	flush_tlb_mm_range(rmap->owner_mm, rmap->address,
+			   rmap->address + PCACHE_HUGE_LINE_SIZE);
+
+	/* No one can dirty it after TLB flush */
+	if (!ret)
+		*dirty = pmd_dirty(*pmd);
+	spin_unlock(ptl);
+
+	return ret;
+}
+
+/* Clear the pmd and remove the rmap. @head is locked when called. */
+void pcache_unmap_huge(struct pcache_meta *head)
+{
+	struct pcache_rmap *rmap = huge_rmap(head);
+	pmd_t *pmd = (pmd_t *)rmap->page_table;
+	spinlock_t *ptl;
+
+	ptl = pmd_lock(rmap->owner_mm, pmd);
+	pmd_clear(pmd);
+	flush_tlb_mm_range(rmap->owner_mm, rmap->address,
+			   rmap->address + PCACHE_HUGE_LINE_SIZE);
+	spin_unlock(ptl);
+
+	__pcache_remove_rmap(head, rmap);
+}
+#endif /* CONFIG_PCACHE_HUGE_LINE */
+
 /*
  * Walk through pcache line's reverse mapping.
  * @pcm must be locked on entry.
@@ -21,6 +21,7 @@ static const char *const pcache_event_text[] = {
 	"nr_clflush_clean_skipped",
 	"nr_clflush_fail",
 	"nr_clflush_piggyback_fallback",
+	"nr_clflush_batch",
 
 	/* write-protection fault */
 	"nr_pgfault_wp",
@@ -41,6 +42,12 @@ static const char *const pcache_event_text[] = {
 	"nr_pcache_eviction_failure_find",
 	"nr_pcache_eviction_failure_evict",
 	"nr_pcache_eviction_succeed",
+	"nr_pcache_eviction_scanned",
+	"nr_pcache_eviction_find_ns",
+
+	"nr_clock_second_chance",
+	"nr_clock_promote",
+	"nr_clock_demote",
 
 	"nr_pset_list_lookup",
 	"nr_pset_list_hit",
@@ -80,8 +87,83 @@ static const char *const pcache_event_text[] = {
 	"nr_pcache_pee_alloc_kmalloc",
 	"nr_pcache_pee_free",
 	"nr_pcache_pee_free_kmalloc",
+
+	"nr_mshr_alloc",
+	"nr_mshr_merge",
+	"nr_mshr_full",
+	"nr_mshr_cancelled",
+
+	"nr_pcache_alloc_direct_evict",
+	"nr_reclaim_run",
+	"nr_reclaim_evict",
+	"nr_reclaim_failure",
+	"nr_reclaim_busy",
+
+	"nr_prefetch_triggered",
+	"nr_prefetch_lines",
+	"nr_prefetch_filled",
+	"nr_prefetch_dropped",
+	"nr_prefetch_useful",
+	"nr_prefetch_wasted",
+	"nr_prefetch_backoff",
+
+	"nr_delta_snapshot",
+	"nr_delta_snapshot_fail",
+	"nr_delta_flush",
+	"nr_delta_flush_clean",
+	"nr_delta_flush_full",
+	"nr_delta_flush_bytes",
+
+	"nr_huge_fill",
+	"nr_huge_fill_fail",
+	"nr_huge_alloc_fail",
+	"nr_huge_eviction",
+	"nr_huge_split",
+	"nr_huge_zap",
+
+	"nr_quota_recycle",
+	"nr_quota_table_full",
 };
 
+static const char *pcache_evict_algorithm(void)
+{
+	if (IS_ENABLED(CONFIG_PCACHE_EVICT_LRU))
+		return "lru";
+	if (IS_ENABLED(CONFIG_PCACHE_EVICT_FIFO))
+		return "fifo";
+	if (IS_ENABLED(CONFIG_PCACHE_EVICT_RANDOM))
+		return "random";
+	if (IS_ENABLED(CONFIG_PCACHE_EVICT_CLOCK_PRO))
+		return "clock-pro";
+	if (IS_ENABLED(CONFIG_PCACHE_EVICT_CLOCK))
+		return "clock";
+	return "unknown";
+}
+
+/*
+ * Summary used to compare eviction algorithms over the same workload.
+ * Pcache hits are served by hardware and invisible to us, so the number
+ * of remote fills is what tells the hit ratio apart.
+ */
+static void print_pcache_eviction_summary(void)
+{
+	unsigned long nr_find, nr_evicted, nr_scanned, find_ns, nr_miss;
+
+	nr_find = pcache_event(PCACHE_EVICTION_TRIGGERED);
+	nr_evicted = pcache_event(PCACHE_EVICTION_SUCCEED);
+	nr_scanned = pcache_event(PCACHE_EVICTION_SCANNED);
+	find_ns = pcache_event(PCACHE_EVICTION_FIND_NS);
+	nr_miss = pcache_event(PCACHE_FAULT_FILL_FROM_MEMORY) +
+		  pcache_event(PCACHE_FAULT_FILL_ZEROFILL);
+
+	pr_info("eviction algorithm: %s\n", pcache_evict_algorithm());
+	pr_info("  misses: %lu evicted: %lu\n", nr_miss, nr_evicted);
+	pr_info("  avg lines scanned per find: %lu\n",
+		nr_find ? nr_scanned / nr_find : 0);
+	pr_info("  avg find latency: %lu ns\n",
+		nr_find ? find_ns / nr_find : 0);
+}
+
 void print_pcache_events(void)
 {
 	int i;
@@ -92,4 +174,6 @@ void print_pcache_events(void)
 		pr_info("%s: %lu\n", pcache_event_text[i],
 			atomic_long_read(&pcache_event_stats.event[i]));
 	}
+
+	print_pcache_eviction_summary();
 }
@@ -79,6 +79,8 @@ void pcache_process_exit(struct task_struct *tsk)
 {
 	/* will also free rmap */
 	release_pgtable(tsk, PAGE_SIZE, TASK_SIZE);
+
+	pcache_quota_exit(tsk->mm);
 }
 
 /*
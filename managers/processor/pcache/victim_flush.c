@@ -113,10 +113,11 @@ int victim_submit_flush(struct pcache_victim_meta *victim, bool wait, bool dirty
 }
 
 /*
- * Return number of succeed clflush
- * It can be 0, if the address belonged area was unmapped
+ * Add all hits of @victim to @batch.
+ * Lines are only guaranteed to be flushed after the batch is sent.
  */
-static void victim_flush_one(struct pcache_victim_meta *victim)
+static void victim_flush_one(struct pcache_victim_meta *victim,
+			     struct pcache_flush_batch *batch)
 {
 	void *cache_kva;
 	struct pcache_victim_hit_entry *entry;
@@ -130,14 +131,12 @@ static void victim_flush_one(struct pcache_victim_meta *victim)
 	 * happens once and it already happened.
 	 */
 	list_for_each_entry(entry, &victim->hits, next)
-		__clflush_one(entry->tgid, entry->address,
-			      entry->m_nid, entry->rep_nid, cache_kva);
+		pcache_flush_batch_add(batch, entry->tgid, entry->address,
+				       entry->m_nid, entry->rep_nid, cache_kva);
 }
 
-void __victim_flush_func(struct victim_flush_job *job)
+static void victim_flush_prepare(struct victim_flush_job *job)
 {
-	bool wait = job->wait;
-	struct completion *done = &job->done;
 	struct pcache_victim_meta *victim = job->victim;
 
 	PCACHE_BUG_ON_VICTIM(!VictimHasdata(victim) || !VictimAllocated(victim), victim);
@@ -145,7 +144,14 @@ void __victim_flush_func(struct victim_flush_job *job)
 	PCACHE_BUG_ON_VICTIM(!VictimWaitflush(victim), victim);
 
 	__SetVictimWriteback(victim);
-	victim_flush_one(victim);
+}
+
+static void victim_flush_finish(struct victim_flush_job *job)
+{
+	bool wait = job->wait;
+	struct completion *done = &job->done;
+	struct pcache_victim_meta *victim = job->victim;
+
 	inc_pcache_event(PCACHE_VICTIM_FLUSH_FINISHED_DIRTY);
 	__ClearVictimWriteback(victim);
 
@@ -168,6 +174,32 @@ void __victim_flush_func(struct victim_flush_job *job)
 	kfree(job);
 }
 
+/*
+ * Flush a group of jobs. Lines of the same process going to the same
+ * memory node are sent in one batched message. No victim is marked
+ * Flushed before the whole group has been written back.
+ */
+static void victim_flush_jobs(struct victim_flush_job **jobs, int nr_jobs)
+{
+	struct pcache_flush_batch batch;
+	int i;
+
+	pcache_flush_batch_init(&batch);
+	for (i = 0; i < nr_jobs; i++) {
+		victim_flush_prepare(jobs[i]);
+		victim_flush_one(jobs[i]->victim, &batch);
+	}
+	pcache_flush_batch_send(&batch);
+
+	for (i = 0; i < nr_jobs; i++)
+		victim_flush_finish(jobs[i]);
+}
+
+void __victim_flush_func(struct victim_flush_job *job)
+{
+	victim_flush_jobs(&job, 1);
+}
+
 /*
  * Stead a victim flush job from the pending queue.
  * Return NULL if we failed.
@@ -185,8 +217,13 @@ struct victim_flush_job *__steal_victim_flush_job(void)
 	return job;
 }
 
+#define VICTIM_FLUSH_MAX_JOBS	PCACHE_FLUSH_BATCH_MAX_LINES
+
 static int victim_flush_async(void *unused)
 {
+	struct victim_flush_job *jobs[VICTIM_FLUSH_MAX_JOBS];
+	int nr_jobs;
+
 	if (pin_current_thread())
 		panic("Fail to pin victim flush");
 
@@ -198,12 +235,18 @@ static int victim_flush_async(void *unused)
 		while (!list_empty(&victim_flush_queue)) {
 			struct victim_flush_job *job;
 
-			job = list_entry(victim_flush_queue.next,
-					 struct victim_flush_job, next);
-			__dequeue_victim_flush_job(job);
+			/* Grab as many jobs as one batch can carry */
+			nr_jobs = 0;
+			while (!list_empty(&victim_flush_queue) &&
+			       nr_jobs < VICTIM_FLUSH_MAX_JOBS) {
+				job = list_entry(victim_flush_queue.next,
+						 struct victim_flush_job, next);
+				__dequeue_victim_flush_job(job);
+				jobs[nr_jobs++] = job;
+			}
 			spin_unlock(&victim_flush_lock);
 
-			__victim_flush_func(job);
+			victim_flush_jobs(jobs, nr_jobs);
 
 			spin_lock(&victim_flush_lock);
 		}
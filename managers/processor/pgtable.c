@@ -184,6 +184,15 @@ zap_pmd_range(struct mm_struct *mm, pud_t *pud,
 	pmd = pmd_offset(pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pcache_pmd_huge(*pmd)) {
+			if (next - addr == PMD_SIZE) {
+				pcache_zap_huge_pmd(mm, pmd, addr);
+				continue;
+			}
+			/* Partial unmap, fall back to 4KB lines */
+			if (WARN_ON_ONCE(pcache_split_huge_pmd(mm, pmd, addr)))
+				continue;
+		}
 		if (pmd_none_or_clear_bad(pmd))
 			continue;
 		next = zap_pte_range(mm, pmd, addr, next);
@@ -254,6 +263,9 @@ void release_pgtable(struct task_struct *tsk,
 	pgtable_debug("%s[%d] [%#lx - %#lx]",
 		tsk->comm, tsk->tgid, start, end);
 
+	/* Fills in flight must not establish mapping after zap */
+	pcache_mshr_cancel_range(mm, start, end);
+
 	/* Free actual pages */
 	unmap_page_range(mm, start, end);
 
@@ -407,6 +419,10 @@ pcache_copy_pmd_range(struct mm_struct *dst_mm, struct mm_struct *src_mm,
 	src_pmd = pmd_offset(src_pud, addr);
 	do {
 		next = pmd_addr_end(addr, end);
+		/* Child only gets 4KB lines */
+		if (pcache_pmd_huge(*src_pmd) &&
+		    pcache_split_huge_pmd(src_mm, src_pmd, addr))
+			return -ENOMEM;
 		if (pmd_none_or_clear_bad(src_pmd))
 			continue;
 		if (pcache_copy_pte_range(dst_mm, src_mm, dst_pmd, src_pmd,
@@ -622,10 +638,19 @@ unsigned long move_page_tables(struct task_struct *tsk,
 		if (!old_pmd)
 			continue;
 
+		/* Huge lines are moved as 4KB lines */
+		if (pcache_pmd_huge(*old_pmd) &&
+		    WARN_ON_ONCE(pcache_split_huge_pmd(mm, old_pmd, old_addr)))
+			break;
+
 		new_pmd = alloc_new_pmd(mm, new_addr);
 		if (WARN_ON_ONCE(!new_pmd))
 			break;
 
+		if (pcache_pmd_huge(*new_pmd) &&
+		    WARN_ON_ONCE(pcache_split_huge_pmd(mm, new_pmd, new_addr)))
+			break;
+
 		if (WARN_ON_ONCE(!pte_alloc(mm, new_pmd, new_addr)))
 			break;
 
@@ -686,6 +711,9 @@ zerofill_set_pmd_range(struct mm_struct *mm, pud_t *pud,
 
 	do {
 		next = pmd_addr_end(addr, end);
+		if (pcache_pmd_huge(*pmd) &&
+		    pcache_split_huge_pmd(mm, pmd, addr))
+			return -ENOMEM;
 		next = zerofill_set_pte_range(mm, pmd, addr, next);
 		if (unlikely(next == -ENOMEM))
 			return -ENOMEM;
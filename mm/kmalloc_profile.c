@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * Boot-time kmalloc/kfree throughput profiling
+ *
+ * Each thread allocates a batch of objects and then frees them all,
+ * over and over, with 1, 2, 4.. threads. Only active CPUs are used,
+ * pinned CPUs are busy polling. This does not depend on the kmalloc
+ * implementation, build with SLOB and SLUB to compare them.
+ */
+
+#include <lego/smp.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/cpumask.h>
+#include <lego/profile.h>
+
+#define NR_TESTS		(20000)
+#define NR_BATCH		(16)
+#define NR_OPS			(NR_TESTS * NR_BATCH)
+
+/*
+ * 64: small metadata, e.g. RPC reply headers
+ * 512: mid-sized RPC messages
+ * 4104: page cache line plus an 8 bytes reply header
+ */
+static const size_t profile_sizes[] = { 64, 512, 4104 };
+
+static void __profile_kmalloc(void *_size)
+{
+	size_t size = (size_t)_size;
+	void *objs[NR_BATCH];
+	int i, j;
+
+	for (i = 0; i < NR_TESTS; i++) {
+		for (j = 0; j < NR_BATCH; j++) {
+			objs[j] = kmalloc(size, GFP_KERNEL);
+			if (unlikely(!objs[j])) {
+				pr_err("CPU%2d fail to kmalloc %zu\n",
+					smp_processor_id(), size);
+				break;
+			}
+		}
+		while (--j >= 0)
+			kfree(objs[j]);
+	}
+}
+
+static void profile_kmalloc_threads(size_t size, unsigned int nr_threads)
+{
+	unsigned long thread_ns;
+
+	thread_ns = profile_run_threads(__profile_kmalloc, (void *)size,
+					nr_threads, cpu_active_mask,
+					"kmalloc_profile");
+	if (!thread_ns)
+		return;
+
+	/* Average run time of one thread */
+	thread_ns /= nr_threads;
+	if (!thread_ns)
+		thread_ns = 1;
+
+	pr_info("    size: %5zu nr_threads: %2u. Avg kmalloc+kfree: %4lu ns. "
+		"Throughput: %lu Kops/s\n", size, nr_threads,
+		thread_ns / NR_OPS,
+		NR_OPS * nr_threads * 1000000UL / thread_ns);
+}
+
+void kmalloc_profile(void)
+{
+	unsigned int nr_threads, max_threads;
+	int i;
+
+	max_threads = cpumask_weight(cpu_active_mask);
+
+	pr_info("Kmalloc Profile. [nr_run/thread: %d, batch: %d]\n",
+		NR_TESTS, NR_BATCH);
+	for (i = 0; i < ARRAY_SIZE(profile_sizes); i++) {
+		for (nr_threads = 1; nr_threads <= max_threads; nr_threads *= 2)
+			profile_kmalloc_threads(profile_sizes[i], nr_threads);
+	}
+}
@@ -17,6 +17,9 @@
 #include <lego/init.h>
 #include <lego/numa.h>
 #include <lego/sched.h>
+#include <lego/percpu.h>
+#include <lego/smp.h>
+#include <lego/slab.h>
 #include <lego/string.h>
 #include <lego/kernel.h>
 #include <lego/vmstat.h>
@@ -301,10 +304,13 @@ static void zone_init_free_lists(struct zone *zone)
 	}
 }
 
-/* TODO */
+/*
+ * Per-CPU pagesets are allocated later by setup_per_cpu_pageset(),
+ * until then everything goes to buddy directly.
+ */
 static void zone_pcp_init(struct zone *zone)
 {
-
+	zone->pageset = NULL;
 }
 
 /*
@@ -768,36 +774,11 @@ static void __free_pages_ok(struct page *page, unsigned int order)
 		return;
 
 	local_irq_save(flags);
+	__count_vm_events(PGFREE, 1 << order);
 	free_one_page(page_zone(page), page, pfn, order);
 	local_irq_restore(flags);
 }
 
-void __free_pages_boot(struct page *page, unsigned int order)
-{
-	if (put_page_testzero(page)) {
-		__free_pages_ok(page, order);
-	}
-}
-
-void __free_pages(struct page *page, unsigned int order)
-{
-#ifndef CONFIG_DEBUG_KMALLOC_USE_BUDDY
-	if (put_page_testzero(page)) {
-		__free_pages_ok(page, order);
-	}
-#endif
-}
-
-void free_pages(unsigned long addr, unsigned int order)
-{
-#ifndef CONFIG_DEBUG_KMALLOC_USE_BUDDY
-	if (addr != 0) {
-		VM_BUG_ON(!virt_addr_valid(addr));
-		__free_pages(virt_to_page((void *)addr), order);
-	}
-#endif
-}
-
 static __always_inline void __clear_page(void *page)
 {
 	/* XXX: Trace this if necessary */
@@ -881,6 +862,201 @@ static inline struct page *__rmqueue(struct zone *zone, unsigned int order)
 	return page;
 }
 
+/*
+ * Per-CPU page lists
+ *
+ * Every anonymous fault and every page table page is an order-0
+ * allocation, and zone->lock used to be taken for each of them.
+ * Instead, each CPU keeps a short list of order-0 pages per zone.
+ * It is refilled from, and drained to, buddy in batches, so zone->lock
+ * is taken once per batch. Hot pages (just freed, likely still in cache)
+ * sit at the head, cold ones at the tail.
+ *
+ * Each list is only touched by its own CPU, with irq disabled.
+ */
+
+/*
+ * Move up to @count pages from buddy to @list.
+ * Return the number of pages moved.
+ */
+static int rmqueue_bulk(struct zone *zone, int count, struct list_head *list)
+{
+	struct page *page;
+	int i;
+
+	spin_lock(&zone->lock);
+	for (i = 0; i < count; i++) {
+		page = __rmqueue(zone, 0);
+		if (unlikely(!page))
+			break;
+		list_add_tail(&page->lru, list);
+	}
+	__mod_zone_page_state(zone, NR_FREE_PAGES, -i);
+	spin_unlock(&zone->lock);
+
+	return i;
+}
+
+/* Give up to @count coldest pages of @pcp back to buddy */
+static void free_pcppages_bulk(struct zone *zone, int count,
+			       struct per_cpu_pages *pcp)
+{
+	struct page *page;
+
+	spin_lock(&zone->lock);
+	while (count-- && !list_empty(&pcp->list)) {
+		page = list_last_entry(&pcp->list, struct page, lru);
+		list_del(&page->lru);
+		pcp->count--;
+		__free_one_page(page, page_to_pfn(page), zone, 0);
+	}
+	spin_unlock(&zone->lock);
+}
+
+static void free_hot_cold_page(struct page *page, bool cold)
+{
+	struct zone *zone = page_zone(page);
+	struct per_cpu_pages *pcp;
+	unsigned long flags;
+
+	if (unlikely(!zone->pageset)) {
+		__free_pages_ok(page, 0);
+		return;
+	}
+
+	if (!free_pages_prepare(page, 0, true))
+		return;
+
+	local_irq_save(flags);
+	__count_vm_event(PGFREE);
+	__count_vm_event(PCP_FREE);
+
+	pcp = &this_cpu_ptr(zone->pageset)->pcp;
+	if (!cold)
+		list_add(&page->lru, &pcp->list);
+	else
+		list_add_tail(&page->lru, &pcp->list);
+	pcp->count++;
+
+	if (unlikely(pcp->count >= pcp->high)) {
+		free_pcppages_bulk(zone, pcp->batch, pcp);
+		__count_vm_event(PCP_DRAIN);
+	}
+	local_irq_restore(flags);
+}
+
+/* Give all pages of this CPU's lists back to buddy */
+static void drain_local_pages(void *unused)
+{
+	struct per_cpu_pages *pcp;
+	struct zone *zone;
+	unsigned long flags;
+	int nid;
+
+	local_irq_save(flags);
+	for_each_managed_zone(nid, zone) {
+		if (!zone->pageset)
+			continue;
+		pcp = &this_cpu_ptr(zone->pageset)->pcp;
+		if (pcp->count)
+			free_pcppages_bulk(zone, pcp->count, pcp);
+	}
+	local_irq_restore(flags);
+}
+
+/*
+ * Called before we give up an allocation. Pages sitting in
+ * other CPUs' lists can only be given back by those CPUs.
+ */
+static void drain_all_pages(void)
+{
+	count_vm_event(PCP_DRAIN_ALL);
+
+	drain_local_pages(NULL);
+
+	/* Waiting for other CPUs with irq disabled would deadlock */
+	if (!irqs_disabled())
+		smp_call_function(drain_local_pages, NULL, 1);
+}
+
+static int zone_batchsize(struct zone *zone)
+{
+	int batch;
+
+	/* About 1/4 of 1/1000 of the zone, but no more than 128KB */
+	batch = zone->managed_pages / 1024;
+	if (batch * PAGE_SIZE > 512 * 1024)
+		batch = (512 * 1024) / PAGE_SIZE;
+	batch /= 4;
+	if (batch < 1)
+		batch = 1;
+	return batch;
+}
+
+/*
+ * Called once buddy and percpu allocator are both up.
+ * Zones without a pageset simply keep using buddy directly.
+ */
+static void __init setup_per_cpu_pageset(void)
+{
+	struct per_cpu_pageset __percpu *pageset;
+	struct per_cpu_pageset *p;
+	struct zone *zone;
+	int nid, cpu, batch;
+
+	for_each_managed_zone(nid, zone) {
+		pageset = alloc_percpu(struct per_cpu_pageset);
+		if (!pageset) {
+			pr_warn("Fail to allocate pageset for zone %s\n", zone->name);
+			continue;
+		}
+
+		batch = zone_batchsize(zone);
+		for_each_possible_cpu(cpu) {
+			p = per_cpu_ptr(pageset, cpu);
+
+			INIT_LIST_HEAD(&p->pcp.list);
+			p->pcp.count = 0;
+			p->pcp.batch = batch;
+			p->pcp.high = 6 * batch;
+			p->stat_threshold = min(2 * batch, 125);
+		}
+
+		/* Publish only after it is fully set up */
+		smp_wmb();
+		zone->pageset = pageset;
+	}
+}
+
+void __free_pages_boot(struct page *page, unsigned int order)
+{
+	if (put_page_testzero(page)) {
+		__free_pages_ok(page, order);
+	}
+}
+
+void __free_pages(struct page *page, unsigned int order)
+{
+#ifndef CONFIG_DEBUG_KMALLOC_USE_BUDDY
+	if (put_page_testzero(page)) {
+		if (likely(order == 0))
+			free_hot_cold_page(page, false);
+		else
+			__free_pages_ok(page, order);
+	}
+#endif
+}
+
+void free_pages(unsigned long addr, unsigned int order)
+{
+#ifndef CONFIG_DEBUG_KMALLOC_USE_BUDDY
+	if (addr != 0) {
+		VM_BUG_ON(!virt_addr_valid(addr));
+		__free_pages(virt_to_page((void *)addr), order);
+	}
+#endif
+}
+
 static inline
 struct page *buffered_rmqueue(struct zone *zone, unsigned int order,
 			      gfp_t gfp_flags)
@@ -894,6 +1070,31 @@ struct page *buffered_rmqueue(struct zone *zone, unsigned int order,
 	 */
 	WARN_ON_ONCE((gfp_flags & __GFP_NOFAIL) && (order > 1));
 
+	if (likely(order == 0) && likely(zone->pageset)) {
+		struct per_cpu_pages *pcp;
+
+		local_irq_save(flags);
+		pcp = &this_cpu_ptr(zone->pageset)->pcp;
+		if (unlikely(list_empty(&pcp->list))) {
+			pcp->count += rmqueue_bulk(zone, pcp->batch, &pcp->list);
+			if (unlikely(list_empty(&pcp->list)))
+				goto failed;
+			__count_vm_event(PCP_REFILL);
+		}
+
+		if (gfp_flags & __GFP_COLD)
+			page = list_last_entry(&pcp->list, struct page, lru);
+		else
+			page = list_first_entry(&pcp->list, struct page, lru);
+		list_del(&page->lru);
+		pcp->count--;
+
+		__count_vm_event(PGALLOC);
+		__count_vm_event(PCP_ALLOC);
+		local_irq_restore(flags);
+		return page;
+	}
+
 	spin_lock_irqsave(&zone->lock, flags);
 	page = __rmqueue(zone, order);
 	spin_unlock(&zone->lock);
@@ -901,6 +1102,7 @@ struct page *buffered_rmqueue(struct zone *zone, unsigned int order,
 		goto failed;
 
 	__mod_zone_page_state(zone, NR_FREE_PAGES, -(1<< order));
+	__count_vm_events(PGALLOC, 1 << order);
 	local_irq_restore(flags);
 	return page;
 
@@ -960,7 +1162,22 @@ __alloc_pages_nodemask(gfp_t gfp_mask, unsigned int order,
 		return NULL;
 
 	page = get_page_from_freelist(gfp_mask, order, zonelist, nodemask);
-	if (unlikely(!page && order < MAX_ORDER)) {
+
+	/*
+	 * Free pages may be sitting in per-CPU lists. Draining them costs
+	 * an IPI round, and waits for all CPUs. Only do it as the last
+	 * resort before the panic below, and not in atomic context: the
+	 * caller may hold a lock another CPU spins on. Per-CPU lists only
+	 * hold order-0 pages anyway.
+	 */
+	if (unlikely(!page) && !order &&
+	    !(gfp_mask & (__GFP_NOWARN | __GFP_ATOMIC))) {
+		drain_all_pages();
+		page = get_page_from_freelist(gfp_mask, order, zonelist, nodemask);
+	}
+
+	/* Callers passing __GFP_NOWARN have a fallback */
+	if (unlikely(!page && order < MAX_ORDER && !(gfp_mask & __GFP_NOWARN))) {
 		struct manager_sysinfo i;
 
 		manager_meminfo(&i);
@@ -1426,7 +1643,7 @@ void dump_zonelists(void)
 void manager_meminfo(struct manager_sysinfo *val)
 {
 	val->totalram = totalram_pages;
-	val->freeram = global_page_state(NR_FREE_PAGES);
+	val->freeram = global_page_state_snapshot(NR_FREE_PAGES);
 	val->mem_unit = PAGE_SIZE;
 }
 
@@ -1446,6 +1663,11 @@ void __init memory_init(void)
 	/* Put all avaiable memory to allocator */
 	free_all_bootmem();
 
+	setup_per_cpu_pageset();
+
+	/* kmalloc() is usable from now on */
+	kmem_cache_init();
+
 	dump_zonelists();
 }
 
@@ -0,0 +1,462 @@
+/*
+ * Copyright (c) 2016-2018 Wuklab, Purdue University. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ */
+
+/*
+ * SLUB-style kmalloc
+ *
+ * SLOB serializes every kmalloc/kfree in the system on one lock and walks
+ * a first-fit list while holding it. Here requests are rounded up to a
+ * fixed set of size classes, each class carves objects out of its own slabs,
+ * and each CPU owns (freezes) one slab per class:
+ *
+ *  - Alloc pops from the per-cpu freelist, kfree of an object that belongs
+ *    to the slab frozen by this CPU pushes onto it. Both only disable local
+ *    interrupts, no lock and no atomic instruction is involved.
+ *
+ *  - kfree from another CPU, or of an object whose slab is not frozen by
+ *    this CPU, goes onto the slab's own freelist under the per-class
+ *    list_lock. The owning CPU takes the whole list in one go once its
+ *    per-cpu freelist runs dry.
+ *
+ *  - Slabs that are neither frozen nor full sit on the per-class partial
+ *    list. Empty slabs go back to buddy once there are enough partial ones.
+ *
+ * The free pointer lives in the first word of a free object. For the head
+ * page of a slab, page->freelist is the remote freelist and page->units is
+ * the number of objects not on it. Every page of a slab has PageSlab set and
+ * page->private pointing back to its kmem_cache.
+ */
+
+#include <lego/mm.h>
+#include <lego/bug.h>
+#include <lego/init.h>
+#include <lego/list.h>
+#include <lego/slab.h>
+#include <lego/kernel.h>
+#include <lego/percpu.h>
+#include <lego/string.h>
+#include <lego/spinlock.h>
+#include <lego/profile.h>
+
+/* Upper bound of slab size, and how many objects we want per slab */
+#define SLUB_MAX_ORDER		3
+#define SLUB_MIN_OBJECTS	8
+
+/* Empty slabs are kept until this many are on the partial list */
+#define SLUB_MIN_PARTIAL	2
+
+struct kmem_cache_cpu {
+	void **freelist;		/* next available object */
+	struct page *page;		/* the slab we are allocating from */
+};
+
+struct kmem_cache {
+	struct kmem_cache_cpu __percpu *cpu_slab;
+	unsigned int size;		/* object size */
+	unsigned int order;		/* slab order */
+	unsigned int objects;		/* objects per slab */
+
+	spinlock_t list_lock;
+	unsigned long nr_partial;
+	struct list_head partial;
+
+	char name[16];
+};
+
+static struct kmem_cache kmalloc_cache_array[KMALLOC_SHIFT_HIGH + 1];
+static DEFINE_PER_CPU(struct kmem_cache_cpu, kmalloc_cpu_slab[KMALLOC_SHIFT_HIGH + 1]);
+
+struct kmem_cache *kmalloc_caches[KMALLOC_SHIFT_HIGH + 1] __read_mostly;
+
+static inline void *get_freepointer(void *object)
+{
+	return *(void **)object;
+}
+
+static inline void set_freepointer(void *object, void *fp)
+{
+	*(void **)object = fp;
+}
+
+/* Objects never straddle slabs and slabs are naturally aligned */
+static inline struct page *slab_head_page(struct kmem_cache *s, const void *x)
+{
+	unsigned long slab_size = PAGE_SIZE << s->order;
+
+	return virt_to_page((unsigned long)x & ~(slab_size - 1));
+}
+
+static struct page *new_slab(struct kmem_cache *s, gfp_t flags, int node)
+{
+	struct page *page;
+	void *start, *p, *next;
+	int i;
+
+	flags &= ~__GFP_ZERO;
+#ifdef CONFIG_NUMA
+	if (node != NUMA_NO_NODE)
+		page = __alloc_pages_node(node, flags, s->order);
+	else
+#endif
+		page = alloc_pages(flags, s->order);
+	if (unlikely(!page))
+		return NULL;
+
+	for (i = 0; i < (1 << s->order); i++) {
+		__SetPageSlab(page + i);
+		set_page_private(page + i, (unsigned long)s);
+	}
+
+	start = page_address(page);
+	for (i = 0, p = start; i < s->objects - 1; i++, p = next) {
+		next = p + s->size;
+		set_freepointer(p, next);
+	}
+	set_freepointer(p, NULL);
+
+	page->freelist = start;
+	page->units = 0;
+	INIT_LIST_HEAD(&page->lru);
+	return page;
+}
+
+static void discard_slab(struct kmem_cache *s, struct page *page)
+{
+	int i;
+
+	for (i = 0; i < (1 << s->order); i++) {
+		__ClearPageSlab(page + i);
+		set_page_private(page + i, 0);
+	}
+	page->freelist = NULL;
+	page->units = 0;
+	__free_pages(page, s->order);
+}
+
+static inline void add_partial(struct kmem_cache *s, struct page *page)
+{
+	list_add_tail(&page->lru, &s->partial);
+	s->nr_partial++;
+}
+
+static inline void remove_partial(struct kmem_cache *s, struct page *page)
+{
+	list_del_init(&page->lru);
+	s->nr_partial--;
+}
+
+/*
+ * Make @page the cpu slab of @c. The page's whole freelist moves to
+ * the cpu, so all objects are accounted as in use from now on.
+ * Caller holds list_lock with irq disabled.
+ */
+static void freeze_slab(struct kmem_cache *s, struct kmem_cache_cpu *c,
+			struct page *page)
+{
+	__SetPageSlubFrozen(page);
+	c->page = page;
+	c->freelist = page->freelist;
+	page->freelist = NULL;
+	page->units = s->objects;
+}
+
+/*
+ * Give the cpu slab back. Objects still on the per-cpu freelist
+ * all belong to c->page, they are returned to the page first.
+ * Caller holds list_lock with irq disabled.
+ */
+static void deactivate_slab(struct kmem_cache *s, struct kmem_cache_cpu *c)
+{
+	struct page *page = c->page;
+	void *object, *next;
+
+	for (object = c->freelist; object; object = next) {
+		next = get_freepointer(object);
+		set_freepointer(object, page->freelist);
+		page->freelist = object;
+		page->units--;
+	}
+	c->freelist = NULL;
+	c->page = NULL;
+	__ClearPageSlubFrozen(page);
+
+	if (!page->freelist)
+		return;
+
+	if (!page->units && s->nr_partial >= SLUB_MIN_PARTIAL) {
+		discard_slab(s, page);
+		return;
+	}
+	add_partial(s, page);
+}
+
+/*
+ * Slow path: the per-cpu freelist is empty. In order, try objects freed
+ * remotely into the cpu slab, a slab from the partial list, and finally
+ * a fresh slab from buddy.
+ */
+static void *__slab_alloc(struct kmem_cache *s, gfp_t gfpflags, int node)
+{
+	struct kmem_cache_cpu *c;
+	struct page *page;
+	unsigned long flags;
+	void *object;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(s->cpu_slab);
+
+	/* Someone else may have refilled it if we migrated */
+	if (c->freelist)
+		goto load_freelist;
+
+	spin_lock(&s->list_lock);
+	if (c->page) {
+		page = c->page;
+		if (page->freelist) {
+			c->freelist = page->freelist;
+			page->freelist = NULL;
+			page->units = s->objects;
+			spin_unlock(&s->list_lock);
+			goto load_freelist;
+		}
+		deactivate_slab(s, c);
+	}
+
+	if (s->nr_partial) {
+		page = list_first_entry(&s->partial, struct page, lru);
+		remove_partial(s, page);
+		goto freeze;
+	}
+	spin_unlock(&s->list_lock);
+	local_irq_restore(flags);
+
+	page = new_slab(s, gfpflags, node);
+	if (unlikely(!page))
+		return NULL;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(s->cpu_slab);
+	spin_lock(&s->list_lock);
+	if (c->page)
+		deactivate_slab(s, c);
+
+freeze:
+	freeze_slab(s, c, page);
+	spin_unlock(&s->list_lock);
+
+load_freelist:
+	object = c->freelist;
+	c->freelist = get_freepointer(object);
+	local_irq_restore(flags);
+	return object;
+}
+
+static __always_inline void *
+slab_alloc_node(struct kmem_cache *s, gfp_t gfpflags, int node)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+	void *object;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(s->cpu_slab);
+	object = c->freelist;
+	if (likely(object))
+		c->freelist = get_freepointer(object);
+	local_irq_restore(flags);
+
+	if (unlikely(!object)) {
+		object = __slab_alloc(s, gfpflags, node);
+		if (unlikely(!object))
+			return NULL;
+	}
+
+	if (unlikely(gfpflags & __GFP_ZERO))
+		memset(object, 0, s->size);
+	return object;
+}
+
+/*
+ * Slow path of kfree: the object does not belong to our cpu slab.
+ */
+static void __slab_free(struct kmem_cache *s, struct page *page, void *x)
+{
+	unsigned long flags;
+	bool was_full;
+
+	spin_lock_irqsave(&s->list_lock, flags);
+	was_full = !page->freelist;
+	set_freepointer(x, page->freelist);
+	page->freelist = x;
+	page->units--;
+
+	/* The owner cpu will pick it up */
+	if (PageSlubFrozen(page))
+		goto out;
+
+	if (!page->units && s->nr_partial >= SLUB_MIN_PARTIAL) {
+		if (!was_full)
+			remove_partial(s, page);
+		spin_unlock_irqrestore(&s->list_lock, flags);
+		discard_slab(s, page);
+		return;
+	}
+
+	if (was_full)
+		add_partial(s, page);
+out:
+	spin_unlock_irqrestore(&s->list_lock, flags);
+}
+
+static __always_inline void
+slab_free(struct kmem_cache *s, struct page *page, void *x)
+{
+	struct kmem_cache_cpu *c;
+	unsigned long flags;
+
+	local_irq_save(flags);
+	c = this_cpu_ptr(s->cpu_slab);
+	if (likely(page == c->page)) {
+		set_freepointer(x, c->freelist);
+		c->freelist = x;
+		local_irq_restore(flags);
+		return;
+	}
+	local_irq_restore(flags);
+
+	__slab_free(s, page, x);
+}
+
+/*
+ * End of slub allocator proper. Begin kmem_cache_alloc and kmalloc frontend.
+ */
+
+void *kmem_cache_alloc_trace(struct kmem_cache *s, gfp_t gfpflags, size_t size)
+{
+	return slab_alloc_node(s, gfpflags, NUMA_NO_NODE);
+}
+
+#ifdef CONFIG_NUMA
+void *kmem_cache_alloc_node_trace(struct kmem_cache *s, gfp_t gfpflags,
+				  int node, size_t size)
+{
+	return slab_alloc_node(s, gfpflags, node);
+}
+#endif
+
+DEFINE_PROFILE_POINT(__do_kmalloc_node)
+
+static __always_inline void *
+__do_kmalloc_node(size_t size, gfp_t gfp, int node, unsigned long caller)
+{
+	struct kmem_cache *s;
+	void *ret;
+	PROFILE_POINT_TIME(__do_kmalloc_node)
+
+	if (unlikely(size > KMALLOC_MAX_CACHE_SIZE || (gfp & GFP_DMA))) {
+		profile_point_start(__do_kmalloc_node);
+		ret = kmalloc_large(size, gfp);
+		profile_point_leave(__do_kmalloc_node);
+		return ret;
+	}
+
+	if (unlikely(!size))
+		return ZERO_SIZE_PTR;
+
+	s = kmalloc_caches[kmalloc_index(size)];
+
+	profile_point_start(__do_kmalloc_node);
+	ret = slab_alloc_node(s, gfp, node);
+	profile_point_leave(__do_kmalloc_node);
+
+	return ret;
+}
+
+void *__kmalloc(size_t size, gfp_t gfp)
+{
+	return __do_kmalloc_node(size, gfp, NUMA_NO_NODE, _RET_IP_);
+}
+
+#ifdef CONFIG_NUMA
+void *__kmalloc_node(size_t size, gfp_t gfp, int node)
+{
+	return __do_kmalloc_node(size, gfp, node, _RET_IP_);
+}
+#endif
+
+#ifndef CONFIG_DEBUG_KMALLOC_USE_BUDDY
+void kfree(const void *block)
+{
+	struct page *sp;
+	struct kmem_cache *s;
+
+	BUG_ON(ZERO_OR_NULL_PTR(block));
+
+	sp = virt_to_page(block);
+	if (PageSlab(sp)) {
+		s = (struct kmem_cache *)page_private(sp);
+		slab_free(s, slab_head_page(s, block), (void *)block);
+	} else
+		/* See kmalloc_order() */
+		__free_pages(sp, page_private(sp));
+}
+#endif
+
+size_t ksize(const void *block)
+{
+	struct page *sp;
+	struct kmem_cache *s;
+
+	BUG_ON(!block);
+	if (unlikely(block == ZERO_SIZE_PTR))
+		return 0;
+
+	sp = virt_to_page(block);
+	if (unlikely(!PageSlab(sp)))
+		return PAGE_SIZE << page_private(sp);
+
+	s = (struct kmem_cache *)page_private(sp);
+	return s->size;
+}
+
+static void __init create_kmalloc_cache(int index)
+{
+	struct kmem_cache *s = &kmalloc_cache_array[index];
+	unsigned int size = kmalloc_size(index);
+
+	s->size = size;
+	s->order = min_t(unsigned int, get_order(size * SLUB_MIN_OBJECTS),
+			 SLUB_MAX_ORDER);
+	s->objects = (PAGE_SIZE << s->order) / size;
+	s->cpu_slab = &kmalloc_cpu_slab[index];
+	spin_lock_init(&s->list_lock);
+	INIT_LIST_HEAD(&s->partial);
+
+	sprintf(s->name, "kmalloc-%u", size);
+
+	kmalloc_caches[index] = s;
+}
+
+/*
+ * Called once buddy is up. kmalloc() must not be used before this.
+ */
+void __init kmem_cache_init(void)
+{
+	int i;
+
+	for (i = KMALLOC_SHIFT_LOW; i <= KMALLOC_SHIFT_HIGH; i++) {
+		create_kmalloc_cache(i);
+
+		/* 96 and 192 go right after their smaller neighbours */
+		if (KMALLOC_MIN_SIZE <= 32 && i == 6)
+			create_kmalloc_cache(1);
+		if (KMALLOC_MIN_SIZE <= 64 && i == 7)
+			create_kmalloc_cache(2);
+	}
+}
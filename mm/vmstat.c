@@ -15,6 +15,9 @@
 #include <lego/mm.h>
 #include <lego/atomic.h>
 #include <lego/vmstat.h>
+#include <lego/printk.h>
+#include <lego/string.h>
+#include <lego/nodemask.h>
 
 /*
  * Manage combined zone based / global counters
@@ -23,3 +26,87 @@
  */
 atomic_long_t vm_zone_stat[NR_VM_ZONE_STAT_ITEMS] __cacheline_aligned_in_smp;
 atomic_long_t vm_node_stat[NR_VM_NODE_STAT_ITEMS] __cacheline_aligned_in_smp;
+
+DEFINE_PER_CPU(struct vm_event_state, vm_event_states);
+
+void __mod_zone_page_state(struct zone *zone, enum zone_stat_item item,
+			   long delta)
+{
+	struct per_cpu_pageset *pcp;
+	unsigned long flags;
+	long x;
+
+	/* Boot time, before per-CPU pagesets are set up */
+	if (unlikely(!zone->pageset)) {
+		zone_page_state_add(delta, zone, item);
+		return;
+	}
+
+	local_irq_save(flags);
+	pcp = this_cpu_ptr(zone->pageset);
+	x = delta + pcp->vm_stat_diff[item];
+	if (unlikely(x > pcp->stat_threshold || x < -pcp->stat_threshold)) {
+		zone_page_state_add(x, zone, item);
+		x = 0;
+	}
+	pcp->vm_stat_diff[item] = x;
+	local_irq_restore(flags);
+}
+
+/*
+ * Sum up the folded counter and all per-CPU diffs.
+ * More accurate than global_page_state(), and more expensive.
+ */
+unsigned long global_page_state_snapshot(enum zone_stat_item item)
+{
+	struct zone *zone;
+	long x = atomic_long_read(&vm_zone_stat[item]);
+	int nid, cpu;
+
+	for_each_managed_zone(nid, zone) {
+		if (!zone->pageset)
+			continue;
+		for_each_online_cpu(cpu)
+			x += per_cpu_ptr(zone->pageset, cpu)->vm_stat_diff[item];
+	}
+
+	if (x < 0)
+		x = 0;
+	return x;
+}
+
+void all_vm_events(unsigned long *ret)
+{
+	int cpu, i;
+
+	memset(ret, 0, NR_VM_EVENT_ITEMS * sizeof(unsigned long));
+
+	for_each_online_cpu(cpu) {
+		struct vm_event_state *this = &per_cpu(vm_event_states, cpu);
+
+		for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
+			ret[i] += this->event[i];
+	}
+}
+
+static const char *const vm_event_text[] = {
+	"pgalloc",
+	"pgfree",
+	"pcp_alloc",
+	"pcp_free",
+	"pcp_refill",
+	"pcp_drain",
+	"pcp_drain_all",
+};
+
+void print_vm_events(void)
+{
+	unsigned long events[NR_VM_EVENT_ITEMS];
+	int i;
+
+	BUILD_BUG_ON(ARRAY_SIZE(vm_event_text) != NR_VM_EVENT_ITEMS);
+
+	all_vm_events(events);
+	for (i = 0; i < NR_VM_EVENT_ITEMS; i++)
+		pr_info("vmstat: %-16s %lu\n", vm_event_text[i], events[i]);
+}
@@ -15,6 +15,7 @@
 //#include <lego/wait.h>
 #include <net/arch/cc.h>
 #include <lego/socket.h>
+#include <lego/fit_ibapi.h>
 
 #define DEBUG_SHINYEH
 
@@ -102,7 +103,7 @@
 #define IMM_GET_OPCODE		0x0f000000
 #define IMM_GET_OPCODE_NUMBER(imm) (imm<<4)>>28
 #define IMM_DATA_BIT 32
-#define IMM_NUM_OF_SEMAPHORE 64
+#define IMM_NUM_OF_SEMAPHORE FIT_NR_REPLY_INDICATORS
 #define IMM_MAX_PORT 64
 #define IMM_RING_SIZE 1024*1024*4
 #define IMM_MAX_SIZE IMM_RING_SIZE/NUM_OF_CORES
@@ -495,6 +496,12 @@ struct lego_context {
 	void		*reply_ready_indicators[IMM_NUM_OF_SEMAPHORE];
 	DECLARE_BITMAP(reply_ready_indicators_bitmap, IMM_NUM_OF_SEMAPHORE);
 
+	/*
+	 * Header of each posted send_reply, indexed like the indicators.
+	 * HCA reads it after the post returns, it must live until the reply.
+	 */
+	struct imm_message_metadata reply_msg_headers[IMM_NUM_OF_SEMAPHORE];
+
 	CTX_PADDING(_pad3_)
 
 #ifdef ADAPTIVE_MODEL
@@ -162,6 +162,126 @@ int ibapi_send_reply_timeout(int target_node, void *addr, int size, void *ret_ad
 			__builtin_return_address(0));
 }
 
+/**
+ * ibapi_send_reply_async
+ * @target_node: target node id
+ * @addr: message to send
+ * @size: size of message
+ * @ret_addr: buffer to receive the reply
+ * @max_ret_size: size of @ret_addr
+ * @if_use_ret_phys_addr: if @ret_addr is physical address
+ * @handle: handle describing this outstanding request
+ *
+ * Post a send_reply request and return immediately. Both @addr and @ret_addr
+ * must stay valid until the reply is reaped by ibapi_wait_reply(). This lets
+ * one thread have multiple requests in flight.
+ *
+ * Return 0 on success, negative values on failure.
+ */
+int ibapi_send_reply_async(int target_node, void *addr, int size, void *ret_addr,
+			   int max_ret_size, int if_use_ret_phys_addr,
+			   struct fit_reply_handle *handle)
+{
+	int index;
+
+	if (unlikely(target_node >= CONFIG_FIT_NR_NODES)) {
+		pr_info("target_node: %d\n", target_node);
+		BUG();
+	}
+
+	handle->caller = __builtin_return_address(0);
+	index = fit_send_reply_post(FIT_ctx, target_node, addr, size, ret_addr,
+				    max_ret_size, 0, if_use_ret_phys_addr,
+				    &handle->reply_ready, handle->caller);
+	if (unlikely(index < 0))
+		return index;
+	handle->reply_index = index;
+
+#ifdef CONFIG_COUNTER_FIT_IB
+	atomic_long_inc(&nr_ib_send_reply);
+	atomic_long_add(size, &nr_bytes_tx);
+#endif
+	return 0;
+}
+
+/**
+ * ibapi_wait_reply
+ * @handle: handle filled by ibapi_send_reply_async()
+ * @timeout_sec: timeout value in seconds
+ * @may_yield: if we can give up CPU while waiting
+ *
+ * Return:
+ * Negative values on failure (-ETIMEDOUT for timeout)
+ * Positive values indicate the reply message length
+ */
+int ibapi_wait_reply(struct fit_reply_handle *handle, unsigned long timeout_sec,
+		     bool may_yield)
+{
+	int ret;
+
+	ret = fit_wait_reply(FIT_ctx, handle->reply_index, &handle->reply_ready,
+			     timeout_sec, may_yield, handle->caller);
+
+#ifdef CONFIG_COUNTER_FIT_IB
+	if (likely(ret > 0))
+		atomic_long_add(ret, &nr_bytes_rx);
+#endif
+	return ret;
+}
+
+/**
+ * ibapi_send_reply_sglist_timeout
+ * @target_node: target node id
+ * @sglist: pieces of the message, in order
+ * @nr_sglist: number of entries in @sglist, at most FIT_MAX_NR_SGLIST
+ * @ret_addr: buffer to receive the reply
+ * @max_ret_size: size of @ret_addr
+ * @if_use_ret_phys_addr: if @ret_addr is physical address
+ * @timeout_sec: timeout value in seconds
+ *
+ * Same as ibapi_send_reply_timeout(), but the message is gathered from
+ * @sglist by the HCA. Remote receives one contiguous message. This saves
+ * the memcpy when the message consists of a header and some in-place data.
+ *
+ * Return:
+ * Negative values on failure (-ETIMEDOUT for timeout)
+ * Positive values indicate the reply message length
+ */
+int ibapi_send_reply_sglist_timeout(int target_node, struct fit_sglist *sglist,
+				    int nr_sglist, void *ret_addr, int max_ret_size,
+				    int if_use_ret_phys_addr, unsigned long timeout_sec)
+{
+	ppc *ctx = FIT_ctx;
+	void *caller = __builtin_return_address(0);
+	int index, ret, checker;
+
+	if (unlikely(target_node >= CONFIG_FIT_NR_NODES)) {
+		pr_info("target_node: %d\n", target_node);
+		BUG();
+	}
+
+	index = fit_send_reply_sglist_post(ctx, target_node, sglist, nr_sglist,
+					   ret_addr, max_ret_size, 0,
+					   if_use_ret_phys_addr, &checker, caller);
+	if (unlikely(index < 0))
+		return index;
+
+	ret = fit_wait_reply(ctx, index, &checker, timeout_sec, false, caller);
+	if (unlikely(ret > max_ret_size)) {
+		pr_info("ret: %d, max_ret_size: %d\n", ret, max_ret_size);
+		BUG();
+	}
+
+#ifdef CONFIG_COUNTER_FIT_IB
+	atomic_long_inc(&nr_ib_send_reply);
+	for (index = 0; index < nr_sglist; index++)
+		atomic_long_add(sglist[index].len, &nr_bytes_tx);
+	if (likely(ret > 0))
+		atomic_long_add(ret, &nr_bytes_rx);
+#endif
+	return ret;
+}
+
 static inline int
 __ibapi_send_reply_timeout_w_private_bits(int target_node, void *addr, int size, void *ret_addr,
 			   int max_ret_size, int *private_bits, int if_use_ret_phys_addr,
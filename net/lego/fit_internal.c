@@ -1205,6 +1205,69 @@ int fit_send_message_with_rdma_write_with_imm_request(ppc *ctx, int connection_i
 	return 0;
 }
 
+/*
+ * Same as the FIT_SEND_MESSAGE_HEADER_AND_IMM mode of above, except the user
+ * message is described by @sglist. HCA gathers all pieces, so sender does not
+ * need to copy them into one buffer. Remote still sees one contiguous message.
+ *
+ * Unless @if_poll_now is set, HCA may read @header and the pieces after we
+ * return. They must then stay valid until the reply, never use the stack.
+ */
+static int fit_send_sglist_with_rdma_write_with_imm_request(ppc *ctx, int connection_id,
+		uint32_t input_mr_rkey, uintptr_t input_mr_addr,
+		struct fit_sglist *sglist, int nr_sglist, int offset, uint32_t imm,
+		struct imm_message_metadata *header, int if_poll_now)
+{
+	struct ib_send_wr wr, *bad_wr = NULL;
+	struct ib_sge sge[FIT_MAX_NR_SGLIST + 1];
+	int poll_status = SEND_REPLY_WAIT;
+	int ret, i;
+
+	BUG_ON(nr_sglist > FIT_MAX_NR_SGLIST);
+
+	memset(&wr, 0, sizeof(wr));
+
+	wr.sg_list = sge;
+	wr.wr.rdma.remote_addr = (uintptr_t)(input_mr_addr + offset);
+	wr.wr.rdma.rkey = input_mr_rkey;
+
+	if (header->reply_indicator_index == -1)
+		wr.wr_id = -1;
+	else
+		wr.wr_id = (u64)get_reply_ready_ptr(ctx, header->reply_indicator_index);
+
+	wr.opcode = IB_WR_RDMA_WRITE_WITH_IMM;
+	wr.ex.imm_data = imm;
+	wr.send_flags = IB_SEND_SIGNALED;
+	wr.num_sge = nr_sglist + 1;
+
+	sge[0].addr = fit_ib_reg_mr_addr(ctx, header, sizeof(*header));
+	sge[0].length = sizeof(struct imm_message_metadata);
+	sge[0].lkey = ctx->proc->lkey;
+
+	for (i = 0; i < nr_sglist; i++) {
+		sge[i + 1].addr = fit_ib_reg_mr_addr(ctx, sglist[i].addr, sglist[i].len);
+		sge[i + 1].length = sglist[i].len;
+		sge[i + 1].lkey = ctx->proc->lkey;
+	}
+
+	ret = ib_post_send(ctx->qp[connection_id], &wr, &bad_wr);
+	if (unlikely(ret)) {
+		pr_info_once("Fail to post send to con:%d ret:%d\n",
+			connection_id, ret);
+		WARN_ON_ONCE(1);
+		return ret;
+	}
+
+	ret = fit_internal_poll_sendcq(ctx, ctx->send_cq[connection_id],
+				       connection_id, &poll_status, if_poll_now);
+	if (unlikely(ret == -ETIMEDOUT))
+		pr_debug("sglist: remote addr: %p, rkey: %#lx nr_sglist: %d\n",
+			(void *)wr.wr.rdma.remote_addr, (unsigned long)wr.wr.rdma.rkey,
+			nr_sglist);
+	return 0;
+}
+
 inline int fit_get_connection_by_atomic_number(ppc *ctx, int target_node, int priority)
 {
 #ifdef CONFIG_SOCKET_O_IB
@@ -2381,44 +2444,53 @@ int fit_send_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 }
 
 /*
- * This is one major function, it is used by ibapi_send_reply().
- * This function is blocking, it uses busy polling to get reply.
+ * The send half of ibapi_send_reply(), with message gathered from @sglist.
+ * Post the request and return without waiting for the reply.
+ * @reply_ready_checker will be set by recv_cq polling thread once
+ * the reply has landed in @ret_addr. It must stay valid until then.
  *
  * Return:
- * Negative values on failues
- * Positive values indicate the reply message length
+ * Negative values on failures
+ * Otherwise the reply indicator index, which must be passed to fit_wait_reply()
  */
-int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
-					       int size, void *ret_addr, int max_ret_size,
-					       int userspace_flag, int if_use_ret_phys_addr,
-					       unsigned long timeout_sec, void *caller)
+int fit_send_reply_sglist_post(ppc *ctx, int target_node,
+			       struct fit_sglist *sglist, int nr_sglist,
+			       void *ret_addr, int max_ret_size, int userspace_flag,
+			       int if_use_ret_phys_addr, int *reply_ready_checker,
+			       void *caller)
 {
 	int tar_offset_start;
 	int connection_id;
 	int reply_indicator_index;
 	int imm_data;
-	int real_size;
+	int real_size, size, i;
 	void *remote_addr;
 	uint32_t remote_rkey;
 	struct fit_ibv_mr *remote_mr;
-	struct imm_message_metadata msg_header;
+	struct imm_message_metadata *msg_header;
 	int last_ack;
-	unsigned long start_time;
-	int reply_length;
-
-	int local_reply_ready_checker = SEND_REPLY_WAIT;
 
-	if (unlikely(!addr)) {
-		fit_err("BUG: NULL addr. Caller: %pS", caller);
+	if (unlikely(nr_sglist < 1 || nr_sglist > FIT_MAX_NR_SGLIST)) {
+		fit_err("BUG: nr_sglist %d. Caller: %pS", nr_sglist, caller);
 		return -EINVAL;
 	}
 
+	for (i = 0, size = 0; i < nr_sglist; i++) {
+		if (unlikely(!sglist[i].addr)) {
+			fit_err("BUG: NULL addr. Caller: %pS", caller);
+			return -EINVAL;
+		}
+		size += sglist[i].len;
+	}
+
 	real_size = size + sizeof(struct imm_message_metadata);
 	if (unlikely(real_size > IMM_MAX_SIZE)) {
 		fit_err("Size %d + header > %d", size, IMM_MAX_SIZE);
 		return -EINVAL;
 	}
 
+	*reply_ready_checker = SEND_REPLY_WAIT;
+
 	spin_lock(&ctx->remote_imm_offset_lock[target_node]);
 	/* If hits the end of ring, write start from 0 directly */
 	if (ctx->remote_rdma_ring_mrs_offset[target_node] + real_size >= RDMA_RING_SIZE)
@@ -2444,40 +2516,80 @@ int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *add
 
 	connection_id = fit_get_connection_by_atomic_number(ctx, target_node, LOW_PRIORITY);
 
-	reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, &local_reply_ready_checker);
+	reply_indicator_index = alloc_index_and_set_reply_indicator(ctx, reply_ready_checker);
 
 	imm_data = IMM_SEND_REPLY_SEND | tar_offset_start;
 
+	/*
+	 * The send is not polled, HCA may read the header after we return.
+	 * Use the slot of our reply indicator, which is only freed once the
+	 * reply arrived, thus long after the header was sent.
+	 */
+	msg_header = &ctx->reply_msg_headers[reply_indicator_index];
+
 	if (if_use_ret_phys_addr == 1)
-		msg_header.reply_addr = fit_ib_reg_mr_addr_phys(ctx, ret_addr, max_ret_size);
+		msg_header->reply_addr = fit_ib_reg_mr_addr_phys(ctx, ret_addr, max_ret_size);
 	else
-		msg_header.reply_addr = fit_ib_reg_mr_addr(ctx, ret_addr, max_ret_size);
+		msg_header->reply_addr = fit_ib_reg_mr_addr(ctx, ret_addr, max_ret_size);
 
-	msg_header.reply_rkey = ctx->proc->rkey;
-	msg_header.reply_indicator_index = reply_indicator_index;
-	msg_header.source_node_id = ctx->node_id;
-	msg_header.size = size;
+	msg_header->reply_rkey = ctx->proc->rkey;
+	msg_header->reply_indicator_index = reply_indicator_index;
+	msg_header->source_node_id = ctx->node_id;
+	msg_header->size = size;
 	remote_addr = remote_mr->addr;
 	remote_rkey = remote_mr->rkey;
 
 	fit_debug("send imm-%x addr-%x rkey-%x oaddr-%x orkey-%x\n",
-		imm_data, remote_addr, remote_rkey, msg_header.reply_addr, msg_header.reply_rkey);
+		imm_data, remote_addr, remote_rkey, msg_header->reply_addr, msg_header->reply_rkey);
 
 	/* for send reply, no need to poll the send now, since we have reply already */
-	fit_send_message_with_rdma_write_with_imm_request(ctx, connection_id, remote_rkey,
-			(uintptr_t)remote_addr, addr, size, tar_offset_start, imm_data,
-			FIT_SEND_MESSAGE_HEADER_AND_IMM, &msg_header, 0);
+	if (nr_sglist == 1)
+		fit_send_message_with_rdma_write_with_imm_request(ctx, connection_id, remote_rkey,
+				(uintptr_t)remote_addr, sglist[0].addr, size, tar_offset_start,
+				imm_data, FIT_SEND_MESSAGE_HEADER_AND_IMM, msg_header, 0);
+	else
+		fit_send_sglist_with_rdma_write_with_imm_request(ctx, connection_id, remote_rkey,
+				(uintptr_t)remote_addr, sglist, nr_sglist, tar_offset_start,
+				imm_data, msg_header, 0);
+
+	return reply_indicator_index;
+}
+
+/*
+ * The send half of ibapi_send_reply().
+ * Same as above, with a single contiguous message.
+ */
+int fit_send_reply_post(ppc *ctx, int target_node, void *addr, int size,
+			void *ret_addr, int max_ret_size, int userspace_flag,
+			int if_use_ret_phys_addr, int *reply_ready_checker,
+			void *caller)
+{
+	struct fit_sglist sglist = {
+		.addr = addr,
+		.len = size,
+	};
+
+	return fit_send_reply_sglist_post(ctx, target_node, &sglist, 1,
+			ret_addr, max_ret_size, userspace_flag,
+			if_use_ret_phys_addr, reply_ready_checker, caller);
+}
+
+/*
+ * The reply half of ibapi_send_reply().
+ * Busy poll until the reply of a request posted by fit_send_reply_post() arrives.
+ * If @may_yield is set, the CPU is given away to other runnable threads
+ * while we are waiting, so they can issue their own requests meanwhile.
+ *
+ * Return:
+ * Negative values on failues
+ * Positive values indicate the reply message length
+ */
+int fit_wait_reply(ppc *ctx, int reply_indicator_index, int *reply_ready_checker,
+		   unsigned long timeout_sec, bool may_yield, void *caller)
+{
+	unsigned long start_time;
+	int reply_length;
 
-	/*
-	 * Default model
-	 *
-	 * And we don't want to stuck here forever.
-	 * So we add timeout checking here.
-	 *
-	 * Side note:
-	 * This is where make our network requests all synchronous.
-	 * If we want to change the behaviour, we need to change here.
-	 */
 	/* Caller does not specify an timeout, use the maximum */
 	if (timeout_sec == 0)
 		timeout_sec = FIT_MAX_TIMEOUT_SEC;
@@ -2488,11 +2600,13 @@ int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *add
 	start_time = jiffies;
 
 	/*
-	 * The local_reply_ready_checker will be set by
+	 * The reply_ready_checker will be set by
 	 * recv_cq polling thread, when it gets the reply.
 	 */
-	while (local_reply_ready_checker == SEND_REPLY_WAIT) {
+	while (READ_ONCE(*reply_ready_checker) == SEND_REPLY_WAIT) {
 		cpu_relax();
+		if (may_yield)
+			cond_resched();
 		if (unlikely(time_after(jiffies, start_time + timeout_sec * HZ))) {
 			pr_warn("ibapi_send_reply() CPU:%d PID:%d timeout (%u ms), caller: %pS\n",
 				smp_processor_id(), current->pid,
@@ -2504,15 +2618,47 @@ int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *add
 		}
 	}
 	free_reply_indicator(ctx, reply_indicator_index);
-	reply_length = local_reply_ready_checker;
+	reply_length = *reply_ready_checker;
 
 	if (unlikely(reply_length < 0)) {
-		fit_err("connection-%d inbox-%d reply-length-%d",
-			connection_id, reply_indicator_index, reply_length);
+		fit_err("inbox-%d reply-length-%d",
+			reply_indicator_index, reply_length);
 	}
 	return reply_length;
 }
 
+/*
+ * This is one major function, it is used by ibapi_send_reply().
+ * This function is blocking, it uses busy polling to get reply.
+ *
+ * Side note:
+ * This is where make our network requests all synchronous.
+ * Callers who want to overlap requests should use the
+ * fit_send_reply_post() and fit_wait_reply() pair directly.
+ *
+ * Return:
+ * Negative values on failues
+ * Positive values indicate the reply message length
+ */
+int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
+					       int size, void *ret_addr, int max_ret_size,
+					       int userspace_flag, int if_use_ret_phys_addr,
+					       unsigned long timeout_sec, void *caller)
+{
+	int reply_indicator_index;
+	int local_reply_ready_checker;
+
+	reply_indicator_index = fit_send_reply_post(ctx, target_node, addr, size,
+				ret_addr, max_ret_size, userspace_flag,
+				if_use_ret_phys_addr, &local_reply_ready_checker,
+				caller);
+	if (unlikely(reply_indicator_index < 0))
+		return reply_indicator_index;
+
+	return fit_wait_reply(ctx, reply_indicator_index, &local_reply_ready_checker,
+			      timeout_sec, false, caller);
+}
+
 /*
  * send data and reply with extra bits
  * Return:
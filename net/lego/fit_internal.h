@@ -54,6 +54,17 @@ struct fit_sglist;
 int fit_send_reply_with_rdma_write_with_imm(ppc *ctx, int target_node, void *addr,
 				int size, void *ret_addr, int max_ret_size, int userspace_flag,
 				int if_use_ret_phys_addr, unsigned long timeout_sec, void *caller);
+int fit_send_reply_post(ppc *ctx, int target_node, void *addr, int size,
+			void *ret_addr, int max_ret_size, int userspace_flag,
+			int if_use_ret_phys_addr, int *reply_ready_checker,
+			void *caller);
+int fit_send_reply_sglist_post(ppc *ctx, int target_node,
+			       struct fit_sglist *sglist, int nr_sglist,
+			       void *ret_addr, int max_ret_size, int userspace_flag,
+			       int if_use_ret_phys_addr, int *reply_ready_checker,
+			       void *caller);
+int fit_wait_reply(ppc *ctx, int reply_indicator_index, int *reply_ready_checker,
+		   unsigned long timeout_sec, bool may_yield, void *caller);
 int fit_send_reply_with_rdma_write_with_imm_reply_extra_bits(ppc *ctx, int target_node, void *addr,
 					       int size, void *ret_addr, int max_ret_size, int *ret_private_bits,
 					       int userspace_flag, int if_use_ret_phys_addr,